@@ -27,6 +27,7 @@
 #include "g10lib.h"
 #include "cipher.h"
 #include "ath.h"
+#include "bufhelp.h"
 
 #define MAX_BLOCKSIZE 16
 #define TABLE_SIZE 14
@@ -125,6 +126,16 @@ static gcry_module_t ciphers_registered;
 /* This is the lock protecting CIPHERS_REGISTERED.  */
 static ath_mutex_t ciphers_registered_lock = ATH_MUTEX_INITIALIZER;
 
+/* The lookup index of the default ciphers.  It is set once after the
+   default ciphers have been registered and may then be used without
+   holding CIPHERS_REGISTERED_LOCK.  */
+static gcry_module_index_t volatile ciphers_index;
+
+/* Set once a module has been added with _gcry_cipher_register.  Until
+   then a miss in CIPHERS_INDEX means that the algorithm is not known at
+   all and the list does not need to be searched.  */
+static int volatile ciphers_user_registered;
+
 /* Flag to check whether the default ciphers have already been
    registered.  */
 static int default_ciphers_registered;
@@ -197,6 +208,13 @@ struct gcry_cipher_handle
     void (*ctr_enc)(void *context, unsigned char *iv,
                     void *outbuf_arg, const void *inbuf_arg,
                     unsigned int nblocks);
+    void (*gcm_crypt)(void *context, unsigned char *ctr,
+                      ghash_context_t *ghash, unsigned char *hash,
+                      void *outbuf_arg, const void *inbuf_arg,
+                      unsigned int nblocks, int encrypt);
+    void (*xts_crypt)(void *context, unsigned char *tweak,
+                      void *outbuf_arg, const void *inbuf_arg,
+                      unsigned int nblocks, int encrypt);
   } bulk;
 
 
@@ -217,7 +235,8 @@ struct gcry_cipher_handle
   } u_iv;
 
   /* The counter for CTR mode.  This field is also used by AESWRAP and
-     thus we can't use the U_IV union.  */
+     thus we can't use the U_IV union.  XTS keeps the current tweak
+     here.  */
   union {
     cipher_context_alignment_t iv_align;
     unsigned char ctr[MAX_BLOCKSIZE];
@@ -227,15 +246,70 @@ struct gcry_cipher_handle
   unsigned char lastiv[MAX_BLOCKSIZE];
   int unused;  /* Number of unused bytes in LASTIV. */
 
+  /* Mode specific storage.  */
+  union {
+    /* Galois/Counter Mode.  */
+    struct {
+      ghash_context_t ghash;          /* Derived from the key.  */
+      unsigned char u_tag[MAX_BLOCKSIZE];  /* GHASH value and final tag. */
+      unsigned char tagiv[MAX_BLOCKSIZE];  /* The encrypted J0.  */
+      unsigned char macbuf[MAX_BLOCKSIZE]; /* Partial block to hash.  */
+      unsigned int mac_unused;        /* Number of bytes in MACBUF.  */
+      u64 aadlen;                     /* Length of the AAD in bytes.  */
+      u64 datalen;                    /* Length of the data in bytes.  */
+      unsigned int data_started:1;    /* No more AAD may be added.  */
+      unsigned int tag_done:1;        /* The tag has been computed.  */
+    } gcm;
+  } u_mode;
+
   /* What follows are two contexts of the cipher in use.  The first
      one needs to be aligned well enough for the cipher operation
      whereas the second one is a copy created by cipher_setkey and
      used by cipher_reset.  That second copy has no need for proper
-     aligment because it is only accessed by memcpy.  */
+     aligment because it is only accessed by memcpy.  In XTS mode a
+     third, aligned context for the tweak key follows; see
+     xts_tweak_context.  */
   cipher_context_alignment_t context;
 };
 
 
+/* Forward declarations of the GCM functions.  */
+static void gcm_clear_state (gcry_cipher_hd_t c);
+static void gcm_setkey (gcry_cipher_hd_t c);
+static gcry_err_code_t gcm_setiv (gcry_cipher_hd_t c,
+                                  const unsigned char *iv, size_t ivlen);
+
+/* Forward declarations of the XTS functions.  */
+static void *xts_tweak_context (gcry_cipher_hd_t c);
+static void xts_set_tweak (gcry_cipher_hd_t c);
+
+
+/* Closed handles in standard memory are kept in a pool for reuse by
+   gcry_cipher_open and gcry_cipher_copy.  The blocks are wiped before
+   they are put into the pool.  Blocks of up to CIPHER_POOL_CLASSES
+   different sizes are kept.  */
+#define CIPHER_POOL_CLASSES 8
+
+struct cipher_pool_item
+{
+  struct cipher_pool_item *next;
+};
+
+static struct
+{
+  size_t size;                     /* Allocated size of the blocks.  */
+  struct cipher_pool_item *items;  /* List of free blocks.  */
+} cipher_pool[CIPHER_POOL_CLASSES];
+
+/* Number of blocks in the pool and the maximum number as set with
+   GCRYCTL_SET_CIPHER_POOL.  A maximum of 0 disables the pool.  */
+static unsigned int cipher_pool_count;
+static unsigned int volatile cipher_pool_max;
+
+/* This is the lock protecting the pool.  */
+static ath_mutex_t cipher_pool_lock = ATH_MUTEX_INITIALIZER;
+
+
 
 /* These dummy functions are used in case a cipher implementation
    refuses to provide it's own functions.  */
@@ -294,6 +368,34 @@ dummy_decrypt_stream (void *c,
 }
 
 
+/* Internal callback function.  Used via _gcry_module_index_new.  */
+static const char *
+cipher_name_func (void *spec, int idx)
+{
+  gcry_cipher_spec_t *cipher = spec;
+  int i;
+
+  if (! idx)
+    return cipher->name;
+  for (i = 0; cipher->aliases && cipher->aliases[i]; i++)
+    if (i == idx - 1)
+      return cipher->aliases[i];
+  return NULL;
+}
+
+/* Internal callback function.  Used via _gcry_module_index_new.  */
+static const char *
+cipher_oid_func (void *spec, int idx)
+{
+  gcry_cipher_spec_t *cipher = spec;
+  int i;
+
+  for (i = 0; cipher->oids && cipher->oids[i].oid; i++)
+    if (i == idx)
+      return cipher->oids[i].oid;
+  return NULL;
+}
+
 /* Internal function.  Register all the ciphers included in
    CIPHER_TABLE.  Note, that this function gets only used by the macro
    REGISTER_DEFAULT_CIPHERS which protects it using a mutex. */
@@ -301,6 +403,7 @@ static void
 cipher_register_default (void)
 {
   gcry_err_code_t err = GPG_ERR_NO_ERROR;
+  gcry_module_index_t index;
   int i;
 
   for (i = 0; !err && cipher_table[i].cipher; i++)
@@ -328,6 +431,11 @@ cipher_register_default (void)
 
   if (err)
     BUG ();
+
+  index = _gcry_module_index_new (ciphers_registered,
+                                  cipher_name_func, cipher_oid_func);
+  if (index)
+    _gcry_module_index_publish (&ciphers_index, index);
 }
 
 /* Internal callback function.  Used via _gcry_module_lookup.  */
@@ -387,6 +495,58 @@ gcry_cipher_lookup_oid (const char *oid)
   return cipher;
 }
 
+/* Internal function.  Return the module of the cipher ALGORITHM with
+   its use counter incremented or NULL if it is not known.  The default
+   ciphers are served from the lookup index without taking the lock.
+   The module needs to be released with cipher_module_put.  */
+static gcry_module_t
+cipher_module_get (int algorithm)
+{
+  gcry_module_index_t index = ciphers_index;
+  gcry_module_t cipher;
+
+  if (index)
+    {
+      cipher = _gcry_module_index_lookup_id (index, algorithm);
+      if (cipher || ! ciphers_user_registered)
+        return cipher;
+    }
+  else
+    REGISTER_DEFAULT_CIPHERS;
+
+  ath_mutex_lock (&ciphers_registered_lock);
+  cipher = _gcry_module_lookup_id (ciphers_registered, algorithm);
+  ath_mutex_unlock (&ciphers_registered_lock);
+
+  return cipher;
+}
+
+/* Internal function.  Add a reference to a module returned by
+   cipher_module_get.  */
+static void
+cipher_module_use (gcry_module_t cipher)
+{
+  if (! (cipher->flags & FLAG_MODULE_STATIC))
+    {
+      ath_mutex_lock (&ciphers_registered_lock);
+      _gcry_module_use (cipher);
+      ath_mutex_unlock (&ciphers_registered_lock);
+    }
+}
+
+/* Internal function.  Release a module returned by
+   cipher_module_get.  */
+static void
+cipher_module_put (gcry_module_t cipher)
+{
+  if (cipher && ! (cipher->flags & FLAG_MODULE_STATIC))
+    {
+      ath_mutex_lock (&ciphers_registered_lock);
+      _gcry_module_release (cipher);
+      ath_mutex_unlock (&ciphers_registered_lock);
+    }
+}
+
 /* Register a new cipher module whose specification can be found in
    CIPHER.  On success, a new algorithm ID is stored in ALGORITHM_ID
    and a pointer representhing this module is stored in MODULE.  */
@@ -403,11 +563,16 @@ _gcry_cipher_register (gcry_cipher_spec_t *cipher,
   if (fips_mode ())
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
+  /* Make sure that only the default ciphers are marked static.  */
+  REGISTER_DEFAULT_CIPHERS;
+
   ath_mutex_lock (&ciphers_registered_lock);
   err = _gcry_module_add (&ciphers_registered, 0,
 			  (void *)cipher,
 			  (void *)(extraspec? extraspec : &dummy_extra_spec),
                           &mod);
+  if (! err)
+    ciphers_user_registered = 1;
   ath_mutex_unlock (&ciphers_registered_lock);
 
   if (! err)
@@ -435,18 +600,27 @@ gcry_cipher_unregister (gcry_module_t module)
    internal algorithm number is returned in ALGORITHM unless it
    ispassed as NULL.  A pointer to the specification of the module
    implementing this algorithm is return in OID_SPEC unless passed as
-   NULL.*/
+   NULL.  The default ciphers are looked up without taking the
+   lock.*/
 static int
 search_oid (const char *oid, int *algorithm, gcry_cipher_oid_spec_t *oid_spec)
 {
-  gcry_module_t module;
+  gcry_module_index_t index = ciphers_index;
+  gcry_module_t module = NULL;
   int ret = 0;
 
   if (oid && ((! strncmp (oid, "oid.", 4))
 	      || (! strncmp (oid, "OID.", 4))))
     oid += 4;
 
-  module = gcry_cipher_lookup_oid (oid);
+  if (index)
+    module = _gcry_module_index_lookup_oid (index, oid);
+  if (! module && (! index || ciphers_user_registered))
+    {
+      ath_mutex_lock (&ciphers_registered_lock);
+      module = gcry_cipher_lookup_oid (oid);
+      ath_mutex_unlock (&ciphers_registered_lock);
+    }
   if (module)
     {
       gcry_cipher_spec_t *cipher = module->spec;
@@ -461,7 +635,7 @@ search_oid (const char *oid, int *algorithm, gcry_cipher_oid_spec_t *oid_spec)
 	      *oid_spec = cipher->oids[i];
 	    ret = 1;
 	  }
-      _gcry_module_release (module);
+      cipher_module_put (module);
     }
 
   return ret;
@@ -474,33 +648,39 @@ search_oid (const char *oid, int *algorithm, gcry_cipher_oid_spec_t *oid_spec)
 int
 gcry_cipher_map_name (const char *string)
 {
-  gcry_module_t cipher;
+  gcry_module_index_t index;
+  gcry_module_t cipher = NULL;
   int ret, algorithm = 0;
 
   if (! string)
     return 0;
 
-  REGISTER_DEFAULT_CIPHERS;
+  index = ciphers_index;
+  if (! index)
+    REGISTER_DEFAULT_CIPHERS;
 
   /* If the string starts with a digit (optionally prefixed with
      either "OID." or "oid."), we first look into our table of ASN.1
      object identifiers to figure out the algorithm */
 
-  ath_mutex_lock (&ciphers_registered_lock);
-
   ret = search_oid (string, &algorithm, NULL);
   if (! ret)
     {
-      cipher = gcry_cipher_lookup_name (string);
+      if (index)
+        cipher = _gcry_module_index_lookup_name (index, string);
+      if (! cipher && (! index || ciphers_user_registered))
+        {
+          ath_mutex_lock (&ciphers_registered_lock);
+          cipher = gcry_cipher_lookup_name (string);
+          ath_mutex_unlock (&ciphers_registered_lock);
+        }
       if (cipher)
 	{
 	  algorithm = cipher->mod_id;
-	  _gcry_module_release (cipher);
+	  cipher_module_put (cipher);
 	}
     }
 
-  ath_mutex_unlock (&ciphers_registered_lock);
-
   return algorithm;
 }
 
@@ -518,11 +698,9 @@ gcry_cipher_mode_from_oid (const char *string)
   if (!string)
     return 0;
 
-  ath_mutex_lock (&ciphers_registered_lock);
   ret = search_oid (string, NULL, &oid_spec);
   if (ret)
     mode = oid_spec.mode;
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   return mode;
 }
@@ -537,18 +715,14 @@ cipher_algo_to_string (int algorithm)
   gcry_module_t cipher;
   const char *name;
 
-  REGISTER_DEFAULT_CIPHERS;
-
-  ath_mutex_lock (&ciphers_registered_lock);
-  cipher = _gcry_module_lookup_id (ciphers_registered, algorithm);
+  cipher = cipher_module_get (algorithm);
   if (cipher)
     {
       name = ((gcry_cipher_spec_t *) cipher->spec)->name;
-      _gcry_module_release (cipher);
+      cipher_module_put (cipher);
     }
   else
     name = "?";
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   return name;
 }
@@ -596,19 +770,15 @@ check_cipher_algo (int algorithm)
   gcry_err_code_t err = GPG_ERR_NO_ERROR;
   gcry_module_t cipher;
 
-  REGISTER_DEFAULT_CIPHERS;
-
-  ath_mutex_lock (&ciphers_registered_lock);
-  cipher = _gcry_module_lookup_id (ciphers_registered, algorithm);
+  cipher = cipher_module_get (algorithm);
   if (cipher)
     {
       if (cipher->flags & FLAG_MODULE_DISABLED)
 	err = GPG_ERR_CIPHER_ALGO;
-      _gcry_module_release (cipher);
+      cipher_module_put (cipher);
     }
   else
     err = GPG_ERR_CIPHER_ALGO;
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   return err;
 }
@@ -622,18 +792,14 @@ cipher_get_keylen (int algorithm)
   gcry_module_t cipher;
   unsigned len = 0;
 
-  REGISTER_DEFAULT_CIPHERS;
-
-  ath_mutex_lock (&ciphers_registered_lock);
-  cipher = _gcry_module_lookup_id (ciphers_registered, algorithm);
+  cipher = cipher_module_get (algorithm);
   if (cipher)
     {
       len = ((gcry_cipher_spec_t *) cipher->spec)->keylen;
       if (!len)
 	log_bug ("cipher %d w/o key length\n", algorithm);
-      _gcry_module_release (cipher);
+      cipher_module_put (cipher);
     }
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   return len;
 }
@@ -646,23 +812,122 @@ cipher_get_blocksize (int algorithm)
   gcry_module_t cipher;
   unsigned len = 0;
 
-  REGISTER_DEFAULT_CIPHERS;
-
-  ath_mutex_lock (&ciphers_registered_lock);
-  cipher = _gcry_module_lookup_id (ciphers_registered, algorithm);
+  cipher = cipher_module_get (algorithm);
   if (cipher)
     {
       len = ((gcry_cipher_spec_t *) cipher->spec)->blocksize;
       if (! len)
 	  log_bug ("cipher %d w/o blocksize\n", algorithm);
-      _gcry_module_release (cipher);
+      cipher_module_put (cipher);
     }
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   return len;
 }
 
 
+/* Internal function.  Take a block of SIZE bytes from the pool of
+   closed handles.  Returns NULL if there is none.  The block has been
+   wiped when it was put into the pool and is thus all zero.  */
+static void *
+cipher_pool_get (size_t size)
+{
+  struct cipher_pool_item *item = NULL;
+  int i;
+
+  if (! cipher_pool_max)
+    return NULL;
+
+  ath_mutex_lock (&cipher_pool_lock);
+  for (i = 0; i < CIPHER_POOL_CLASSES; i++)
+    if (cipher_pool[i].size == size && cipher_pool[i].items)
+      {
+        item = cipher_pool[i].items;
+        cipher_pool[i].items = item->next;
+        cipher_pool_count--;
+        break;
+      }
+  ath_mutex_unlock (&cipher_pool_lock);
+
+  if (item)
+    memset (item, 0, sizeof *item);
+  return item;
+}
+
+/* Internal function.  Put the wiped block P of SIZE bytes into the
+   pool.  Returns false if the pool is full and the block needs to be
+   released.  */
+static int
+cipher_pool_put (void *p, size_t size)
+{
+  struct cipher_pool_item *item = p;
+  int i, done = 0;
+
+  if (! cipher_pool_max)
+    return 0;
+
+  ath_mutex_lock (&cipher_pool_lock);
+  if (cipher_pool_count < cipher_pool_max)
+    {
+      for (i = 0; i < CIPHER_POOL_CLASSES; i++)
+        if (cipher_pool[i].size == size)
+          break;
+      if (i == CIPHER_POOL_CLASSES)
+        for (i = 0; i < CIPHER_POOL_CLASSES; i++)
+          if (! cipher_pool[i].items)
+            break;
+      if (i < CIPHER_POOL_CLASSES)
+        {
+          cipher_pool[i].size = size;
+          item->next = cipher_pool[i].items;
+          cipher_pool[i].items = item;
+          cipher_pool_count++;
+          done = 1;
+        }
+    }
+  ath_mutex_unlock (&cipher_pool_lock);
+
+  return done;
+}
+
+
+/* Internal function.  Allocate a zeroed handle of SIZE bytes
+   including the alignment gap and store it at R_HANDLE.  Handles in
+   standard memory are taken from the pool if possible.  */
+static gcry_err_code_t
+cipher_alloc_handle (gcry_cipher_hd_t *r_handle, size_t size, int secure)
+{
+  gcry_cipher_hd_t h;
+  size_t off = 0;
+
+  if (secure)
+    h = gcry_calloc_secure (1, size);
+  else
+    {
+      h = cipher_pool_get (size);
+      if (! h)
+        h = gcry_calloc (1, size);
+    }
+  if (! h)
+    return gpg_err_code_from_syserror ();
+
+#ifdef NEED_16BYTE_ALIGNED_CONTEXT
+  if ( ((unsigned long)h & 0x0f) )
+    {
+      /* The malloced block is not aligned on a 16 byte
+         boundary.  Correct for this.  */
+      off = 16 - ((unsigned long)h & 0x0f);
+      h = (void*)((char*)h + off);
+    }
+#endif /*NEED_16BYTE_ALIGNED_CONTEXT*/
+
+  h->magic = secure ? CTX_MAGIC_SECURE : CTX_MAGIC_NORMAL;
+  h->actual_handle_size = size - off;
+  h->handle_offset = off;
+  *r_handle = h;
+  return 0;
+}
+
+
 /*
    Open a cipher handle for use with cipher algorithm ALGORITHM, using
    the cipher mode MODE (one of the GCRY_CIPHER_MODE_*) and return a
@@ -692,12 +957,9 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
      it here to ensure that it is used once in a while. */
   _gcry_fast_random_poll ();
 
-  REGISTER_DEFAULT_CIPHERS;
-
   /* Fetch the according module and check whether the cipher is marked
      available for use.  */
-  ath_mutex_lock (&ciphers_registered_lock);
-  module = _gcry_module_lookup_id (ciphers_registered, algo);
+  module = cipher_module_get (algo);
   if (module)
     {
       /* Found module.  */
@@ -715,7 +977,6 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
     }
   else
     err = GPG_ERR_CIPHER_ALGO;
-  ath_mutex_unlock (&ciphers_registered_lock);
 
   /* check flags */
   if ((! err)
@@ -742,6 +1003,19 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
 	  err = GPG_ERR_INV_CIPHER_MODE;
 	break;
 
+      case GCRY_CIPHER_MODE_GCM:
+	if (cipher->encrypt == dummy_encrypt_block
+            || cipher->blocksize != 16)
+	  err = GPG_ERR_INV_CIPHER_MODE;
+	break;
+
+      case GCRY_CIPHER_MODE_XTS:
+	if (cipher->encrypt == dummy_encrypt_block
+            || cipher->decrypt == dummy_decrypt_block
+            || cipher->blocksize != 16)
+	  err = GPG_ERR_INV_CIPHER_MODE;
+	break;
+
       case GCRY_CIPHER_MODE_STREAM:
 	if ((cipher->stencrypt == dummy_encrypt_stream)
 	    || (cipher->stdecrypt == dummy_decrypt_stream))
@@ -776,30 +1050,13 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
 #endif /*NEED_16BYTE_ALIGNED_CONTEXT*/
                      );
 
-      if (secure)
-	h = gcry_calloc_secure (1, size);
-      else
-	h = gcry_calloc (1, size);
+      /* XTS needs another context for the tweak key.  */
+      if (mode == GCRY_CIPHER_MODE_XTS)
+        size += cipher->contextsize + 15;
 
-      if (! h)
-	err = gpg_err_code_from_syserror ();
-      else
+      err = cipher_alloc_handle (&h, size, secure);
+      if (! err)
 	{
-          size_t off = 0;
-
-#ifdef NEED_16BYTE_ALIGNED_CONTEXT
-          if ( ((unsigned long)h & 0x0f) )
-            {
-              /* The malloced block is not aligned on a 16 byte
-                 boundary.  Correct for this.  */
-              off = 16 - ((unsigned long)h & 0x0f);
-              h = (void*)((char*)h + off);
-            }
-#endif /*NEED_16BYTE_ALIGNED_CONTEXT*/
-
-	  h->magic = secure ? CTX_MAGIC_SECURE : CTX_MAGIC_NORMAL;
-          h->actual_handle_size = size - off;
-          h->handle_offset = off;
 	  h->cipher = cipher;
 	  h->extraspec = extraspec;
 	  h->module = module;
@@ -819,6 +1076,8 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
               h->bulk.cbc_enc = _gcry_aes_cbc_enc;
               h->bulk.cbc_dec = _gcry_aes_cbc_dec;
               h->bulk.ctr_enc = _gcry_aes_ctr_enc;
+              h->bulk.gcm_crypt = _gcry_aes_gcm_crypt;
+              h->bulk.xts_crypt = _gcry_aes_xts_crypt;
               break;
 #endif /*USE_AES*/
 
@@ -835,9 +1094,7 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
       if (module)
 	{
 	  /* Release module.  */
-	  ath_mutex_lock (&ciphers_registered_lock);
-	  _gcry_module_release (module);
-	  ath_mutex_unlock (&ciphers_registered_lock);
+	  cipher_module_put (module);
 	}
     }
 
@@ -852,7 +1109,8 @@ gcry_cipher_open (gcry_cipher_hd_t *handle,
 void
 gcry_cipher_close (gcry_cipher_hd_t h)
 {
-  size_t off;
+  size_t off, size;
+  int secure;
 
   if (!h)
     return;
@@ -861,13 +1119,11 @@ gcry_cipher_close (gcry_cipher_hd_t h)
       && (h->magic != CTX_MAGIC_NORMAL))
     _gcry_fatal_error(GPG_ERR_INTERNAL,
 		      "gcry_cipher_close: already closed/invalid handle");
-  else
-    h->magic = 0;
+  secure = (h->magic == CTX_MAGIC_SECURE);
+  h->magic = 0;
 
   /* Release module.  */
-  ath_mutex_lock (&ciphers_registered_lock);
-  _gcry_module_release (h->module);
-  ath_mutex_unlock (&ciphers_registered_lock);
+  cipher_module_put (h->module);
 
   /* We always want to wipe out the memory even when the context has
      been allocated in secure memory.  The user might have disabled
@@ -876,9 +1132,47 @@ gcry_cipher_close (gcry_cipher_hd_t h)
      actual size of this structure because we have no way to known
      how large the allocated area was when using a standard malloc. */
   off = h->handle_offset;
+  size = off + h->actual_handle_size;
   wipememory (h, h->actual_handle_size);
 
-  gcry_free ((char*)h - off);
+  if (secure || ! cipher_pool_put ((char*)h - off, size))
+    gcry_free ((char*)h - off);
+}
+
+
+/* Create a new handle at R_HD which is an exact copy of the handle H
+   including the key schedule and the current IV.  This is much
+   faster than opening a new handle and setting the key.  */
+gcry_error_t
+gcry_cipher_copy (gcry_cipher_hd_t *r_hd, gcry_cipher_hd_t h)
+{
+  gcry_cipher_hd_t b;
+  gcry_err_code_t err;
+  size_t n, size, off;
+
+  *r_hd = NULL;
+  if ((h->magic != CTX_MAGIC_SECURE)
+      && (h->magic != CTX_MAGIC_NORMAL))
+    _gcry_fatal_error(GPG_ERR_INTERNAL,
+		      "gcry_cipher_copy: invalid handle");
+
+  err = cipher_alloc_handle (&b, h->handle_offset + h->actual_handle_size,
+                             h->magic == CTX_MAGIC_SECURE);
+  if (err)
+    return gcry_error (err);
+
+  /* The alignment gap of the new block may differ; the used part of
+     the handle fits into both.  */
+  size = b->actual_handle_size;
+  off = b->handle_offset;
+  n = h->actual_handle_size < size? h->actual_handle_size : size;
+  memcpy (b, h, n);
+  b->actual_handle_size = size;
+  b->handle_offset = off;
+
+  cipher_module_use (b->module);
+  *r_hd = b;
+  return 0;
 }
 
 
@@ -889,6 +1183,22 @@ cipher_setkey (gcry_cipher_hd_t c, byte *key, unsigned int keylen)
 {
   gcry_err_code_t ret;
 
+  if (c->mode == GCRY_CIPHER_MODE_XTS)
+    {
+      /* XTS takes two keys of the same length; the second one is used
+         to encrypt the tweak.  FIPS requires that they differ.  */
+      c->marks.key = 0;
+      if ((keylen & 1))
+        return gcry_error (GPG_ERR_INV_KEYLEN);
+      keylen /= 2;
+      if (fips_mode () && !memcmp (key, key + keylen, keylen))
+        return gcry_error (GPG_ERR_WEAK_KEY);
+      ret = (*c->cipher->setkey) (xts_tweak_context (c),
+                                  key + keylen, keylen);
+      if (ret)
+        return gcry_error (ret);
+    }
+
   ret = (*c->cipher->setkey) (&c->context.c, key, keylen);
   if (!ret)
     {
@@ -897,6 +1207,11 @@ cipher_setkey (gcry_cipher_hd_t c, byte *key, unsigned int keylen)
               (void *) &c->context.c,
               c->cipher->contextsize);
       c->marks.key = 1;
+
+      if (c->mode == GCRY_CIPHER_MODE_GCM)
+        gcm_setkey (c);
+      else if (c->mode == GCRY_CIPHER_MODE_XTS)
+        xts_set_tweak (c);
     }
   else
     c->marks.key = 0;
@@ -906,10 +1221,14 @@ cipher_setkey (gcry_cipher_hd_t c, byte *key, unsigned int keylen)
 
 
 /* Set the IV to be used for the encryption context C to IV with
-   length IVLEN.  The length should match the required length. */
-static void
+   length IVLEN.  The length should match the required length; only
+   GCM accepts other lengths. */
+static gcry_err_code_t
 cipher_setiv( gcry_cipher_hd_t c, const byte *iv, unsigned ivlen )
 {
+  if (c->mode == GCRY_CIPHER_MODE_GCM)
+    return gcm_setiv (c, iv, ivlen);
+
   memset (c->u_iv.iv, 0, c->cipher->blocksize);
   if (iv)
     {
@@ -927,6 +1246,10 @@ cipher_setiv( gcry_cipher_hd_t c, const byte *iv, unsigned ivlen )
   else
       c->marks.iv = 0;
   c->unused = 0;
+
+  if (c->mode == GCRY_CIPHER_MODE_XTS)
+    xts_set_tweak (c);
+  return 0;
 }
 
 
@@ -942,6 +1265,12 @@ cipher_reset (gcry_cipher_hd_t c)
   memset (c->u_iv.iv, 0, c->cipher->blocksize);
   memset (c->lastiv, 0, c->cipher->blocksize);
   memset (c->u_ctr.ctr, 0, c->cipher->blocksize);
+  c->unused = 0;
+
+  if (c->mode == GCRY_CIPHER_MODE_GCM)
+    gcm_clear_state (c);  /* Keeps the hash key.  */
+  else if (c->mode == GCRY_CIPHER_MODE_XTS)
+    xts_set_tweak (c);    /* The tweak key is kept as well.  */
 }
 
 
@@ -1689,6 +2018,533 @@ do_aeswrap_decrypt (gcry_cipher_hd_t c, byte *outbuf, unsigned int outbuflen,
 }
 
 
+/* The Galois/Counter Mode (GCM) as specified by NIST SP 800-38D.  It
+   is implemented for any cipher algorithm with a blocksize of 128.
+   The counter block is kept in U_CTR and the encrypted counter bytes
+   not yet used are kept in LASTIV as done by the CTR mode.  Partial
+   blocks of the AAD or the ciphertext which still need to be hashed
+   are collected in the MACBUF.  */
+#define GCM_BLOCKSIZE 16
+
+/* The maximum length of the plaintext in bytes (2^39 - 256 bits).  */
+#define GCM_MAX_DATALEN ((U64_C(1) << 36) - 32)
+
+
+/* Increment the rightmost 32 bits of the counter block CTR.  */
+static void
+gcm_inc32 (unsigned char *ctr)
+{
+  buf_put_be32 (ctr + 12, buf_get_be32 (ctr + 12) + 1);
+}
+
+
+/* Clear all state of the current GCM operation.  */
+static void
+gcm_clear_state (gcry_cipher_hd_t c)
+{
+  memset (c->u_mode.gcm.u_tag, 0, GCM_BLOCKSIZE);
+  memset (c->u_mode.gcm.tagiv, 0, GCM_BLOCKSIZE);
+  memset (c->u_mode.gcm.macbuf, 0, GCM_BLOCKSIZE);
+  c->u_mode.gcm.mac_unused = 0;
+  c->u_mode.gcm.aadlen = 0;
+  c->u_mode.gcm.datalen = 0;
+  c->u_mode.gcm.data_started = 0;
+  c->u_mode.gcm.tag_done = 0;
+  c->unused = 0;
+}
+
+
+/* Feed BUFLEN bytes from BUF into the GHASH computation using the
+   MACBUF for partial blocks.  */
+static void
+gcm_hash_buffered (gcry_cipher_hd_t c, const unsigned char *buf,
+                   size_t buflen)
+{
+  ghash_context_t *ghash = &c->u_mode.gcm.ghash;
+  unsigned char *hash = c->u_mode.gcm.u_tag;
+  size_t n;
+
+  if (c->u_mode.gcm.mac_unused)
+    {
+      for (; buflen && c->u_mode.gcm.mac_unused < GCM_BLOCKSIZE; buflen--)
+        c->u_mode.gcm.macbuf[c->u_mode.gcm.mac_unused++] = *buf++;
+      if (c->u_mode.gcm.mac_unused < GCM_BLOCKSIZE)
+        return;
+      _gcry_ghash (ghash, hash, c->u_mode.gcm.macbuf, 1);
+      c->u_mode.gcm.mac_unused = 0;
+    }
+
+  n = buflen / GCM_BLOCKSIZE;
+  if (n)
+    {
+      _gcry_ghash (ghash, hash, buf, n);
+      buf += n * GCM_BLOCKSIZE;
+      buflen -= n * GCM_BLOCKSIZE;
+    }
+
+  if (buflen)
+    {
+      memcpy (c->u_mode.gcm.macbuf, buf, buflen);
+      c->u_mode.gcm.mac_unused = buflen;
+    }
+}
+
+
+/* Hash a partial block left in the MACBUF padded with zeroes.  */
+static void
+gcm_hash_pad (gcry_cipher_hd_t c)
+{
+  if (c->u_mode.gcm.mac_unused)
+    {
+      memset (c->u_mode.gcm.macbuf + c->u_mode.gcm.mac_unused, 0,
+              GCM_BLOCKSIZE - c->u_mode.gcm.mac_unused);
+      _gcry_ghash (&c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag,
+                   c->u_mode.gcm.macbuf, 1);
+      c->u_mode.gcm.mac_unused = 0;
+    }
+}
+
+
+/* Derive the hash key H from the key which has just been set.  */
+static void
+gcm_setkey (gcry_cipher_hd_t c)
+{
+  unsigned char h[GCM_BLOCKSIZE];
+
+  memset (h, 0, GCM_BLOCKSIZE);
+  c->cipher->encrypt (&c->context.c, h, h);
+  _gcry_ghash_setkey (&c->u_mode.gcm.ghash, h);
+  wipememory (h, sizeof h);
+
+  /* A new key requires a new IV.  */
+  gcm_clear_state (c);
+  c->marks.iv = 0;
+}
+
+
+/* Set the IV for GCM and derive the pre-counter block J0 from it.  An
+   IV of 96 bits is used directly; other lengths are hashed.  */
+static gcry_err_code_t
+gcm_setiv (gcry_cipher_hd_t c, const unsigned char *iv, size_t ivlen)
+{
+  unsigned char *ctr = c->u_ctr.ctr;
+
+  gcm_clear_state (c);
+  memset (c->u_iv.iv, 0, GCM_BLOCKSIZE);
+  c->marks.iv = 0;
+
+  if (!iv)
+    return 0;
+  if (!ivlen)
+    return GPG_ERR_INV_LENGTH;
+
+  if (ivlen == 12)
+    {
+      memcpy (ctr, iv, 12);
+      buf_put_be32 (ctr + 12, 1);
+    }
+  else
+    {
+      unsigned char lenblock[GCM_BLOCKSIZE];
+
+      memset (ctr, 0, GCM_BLOCKSIZE);
+      gcm_hash_buffered (c, iv, ivlen);
+      gcm_hash_pad (c);
+      buf_put_be64 (lenblock, 0);
+      buf_put_be64 (lenblock + 8, (u64)ivlen * 8);
+      _gcry_ghash (&c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag, lenblock, 1);
+      memcpy (ctr, c->u_mode.gcm.u_tag, GCM_BLOCKSIZE);
+      memset (c->u_mode.gcm.u_tag, 0, GCM_BLOCKSIZE);
+    }
+  memcpy (c->u_iv.iv, iv, ivlen < GCM_BLOCKSIZE? ivlen : GCM_BLOCKSIZE);
+
+  /* The encrypted J0 is used to finalize the tag.  */
+  c->cipher->encrypt (&c->context.c, c->u_mode.gcm.tagiv, ctr);
+  gcm_inc32 (ctr);
+
+  c->marks.iv = 1;
+  return 0;
+}
+
+
+/* Make sure that an IV has been set.  There is no default because
+   an IV must never be used twice with the same key.  */
+static gcry_err_code_t
+gcm_check_iv (gcry_cipher_hd_t c)
+{
+  if (!c->marks.iv)
+    return GPG_ERR_MISSING_VALUE;
+  return 0;
+}
+
+
+/* Add BUFLEN bytes of additional authenticated data.  */
+static gcry_err_code_t
+gcm_authenticate (gcry_cipher_hd_t c, const unsigned char *buf,
+                  size_t buflen)
+{
+  gcry_err_code_t rc;
+
+  rc = gcm_check_iv (c);
+  if (rc)
+    return rc;
+  if (c->u_mode.gcm.data_started || c->u_mode.gcm.tag_done)
+    return GPG_ERR_INV_STATE;
+  if (buflen && !buf)
+    return GPG_ERR_INV_ARG;
+  if (c->u_mode.gcm.aadlen + buflen < c->u_mode.gcm.aadlen
+      || c->u_mode.gcm.aadlen + buflen > (U64_C(1) << 61) - 1)
+    return GPG_ERR_INV_LENGTH;
+
+  gcm_hash_buffered (c, buf, buflen);
+  c->u_mode.gcm.aadlen += buflen;
+  return 0;
+}
+
+
+/* Encrypt or decrypt INBUF into OUTBUF and update the hash with the
+   ciphertext.  */
+static gcry_err_code_t
+do_gcm_crypt (gcry_cipher_hd_t c,
+              unsigned char *outbuf, unsigned int outbuflen,
+              const unsigned char *inbuf, unsigned int inbuflen,
+              int encrypt)
+{
+  unsigned char *ctr = c->u_ctr.ctr;
+  unsigned char *macbuf = c->u_mode.gcm.macbuf;
+  unsigned int n;
+  int i;
+  gcry_err_code_t rc;
+
+  if (outbuflen < inbuflen)
+    return GPG_ERR_BUFFER_TOO_SHORT;
+
+  rc = gcm_check_iv (c);
+  if (rc)
+    return rc;
+  if (c->u_mode.gcm.tag_done)
+    return GPG_ERR_INV_STATE;
+  if (c->u_mode.gcm.datalen + inbuflen > GCM_MAX_DATALEN)
+    return GPG_ERR_INV_LENGTH;
+
+  if (!c->u_mode.gcm.data_started)
+    {
+      /* The AAD is complete; pad it to a full block.  */
+      gcm_hash_pad (c);
+      c->u_mode.gcm.data_started = 1;
+    }
+  c->u_mode.gcm.datalen += inbuflen;
+
+  /* First process a left over encrypted counter.  The ciphertext
+     bytes are collected in the MACBUF which will be full at the same
+     time the encrypted counter has been consumed.  */
+  if (c->unused)
+    {
+      i = GCM_BLOCKSIZE - c->unused;
+      for (n=0; c->unused && n < inbuflen; c->unused--, n++, i++)
+        {
+          if (encrypt)
+            macbuf[i] = outbuf[n] = inbuf[n] ^ c->lastiv[i];
+          else
+            {
+              macbuf[i] = inbuf[n];
+              outbuf[n] = inbuf[n] ^ c->lastiv[i];
+            }
+        }
+      c->u_mode.gcm.mac_unused = i;
+      if (!c->unused)
+        {
+          _gcry_ghash (&c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag, macbuf, 1);
+          c->u_mode.gcm.mac_unused = 0;
+        }
+      inbuf  += n;
+      outbuf += n;
+      inbuflen -= n;
+    }
+
+  /* Process complete blocks.  The bulk function may only be used up
+     to the point where the 32 bit counter wraps.  */
+  while (inbuflen >= GCM_BLOCKSIZE && c->bulk.gcm_crypt)
+    {
+      unsigned char save[12];
+      u64 avail = (U64_C(1) << 32) - buf_get_be32 (ctr + 12);
+
+      n = inbuflen / GCM_BLOCKSIZE;
+      if (n > avail)
+        n = avail;
+
+      memcpy (save, ctr, 12);
+      c->bulk.gcm_crypt (&c->context.c, ctr,
+                         &c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag,
+                         outbuf, inbuf, n, encrypt);
+      memcpy (ctr, save, 12);
+
+      inbuf  += n * GCM_BLOCKSIZE;
+      outbuf += n * GCM_BLOCKSIZE;
+      inbuflen -= n * GCM_BLOCKSIZE;
+    }
+
+  /* Use the standard method for the remaining data.  */
+  if (inbuflen)
+    {
+      unsigned char tmp[GCM_BLOCKSIZE];
+
+      for (n=0; n < inbuflen; n++)
+        {
+          i = n % GCM_BLOCKSIZE;
+          if (!i)
+            {
+              c->cipher->encrypt (&c->context.c, tmp, ctr);
+              gcm_inc32 (ctr);
+            }
+
+          if (encrypt)
+            macbuf[i] = outbuf[n] = inbuf[n] ^ tmp[i];
+          else
+            {
+              macbuf[i] = inbuf[n];
+              outbuf[n] = inbuf[n] ^ tmp[i];
+            }
+
+          if (i == GCM_BLOCKSIZE - 1)
+            _gcry_ghash (&c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag,
+                         macbuf, 1);
+        }
+
+      /* Save the unused bytes of the counter.  */
+      n %= GCM_BLOCKSIZE;
+      c->u_mode.gcm.mac_unused = n;
+      c->unused = (GCM_BLOCKSIZE - n) % GCM_BLOCKSIZE;
+      if (c->unused)
+        memcpy (c->lastiv+n, tmp+n, c->unused);
+
+      wipememory (tmp, sizeof tmp);
+    }
+
+  return 0;
+}
+
+
+/* Finish the GHASH computation and compute the authentication tag.  */
+static gcry_err_code_t
+gcm_finalize (gcry_cipher_hd_t c)
+{
+  unsigned char lenblock[GCM_BLOCKSIZE];
+  gcry_err_code_t rc;
+
+  if (c->u_mode.gcm.tag_done)
+    return 0;
+
+  rc = gcm_check_iv (c);
+  if (rc)
+    return rc;
+  gcm_hash_pad (c);  /* Pads the AAD or the ciphertext.  */
+  buf_put_be64 (lenblock, c->u_mode.gcm.aadlen * 8);
+  buf_put_be64 (lenblock + 8, c->u_mode.gcm.datalen * 8);
+  _gcry_ghash (&c->u_mode.gcm.ghash, c->u_mode.gcm.u_tag, lenblock, 1);
+  buf_xor (c->u_mode.gcm.u_tag, c->u_mode.gcm.u_tag,
+           c->u_mode.gcm.tagiv, GCM_BLOCKSIZE);
+  c->u_mode.gcm.data_started = 1;
+  c->u_mode.gcm.tag_done = 1;
+  return 0;
+}
+
+
+/* Return true if TAGLEN is a tag length allowed by SP 800-38D.  */
+static int
+gcm_valid_taglen (size_t taglen)
+{
+  switch (taglen)
+    {
+    case 16: case 15: case 14: case 13: case 12:
+    case 8: case 4:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Store the authentication tag into OUTBUF.  If OUTBUFLEN is larger
+   than 16 bytes, only the first 16 bytes are written.  */
+static gcry_err_code_t
+gcm_get_tag (gcry_cipher_hd_t c, unsigned char *outbuf, size_t outbuflen)
+{
+  gcry_err_code_t rc;
+
+  if (!outbuf)
+    return GPG_ERR_INV_ARG;
+  if (outbuflen > GCM_BLOCKSIZE)
+    outbuflen = GCM_BLOCKSIZE;
+  if (!gcm_valid_taglen (outbuflen))
+    return GPG_ERR_INV_LENGTH;
+
+  rc = gcm_finalize (c);
+  if (rc)
+    return rc;
+  memcpy (outbuf, c->u_mode.gcm.u_tag, outbuflen);
+  return 0;
+}
+
+
+/* Compare the authentication tag with the one given in TAG using a
+   constant time comparison.  */
+static gcry_err_code_t
+gcm_check_tag (gcry_cipher_hd_t c, const unsigned char *tag, size_t taglen)
+{
+  gcry_err_code_t rc;
+
+  if (!tag)
+    return GPG_ERR_INV_ARG;
+  if (!gcm_valid_taglen (taglen))
+    return GPG_ERR_INV_LENGTH;
+
+  rc = gcm_finalize (c);
+  if (rc)
+    return rc;
+  if (!buf_eq_const (c->u_mode.gcm.u_tag, tag, taglen))
+    return GPG_ERR_CHECKSUM;
+  return 0;
+}
+
+
+/* The XTS-AES mode as specified by IEEE Std 1619-2007 and NIST SP
+   800-38E.  It is implemented for any cipher algorithm with a
+   blocksize of 128.  The key given to setkey is the concatenation of
+   the data key and the tweak key.  The IV is the tweak of the data
+   unit (e.g. the sector number as a little endian value); it is
+   encrypted with the tweak key and the result is kept in U_CTR, where
+   it is advanced for each block.  Thus a data unit may be processed
+   with several calls as long as all but the last one use a multiple
+   of the blocksize; the last call may end with a partial block, which
+   is handled by ciphertext stealing.  */
+#define XTS_BLOCKSIZE 16
+
+
+/* Return the context for the tweak key.  It follows the two contexts
+   for the data key.  */
+static void *
+xts_tweak_context (gcry_cipher_hd_t c)
+{
+  size_t off = 2 * c->cipher->contextsize;
+
+  off = (off + 15) & ~(size_t)15;
+  return (char *)&c->context.c + off;
+}
+
+
+/* Compute the tweak for the first block from the IV.  */
+static void
+xts_set_tweak (gcry_cipher_hd_t c)
+{
+  c->cipher->encrypt (xts_tweak_context (c), c->u_ctr.ctr, c->u_iv.iv);
+}
+
+
+/* Multiply the tweak T by the primitive element x of GF(2^128).  The
+   tweak is stored as a little endian value.  */
+static void
+xts_mul_x (unsigned char *t)
+{
+  u64 lo = buf_get_le64 (t);
+  u64 hi = buf_get_le64 (t + 8);
+  u64 carry = hi >> 63;
+
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (0x87 & -carry);
+  buf_put_le64 (t, lo);
+  buf_put_le64 (t + 8, hi);
+}
+
+
+/* Encrypt or decrypt one block from INBUF to OUTBUF using the tweak
+   T.  The buffers may be the same.  */
+static void
+xts_crypt_block (gcry_cipher_hd_t c, unsigned char *outbuf,
+                 const unsigned char *inbuf, const unsigned char *t,
+                 int encrypt)
+{
+  buf_xor (outbuf, inbuf, t, XTS_BLOCKSIZE);
+  if (encrypt)
+    c->cipher->encrypt (&c->context.c, outbuf, outbuf);
+  else
+    c->cipher->decrypt (&c->context.c, outbuf, outbuf);
+  buf_xor (outbuf, outbuf, t, XTS_BLOCKSIZE);
+}
+
+
+/* Encrypt or decrypt INBUF into OUTBUF.  INBUFLEN needs to be at
+   least the blocksize.  */
+static gcry_err_code_t
+do_xts_crypt (gcry_cipher_hd_t c,
+              unsigned char *outbuf, unsigned int outbuflen,
+              const unsigned char *inbuf, unsigned int inbuflen,
+              int encrypt)
+{
+  unsigned char *tweak = c->u_ctr.ctr;
+  unsigned char tmp[XTS_BLOCKSIZE];
+  unsigned char pp[XTS_BLOCKSIZE];
+  unsigned char t2[XTS_BLOCKSIZE];
+  unsigned int nblocks, tail;
+
+  if (outbuflen < inbuflen)
+    return GPG_ERR_BUFFER_TOO_SHORT;
+  if (inbuflen < XTS_BLOCKSIZE)
+    return GPG_ERR_INV_LENGTH;
+
+  /* With a partial last block the last complete block takes part in
+     the ciphertext stealing.  */
+  nblocks = inbuflen / XTS_BLOCKSIZE;
+  tail = inbuflen % XTS_BLOCKSIZE;
+  if (tail)
+    nblocks--;
+
+  if (nblocks && c->bulk.xts_crypt)
+    {
+      c->bulk.xts_crypt (&c->context.c, tweak, outbuf, inbuf, nblocks,
+                         encrypt);
+      inbuf  += nblocks * XTS_BLOCKSIZE;
+      outbuf += nblocks * XTS_BLOCKSIZE;
+    }
+  else
+    {
+      for ( ;nblocks; nblocks--)
+        {
+          xts_crypt_block (c, outbuf, inbuf, tweak, encrypt);
+          xts_mul_x (tweak);
+          inbuf  += XTS_BLOCKSIZE;
+          outbuf += XTS_BLOCKSIZE;
+        }
+    }
+
+  if (tail)
+    {
+      /* Ciphertext stealing.  The partial block is padded with the
+         trailing bytes of the processed last complete block, which
+         gets truncated and moved to the end.  For decryption the two
+         tweaks are used in reverse order.  Note that INBUF and OUTBUF
+         may be the same.  */
+      memcpy (t2, tweak, XTS_BLOCKSIZE);
+      xts_mul_x (t2);
+
+      xts_crypt_block (c, tmp, inbuf, encrypt? tweak : t2, encrypt);
+      memcpy (pp, inbuf + XTS_BLOCKSIZE, tail);
+      memcpy (pp + tail, tmp + tail, XTS_BLOCKSIZE - tail);
+      memcpy (outbuf + XTS_BLOCKSIZE, tmp, tail);
+      xts_crypt_block (c, outbuf, pp, encrypt? t2 : tweak, encrypt);
+
+      memcpy (tweak, t2, XTS_BLOCKSIZE);
+      xts_mul_x (tweak);
+
+      wipememory (tmp, sizeof tmp);
+      wipememory (pp, sizeof pp);
+      wipememory (t2, sizeof t2);
+    }
+
+  return 0;
+}
+
+
 /****************
  * Encrypt INBUF to OUTBUF with the mode selected at open.
  * inbuf and outbuf may overlap or be the same.
@@ -1726,6 +2582,14 @@ cipher_encrypt (gcry_cipher_hd_t c, byte *outbuf, unsigned int outbuflen,
       rc = do_aeswrap_encrypt (c, outbuf, outbuflen, inbuf, inbuflen);
       break;
 
+    case GCRY_CIPHER_MODE_GCM:
+      rc = do_gcm_crypt (c, outbuf, outbuflen, inbuf, inbuflen, 1);
+      break;
+
+    case GCRY_CIPHER_MODE_XTS:
+      rc = do_xts_crypt (c, outbuf, outbuflen, inbuf, inbuflen, 1);
+      break;
+
     case GCRY_CIPHER_MODE_STREAM:
       c->cipher->stencrypt (&c->context.c,
                             outbuf, (byte*)/*arggg*/inbuf, inbuflen);
@@ -1818,6 +2682,14 @@ cipher_decrypt (gcry_cipher_hd_t c, byte *outbuf, unsigned int outbuflen,
       rc = do_aeswrap_decrypt (c, outbuf, outbuflen, inbuf, inbuflen);
       break;
 
+    case GCRY_CIPHER_MODE_GCM:
+      rc = do_gcm_crypt (c, outbuf, outbuflen, inbuf, inbuflen, 0);
+      break;
+
+    case GCRY_CIPHER_MODE_XTS:
+      rc = do_xts_crypt (c, outbuf, outbuflen, inbuf, inbuflen, 0);
+      break;
+
     case GCRY_CIPHER_MODE_STREAM:
       c->cipher->stdecrypt (&c->context.c,
                             outbuf, (byte*)/*arggg*/inbuf, inbuflen);
@@ -1892,8 +2764,7 @@ _gcry_cipher_setkey (gcry_cipher_hd_t hd, const void *key, size_t keylen)
 gcry_error_t
 _gcry_cipher_setiv (gcry_cipher_hd_t hd, const void *iv, size_t ivlen)
 {
-  cipher_setiv (hd, iv, ivlen);
-  return 0;
+  return gcry_error (cipher_setiv (hd, iv, ivlen));
 }
 
 /* Set counter for CTR mode.  (CTR,CTRLEN) must denote a buffer of
@@ -1930,7 +2801,7 @@ gcry_cipher_ctl( gcry_cipher_hd_t h, int cmd, void *buffer, size_t buflen)
       break;
 
     case GCRYCTL_SET_IV:   /* Deprecated; use gcry_cipher_setiv.  */
-      cipher_setiv( h, buffer, buflen );
+      rc = cipher_setiv( h, buffer, buflen );
       break;
 
     case GCRYCTL_RESET:
@@ -1973,6 +2844,27 @@ gcry_cipher_ctl( gcry_cipher_hd_t h, int cmd, void *buffer, size_t buflen)
       rc = gpg_err_code (_gcry_cipher_setctr (h, buffer, buflen));
       break;
 
+    case GCRYCTL_AUTHENTICATE:
+      if (h->mode != GCRY_CIPHER_MODE_GCM)
+        rc = GPG_ERR_INV_CIPHER_MODE;
+      else
+        rc = gcm_authenticate (h, buffer, buflen);
+      break;
+
+    case GCRYCTL_GET_TAG:
+      if (h->mode != GCRY_CIPHER_MODE_GCM)
+        rc = GPG_ERR_INV_CIPHER_MODE;
+      else
+        rc = gcm_get_tag (h, buffer, buflen);
+      break;
+
+    case GCRYCTL_CHECK_TAG:
+      if (h->mode != GCRY_CIPHER_MODE_GCM)
+        rc = GPG_ERR_INV_CIPHER_MODE;
+      else
+        rc = gcm_check_tag (h, buffer, buflen);
+      break;
+
     case 61:  /* Disable weak key detection (private).  */
       if (h->extraspec->set_extra_info)
         rc = h->extraspec->set_extra_info
@@ -2149,6 +3041,29 @@ gcry_cipher_get_algo_blklen (int algo)
   return n;
 }
 
+
+/* Set the maximum number of closed handles kept for reuse to
+   MAX_HANDLES.  Surplus handles are released; 0 disables the pool.  */
+void
+_gcry_cipher_set_pool (unsigned int max_handles)
+{
+  struct cipher_pool_item *item;
+  int i;
+
+  ath_mutex_lock (&cipher_pool_lock);
+  cipher_pool_max = max_handles;
+  for (i = 0; i < CIPHER_POOL_CLASSES; i++)
+    while (cipher_pool_count > max_handles && cipher_pool[i].items)
+      {
+        item = cipher_pool[i].items;
+        cipher_pool[i].items = item->next;
+        cipher_pool_count--;
+        gcry_free (item);
+      }
+  ath_mutex_unlock (&cipher_pool_lock);
+}
+
+
 /* Explicitly initialize this module.  */
 gcry_err_code_t
 _gcry_cipher_init (void)
@@ -2188,13 +3103,9 @@ _gcry_cipher_selftest (int algo, int extended, selftest_report_func_t report)
   cipher_extra_spec_t *extraspec = NULL;
   gcry_err_code_t ec = 0;
 
-  REGISTER_DEFAULT_CIPHERS;
-
-  ath_mutex_lock (&ciphers_registered_lock);
-  module = _gcry_module_lookup_id (ciphers_registered, algo);
+  module = cipher_module_get (algo);
   if (module && !(module->flags & FLAG_MODULE_DISABLED))
     extraspec = module->extraspec;
-  ath_mutex_unlock (&ciphers_registered_lock);
   if (extraspec && extraspec->selftest)
     ec = extraspec->selftest (algo, extended, report);
   else
@@ -2207,11 +3118,6 @@ _gcry_cipher_selftest (int algo, int extended, selftest_report_func_t report)
                 module? "algorithm disabled" : "algorithm not found");
     }
 
-  if (module)
-    {
-      ath_mutex_lock (&ciphers_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&ciphers_registered_lock);
-    }
+  cipher_module_put (module);
   return gpg_error (ec);
 }
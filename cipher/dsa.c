@@ -365,7 +365,7 @@ generate (DSA_secret_key *sk, unsigned int nbits, unsigned int qbits,
 
   /* y = g^x mod p */
   y = mpi_alloc( mpi_get_nlimbs(p) );
-  gcry_mpi_powm( y, g, x, p );
+  mpi_powm_sec( y, g, x, p );
 
   if( DBG_CIPHER )
     {
@@ -529,7 +529,7 @@ generate_fips186 (DSA_secret_key *sk, unsigned int nbits, unsigned int qbits,
 
   /* y = g^x mod p */
   value_y = mpi_alloc_like (prime_p);
-  gcry_mpi_powm (value_y, value_g, value_x, prime_p);
+  mpi_powm_sec (value_y, value_g, value_x, prime_p);
 
   if (DBG_CIPHER)
     {
@@ -616,7 +616,7 @@ sign(gcry_mpi_t r, gcry_mpi_t s, gcry_mpi_t hash, DSA_secret_key *skey )
   k = gen_k( skey->q );
 
   /* r = (a^k mod p) mod q */
-  gcry_mpi_powm( r, skey->g, k, skey->p );
+  mpi_powm_sec( r, skey->g, k, skey->p );
   mpi_fdiv_r( r, r, skey->q );
 
   /* kinv = k^(-1) mod q */
@@ -383,6 +383,35 @@ scanval (const char *string)
 }
 
 
+/* Allow the comb tables of the EC code for the base points of the
+   curves in DOMAIN_PARMS.  Other base points, like those of curves
+   given by the caller, do not get a table, so that they can't use up
+   memory.  */
+static void
+register_base_points (void)
+{
+  static int done;
+  gcry_mpi_t p, a, gx, gy;
+  int idx;
+
+  if (done)
+    return;
+  for (idx = 0; domain_parms[idx].desc; idx++)
+    {
+      p = scanval (domain_parms[idx].p);
+      a = scanval (domain_parms[idx].a);
+      gx = scanval (domain_parms[idx].g_x);
+      gy = scanval (domain_parms[idx].g_y);
+      _gcry_mpi_ec_register_base (p, a, gx, gy);
+      mpi_free (gy);
+      mpi_free (gx);
+      mpi_free (a);
+      mpi_free (p);
+    }
+  done = 1;
+}
+
+
 
 
 
@@ -544,8 +573,9 @@ generate_key (ECC_secret_key *sk, unsigned int nbits, const char *name,
 
   /* Compute Q.  */
   point_init (&Q);
+  register_base_points ();
   ctx = _gcry_mpi_ec_init (E.p, E.a);
-  _gcry_mpi_ec_mul_point (&Q, d, &E.G, ctx);
+  _gcry_mpi_ec_mul_base (&Q, d, &E.G, ctx);
 
   /* Copy the stuff to the key structures. */
   sk->E.p = mpi_copy (E.p);
@@ -730,6 +760,7 @@ sign (gcry_mpi_t input, ECC_secret_key *skey, gcry_mpi_t r, gcry_mpi_t s)
   mpi_set_ui (s, 0);
   mpi_set_ui (r, 0);
 
+  register_base_points ();
   ctx = _gcry_mpi_ec_init (skey->E.p, skey->E.a);
 
   while (!mpi_cmp_ui (s, 0)) /* s == 0 */
@@ -742,7 +773,7 @@ sign (gcry_mpi_t input, ECC_secret_key *skey, gcry_mpi_t r, gcry_mpi_t s)
              has to be recomputed.  */
           mpi_free (k);
           k = gen_k (skey->E.n, GCRY_STRONG_RANDOM);
-          _gcry_mpi_ec_mul_point (&I, k, &skey->E.G, ctx);
+          _gcry_mpi_ec_mul_base (&I, k, &skey->E.G, ctx);
           if (_gcry_mpi_ec_get_affine (x, NULL, &I, ctx))
             {
               if (DBG_CIPHER)
@@ -785,7 +816,7 @@ verify (gcry_mpi_t input, ECC_public_key *pkey, gcry_mpi_t r, gcry_mpi_t s)
 {
   gpg_err_code_t err = 0;
   gcry_mpi_t h, h1, h2, x, y;
-  mpi_point_t Q, Q1, Q2;
+  mpi_point_t Q;
   mpi_ec_t ctx;
 
   if( !(mpi_cmp_ui (r, 0) > 0 && mpi_cmp (r, pkey->E.n) < 0) )
@@ -799,9 +830,8 @@ verify (gcry_mpi_t input, ECC_public_key *pkey, gcry_mpi_t r, gcry_mpi_t s)
   x = mpi_alloc (0);
   y = mpi_alloc (0);
   point_init (&Q);
-  point_init (&Q1);
-  point_init (&Q2);
 
+  register_base_points ();
   ctx = _gcry_mpi_ec_init (pkey->E.p, pkey->E.a);
 
   /* h  = s^(-1) (mod n) */
@@ -810,21 +840,11 @@ verify (gcry_mpi_t input, ECC_public_key *pkey, gcry_mpi_t r, gcry_mpi_t s)
   /* h1 = hash * s^(-1) (mod n) */
   mpi_mulm (h1, input, h, pkey->E.n);
 /*   log_mpidump ("  h1", h1); */
-  /* Q1 = [ hash * s^(-1) ]G  */
-  _gcry_mpi_ec_mul_point (&Q1, h1, &pkey->E.G, ctx);
-/*   log_mpidump ("Q1.x", Q1.x); */
-/*   log_mpidump ("Q1.y", Q1.y); */
-/*   log_mpidump ("Q1.z", Q1.z); */
   /* h2 = r * s^(-1) (mod n) */
   mpi_mulm (h2, r, h, pkey->E.n);
 /*   log_mpidump ("  h2", h2); */
-  /* Q2 = [ r * s^(-1) ]Q */
-  _gcry_mpi_ec_mul_point (&Q2, h2, &pkey->Q, ctx);
-/*   log_mpidump ("Q2.x", Q2.x); */
-/*   log_mpidump ("Q2.y", Q2.y); */
-/*   log_mpidump ("Q2.z", Q2.z); */
   /* Q  = ([hash * s^(-1)]G) + ([r * s^(-1)]Q) */
-  _gcry_mpi_ec_add_points (&Q, &Q1, &Q2, ctx);
+  _gcry_mpi_ec_mul_add (&Q, h1, &pkey->E.G, h2, &pkey->Q, ctx);
 /*   log_mpidump (" Q.x", Q.x); */
 /*   log_mpidump (" Q.y", Q.y); */
 /*   log_mpidump (" Q.z", Q.z); */
@@ -862,8 +882,6 @@ verify (gcry_mpi_t input, ECC_public_key *pkey, gcry_mpi_t r, gcry_mpi_t s)
 
  leave:
   _gcry_mpi_ec_free (ctx);
-  point_free (&Q2);
-  point_free (&Q1);
   point_free (&Q);
   mpi_free (y);
   mpi_free (x);
@@ -1421,6 +1439,7 @@ ecc_encrypt_raw (int algo, gcry_mpi_t *resarr, gcry_mpi_t k,
       return err;
     }
 
+  register_base_points ();
   ctx = _gcry_mpi_ec_init (pk.E.p, pk.E.a);
 
   /* The following is false: assert( mpi_cmp_ui( R.x, 1 )==0 );, so */
@@ -1442,7 +1461,7 @@ ecc_encrypt_raw (int algo, gcry_mpi_t *resarr, gcry_mpi_t k,
     result[0] = ec2os (x, y, pk.E.p);
 
     /* R = kG */
-    _gcry_mpi_ec_mul_point (&R, k, &pk.E.G, ctx);
+    _gcry_mpi_ec_mul_base (&R, k, &pk.E.G, ctx);
 
     if (_gcry_mpi_ec_get_affine (x, y, &R, ctx))
       log_fatal ("ecdh: Failed to get affine coordinates for kG\n");
@@ -326,7 +326,7 @@ generate ( ELG_secret_key *sk, unsigned int nbits, gcry_mpi_t **ret_factors )
   gcry_free(rndbuf);
 
   y = gcry_mpi_new (nbits);
-  gcry_mpi_powm( y, g, x, p );
+  mpi_powm_sec( y, g, x, p );
 
   if( DBG_CIPHER )
     {
@@ -397,7 +397,7 @@ generate_using_x (ELG_secret_key *sk, unsigned int nbits, gcry_mpi_t x,
     }
 
   y = gcry_mpi_new (nbits);
-  gcry_mpi_powm ( y, g, x, p );
+  mpi_powm_sec ( y, g, x, p );
 
   if ( DBG_CIPHER )
     {
@@ -458,13 +458,13 @@ do_encrypt(gcry_mpi_t a, gcry_mpi_t b, gcry_mpi_t input, ELG_public_key *pkey )
    */
 
   k = gen_k( pkey->p, 1 );
-  gcry_mpi_powm( a, pkey->g, k, pkey->p );
+  mpi_powm_sec( a, pkey->g, k, pkey->p );
   /* b = (y^k * input) mod p
    *	 = ((y^k mod p) * (input mod p)) mod p
    * and because input is < p
    *	 = ((y^k mod p) * input) mod p
    */
-  gcry_mpi_powm( b, pkey->y, k, pkey->p );
+  mpi_powm_sec( b, pkey->y, k, pkey->p );
   gcry_mpi_mulm( b, b, input, pkey->p );
 #if 0
   if( DBG_CIPHER )
@@ -489,7 +489,7 @@ decrypt(gcry_mpi_t output, gcry_mpi_t a, gcry_mpi_t b, ELG_secret_key *skey )
   gcry_mpi_t t1 = mpi_alloc_secure( mpi_get_nlimbs( skey->p ) );
 
   /* output = b/(a^x) mod p */
-  gcry_mpi_powm( t1, a, skey->x, skey->p );
+  mpi_powm_sec( t1, a, skey->x, skey->p );
   mpi_invm( t1, t1, skey->p );
   mpi_mulm( output, b, t1, skey->p );
 #if 0
@@ -526,7 +526,7 @@ sign(gcry_mpi_t a, gcry_mpi_t b, gcry_mpi_t input, ELG_secret_key *skey )
     */
     mpi_sub_ui(p_1, p_1, 1);
     k = gen_k( skey->p, 0 /* no small K ! */ );
-    gcry_mpi_powm( a, skey->g, k, skey->p );
+    mpi_powm_sec( a, skey->g, k, skey->p );
     mpi_mul(t, skey->x, a );
     mpi_subm(t, input, t, p_1 );
     mpi_invm(inv, k, p_1 );
@@ -0,0 +1,378 @@
+/* ghash.c - GHASH universal hash function for the GCM mode
+ * Copyright (C) 2013 Free Software Foundation, Inc.
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* GHASH is the multiplication in GF(2^128) used by the Galois/Counter
+   Mode as specified in NIST SP 800-38D.  Two implementations are
+   provided here:
+
+   - A portable one using Shoup's method with a 16 entry table of
+     multiples of the hash key H (4 bit at a time).
+
+   - One using the Intel PCLMULQDQ carry-less multiply instruction.
+     It follows the algorithm described in Intel's white paper
+     "Intel Carry-Less Multiplication Instruction and its Usage for
+     Computing the GCM Mode" by S. Gueron and M. E. Kounavis.  Four
+     blocks are processed at a time using the precomputed powers
+     H^1..H^4 so that only one reduction per four blocks is
+     required.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "g10lib.h"
+#include "cipher.h"
+#include "bufhelp.h"
+
+
+/* USE_PCLMUL indicates whether to compile with Intel PCLMUL code.  */
+#undef USE_PCLMUL
+#ifdef ENABLE_PCLMUL_SUPPORT
+# if ((defined (__i386__) && SIZEOF_UNSIGNED_LONG == 4) \
+      || defined (__x86_64__)) && __GNUC__ >= 4
+#  define USE_PCLMUL 1
+# endif
+#endif /* ENABLE_PCLMUL_SUPPORT */
+
+
+
+/* The reduction constants for the 4 bit table method; these are the
+   multiples of the reduction polynomial for the 4 bits shifted out.  */
+static const u64 rem_4bit[16] =
+  {
+    U64_C(0x0000) << 48, U64_C(0x1C20) << 48,
+    U64_C(0x3840) << 48, U64_C(0x2460) << 48,
+    U64_C(0x7080) << 48, U64_C(0x6CA0) << 48,
+    U64_C(0x48C0) << 48, U64_C(0x54E0) << 48,
+    U64_C(0xE100) << 48, U64_C(0xFD20) << 48,
+    U64_C(0xD940) << 48, U64_C(0xC560) << 48,
+    U64_C(0x9180) << 48, U64_C(0x8DA0) << 48,
+    U64_C(0xA9C0) << 48, U64_C(0xB5E0) << 48
+  };
+
+
+/* Build the table with the 16 multiples of H.  */
+static void
+fillM (ghash_context_t *ctx, const unsigned char *h)
+{
+  u64 vhi, vlo, t;
+  int i, j;
+
+  vhi = buf_get_be64 (h);
+  vlo = buf_get_be64 (h + 8);
+
+  ctx->m_hi[0] = ctx->m_lo[0] = 0;
+  ctx->m_hi[8] = vhi;
+  ctx->m_lo[8] = vlo;
+  for (i = 4; i > 0; i >>= 1)
+    {
+      /* Multiply V by x (i.e. shift right in GCM's bit order).  */
+      t = U64_C(0xe100000000000000) & (0 - (vlo & 1));
+      vlo = (vhi << 63) | (vlo >> 1);
+      vhi = (vhi >> 1) ^ t;
+      ctx->m_hi[i] = vhi;
+      ctx->m_lo[i] = vlo;
+    }
+  for (i = 2; i < 16; i <<= 1)
+    for (j = 1; j < i; j++)
+      {
+        ctx->m_hi[i+j] = ctx->m_hi[i] ^ ctx->m_hi[j];
+        ctx->m_lo[i+j] = ctx->m_lo[i] ^ ctx->m_lo[j];
+      }
+}
+
+
+/* Compute X = X * H using the table.  */
+static void
+do_ghash_4bit (const ghash_context_t *ctx, unsigned char *x)
+{
+  u64 zhi, zlo;
+  unsigned int rem, nlo, nhi;
+  int cnt;
+
+  nlo = x[15];
+  nhi = nlo >> 4;
+  nlo &= 0xf;
+  zhi = ctx->m_hi[nlo];
+  zlo = ctx->m_lo[nlo];
+
+  for (cnt = 15; ; )
+    {
+      rem = zlo & 0xf;
+      zlo = (zhi << 60) | (zlo >> 4);
+      zhi = (zhi >> 4) ^ rem_4bit[rem];
+      zhi ^= ctx->m_hi[nhi];
+      zlo ^= ctx->m_lo[nhi];
+
+      if (--cnt < 0)
+        break;
+
+      nlo = x[cnt];
+      nhi = nlo >> 4;
+      nlo &= 0xf;
+
+      rem = zlo & 0xf;
+      zlo = (zhi << 60) | (zlo >> 4);
+      zhi = (zhi >> 4) ^ rem_4bit[rem];
+      zhi ^= ctx->m_hi[nlo];
+      zlo ^= ctx->m_lo[nlo];
+    }
+
+  buf_put_be64 (x, zhi);
+  buf_put_be64 (x + 8, zlo);
+}
+
+
+
+#ifdef USE_PCLMUL
+/* The carry-less multiply is written as plain opcodes so that we do
+   not depend on a recent assembler (see also rijndael.c).  The
+   naming is pclmul_<imm>_<src>_<dst>.  */
+#define pclmul_00_xmm1_xmm2  ".byte 0x66, 0x0f, 0x3a, 0x44, 0xd1, 0x00\n\t"
+#define pclmul_11_xmm1_xmm2  ".byte 0x66, 0x0f, 0x3a, 0x44, 0xd1, 0x11\n\t"
+#define pclmul_10_xmm1_xmm2  ".byte 0x66, 0x0f, 0x3a, 0x44, 0xd1, 0x10\n\t"
+#define pclmul_01_xmm1_xmm0  ".byte 0x66, 0x0f, 0x3a, 0x44, 0xc1, 0x01\n\t"
+
+/* Multiply the byte reflected block in xmm0 with the byte reflected
+   hash key power in xmm1 and accumulate the 256 bit product into
+   xmm3 (low), xmm4 (middle) and xmm6 (high).  xmm0 and xmm2 are
+   clobbered.  */
+#define PCLMUL_MUL_ACC                          \
+  "movdqa %%xmm0, %%xmm2\n\t"                   \
+  pclmul_00_xmm1_xmm2                           \
+  "pxor   %%xmm2, %%xmm3\n\t"                   \
+  "movdqa %%xmm0, %%xmm2\n\t"                   \
+  pclmul_11_xmm1_xmm2                           \
+  "pxor   %%xmm2, %%xmm6\n\t"                   \
+  "movdqa %%xmm0, %%xmm2\n\t"                   \
+  pclmul_10_xmm1_xmm2                           \
+  "pxor   %%xmm2, %%xmm4\n\t"                   \
+  pclmul_01_xmm1_xmm0                           \
+  "pxor   %%xmm0, %%xmm4\n\t"
+
+/* Fold the middle part in xmm4 into xmm3:xmm6, shift the 256 bit
+   value left by one bit to account for the bit reflection and
+   reduce it modulo the field polynomial.  The result is left in
+   xmm6; all registers xmm0 to xmm7 are clobbered.  */
+#define PCLMUL_REDUCE                                                   \
+  "movdqa %%xmm4, %%xmm5\n\t"                                           \
+  "psrldq $8, %%xmm4\n\t"                                               \
+  "pslldq $8, %%xmm5\n\t"                                               \
+  "pxor   %%xmm5, %%xmm3\n\t"                                           \
+  "pxor   %%xmm4, %%xmm6\n\t"                                           \
+  /* Shift xmm6:xmm3 left by one bit.  */                               \
+  "movdqa %%xmm3, %%xmm7\n\t"                                           \
+  "psrld  $31, %%xmm7\n\t"                                              \
+  "movdqa %%xmm6, %%xmm5\n\t"                                           \
+  "psrld  $31, %%xmm5\n\t"                                              \
+  "pslld  $1, %%xmm3\n\t"                                               \
+  "pslld  $1, %%xmm6\n\t"                                               \
+  "movdqa %%xmm7, %%xmm4\n\t"                                           \
+  "psrldq $12, %%xmm4\n\t"                                              \
+  "pslldq $4, %%xmm5\n\t"                                               \
+  "pslldq $4, %%xmm7\n\t"                                               \
+  "por    %%xmm7, %%xmm3\n\t"                                           \
+  "por    %%xmm5, %%xmm6\n\t"                                           \
+  "por    %%xmm4, %%xmm6\n\t"                                           \
+  /* First phase of the reduction.  */                                  \
+  "movdqa %%xmm3, %%xmm7\n\t"                                           \
+  "pslld  $31, %%xmm7\n\t"                                              \
+  "movdqa %%xmm3, %%xmm5\n\t"                                           \
+  "pslld  $30, %%xmm5\n\t"                                              \
+  "movdqa %%xmm3, %%xmm4\n\t"                                           \
+  "pslld  $25, %%xmm4\n\t"                                              \
+  "pxor   %%xmm5, %%xmm7\n\t"                                           \
+  "pxor   %%xmm4, %%xmm7\n\t"                                           \
+  "movdqa %%xmm7, %%xmm5\n\t"                                           \
+  "psrldq $4, %%xmm5\n\t"                                               \
+  "pslldq $12, %%xmm7\n\t"                                              \
+  "pxor   %%xmm7, %%xmm3\n\t"                                           \
+  /* Second phase of the reduction.  */                                 \
+  "movdqa %%xmm3, %%xmm0\n\t"                                           \
+  "psrld  $1, %%xmm0\n\t"                                               \
+  "movdqa %%xmm3, %%xmm1\n\t"                                           \
+  "psrld  $2, %%xmm1\n\t"                                               \
+  "movdqa %%xmm3, %%xmm4\n\t"                                           \
+  "psrld  $7, %%xmm4\n\t"                                               \
+  "pxor   %%xmm1, %%xmm0\n\t"                                           \
+  "pxor   %%xmm4, %%xmm0\n\t"                                           \
+  "pxor   %%xmm5, %%xmm0\n\t"                                           \
+  "pxor   %%xmm0, %%xmm3\n\t"                                           \
+  "pxor   %%xmm3, %%xmm6\n\t"
+
+static unsigned char be_mask[16] __attribute__ ((aligned (16))) =
+  { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+
+
+/* Compute X = (X ^ BUF) * H where H is given byte reflected.  If BUF
+   is NULL X = X * H is computed.  */
+static void
+do_ghash_pclmul (unsigned char *x, const unsigned char *buf,
+                 const unsigned char *h)
+{
+  static const unsigned char zero[16];
+
+  asm volatile ("movdqu (%[x]), %%xmm0\n\t"
+                "movdqu (%[buf]), %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                "pshufb %[mask], %%xmm0\n\t"
+                "movdqu (%[h]), %%xmm1\n\t"
+                "pxor   %%xmm3, %%xmm3\n\t"
+                "pxor   %%xmm4, %%xmm4\n\t"
+                "pxor   %%xmm6, %%xmm6\n\t"
+                PCLMUL_MUL_ACC
+                PCLMUL_REDUCE
+                "pshufb %[mask], %%xmm6\n\t"
+                "movdqu %%xmm6, (%[x])\n\t"
+                :
+                : [x] "r" (x),
+                  [buf] "r" (buf? buf : zero),
+                  [h] "r" (h),
+                  [mask] "m" (*be_mask)
+                : "cc", "memory");
+}
+
+
+/* Compute X = ((((X ^ B0) * H + B1) * H + B2) * H + B3) * H for the
+   4 blocks at BUF.  HPOW holds H^1..H^4 byte reflected.  */
+static void
+do_ghash_pclmul_4 (unsigned char *x, const unsigned char *buf,
+                   const unsigned char *hpow)
+{
+  asm volatile ("pxor   %%xmm3, %%xmm3\n\t"
+                "pxor   %%xmm4, %%xmm4\n\t"
+                "pxor   %%xmm6, %%xmm6\n\t"
+
+                "movdqu (%[x]), %%xmm0\n\t"       /* (X ^ B0) * H^4 */
+                "movdqu (%[buf]), %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                "pshufb %[mask], %%xmm0\n\t"
+                "movdqu 0x30(%[h]), %%xmm1\n\t"
+                PCLMUL_MUL_ACC
+
+                "movdqu 0x10(%[buf]), %%xmm0\n\t" /* B1 * H^3 */
+                "pshufb %[mask], %%xmm0\n\t"
+                "movdqu 0x20(%[h]), %%xmm1\n\t"
+                PCLMUL_MUL_ACC
+
+                "movdqu 0x20(%[buf]), %%xmm0\n\t" /* B2 * H^2 */
+                "pshufb %[mask], %%xmm0\n\t"
+                "movdqu 0x10(%[h]), %%xmm1\n\t"
+                PCLMUL_MUL_ACC
+
+                "movdqu 0x30(%[buf]), %%xmm0\n\t" /* B3 * H */
+                "pshufb %[mask], %%xmm0\n\t"
+                "movdqu (%[h]), %%xmm1\n\t"
+                PCLMUL_MUL_ACC
+
+                PCLMUL_REDUCE
+                "pshufb %[mask], %%xmm6\n\t"
+                "movdqu %%xmm6, (%[x])\n\t"
+                :
+                : [x] "r" (x),
+                  [buf] "r" (buf),
+                  [h] "r" (hpow),
+                  [mask] "m" (*be_mask)
+                : "cc", "memory");
+}
+
+
+/* Clear the SSE registers used by the PCLMUL code.  */
+static void
+pclmul_cleanup (void)
+{
+  asm volatile ("pxor %%xmm0, %%xmm0\n\t"
+                "pxor %%xmm1, %%xmm1\n\t"
+                "pxor %%xmm2, %%xmm2\n\t"
+                "pxor %%xmm3, %%xmm3\n\t"
+                "pxor %%xmm4, %%xmm4\n\t"
+                "pxor %%xmm5, %%xmm5\n\t"
+                "pxor %%xmm6, %%xmm6\n\t"
+                "pxor %%xmm7, %%xmm7\n" :: );
+}
+#endif /*USE_PCLMUL*/
+
+
+
+/* Set the hash key H (which is the encrypted all-zero block) for the
+   GHASH context CTX.  */
+void
+_gcry_ghash_setkey (ghash_context_t *ctx, const unsigned char *h)
+{
+  memset (ctx, 0, sizeof *ctx);
+
+#ifdef USE_PCLMUL
+  if ((_gcry_get_hw_features () & HWF_INTEL_PCLMUL))
+    {
+      unsigned char hp[16];
+      int i, j;
+
+      ctx->use_pclmul = 1;
+
+      /* Store H^1..H^4 byte reflected as expected by the asm code.  */
+      memcpy (hp, h, 16);
+      for (i = 0; i < 4; i++)
+        {
+          if (i)
+            do_ghash_pclmul (hp, NULL, ctx->h_pow[0]);
+          for (j = 0; j < 16; j++)
+            ctx->h_pow[i][j] = hp[15 - j];
+        }
+      pclmul_cleanup ();
+      wipememory (hp, sizeof hp);
+      return;
+    }
+#endif /*USE_PCLMUL*/
+
+  fillM (ctx, h);
+}
+
+
+/* Update the GHASH value HASH with the NBLOCKS 16 byte blocks at
+   BUF.  */
+void
+_gcry_ghash (ghash_context_t *ctx, unsigned char *hash,
+             const unsigned char *buf, size_t nblocks)
+{
+#ifdef USE_PCLMUL
+  if (ctx->use_pclmul)
+    {
+      for ( ;nblocks > 3; nblocks -= 4)
+        {
+          do_ghash_pclmul_4 (hash, buf, ctx->h_pow[0]);
+          buf += 4*16;
+        }
+      for ( ;nblocks; nblocks--)
+        {
+          do_ghash_pclmul (hash, buf, ctx->h_pow[0]);
+          buf += 16;
+        }
+      pclmul_cleanup ();
+      return;
+    }
+#endif /*USE_PCLMUL*/
+
+  for ( ;nblocks; nblocks--)
+    {
+      buf_xor (hash, hash, buf, 16);
+      do_ghash_4bit (ctx, hash);
+      buf += 16;
+    }
+}
@@ -26,6 +26,7 @@
 #endif
 
 #include "g10lib.h"
+#include "bufhelp.h"
 #include "hash-common.h"
 
 
@@ -91,3 +92,241 @@ _gcry_hash_selftest_check_one (int algo,
 
   return result;
 }
+
+
+
+#ifdef USE_MD_BATCH
+/* Bookkeeping for one lane of _gcry_md_batch_process.  */
+struct md_batch_lane
+{
+  const gcry_md_batch_item_t *item;  /* The message or NULL if idle.  */
+  const unsigned char *data;         /* The next full block.  */
+  size_t nfull;                      /* Number of full blocks left.  */
+  int ntail;                         /* Number of padded blocks left.  */
+  const unsigned char *tailp;        /* The next padded block.  */
+  unsigned char tail[2 * MD_BATCH_MAX_BLOCKSIZE];
+};
+
+
+/* Assign the message ITEM to lane number IDX.  This sets up the final
+   padded block(s) of the message in LANE and initializes the state of
+   the lane.  */
+static void
+batch_start_lane (const md_batch_spec_t *spec, struct md_batch_lane *lane,
+                  const gcry_md_batch_item_t *item, void *state, int idx)
+{
+  size_t bs = spec->blocksize;
+  size_t rest = item->length % bs;
+  unsigned char *p;
+
+  lane->item = item;
+  lane->data = item->buffer;
+  lane->nfull = item->length / bs;
+  lane->ntail = (rest + 1 + spec->lenbytes > bs)? 2 : 1;
+  lane->tailp = lane->tail;
+
+  memset (lane->tail, 0, lane->ntail * bs);
+  memcpy (lane->tail, lane->data + lane->nfull * bs, rest);
+  lane->tail[rest] = 0x80;
+  /* Append the message length in bits.  */
+  p = lane->tail + lane->ntail * bs;
+  buf_put_be64 (p - 8, (u64)item->length << 3);
+  if (spec->lenbytes > 8)
+    p[-9] = (u64)item->length >> 61;
+
+  spec->init_lane (state, idx);
+}
+
+
+/* Hash the NITEMS messages described by ITEMS using the multi-buffer
+   implementation SPEC.  Each lane takes the next message as soon as it
+   has finished the previous one, so that messages of different length
+   keep all lanes busy; idle lanes at the end process a dummy block.  */
+void
+_gcry_md_batch_process (const md_batch_spec_t *spec,
+                        const gcry_md_batch_item_t *items, size_t nitems)
+{
+  static const unsigned char idleblock[MD_BATCH_MAX_BLOCKSIZE];
+  struct md_batch_lane lane[MD_BATCH_MAX_LANES];
+  u64 state[MD_BATCH_MAX_STATESIZE / 8] __attribute__ ((aligned (32)));
+  const unsigned char *blocks[MD_BATCH_MAX_LANES];
+  size_t bs = spec->blocksize;
+  size_t next = 0;
+  int i, active = 0;
+
+  gcry_assert (spec->lanes <= MD_BATCH_MAX_LANES
+               && bs <= MD_BATCH_MAX_BLOCKSIZE
+               && spec->statesize <= MD_BATCH_MAX_STATESIZE);
+
+  memset (state, 0, sizeof state);
+  for (i = 0; i < spec->lanes; i++)
+    {
+      lane[i].item = NULL;
+      if (next < nitems)
+        {
+          batch_start_lane (spec, &lane[i], &items[next++], state, i);
+          active++;
+        }
+    }
+
+  while (active)
+    {
+      for (i = 0; i < spec->lanes; i++)
+        {
+          if (!lane[i].item)
+            blocks[i] = idleblock;
+          else if (lane[i].nfull)
+            {
+              blocks[i] = lane[i].data;
+              lane[i].data += bs;
+              lane[i].nfull--;
+            }
+          else
+            {
+              blocks[i] = lane[i].tailp;
+              lane[i].tailp += bs;
+              lane[i].ntail--;
+            }
+        }
+
+      spec->transform (state, blocks);
+
+      for (i = 0; i < spec->lanes; i++)
+        if (lane[i].item && !lane[i].nfull && !lane[i].ntail)
+          {
+            spec->read_lane (state, i, lane[i].item->digest);
+            lane[i].item = NULL;
+            active--;
+            if (next < nitems)
+              {
+                batch_start_lane (spec, &lane[i], &items[next++], state, i);
+                active++;
+              }
+          }
+    }
+
+  wipememory (lane, sizeof lane);
+  wipememory (state, sizeof state);
+}
+#endif /*USE_MD_BATCH*/
+
+
+/* Store the padding of a message consisting of one block and one
+   digest at BLOCK, behind the room for the digest.  */
+static void
+pbkdf2_pad_block (const md_pbkdf2_spec_t *spec, unsigned char *block)
+{
+  size_t bs = spec->blocksize;
+
+  memset (block + spec->digestlen, 0, bs - spec->digestlen);
+  block[spec->digestlen] = 0x80;
+  buf_put_be64 (block + bs - 8, (u64)(bs + spec->digestlen) << 3);
+}
+
+
+/* Run COUNT further iterations of the PBKDF2 function F for N output
+   blocks.  INNER and OUTER are the contexts after hashing the HMAC
+   key padded with ipad and opad.  U holds the N previous values U_i
+   and T the N sums of the U_i; both are arrays of N digests and are
+   updated in place.
+
+   Each iteration needs one transform from the inner state and one
+   from the outer state; the padding of both messages is the same and
+   thus set up only once.  If a multi-buffer implementation is
+   available, full groups of blocks are processed in its lanes.  */
+void
+_gcry_hash_pbkdf2_iterate (const md_pbkdf2_spec_t *spec,
+                           const void *inner, const void *outer,
+                           unsigned char *u, unsigned char *t,
+                           size_t n, unsigned long count)
+{
+  u64 context[MD_PBKDF2_MAX_CONTEXTSIZE / 8];
+  unsigned char block[MD_PBKDF2_MAX_BLOCKSIZE];
+  unsigned char digest[64];
+  size_t dlen = spec->digestlen;
+  unsigned long iter;
+  unsigned int burn = 0;
+
+  gcry_assert (spec->blocksize <= sizeof block
+               && spec->contextsize <= sizeof context
+               && dlen <= sizeof digest
+               && dlen + 1 + spec->lenbytes <= spec->blocksize);
+
+#ifdef USE_MD_BATCH
+  if (spec->batch && n >= (size_t)spec->batch->lanes)
+    {
+      const md_batch_spec_t *bspec = spec->batch;
+      u64 state[MD_BATCH_MAX_STATESIZE / 8] __attribute__ ((aligned (32)));
+      u64 istate[MD_BATCH_MAX_STATESIZE / 8] __attribute__ ((aligned (32)));
+      u64 ostate[MD_BATCH_MAX_STATESIZE / 8] __attribute__ ((aligned (32)));
+      unsigned char lblock[MD_BATCH_MAX_LANES][MD_BATCH_MAX_BLOCKSIZE];
+      const unsigned char *blocks[MD_BATCH_MAX_LANES];
+      int i, lanes = bspec->lanes;
+
+      gcry_assert (lanes <= MD_BATCH_MAX_LANES
+                   && bspec->blocksize == spec->blocksize
+                   && bspec->statesize <= sizeof state);
+
+      for (i = 0; i < lanes; i++)
+        {
+          bspec->set_lane (istate, i, inner);
+          bspec->set_lane (ostate, i, outer);
+          pbkdf2_pad_block (spec, lblock[i]);
+          blocks[i] = lblock[i];
+        }
+
+      for (; n >= (size_t)lanes;
+           n -= lanes, u += lanes * dlen, t += lanes * dlen)
+        {
+          for (i = 0; i < lanes; i++)
+            memcpy (lblock[i], u + i * dlen, dlen);
+          for (iter = 0; iter < count; iter++)
+            {
+              memcpy (state, istate, bspec->statesize);
+              bspec->transform (state, blocks);
+              for (i = 0; i < lanes; i++)
+                bspec->read_lane (state, i, lblock[i]);
+              memcpy (state, ostate, bspec->statesize);
+              bspec->transform (state, blocks);
+              for (i = 0; i < lanes; i++)
+                {
+                  bspec->read_lane (state, i, lblock[i]);
+                  buf_xor (t + i * dlen, t + i * dlen, lblock[i], dlen);
+                }
+            }
+          for (i = 0; i < lanes; i++)
+            memcpy (u + i * dlen, lblock[i], dlen);
+        }
+
+      wipememory (state, sizeof state);
+      wipememory (istate, sizeof istate);
+      wipememory (ostate, sizeof ostate);
+      wipememory (lblock, sizeof lblock);
+    }
+#endif /*USE_MD_BATCH*/
+
+  pbkdf2_pad_block (spec, block);
+  for (; n; n--, u += dlen, t += dlen)
+    {
+      memcpy (block, u, dlen);
+      for (iter = 0; iter < count; iter++)
+        {
+          memcpy (context, inner, spec->contextsize);
+          burn = spec->transform (context, block);
+          spec->read (context, digest);
+          memcpy (block, digest, dlen);
+          memcpy (context, outer, spec->contextsize);
+          spec->transform (context, block);
+          spec->read (context, digest);
+          memcpy (block, digest, dlen);
+          buf_xor (t, t, digest, dlen);
+        }
+      memcpy (u, block, dlen);
+    }
+
+  wipememory (context, sizeof context);
+  wipememory (block, sizeof block);
+  wipememory (digest, sizeof digest);
+  if (burn)
+    _gcry_burn_stack (burn);
+}
@@ -27,6 +27,157 @@ const char * _gcry_hash_selftest_check_one
               const void *expect, size_t expectlen);
 
 
+/* The multi-buffer code hashes several independent messages in
+   parallel lanes.  It is written using the vector extensions of GCC
+   which are lowered to the best SIMD instructions available for the
+   target.  */
+#undef USE_MD_BATCH
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+# define USE_MD_BATCH 1
+#endif
+
+#ifdef USE_MD_BATCH
+
+/* Limits for all multi-buffer implementations.  */
+#define MD_BATCH_MAX_LANES      8
+#define MD_BATCH_MAX_BLOCKSIZE  128
+#define MD_BATCH_MAX_STATESIZE  256
+
+/* Description of a multi-buffer implementation of a hash algorithm.
+   The state of all lanes is kept in one 32 byte aligned buffer of
+   STATESIZE bytes whose layout is private to the implementation.  */
+typedef struct md_batch_spec
+{
+  int lanes;           /* Number of messages hashed in parallel.  */
+  size_t blocksize;    /* Size of a block in bytes.  */
+  size_t lenbytes;     /* Size of the bit count in the padding.  */
+  size_t statesize;    /* Size of the state of all lanes.  */
+  /* Set the state of LANE to the initial value.  */
+  void (*init_lane) (void *state, int lane);
+  /* Set the state of LANE to the chaining value of the hash CONTEXT
+     of the scalar implementation.  */
+  void (*set_lane) (void *state, int lane, const void *context);
+  /* Process one block for each lane; BLOCKS has LANES entries.  */
+  void (*transform) (void *state, const unsigned char **blocks);
+  /* Store the digest of LANE at DIGEST.  */
+  void (*read_lane) (void *state, int lane, unsigned char *digest);
+} md_batch_spec_t;
+
+void _gcry_md_batch_process (const md_batch_spec_t *spec,
+                             const gcry_md_batch_item_t *items,
+                             size_t nitems);
+
+#endif /*USE_MD_BATCH*/
+
+
+/* The iterations of PBKDF2 hash messages of exactly one block plus
+   one digest, each starting from one of the two saved HMAC states.
+   This describes the compression function of an algorithm so that
+   they can be run without the buffering and padding of the generic
+   hash interface.  */
+#define MD_PBKDF2_MAX_BLOCKSIZE    128
+#define MD_PBKDF2_MAX_CONTEXTSIZE  256
+
+typedef struct md_pbkdf2_spec
+{
+  size_t blocksize;    /* Size of a block in bytes.  */
+  size_t lenbytes;     /* Size of the bit count in the padding.  */
+  size_t digestlen;    /* Length of the digest in bytes.  */
+  size_t contextsize;  /* Size of the context of the algorithm.  */
+  /* Process one block with CONTEXT.  Returns the number of bytes of
+     stack to burn.  */
+  unsigned int (*transform) (void *context, const unsigned char *block);
+  /* Store the untruncated chaining value of CONTEXT at DIGEST.  */
+  void (*read) (void *context, unsigned char *digest);
+  /* The multi-buffer implementation or NULL.  */
+  const struct md_batch_spec *batch;
+} md_pbkdf2_spec_t;
+
+void _gcry_hash_pbkdf2_iterate (const md_pbkdf2_spec_t *spec,
+                                const void *inner, const void *outer,
+                                unsigned char *u, unsigned char *t,
+                                size_t n, unsigned long count);
+
+
+/* On x86-64 the SHA-256 transform computes the message schedule of
+   8 consecutive blocks at once using SSSE3, AVX or AVX2
+   instructions.  All variants are compiled from the same C code by
+   means of the vector extensions and the target attribute of GCC.  */
+#undef USE_SHA_SSSE3
+#undef USE_SHA_AVX
+#undef USE_SHA_AVX2
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# ifdef ENABLE_SSSE3_SUPPORT
+#  define USE_SHA_SSSE3 1
+# endif
+# ifdef ENABLE_AVX_SUPPORT
+#  define USE_SHA_AVX 1
+# endif
+# ifdef ENABLE_AVX2_SUPPORT
+#  define USE_SHA_AVX2 1
+# endif
+#endif
+
+#if defined(USE_SHA_SSSE3) || defined(USE_SHA_AVX) || defined(USE_SHA_AVX2)
+#define USE_SHA_SIMD 1
+#define SHA_SIMD_LANES 8
+
+typedef u32 sha_simd_vec_t __attribute__ ((vector_size (4 * SHA_SIMD_LANES)));
+
+/* Load the 16 big endian words of each of the 8 consecutive 64 byte
+   blocks at DATA into W, so that lane J of W[I] is word I of block J.
+   This is inlined into the functions compiled for a specific
+   target.  */
+static inline __attribute__ ((always_inline)) void
+sha_simd_load_blocks (sha_simd_vec_t *w, const unsigned char *data)
+{
+  typedef u32 vec4_t __attribute__ ((vector_size (16)));
+  typedef unsigned char bytes_t __attribute__ ((vector_size (16)));
+  const bytes_t bswap = { 3, 2, 1, 0, 7, 6, 5, 4,
+                          11, 10, 9, 8, 15, 14, 13, 12 };
+  const vec4_t lo32 = { 0, 4, 1, 5 };
+  const vec4_t hi32 = { 2, 6, 3, 7 };
+  const vec4_t lo64 = { 0, 1, 4, 5 };
+  const vec4_t hi64 = { 2, 3, 6, 7 };
+  bytes_t x;
+  vec4_t v[SHA_SIMD_LANES], t0, t1, t2, t3;
+  int i, j;
+
+  for (i = 0; i < 16; i += 4)
+    {
+      /* Load 4 words of each block and convert them to host order.  */
+      for (j = 0; j < SHA_SIMD_LANES; j++)
+        {
+          memcpy (&x, data + 64 * j + 4 * i, 16);
+          v[j] = (vec4_t)__builtin_shuffle (x, bswap);
+        }
+
+      /* Transpose the 4x4 matrices of blocks 0 to 3 and 4 to 7.  */
+      for (j = 0; j < SHA_SIMD_LANES; j += 4)
+        {
+          t0 = __builtin_shuffle (v[j], v[j+1], lo32);
+          t1 = __builtin_shuffle (v[j], v[j+1], hi32);
+          t2 = __builtin_shuffle (v[j+2], v[j+3], lo32);
+          t3 = __builtin_shuffle (v[j+2], v[j+3], hi32);
+          v[j]   = __builtin_shuffle (t0, t2, lo64);
+          v[j+1] = __builtin_shuffle (t0, t2, hi64);
+          v[j+2] = __builtin_shuffle (t1, t3, lo64);
+          v[j+3] = __builtin_shuffle (t1, t3, hi64);
+        }
+
+      for (j = 0; j < 4; j++)
+        {
+          memcpy ((u32 *)&w[i + j], &v[j], 16);
+          memcpy ((u32 *)&w[i + j] + 4, &v[4 + j], 16);
+        }
+    }
+}
+#endif /*USE_SHA_SIMD*/
+
+
+
 
 
 
@@ -126,17 +126,16 @@ pkdf2 (const void *passphrase, size_t passphraselen,
   gcry_md_hd_t md;
   int secmode;
   unsigned int dklen = keysize;
-  char *dk = keybuffer;
   unsigned int hlen;   /* Output length of the digest function.  */
   unsigned int l;      /* Rounded up number of blocks.  */
-  unsigned int r;      /* Number of octets in the last block.  */
-  char *sbuf;          /* Malloced buffer to concatenate salt and iter
+  size_t sbuflen;      /* Allocated length of SBUF.  */
+  unsigned char *sbuf; /* Malloced buffer to concatenate salt and iter
                           as well as space to hold TBUF and UBUF.  */
-  char *tbuf;          /* Buffer for T; ptr into SBUF, size is HLEN. */
-  char *ubuf;          /* Buffer for U; ptr into SBUF, size is HLEN. */
+  unsigned char *tbuf; /* Buffer for all T; ptr into SBUF, size is
+                          L * HLEN. */
+  unsigned char *ubuf; /* Buffer for all U; ptr into SBUF, size is
+                          L * HLEN. */
   unsigned int lidx;   /* Current block number.  */
-  unsigned long iter;  /* Current iteration number.  */
-  unsigned int i;
 
   if (!salt || !saltlen || !iterations || !dklen)
     return GPG_ERR_INV_VALUE;
@@ -152,16 +151,16 @@ pkdf2 (const void *passphrase, size_t passphraselen,
 
   /* Step 2 */
   l = ((dklen - 1)/ hlen) + 1;
-  r = dklen - (l - 1) * hlen;
 
   /* Setup buffers and prepare a hash context.  */
+  sbuflen = saltlen + 4 + 2 * (size_t)l * hlen;
   sbuf = (secmode
-          ? gcry_malloc_secure (saltlen + 4 + hlen + hlen)
-          : gcry_malloc (saltlen + 4 + hlen + hlen));
+          ? gcry_malloc_secure (sbuflen)
+          : gcry_malloc (sbuflen));
   if (!sbuf)
     return gpg_err_code_from_syserror ();
-  tbuf = sbuf + saltlen + 4;
-  ubuf = tbuf + hlen;
+  ubuf = sbuf + saltlen + 4;
+  tbuf = ubuf + l * hlen;
 
   ec = gpg_err_code (gcry_md_open (&md, hashalgo,
                                    (GCRY_MD_FLAG_HMAC
@@ -172,49 +171,39 @@ pkdf2 (const void *passphrase, size_t passphraselen,
       return ec;
     }
 
-  /* Step 3 and 4. */
+  /* The key is the same for all iterations; setting it once computes
+     the HMAC states which are then reused by each iteration.  */
+  ec = gpg_err_code (gcry_md_setkey (md, passphrase, passphraselen));
+  if (ec)
+    goto leave;
+
+  /* Step 3 and 4.  Compute U_1 of all blocks, then run the remaining
+     iterations of all blocks at once; the blocks are independent and
+     may thus be processed in parallel.  This is done in the SIMD
+     lanes of the calling thread: helper threads are only started on
+     request for the key generation (GCRYCTL_SET_KEYGEN_THREADS).  */
   memcpy (sbuf, salt, saltlen);
   for (lidx = 1; lidx <= l; lidx++)
     {
-      for (iter = 0; iter < iterations; iter++)
-        {
-          ec = gpg_err_code (gcry_md_setkey (md, passphrase, passphraselen));
-          if (ec)
-            {
-              gcry_md_close (md);
-              gcry_free (sbuf);
-              return ec;
-            }
-          if (!iter) /* Compute U_1:  */
-            {
-              sbuf[saltlen]     = (lidx >> 24);
-              sbuf[saltlen + 1] = (lidx >> 16);
-              sbuf[saltlen + 2] = (lidx >> 8);
-              sbuf[saltlen + 3] = lidx;
-              gcry_md_write (md, sbuf, saltlen + 4);
-              memcpy (ubuf, gcry_md_read (md, 0), hlen);
-              memcpy (tbuf, ubuf, hlen);
-            }
-          else /* Compute U_(2..c):  */
-            {
-              gcry_md_write (md, ubuf, hlen);
-              memcpy (ubuf, gcry_md_read (md, 0), hlen);
-              for (i=0; i < hlen; i++)
-                tbuf[i] ^= ubuf[i];
-            }
-        }
-      if (lidx == l)  /* Last block.  */
-        memcpy (dk, tbuf, r);
-      else
-        {
-          memcpy (dk, tbuf, hlen);
-          dk += hlen;
-        }
+      gcry_md_reset (md);
+      sbuf[saltlen]     = (lidx >> 24);
+      sbuf[saltlen + 1] = (lidx >> 16);
+      sbuf[saltlen + 2] = (lidx >> 8);
+      sbuf[saltlen + 3] = lidx;
+      gcry_md_write (md, sbuf, saltlen + 4);
+      memcpy (ubuf + (lidx - 1) * hlen, gcry_md_read (md, 0), hlen);
     }
+  memcpy (tbuf, ubuf, l * hlen);
+
+  ec = _gcry_md_pbkdf2_iterate (md, ubuf, tbuf, l, iterations - 1);
+  if (!ec)
+    memcpy (keybuffer, tbuf, dklen);
 
+ leave:
   gcry_md_close (md);
+  wipememory (sbuf, sbuflen);
   gcry_free (sbuf);
-  return 0;
+  return ec;
 }
 
 
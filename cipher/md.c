@@ -30,6 +30,9 @@
 
 #include "rmd.h"
 
+/* The largest digest length of all algorithms.  */
+#define MD_MAX_DIGEST_LEN 64
+
 /* A dummy extraspec so that we do not need to tests the extraspec
    field from the module specification against NULL and instead
    directly test the respective fields of extraspecs.  */
@@ -105,6 +108,16 @@ static gcry_module_t digests_registered;
 /* This is the lock protecting DIGESTS_REGISTERED.  */
 static ath_mutex_t digests_registered_lock = ATH_MUTEX_INITIALIZER;
 
+/* The lookup index of the default digests.  It is set once after the
+   default digests have been registered and may then be used without
+   holding DIGESTS_REGISTERED_LOCK.  */
+static gcry_module_index_t volatile digests_index;
+
+/* Set once a module has been added with _gcry_md_register.  Until
+   then a miss in DIGESTS_INDEX means that the algorithm is not known at
+   all and the list does not need to be searched.  */
+static int volatile digests_user_registered;
+
 /* Flag to check whether the default ciphers have already been
    registered.  */
 static int default_digests_registered;
@@ -128,10 +141,25 @@ struct gcry_md_context
   FILE  *debug;
   int finalized;
   GcryDigestEntry *list;
-  byte *macpads;
-  int macpads_Bsize;             /* Blocksize as used for the HMAC pads. */
+  int hmac;                      /* This is an HMAC handle.  */
+  int hmac_keyed;                /* The HMAC states have been computed.  */
 };
 
+/* Round N up to a multiple of the alignment of the digest contexts.  */
+#define MD_ALIGN(n) ((((n) + sizeof (PROPERLY_ALIGNED_TYPE) - 1)  \
+                      / sizeof (PROPERLY_ALIGNED_TYPE))             \
+                     * sizeof (PROPERLY_ALIGNED_TYPE))
+
+/* In HMAC handles each list entry has room for two more contexts
+   after its working context: the state after hashing the inner pad
+   and the state after hashing the outer pad.  They are computed by
+   gcry_md_setkey and copied into the working context by
+   gcry_md_reset and md_final.  */
+#define HMAC_INNER(r) ((void *)((char *)&(r)->context.c            \
+                                + MD_ALIGN ((r)->digest->contextsize)))
+#define HMAC_OUTER(r) ((void *)((char *)&(r)->context.c            \
+                                + 2 * MD_ALIGN ((r)->digest->contextsize)))
+
 
 #define CTX_MAGIC_NORMAL 0x11071961
 #define CTX_MAGIC_SECURE 0x16917011
@@ -170,12 +198,33 @@ static void md_stop_debug ( gcry_md_hd_t a );
 
 
 
+/* Internal callback function.  Used via _gcry_module_index_new.  */
+static const char *
+md_name_func (void *spec, int idx)
+{
+  return idx? NULL : ((gcry_md_spec_t *) spec)->name;
+}
+
+/* Internal callback function.  Used via _gcry_module_index_new.  */
+static const char *
+md_oid_func (void *spec, int idx)
+{
+  gcry_md_spec_t *digest = spec;
+  int i;
+
+  for (i = 0; digest->oids && digest->oids[i].oidstring; i++)
+    if (i == idx)
+      return digest->oids[i].oidstring;
+  return NULL;
+}
+
 /* Internal function.  Register all the ciphers included in
    CIPHER_TABLE.  Returns zero on success or an error code.  */
 static void
 md_register_default (void)
 {
   gcry_err_code_t err = 0;
+  gcry_module_index_t index;
   int i;
 
   for (i = 0; !err && digest_table[i].digest; i++)
@@ -198,6 +247,11 @@ md_register_default (void)
 
   if (err)
     BUG ();
+
+  index = _gcry_module_index_new (digests_registered,
+                                  md_name_func, md_oid_func);
+  if (index)
+    _gcry_module_index_publish (&digests_index, index);
 }
 
 /* Internal callback function.  */
@@ -253,6 +307,57 @@ gcry_md_lookup_oid (const char *oid)
   return digest;
 }
 
+/* Internal function.  Return the module of the digest ALGORITHM with
+   its use counter incremented or NULL if it is not known.  The default
+   digests are served from the lookup index without taking the lock.
+   The module needs to be released with md_module_put.  */
+static gcry_module_t
+md_module_get (int algorithm)
+{
+  gcry_module_index_t index = digests_index;
+  gcry_module_t digest;
+
+  if (index)
+    {
+      digest = _gcry_module_index_lookup_id (index, algorithm);
+      if (digest || ! digests_user_registered)
+        return digest;
+    }
+  else
+    REGISTER_DEFAULT_DIGESTS;
+
+  ath_mutex_lock (&digests_registered_lock);
+  digest = _gcry_module_lookup_id (digests_registered, algorithm);
+  ath_mutex_unlock (&digests_registered_lock);
+
+  return digest;
+}
+
+/* Internal function.  Add a reference to a module returned by
+   md_module_get.  */
+static void
+md_module_use (gcry_module_t digest)
+{
+  if (! (digest->flags & FLAG_MODULE_STATIC))
+    {
+      ath_mutex_lock (&digests_registered_lock);
+      _gcry_module_use (digest);
+      ath_mutex_unlock (&digests_registered_lock);
+    }
+}
+
+/* Internal function.  Release a module returned by md_module_get.  */
+static void
+md_module_put (gcry_module_t digest)
+{
+  if (digest && ! (digest->flags & FLAG_MODULE_STATIC))
+    {
+      ath_mutex_lock (&digests_registered_lock);
+      _gcry_module_release (digest);
+      ath_mutex_unlock (&digests_registered_lock);
+    }
+}
+
 /* Register a new digest module whose specification can be found in
    DIGEST.  On success, a new algorithm ID is stored in ALGORITHM_ID
    and a pointer representhing this module is stored in MODULE.  */
@@ -269,11 +374,16 @@ _gcry_md_register (gcry_md_spec_t *digest,
   if (fips_mode ())
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
+  /* Make sure that only the default digests are marked static.  */
+  REGISTER_DEFAULT_DIGESTS;
+
   ath_mutex_lock (&digests_registered_lock);
   err = _gcry_module_add (&digests_registered, 0,
 			  (void *) digest,
 			  (void *)(extraspec? extraspec : &dummy_extra_spec),
                           &mod);
+  if (! err)
+    digests_user_registered = 1;
   ath_mutex_unlock (&digests_registered_lock);
 
   if (! err)
@@ -299,14 +409,22 @@ gcry_md_unregister (gcry_module_t module)
 static int
 search_oid (const char *oid, int *algorithm, gcry_md_oid_spec_t *oid_spec)
 {
-  gcry_module_t module;
+  gcry_module_index_t index = digests_index;
+  gcry_module_t module = NULL;
   int ret = 0;
 
   if (oid && ((! strncmp (oid, "oid.", 4))
 	      || (! strncmp (oid, "OID.", 4))))
     oid += 4;
 
-  module = gcry_md_lookup_oid (oid);
+  if (index)
+    module = _gcry_module_index_lookup_oid (index, oid);
+  if (! module && (! index || digests_user_registered))
+    {
+      ath_mutex_lock (&digests_registered_lock);
+      module = gcry_md_lookup_oid (oid);
+      ath_mutex_unlock (&digests_registered_lock);
+    }
   if (module)
     {
       gcry_md_spec_t *digest = module->spec;
@@ -321,7 +439,7 @@ search_oid (const char *oid, int *algorithm, gcry_md_oid_spec_t *oid_spec)
 	      *oid_spec = digest->oids[i];
 	    ret = 1;
 	  }
-      _gcry_module_release (module);
+      md_module_put (module);
     }
 
   return ret;
@@ -333,32 +451,39 @@ search_oid (const char *oid, int *algorithm, gcry_md_oid_spec_t *oid_spec)
 int
 gcry_md_map_name (const char *string)
 {
-  gcry_module_t digest;
+  gcry_module_index_t index;
+  gcry_module_t digest = NULL;
   int ret, algorithm = 0;
 
   if (! string)
     return 0;
 
-  REGISTER_DEFAULT_DIGESTS;
+  index = digests_index;
+  if (! index)
+    REGISTER_DEFAULT_DIGESTS;
 
   /* If the string starts with a digit (optionally prefixed with
      either "OID." or "oid."), we first look into our table of ASN.1
      object identifiers to figure out the algorithm */
 
-  ath_mutex_lock (&digests_registered_lock);
-
   ret = search_oid (string, &algorithm, NULL);
   if (! ret)
     {
       /* Not found, search a matching digest name.  */
-      digest = gcry_md_lookup_name (string);
+      if (index)
+        digest = _gcry_module_index_lookup_name (index, string);
+      if (! digest && (! index || digests_user_registered))
+        {
+          ath_mutex_lock (&digests_registered_lock);
+          digest = gcry_md_lookup_name (string);
+          ath_mutex_unlock (&digests_registered_lock);
+        }
       if (digest)
 	{
 	  algorithm = digest->mod_id;
-	  _gcry_module_release (digest);
+	  md_module_put (digest);
 	}
     }
-  ath_mutex_unlock (&digests_registered_lock);
 
   return algorithm;
 }
@@ -373,16 +498,12 @@ digest_algo_to_string (int algorithm)
   const char *name = NULL;
   gcry_module_t digest;
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  digest = _gcry_module_lookup_id (digests_registered, algorithm);
+  digest = md_module_get (algorithm);
   if (digest)
     {
       name = ((gcry_md_spec_t *) digest->spec)->name;
-      _gcry_module_release (digest);
+      md_module_put (digest);
     }
-  ath_mutex_unlock (&digests_registered_lock);
 
   return name;
 }
@@ -407,15 +528,11 @@ check_digest_algo (int algorithm)
   gcry_err_code_t rc = 0;
   gcry_module_t digest;
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  digest = _gcry_module_lookup_id (digests_registered, algorithm);
+  digest = md_module_get (algorithm);
   if (digest)
-    _gcry_module_release (digest);
+    md_module_put (digest);
   else
     rc = GPG_ERR_DIGEST_ALGO;
-  ath_mutex_unlock (&digests_registered_lock);
 
   return rc;
 }
@@ -475,26 +592,7 @@ md_open (gcry_md_hd_t *h, int algo, int secure, int hmac)
       ctx->magic = secure ? CTX_MAGIC_SECURE : CTX_MAGIC_NORMAL;
       ctx->actual_handle_size = n + sizeof (struct gcry_md_context);
       ctx->secure = secure;
-
-      if (hmac)
-	{
-	  switch (algo)
-            {
-              case GCRY_MD_SHA384:
-              case GCRY_MD_SHA512:
-                ctx->macpads_Bsize = 128;
-                break;
-              default:
-                ctx->macpads_Bsize = 64;
-                break;
-            }
-          ctx->macpads = gcry_malloc_secure (2*(ctx->macpads_Bsize));
-	  if (!ctx->macpads)
-	    {
-	      err = gpg_err_code_from_errno (errno);
-	      md_close (hd);
-	    }
-	}
+      ctx->hmac = !!hmac;
     }
 
   if (! err)
@@ -554,11 +652,7 @@ md_enable (gcry_md_hd_t hd, int algorithm)
     if (entry->module->mod_id == algorithm)
       return err; /* already enabled */
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  module = _gcry_module_lookup_id (digests_registered, algorithm);
-  ath_mutex_unlock (&digests_registered_lock);
+  module = md_module_get (algorithm);
   if (! module)
     {
       log_debug ("md_enable: algorithm %d not available\n", algorithm);
@@ -579,12 +673,20 @@ md_enable (gcry_md_hd_t hd, int algorithm)
         }
     }
 
+  /* The HMAC states of a new algorithm can't be computed without the
+     key.  */
+  if (!err && h->hmac_keyed)
+    err = GPG_ERR_CONFLICT;
+
   if (!err)
     {
       size_t size = (sizeof (*entry)
                      + digest->contextsize
                      - sizeof (entry->context));
 
+      if (h->hmac)
+        size += 2 * MD_ALIGN (digest->contextsize);
+
       /* And allocate a new list entry. */
       if (h->secure)
 	entry = gcry_malloc_secure (size);
@@ -609,11 +711,7 @@ md_enable (gcry_md_hd_t hd, int algorithm)
   if (err)
     {
       if (module)
-	{
-	   ath_mutex_lock (&digests_registered_lock);
-	   _gcry_module_release (module);
-	   ath_mutex_unlock (&digests_registered_lock);
-	}
+        md_module_put (module);
     }
 
   return err;
@@ -659,17 +757,6 @@ md_copy (gcry_md_hd_t ahd, gcry_md_hd_t *b_hd)
       memcpy (b, a, sizeof *a);
       b->list = NULL;
       b->debug = NULL;
-      if (a->macpads)
-	{
-	  b->macpads = gcry_malloc_secure (2*(a->macpads_Bsize));
-	  if (! b->macpads)
-	    {
-	      err = gpg_err_code_from_errno (errno);
-	      md_close (bhd);
-	    }
-	  else
-	    memcpy (b->macpads, a->macpads, (2*(a->macpads_Bsize)));
-	}
     }
 
   /* Copy the complete list of algorithms.  The copied list is
@@ -679,13 +766,9 @@ md_copy (gcry_md_hd_t ahd, gcry_md_hd_t *b_hd)
       for (ar = a->list; ar; ar = ar->next)
         {
           if (a->secure)
-            br = gcry_malloc_secure (sizeof *br
-                                     + ar->digest->contextsize
-                                     - sizeof(ar->context));
+            br = gcry_malloc_secure (ar->actual_struct_size);
           else
-            br = gcry_malloc (sizeof *br
-                              + ar->digest->contextsize
-                              - sizeof (ar->context));
+            br = gcry_malloc (ar->actual_struct_size);
           if (!br)
             {
 	      err = gpg_err_code_from_errno (errno);
@@ -693,15 +776,12 @@ md_copy (gcry_md_hd_t ahd, gcry_md_hd_t *b_hd)
               break;
             }
 
-          memcpy (br, ar, (sizeof (*br) + ar->digest->contextsize
-                           - sizeof (ar->context)));
+          memcpy (br, ar, ar->actual_struct_size);
           br->next = b->list;
           b->list = br;
 
           /* Add a reference to the module.  */
-          ath_mutex_lock (&digests_registered_lock);
-          _gcry_module_use (br->module);
-          ath_mutex_unlock (&digests_registered_lock);
+          md_module_use (br->module);
         }
     }
 
@@ -740,11 +820,14 @@ gcry_md_reset (gcry_md_hd_t a)
 
   for (r = a->ctx->list; r; r = r->next)
     {
-      memset (r->context.c, 0, r->digest->contextsize);
-      (*r->digest->init) (&r->context.c);
+      if (a->ctx->hmac_keyed)
+        memcpy (r->context.c, HMAC_INNER (r), r->digest->contextsize);
+      else
+        {
+          memset (r->context.c, 0, r->digest->contextsize);
+          (*r->digest->init) (&r->context.c);
+        }
     }
-  if (a->ctx->macpads)
-    md_write (a, a->ctx->macpads, a->ctx->macpads_Bsize); /* inner pad */
 }
 
 static void
@@ -759,19 +842,11 @@ md_close (gcry_md_hd_t a)
   for (r = a->ctx->list; r; r = r2)
     {
       r2 = r->next;
-      ath_mutex_lock (&digests_registered_lock);
-      _gcry_module_release (r->module);
-      ath_mutex_unlock (&digests_registered_lock);
+      md_module_put (r->module);
       wipememory (r, r->actual_struct_size);
       gcry_free (r);
     }
 
-  if (a->ctx->macpads)
-    {
-      wipememory (a->ctx->macpads, 2*(a->ctx->macpads_Bsize));
-      gcry_free(a->ctx->macpads);
-    }
-
   wipememory (a, a->ctx->actual_handle_size);
   gcry_free(a);
 }
@@ -823,65 +898,83 @@ md_final (gcry_md_hd_t a)
     md_write (a, NULL, 0);
 
   for (r = a->ctx->list; r; r = r->next)
-    (*r->digest->final) (&r->context.c);
-
-  a->ctx->finalized = 1;
-
-  if (a->ctx->macpads)
     {
-      /* Finish the hmac. */
-      int algo = md_get_algo (a);
-      byte *p = md_read (a, algo);
-      size_t dlen = md_digest_length (algo);
-      gcry_md_hd_t om;
-      gcry_err_code_t err = md_open (&om, algo, a->ctx->secure, 0);
+      (*r->digest->final) (&r->context.c);
 
-      if (err)
-	_gcry_fatal_error (err, NULL);
-      md_write (om,
-                (a->ctx->macpads)+(a->ctx->macpads_Bsize),
-                a->ctx->macpads_Bsize);
-      md_write (om, p, dlen);
-      md_final (om);
-      /* Replace our digest with the mac (they have the same size). */
-      memcpy (p, md_read (om, algo), dlen);
-      md_close (om);
+      if (a->ctx->hmac_keyed)
+        {
+          /* Finish the hmac by hashing the inner digest starting
+             with the saved outer state.  */
+          unsigned char inner[MD_MAX_DIGEST_LEN];
+          size_t dlen = r->digest->mdlen;
+
+          gcry_assert (dlen <= sizeof inner);
+          memcpy (inner, (*r->digest->read) (&r->context.c), dlen);
+          memcpy (r->context.c, HMAC_OUTER (r), r->digest->contextsize);
+          (*r->digest->write) (&r->context.c, inner, dlen);
+          (*r->digest->final) (&r->context.c);
+          wipememory (inner, dlen);
+        }
     }
+
+  a->ctx->finalized = 1;
 }
 
+/* Compute the inner and outer HMAC states of all enabled algorithms
+   for KEY of length KEYLEN.  */
 static gcry_err_code_t
 prepare_macpads (gcry_md_hd_t hd, const unsigned char *key, size_t keylen)
 {
-  int i;
-  int algo = md_get_algo (hd);
+  GcryDigestEntry *r;
+  unsigned char pad[128];
   unsigned char *helpkey = NULL;
-  unsigned char *ipad, *opad;
+  const unsigned char *k;
+  size_t klen, bsize, i;
+  int algo;
 
-  if (!algo)
+  if (!hd->ctx->list)
     return GPG_ERR_DIGEST_ALGO; /* Might happen if no algo is enabled.  */
 
-  if ( keylen > hd->ctx->macpads_Bsize )
+  for (r = hd->ctx->list; r; r = r->next)
     {
-      helpkey = gcry_malloc_secure (md_digest_length (algo));
-      if (!helpkey)
-        return gpg_err_code_from_errno (errno);
-      gcry_md_hash_buffer (algo, helpkey, key, keylen);
-      key = helpkey;
-      keylen = md_digest_length (algo);
-      gcry_assert ( keylen <= hd->ctx->macpads_Bsize );
-    }
+      algo = r->module->mod_id;
+      bsize = (algo == GCRY_MD_SHA384 || algo == GCRY_MD_SHA512)? 128 : 64;
+      k = key;
+      klen = keylen;
+      if (klen > bsize)
+        {
+          helpkey = gcry_malloc_secure (r->digest->mdlen);
+          if (!helpkey)
+            return gpg_err_code_from_errno (errno);
+          gcry_md_hash_buffer (algo, helpkey, key, keylen);
+          k = helpkey;
+          klen = r->digest->mdlen;
+          gcry_assert (klen <= bsize);
+        }
 
-  memset ( hd->ctx->macpads, 0, 2*(hd->ctx->macpads_Bsize) );
-  ipad = hd->ctx->macpads;
-  opad = (hd->ctx->macpads)+(hd->ctx->macpads_Bsize);
-  memcpy ( ipad, key, keylen );
-  memcpy ( opad, key, keylen );
-  for (i=0; i < hd->ctx->macpads_Bsize; i++ )
-    {
-      ipad[i] ^= 0x36;
-      opad[i] ^= 0x5c;
+      memset (pad, 0, bsize);
+      memcpy (pad, k, klen);
+      for (i=0; i < bsize; i++)
+        pad[i] ^= 0x36;
+      memset (HMAC_INNER (r), 0, r->digest->contextsize);
+      (*r->digest->init) (HMAC_INNER (r));
+      (*r->digest->write) (HMAC_INNER (r), pad, bsize);
+
+      for (i=0; i < bsize; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+      memset (HMAC_OUTER (r), 0, r->digest->contextsize);
+      (*r->digest->init) (HMAC_OUTER (r));
+      (*r->digest->write) (HMAC_OUTER (r), pad, bsize);
+
+      if (helpkey)
+        {
+          wipememory (helpkey, klen);
+          gcry_free (helpkey);
+          helpkey = NULL;
+        }
     }
-  gcry_free (helpkey);
+  wipememory (pad, sizeof pad);
+  hd->ctx->hmac_keyed = 1;
 
   return GPG_ERR_NO_ERROR;
 }
@@ -916,7 +1009,7 @@ gcry_md_setkey (gcry_md_hd_t hd, const void *key, size_t keylen)
 {
   gcry_err_code_t rc = GPG_ERR_NO_ERROR;
 
-  if (!hd->ctx->macpads)
+  if (!hd->ctx->hmac)
     rc = GPG_ERR_CONFLICT;
   else
     {
@@ -928,6 +1021,47 @@ gcry_md_setkey (gcry_md_hd_t hd, const void *key, size_t keylen)
   return gcry_error (rc);
 }
 
+/* Run COUNT further iterations of the PBKDF2 function F for N output
+   blocks using the key set into the HMAC handle HD, which must have
+   exactly one algorithm enabled.  U holds the N previous values U_i
+   and T the N sums of the U_i, each an array of N digests; both are
+   updated in place.  Algorithms providing a PBKDF2 hook run the
+   iterations on their compression function; for the others the
+   handle is used.  */
+gpg_err_code_t
+_gcry_md_pbkdf2_iterate (gcry_md_hd_t hd, unsigned char *u, unsigned char *t,
+                         size_t n, unsigned long count)
+{
+  GcryDigestEntry *r = hd->ctx->list;
+  md_extra_spec_t *extraspec;
+  size_t dlen, i;
+  unsigned long iter;
+
+  if (!r || r->next || !hd->ctx->hmac_keyed)
+    return GPG_ERR_INV_STATE;
+  dlen = r->digest->mdlen;
+
+  extraspec = r->module->extraspec;
+  if (extraspec && extraspec->pbkdf2_iterate && !hd->ctx->debug)
+    {
+      extraspec->pbkdf2_iterate (HMAC_INNER (r), HMAC_OUTER (r),
+                                 u, t, n, count);
+      return 0;
+    }
+
+  for (; n; n--, u += dlen, t += dlen)
+    for (iter = 0; iter < count; iter++)
+      {
+        gcry_md_reset (hd);
+        md_write (hd, u, dlen);
+        md_final (hd);
+        memcpy (u, r->digest->read (&r->context.c), dlen);
+        for (i=0; i < dlen; i++)
+          t[i] ^= u[i];
+      }
+  return 0;
+}
+
 /* The new debug interface.  If SUFFIX is a string it creates an debug
    file for the context HD.  IF suffix is NULL, the file is closed and
    debugging is stopped.  */
@@ -1045,6 +1179,41 @@ gcry_md_hash_buffer (int algo, void *digest,
     }
 }
 
+
+/* Hash the NITEMS messages described by ITEMS using the algorithm
+   ALGO.  If the algorithm provides a multi-buffer implementation, it
+   is used to process several of the messages in parallel; otherwise
+   each message is hashed on its own.  */
+gcry_error_t
+gcry_md_hash_batch (int algo, const gcry_md_batch_item_t *items,
+                    size_t nitems)
+{
+  gcry_module_t module;
+  md_extra_spec_t *extraspec;
+  gcry_err_code_t err = 0;
+  size_t n;
+
+  module = md_module_get (algo);
+  if (!module)
+    return gcry_error (GPG_ERR_DIGEST_ALGO);
+
+  extraspec = module->extraspec;
+  if ((module->flags & FLAG_MODULE_DISABLED))
+    err = GPG_ERR_DIGEST_ALGO;
+  else if (nitems > 1 && extraspec && extraspec->hash_batch)
+    extraspec->hash_batch (items, nitems);
+  else
+    {
+      for (n = 0; n < nitems; n++)
+        gcry_md_hash_buffer (algo, items[n].digest,
+                             items[n].buffer, items[n].length);
+    }
+
+  md_module_put (module);
+
+  return gcry_error (err);
+}
+
 static int
 md_get_algo (gcry_md_hd_t a)
 {
@@ -1074,16 +1243,12 @@ md_digest_length (int algorithm)
   gcry_module_t digest;
   int mdlen = 0;
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  digest = _gcry_module_lookup_id (digests_registered, algorithm);
+  digest = md_module_get (algorithm);
   if (digest)
     {
       mdlen = ((gcry_md_spec_t *) digest->spec)->mdlen;
-      _gcry_module_release (digest);
+      md_module_put (digest);
     }
-  ath_mutex_unlock (&digests_registered_lock);
 
   return mdlen;
 }
@@ -1107,10 +1272,7 @@ md_asn_oid (int algorithm, size_t *asnlen, size_t *mdlen)
   const byte *asnoid = NULL;
   gcry_module_t digest;
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  digest = _gcry_module_lookup_id (digests_registered, algorithm);
+  digest = md_module_get (algorithm);
   if (digest)
     {
       if (asnlen)
@@ -1118,11 +1280,10 @@ md_asn_oid (int algorithm, size_t *asnlen, size_t *mdlen)
       if (mdlen)
 	*mdlen = ((gcry_md_spec_t *) digest->spec)->mdlen;
       asnoid = ((gcry_md_spec_t *) digest->spec)->asnoid;
-      _gcry_module_release (digest);
+      md_module_put (digest);
     }
   else
     log_bug ("no ASN.1 OID for md algo %d\n", algorithm);
-  ath_mutex_unlock (&digests_registered_lock);
 
   return asnoid;
 }
@@ -1354,13 +1515,9 @@ _gcry_md_selftest (int algo, int extended, selftest_report_func_t report)
   cipher_extra_spec_t *extraspec = NULL;
   gcry_err_code_t ec = 0;
 
-  REGISTER_DEFAULT_DIGESTS;
-
-  ath_mutex_lock (&digests_registered_lock);
-  module = _gcry_module_lookup_id (digests_registered, algo);
+  module = md_module_get (algo);
   if (module && !(module->flags & FLAG_MODULE_DISABLED))
     extraspec = module->extraspec;
-  ath_mutex_unlock (&digests_registered_lock);
   if (extraspec && extraspec->selftest)
     ec = extraspec->selftest (algo, extended, report);
   else
@@ -1373,11 +1530,6 @@ _gcry_md_selftest (int algo, int extended, selftest_report_func_t report)
                 module? "algorithm disabled" : "algorithm not found");
     }
 
-  if (module)
-    {
-      ath_mutex_lock (&digests_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&digests_registered_lock);
-    }
+  md_module_put (module);
   return gpg_error (ec);
 }
@@ -25,6 +25,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# include <unistd.h>
+#endif
 
 #include "g10lib.h"
 #include "mpi.h"
@@ -35,9 +40,16 @@ static gcry_mpi_t gen_prime (unsigned int nbits, int secret, int randomlevel,
                              int (*extra_check)(void *, gcry_mpi_t),
                              void *extra_check_arg);
 static int check_prime( gcry_mpi_t prime, gcry_mpi_t val_2, int rm_rounds,
-                        gcry_prime_check_func_t cb_func, void *cb_arg );
-static int is_prime (gcry_mpi_t n, int steps, unsigned int *count);
+                        gcry_prime_check_func_t cb_func, void *cb_arg,
+                        int quiet );
+static int is_prime (gcry_mpi_t n, int steps, unsigned int *count, int quiet);
 static void m_out_of_n( char *array, int m, int n );
+static gcry_err_code_t prime_generate_internal
+                 (int need_q_factor, gcry_mpi_t *prime_generated,
+                  unsigned int pbits, unsigned int qbits, gcry_mpi_t g,
+                  gcry_mpi_t **ret_factors, gcry_random_level_t randomlevel,
+                  unsigned int flags, int all_factors,
+                  gcry_prime_check_func_t cb_func, void *cb_arg);
 
 static void (*progress_cb) (void *,const char*,int,int, int );
 static void *progress_cb_data;
@@ -126,7 +138,206 @@ static ushort small_prime_numbers[] = {
     4957, 4967, 4969, 4973, 4987, 4993, 4999,
     0
 };
-static int no_of_small_prime_numbers = DIM (small_prime_numbers) - 1;
+
+
+/* gen_prime takes its candidates from an interval of SIEVE_BYTES*8
+   consecutive odd numbers kept as a bitmap.  The multiples of 3, 5
+   and 7 are removed by copying a precomputed wheel of 3*5*7 odd
+   numbers (8 copies of it fill WHEEL_BYTES bytes); the multiples of
+   the other primes below SIEVE_PRIME_LIMIT are sieved out.  */
+#define SIEVE_PRIME_LIMIT  65536
+#define WHEEL_BYTES        105
+#define SIEVE_BYTES        (12 * WHEEL_BYTES)
+#define SIEVE_MAX_DEPTH    32
+
+/* The primes from 11 to SIEVE_PRIME_LIMIT and a product tree over
+   them.  The leaves of the tree are the products of runs of
+   consecutive primes which fit into an unsigned long; the remainders
+   of a candidate modulo all the primes are computed by descending
+   the tree, which does most of the work with multi-limb divisions
+   instead of one single-limb division per prime.  The table is built
+   on first use and never released.  */
+static struct
+{
+  int initialized;
+  unsigned short *primes;
+  int nprimes;
+  unsigned long *leaves;
+  int *leaf_start;      /* Index of the first prime of each leaf; the
+                           last one of the NLEAVES+1 items is NPRIMES. */
+  int nleaves;
+  int depth;            /* Number of levels above the leaves.  */
+  gcry_mpi_t *nodes[SIEVE_MAX_DEPTH]; /* NODES[0] are the products of
+                                         two leaves, the only item of
+                                         NODES[DEPTH-1] is the root.  */
+  int nnodes[SIEVE_MAX_DEPTH];
+  char wheel[WHEEL_BYTES]; /* True if 2*I+1 is coprime to 3*5*7.  */
+} sieve;
+/* Mutex used to protect the initialization of SIEVE.  */
+static ath_mutex_t sieve_lock = ATH_MUTEX_INITIALIZER;
+
+
+/* Build the table of sieving primes.  Needs to be called while
+   sieve_lock is being held.  */
+static void
+sieve_init (void)
+{
+  char *composite;
+  unsigned int i, j;
+  int n, level;
+  unsigned long prod;
+
+  /* Sieve of Eratosthenes; item I stands for 2*I+1.  */
+  composite = gcry_xcalloc (SIEVE_PRIME_LIMIT / 2, 1);
+  for (i = 1; (2*i+1) * (2*i+1) < SIEVE_PRIME_LIMIT; i++)
+    if (!composite[i])
+      for (j = (2*i+1) * (2*i+1) / 2; j < SIEVE_PRIME_LIMIT / 2; j += 2*i+1)
+        composite[j] = 1;
+
+  for (n = 0, i = 5; i < SIEVE_PRIME_LIMIT / 2; i++)
+    if (!composite[i])
+      n++;
+  sieve.primes = gcry_xmalloc (n * sizeof *sieve.primes);
+  for (n = 0, i = 5; i < SIEVE_PRIME_LIMIT / 2; i++)
+    if (!composite[i])
+      sieve.primes[n++] = 2*i+1;
+  sieve.nprimes = n;
+  gcry_free (composite);
+
+  /* The leaves.  Each one holds at least one prime, thus NPRIMES
+     items are enough.  */
+  sieve.leaves = gcry_xmalloc (sieve.nprimes * sizeof *sieve.leaves);
+  sieve.leaf_start = gcry_xmalloc ((sieve.nprimes + 1)
+                                   * sizeof *sieve.leaf_start);
+  for (n = 0, i = 0; i < sieve.nprimes; n++)
+    {
+      sieve.leaf_start[n] = i;
+      for (prod = 1; i < sieve.nprimes; i++)
+        {
+          if (prod > ULONG_MAX / sieve.primes[i])
+            break;
+          prod *= sieve.primes[i];
+        }
+      sieve.leaves[n] = prod;
+    }
+  sieve.leaf_start[n] = sieve.nprimes;
+  sieve.nleaves = n;
+  gcry_assert (sieve.nleaves > 1);
+
+  /* The levels of the tree above the leaves.  */
+  n = (sieve.nleaves + 1) / 2;
+  sieve.nodes[0] = gcry_xmalloc (n * sizeof (gcry_mpi_t));
+  sieve.nnodes[0] = n;
+  for (i = 0; i < n; i++)
+    {
+      sieve.nodes[0][i] = mpi_alloc_set_ui (sieve.leaves[2*i]);
+      if (2*i+1 < sieve.nleaves)
+        mpi_mul_ui (sieve.nodes[0][i], sieve.nodes[0][i],
+                    sieve.leaves[2*i+1]);
+    }
+  for (level = 1; sieve.nnodes[level-1] > 1; level++)
+    {
+      gcry_assert (level < SIEVE_MAX_DEPTH);
+      n = (sieve.nnodes[level-1] + 1) / 2;
+      sieve.nodes[level] = gcry_xmalloc (n * sizeof (gcry_mpi_t));
+      sieve.nnodes[level] = n;
+      for (i = 0; i < n; i++)
+        {
+          if (2*i+1 < sieve.nnodes[level-1])
+            {
+              sieve.nodes[level][i] = mpi_alloc (0);
+              mpi_mul (sieve.nodes[level][i], sieve.nodes[level-1][2*i],
+                       sieve.nodes[level-1][2*i+1]);
+            }
+          else
+            sieve.nodes[level][i] = mpi_copy (sieve.nodes[level-1][2*i]);
+        }
+    }
+  sieve.depth = level;
+
+  for (i = 0; i < WHEEL_BYTES; i++)
+    sieve.wheel[i] = ((2*i+1) % 3) && ((2*i+1) % 5) && ((2*i+1) % 7);
+
+  sieve.initialized = 1;
+}
+
+
+/* REM[LEVEL] holds a number modulo node IDX of LEVEL of the product
+   tree.  Store its remainders modulo the primes below that node at
+   RESIDUES.  REM[0] to REM[LEVEL-1] are used as scratch space.  */
+static void
+sieve_residues (gcry_mpi_t *rem, int level, int idx,
+                unsigned short *residues)
+{
+  int child, i;
+  unsigned long r;
+
+  for (child = 2*idx; child < 2*idx + 2; child++)
+    {
+      if (!level)
+        {
+          if (child >= sieve.nleaves)
+            break;
+          r = mpi_fdiv_r_ui (NULL, rem[0], sieve.leaves[child]);
+          for (i = sieve.leaf_start[child]; i < sieve.leaf_start[child+1]; i++)
+            residues[i] = r % sieve.primes[i];
+        }
+      else
+        {
+          if (child >= sieve.nnodes[level-1])
+            break;
+          mpi_fdiv_r (rem[level-1], rem[level], sieve.nodes[level-1][child]);
+          sieve_residues (rem, level-1, child, residues);
+        }
+    }
+}
+
+
+/* Set the bits of BITMAP (SIEVE_BYTES bytes) for which START + 2*K,
+   with K being the bit number, has no prime factor below
+   SIEVE_PRIME_LIMIT.  START must be odd and NBITS long.  RESIDUES is
+   scratch space for SIEVE.NPRIMES items.  If SECRET is set the
+   temporary values are kept in secure memory.  */
+static void
+sieve_interval (unsigned char *bitmap, gcry_mpi_t start, unsigned int nbits,
+                int secret, unsigned short *residues)
+{
+  gcry_mpi_t rem[SIEVE_MAX_DEPTH];
+  unsigned int plimit, p, s, k;
+  int i;
+
+  /* The wheel.  Bit K of the first WHEEL_BYTES bytes stands for
+     START + 2*K = 2*(S+K)+1 modulo 3*5*7; the pattern repeats after
+     WHEEL_BYTES bytes.  */
+  s = (mpi_fdiv_r_ui (NULL, start, 2*3*5*7) - 1) / 2;
+  memset (bitmap, 0, WHEEL_BYTES);
+  for (k = 0; k < 8 * WHEEL_BYTES; k++)
+    if (sieve.wheel[(s + k) % WHEEL_BYTES])
+      bitmap[k / 8] |= 1 << (k % 8);
+  for (k = WHEEL_BYTES; k < SIEVE_BYTES; k++)
+    bitmap[k] = bitmap[k - WHEEL_BYTES];
+
+  for (i = 0; i < sieve.depth; i++)
+    rem[i] = secret? mpi_alloc_secure (mpi_get_nlimbs (start))
+                   : mpi_alloc (mpi_get_nlimbs (start));
+  mpi_fdiv_r (rem[sieve.depth-1], start, sieve.nodes[sieve.depth-1][0]);
+  sieve_residues (rem, sieve.depth-1, 0, residues);
+  for (i = 0; i < sieve.depth; i++)
+    mpi_free (rem[i]);
+
+  /* Sieve with the primes which are smaller than the candidates; a
+     prime is not a multiple of itself.  */
+  plimit = nbits - 2 < 16? (1 << (nbits - 2)) : SIEVE_PRIME_LIMIT;
+  for (i = 0; i < sieve.nprimes && (p = sieve.primes[i]) < plimit; i++)
+    {
+      /* START + 2*K is divisible by P for K = (P - R)/2 modulo P.  */
+      k = residues[i]? p - residues[i] : 0;
+      if ((k & 1))
+        k += p;
+      for (k /= 2; k < 8 * SIEVE_BYTES; k += p)
+        bitmap[k / 8] &= ~(1 << (k % 8));
+    }
+}
 
 
 
@@ -227,14 +438,730 @@ _gcry_register_primegen_progress ( void (*cb)(void *,const char*,int,int,int),
 }
 
 
+static int stock_thread_p (void);
+
 static void
 progress( int c )
 {
-  if ( progress_cb )
+  if ( progress_cb && !stock_thread_p () )
     progress_cb ( progress_cb_data, "primegen", c, 0, 0 );
 }
 
 
+/* The maximum number of threads used to search for a prime; see
+   GCRYCTL_SET_KEYGEN_THREADS.  */
+#define MAX_KEYGEN_THREADS 64
+
+/* A search for the first of LIMIT candidates for which TEST returns
+   a non-zero value.  TEST is called with ARG, the index of the
+   candidate and a flag telling whether it is running on a helper
+   thread, which must not report progress.  */
+struct prime_search_s
+{
+  int (*test) (void *arg, unsigned int idx, int quiet);
+  void *arg;
+  unsigned int limit;
+  ath_mutex_t lock;
+  unsigned int next;    /* The next candidate to be tested.  */
+  unsigned int found;   /* The first successful candidate or LIMIT.  */
+  int result;           /* The value TEST returned for FOUND.  */
+};
+
+#ifdef HAVE_PTHREAD
+/* The helper threads.  They are started by _gcry_primegen_set_threads
+   and wait on SEARCH_COND for a search to be posted at SEARCH_JOB.
+   Only one search at a time is shared with them; a search started
+   while they are busy runs on its calling thread only.  */
+static pthread_mutex_t search_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t search_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t search_done_cond = PTHREAD_COND_INITIALIZER;
+static int search_helpers;        /* Number of running helpers.  */
+static int search_helpers_wanted; /* Helpers above this number exit.  */
+static struct prime_search_s *search_job;
+static unsigned int search_job_seqno;
+static int search_job_busy;       /* Helpers working on SEARCH_JOB.  */
+static pid_t search_pool_pid;     /* The process running the helpers.  */
+#endif /*HAVE_PTHREAD*/
+
+
+static void
+lock_search (struct prime_search_s *search)
+{
+  if (ath_mutex_lock (&search->lock))
+    log_fatal ("failed to acquire the prime search lock\n");
+}
+
+static void
+unlock_search (struct prime_search_s *search)
+{
+  if (ath_mutex_unlock (&search->lock))
+    log_fatal ("failed to release the prime search lock\n");
+}
+
+
+/* Test the candidates of SEARCH in ascending order until all the
+   candidates below the first successful one have been tested.  */
+static void
+prime_search_run (struct prime_search_s *search, int quiet)
+{
+  unsigned int idx;
+  int rc;
+
+  for (;;)
+    {
+      lock_search (search);
+      idx = search->next < search->found? search->next++ : search->limit;
+      unlock_search (search);
+      if (idx == search->limit)
+        break;
+
+      rc = search->test (search->arg, idx, quiet);
+      if (rc)
+        {
+          lock_search (search);
+          if (idx < search->found)
+            {
+              search->found = idx;
+              search->result = rc;
+            }
+          unlock_search (search);
+        }
+    }
+}
+
+
+#ifdef HAVE_PTHREAD
+static void
+lock_search_pool (void)
+{
+  if (pthread_mutex_lock (&search_pool_lock))
+    log_fatal ("failed to acquire the prime search pool lock\n");
+}
+
+static void
+unlock_search_pool (void)
+{
+  if (pthread_mutex_unlock (&search_pool_lock))
+    log_fatal ("failed to release the prime search pool lock\n");
+}
+
+
+/* The main function of a helper thread.  It takes part in each
+   search posted after it has been started.  */
+static void *
+prime_search_thread (void *arg)
+{
+  struct prime_search_s *search;
+  unsigned int seqno;
+
+  (void)arg;
+
+  lock_search_pool ();
+  seqno = search_job_seqno;
+  for (;;)
+    {
+      if (search_helpers > search_helpers_wanted)
+        break;
+      if (seqno == search_job_seqno || !search_job)
+        {
+          seqno = search_job_seqno;
+          pthread_cond_wait (&search_cond, &search_pool_lock);
+          continue;
+        }
+
+      seqno = search_job_seqno;
+      search = search_job;
+      search_job_busy++;
+      unlock_search_pool ();
+      prime_search_run (search, 1);
+      lock_search_pool ();
+      if (!--search_job_busy)
+        pthread_cond_broadcast (&search_done_cond);
+    }
+  search_helpers--;
+  unlock_search_pool ();
+  return NULL;
+}
+
+
+/* After a fork the child has none of the helper threads, but they
+   may still be counted as waiters of the condition variables.  Forget
+   about them so that new ones are started.  Must be called with the
+   pool lock held.  */
+static void
+reset_search_pool_after_fork (void)
+{
+  if (search_helpers && search_pool_pid != getpid ())
+    {
+      pthread_cond_init (&search_cond, NULL);
+      pthread_cond_init (&search_done_cond, NULL);
+      search_helpers = 0;
+      search_job = NULL;
+      search_job_busy = 0;
+    }
+}
+
+
+/* Start helper threads until there are SEARCH_HELPERS_WANTED.  If a
+   thread can't be started, we go on with the ones we have.  Must be
+   called with the pool lock held.  */
+static gpg_err_code_t
+start_search_helpers (void)
+{
+  gpg_err_code_t ec = 0;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  while (search_helpers < search_helpers_wanted)
+    {
+      if (pthread_create (&thread, &attr, prime_search_thread, NULL))
+        {
+          ec = gpg_err_code_from_syserror ();
+          search_helpers_wanted = search_helpers;
+          break;
+        }
+      search_helpers++;
+      search_pool_pid = getpid ();
+    }
+  pthread_attr_destroy (&attr);
+  return ec;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Set the number of threads used to search for primes.  A value of 0
+   or 1 searches on the calling thread only.  More threads require
+   that the callbacks for POSIX threads have been installed.  The
+   helper threads are started here and kept until the number is
+   lowered again.  */
+gpg_err_code_t
+_gcry_primegen_set_threads (int nthreads)
+{
+#ifdef HAVE_PTHREAD
+  gpg_err_code_t ec;
+
+  if (nthreads < 0 || nthreads > MAX_KEYGEN_THREADS)
+    return GPG_ERR_INV_VALUE;
+  if (nthreads > 1 && ath_get_thread_option () != ATH_THREAD_OPTION_PTHREAD)
+    return GPG_ERR_NOT_SUPPORTED;
+  if (!nthreads)
+    nthreads = 1;
+
+  lock_search_pool ();
+  reset_search_pool_after_fork ();
+  search_helpers_wanted = nthreads - 1;
+  ec = start_search_helpers ();
+  /* Let superfluous helpers exit.  */
+  pthread_cond_broadcast (&search_cond);
+  unlock_search_pool ();
+  return ec;
+#else
+  if (nthreads < 0 || nthreads > MAX_KEYGEN_THREADS)
+    return GPG_ERR_INV_VALUE;
+  return nthreads > 1? GPG_ERR_NOT_SUPPORTED : 0;
+#endif
+}
+
+
+/* Call TEST for the candidates 0 to LIMIT-1 on the calling thread
+   and the idle helper threads.  Return the value of TEST for the
+   first candidate for which it is not zero and store the index of
+   that candidate at R_IDX.  Return 0 if there is no such candidate.
+   The result does not depend on the number of threads.  The calling
+   thread takes part in the search and is the only one reporting
+   progress.  */
+static int
+prime_search (int (*test) (void *arg, unsigned int idx, int quiet),
+              void *arg, unsigned int limit, unsigned int *r_idx)
+{
+  struct prime_search_s search;
+#ifdef HAVE_PTHREAD
+  int shared = 0;
+#endif
+
+  memset (&search, 0, sizeof search);
+  search.test = test;
+  search.arg = arg;
+  search.limit = limit;
+  search.found = limit;
+  if (ath_mutex_init (&search.lock))
+    log_fatal ("failed to create the prime search lock\n");
+
+#ifdef HAVE_PTHREAD
+  if (search_helpers_wanted)
+    {
+      lock_search_pool ();
+      reset_search_pool_after_fork ();
+      if (search_helpers < search_helpers_wanted)
+        start_search_helpers ();
+      if (search_helpers && !search_job && !search_job_busy)
+        {
+          search_job = &search;
+          search_job_seqno++;
+          shared = 1;
+          pthread_cond_broadcast (&search_cond);
+        }
+      unlock_search_pool ();
+    }
+#endif
+  prime_search_run (&search, 0);
+#ifdef HAVE_PTHREAD
+  if (shared)
+    {
+      /* Helpers which did not yet pick up the search will not find it
+         anymore; wait for the others.  */
+      lock_search_pool ();
+      search_job = NULL;
+      while (search_job_busy)
+        pthread_cond_wait (&search_done_cond, &search_pool_lock);
+      unlock_search_pool ();
+    }
+#endif
+
+  ath_mutex_destroy (&search.lock);
+  *r_idx = search.found;
+  return search.found < limit? search.result : 0;
+}
+
+
+
+/* The stock of pre-generated primes; see GCRYCTL_SET_KEYGEN_STOCK.
+   A stock is kept for each kind of prime asked for by the key
+   generation after the stock has been enabled.  A background thread
+   keeps STOCK_SIZE items in each of them.  The secret primes for RSA
+   are kept in secure memory; the Elgamal and DSA groups are public
+   anyway.  */
+#define MAX_STOCK_SIZE 64
+#define MAX_STOCKS     16
+
+enum stock_kinds
+  {
+    STOCK_SECRET_PRIME,   /* A prime from _gcry_generate_secret_prime.  */
+    STOCK_ELG_GROUP,      /* A group from _gcry_generate_elg_prime.  */
+    STOCK_DSA_GROUP       /* Ditto in mode 1.  */
+  };
+
+struct stock_item_s
+{
+  struct stock_item_s *next;
+  gcry_mpi_t prime;
+  gcry_mpi_t g;          /* The generator for STOCK_ELG_GROUP.  */
+  gcry_mpi_t *factors;   /* The factors for the groups.  */
+#ifdef HAVE_PTHREAD
+  pid_t pid;             /* The process which generated the item.  */
+#endif
+};
+
+struct stock_s
+{
+  struct stock_s *next;
+  enum stock_kinds kind;
+  unsigned int nbits;
+  unsigned int qbits;
+  gcry_random_level_t randomlevel;
+  int nitems;
+  struct stock_item_s *items;
+  unsigned long taken;   /* Number of items used for keys.  */
+  unsigned long missed;  /* Number of times the stock was empty.  */
+};
+
+#ifdef HAVE_PTHREAD
+static struct stock_s *stocks;
+static int nstocks;
+static int stock_size;
+
+/* Protects the above variables and the following ones.  The
+   background thread waits on STOCK_COND until a stock needs to be
+   refilled or it is asked to stop or to pause.  It signals
+   STOCK_IDLE_COND whenever it is done with a generation and when it
+   terminates.  */
+static pthread_mutex_t stock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stock_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t stock_idle_cond = PTHREAD_COND_INITIALIZER;
+static int stock_thread_running;
+static int stock_thread_busy;   /* The thread is generating a prime.  */
+static int stock_thread_stop;   /* The thread has been asked to stop.  */
+static int stock_pause;         /* A fork is in progress.  */
+static int stock_atfork_registered;
+static pthread_t stock_thread;
+#endif /*HAVE_PTHREAD*/
+
+
+static void
+release_stock_item (struct stock_item_s *item)
+{
+  gcry_mpi_release (item->prime);
+  gcry_mpi_release (item->g);
+  gcry_prime_release_factors (item->factors);
+  gcry_free (item);
+}
+
+
+#ifdef HAVE_PTHREAD
+static void
+lock_stock (void)
+{
+  if (pthread_mutex_lock (&stock_lock))
+    log_fatal ("failed to acquire the prime stock lock\n");
+}
+
+static void
+unlock_stock (void)
+{
+  if (pthread_mutex_unlock (&stock_lock))
+    log_fatal ("failed to release the prime stock lock\n");
+}
+
+
+/* Return the stock for KIND, NBITS, QBITS and RANDOMLEVEL or NULL.
+   Must be called with the stock lock held.  */
+static struct stock_s *
+find_stock (enum stock_kinds kind, unsigned int nbits, unsigned int qbits,
+            gcry_random_level_t randomlevel)
+{
+  struct stock_s *stock;
+
+  for (stock = stocks; stock; stock = stock->next)
+    if (stock->kind == kind && stock->nbits == nbits
+        && stock->qbits == qbits && stock->randomlevel == randomlevel)
+      break;
+  return stock;
+}
+
+
+/* Generate an item for STOCK, which is a copy made with the stock
+   lock held.  Returns NULL on error.  */
+static struct stock_item_s *
+generate_stock_item (struct stock_s *stock)
+{
+  struct stock_item_s *item;
+
+  item = gcry_calloc (1, sizeof *item);
+  if (!item)
+    return NULL;
+  item->pid = getpid ();
+  if (stock->kind == STOCK_SECRET_PRIME)
+    item->prime = gen_prime (stock->nbits, 1, stock->randomlevel, NULL, NULL);
+  else
+    {
+      if (stock->kind == STOCK_ELG_GROUP)
+        item->g = mpi_alloc (1);
+      if (prime_generate_internal (stock->kind == STOCK_DSA_GROUP,
+                                   &item->prime, stock->nbits, stock->qbits,
+                                   item->g, &item->factors,
+                                   stock->randomlevel, 0, 0, NULL, NULL))
+        {
+          release_stock_item (item);
+          return NULL;
+        }
+    }
+  return item;
+}
+
+
+/* The background thread filling up the stocks.  It terminates after
+   the stock has been disabled or it has been asked to stop.  While
+   it waits for the lock or on STOCK_COND it does not hold any other
+   lock of Libgcrypt.  */
+static void *
+stock_thread_main (void *arg)
+{
+  struct stock_s *stock, tmpl;
+  struct stock_item_s *item;
+
+  (void)arg;
+
+  lock_stock ();
+  for (;;)
+    {
+      if (!stock_size || stock_thread_stop)
+        break;
+      for (stock = stocks; stock; stock = stock->next)
+        if (stock->nitems < stock_size)
+          break;
+      if (!stock || stock_pause)
+        {
+          pthread_cond_wait (&stock_cond, &stock_lock);
+          continue;
+        }
+
+      /* The stock may be released while we are generating; thus we
+         look it up again when storing the item.  */
+      tmpl = *stock;
+      stock_thread_busy = 1;
+      unlock_stock ();
+      item = generate_stock_item (&tmpl);
+      lock_stock ();
+      stock_thread_busy = 0;
+      pthread_cond_broadcast (&stock_idle_cond);
+      if (!item)
+        {
+          log_error ("failed to generate a prime for the stock\n");
+          break;
+        }
+      stock = find_stock (tmpl.kind, tmpl.nbits, tmpl.qbits,
+                          tmpl.randomlevel);
+      if (stock && stock->nitems < stock_size)
+        {
+          item->next = stock->items;
+          stock->items = item;
+          stock->nitems++;
+        }
+      else
+        release_stock_item (item);
+    }
+  stock_thread_running = 0;
+  pthread_cond_broadcast (&stock_idle_cond);
+  unlock_stock ();
+  return NULL;
+}
+
+
+/* Stop the background thread and wait until it has terminated.  A
+   new thread is not started while this is in progress.  Must be
+   called with the stock lock held.  */
+static void
+stop_stock_thread (void)
+{
+  if (!stock_thread_running)
+    return;
+  stock_thread_stop = 1;
+  pthread_cond_broadcast (&stock_cond);
+  while (stock_thread_running)
+    pthread_cond_wait (&stock_idle_cond, &stock_lock);
+  stock_thread_stop = 0;
+}
+
+
+/* Fork handlers.  Before a fork we wait until the background thread
+   is idle so that it does not hold any lock of Libgcrypt which would
+   then stay locked in the child; the thread does not start a new
+   generation until the fork is complete.  The child has a copy of the
+   stock but not the thread, which may still be counted as a waiter
+   of the condition variables; thus we reset the state so that a new
+   thread is started on demand.  The stocked items are discarded by
+   take_stock_item.  */
+static void
+stock_atfork_prepare (void)
+{
+  lock_stock ();
+  stock_pause = 1;
+  while (stock_thread_busy
+         && !pthread_equal (pthread_self (), stock_thread))
+    pthread_cond_wait (&stock_idle_cond, &stock_lock);
+}
+
+static void
+stock_atfork_parent (void)
+{
+  stock_pause = 0;
+  pthread_cond_broadcast (&stock_cond);
+  unlock_stock ();
+}
+
+static void
+stock_atfork_child (void)
+{
+  pthread_cond_init (&stock_cond, NULL);
+  pthread_cond_init (&stock_idle_cond, NULL);
+  stock_thread_running = 0;
+  stock_thread_busy = 0;
+  stock_thread_stop = 0;
+  stock_pause = 0;
+  unlock_stock ();
+}
+
+
+/* Start the background thread.  Must be called with the stock lock
+   held.  */
+static gpg_err_code_t
+start_stock_thread (void)
+{
+  gpg_err_code_t ec = 0;
+  pthread_attr_t attr;
+
+  if (stock_thread_stop)
+    return 0;
+  if (!stock_atfork_registered)
+    {
+      if (pthread_atfork (stock_atfork_prepare, stock_atfork_parent,
+                          stock_atfork_child))
+        return GPG_ERR_GENERAL;
+      stock_atfork_registered = 1;
+    }
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create (&stock_thread, &attr, stock_thread_main, NULL))
+    ec = gpg_err_code_from_syserror ();
+  else
+    stock_thread_running = 1;
+  pthread_attr_destroy (&attr);
+  return ec;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Return true if called by the background thread of the stock.  */
+static int
+stock_thread_p (void)
+{
+#ifdef HAVE_PTHREAD
+  int yes;
+
+  if (!stock_size)
+    return 0;
+  lock_stock ();
+  yes = stock_thread_running && pthread_equal (pthread_self (), stock_thread);
+  unlock_stock ();
+  return yes;
+#else
+  return 0;
+#endif
+}
+
+
+/* Take an item for KIND, NBITS, QBITS and RANDOMLEVEL from the stock.
+   Returns NULL if there is none, in which case the stock is created
+   so that the background thread stocks up such items for the next
+   key.  */
+static struct stock_item_s *
+take_stock_item (enum stock_kinds kind, unsigned int nbits,
+                 unsigned int qbits, gcry_random_level_t randomlevel)
+{
+#ifdef HAVE_PTHREAD
+  struct stock_s *stock;
+  struct stock_item_s *item = NULL;
+  pid_t pid;
+
+  if (!stock_size)
+    return NULL;
+
+  pid = getpid ();
+  lock_stock ();
+  if (!stock_thread_running && stock_size && start_stock_thread ())
+    log_error ("failed to start the prime stock thread\n");
+  stock = find_stock (kind, nbits, qbits, randomlevel);
+  if (!stock && stock_size && nstocks < MAX_STOCKS)
+    {
+      stock = gcry_calloc (1, sizeof *stock);
+      if (stock)
+        {
+          stock->kind = kind;
+          stock->nbits = nbits;
+          stock->qbits = qbits;
+          stock->randomlevel = randomlevel;
+          stock->next = stocks;
+          stocks = stock;
+          nstocks++;
+        }
+    }
+  if (stock)
+    {
+      /* Items generated by another process have also been copied to
+         the parent or to other children of it and must never be used
+         for a key.  */
+      while ((item = stock->items))
+        {
+          stock->items = item->next;
+          stock->nitems--;
+          if (item->pid == pid)
+            break;
+          release_stock_item (item);
+        }
+      if (item)
+        stock->taken++;
+      else
+        stock->missed++;
+      pthread_cond_signal (&stock_cond);
+    }
+  unlock_stock ();
+  return item;
+#else
+  (void)kind;
+  (void)nbits;
+  (void)qbits;
+  (void)randomlevel;
+  return NULL;
+#endif
+}
+
+
+/* Set the number of items kept in each stock of pre-generated primes
+   to SIZE.  A value of 0 disables the stock, waits until the
+   background thread has terminated and releases all stocked items.
+   The background thread requires that the callbacks for
+   POSIX threads have been installed.  */
+gpg_err_code_t
+_gcry_primegen_set_stock (int size)
+{
+#ifdef HAVE_PTHREAD
+  struct stock_s *stock;
+  struct stock_item_s *item;
+  gpg_err_code_t ec = 0;
+
+  if (size < 0 || size > MAX_STOCK_SIZE)
+    return GPG_ERR_INV_VALUE;
+  if (size && (fips_mode ()
+               || ath_get_thread_option () != ATH_THREAD_OPTION_PTHREAD))
+    return GPG_ERR_NOT_SUPPORTED;
+
+  lock_stock ();
+  stock_size = size;
+  if (!size)
+    {
+      stop_stock_thread ();
+      while ((stock = stocks))
+        {
+          stocks = stock->next;
+          while ((item = stock->items))
+            {
+              stock->items = item->next;
+              release_stock_item (item);
+            }
+          gcry_free (stock);
+        }
+      nstocks = 0;
+    }
+  else if (!stock_thread_running)
+    {
+      ec = start_stock_thread ();
+      if (ec)
+        stock_size = 0;
+    }
+  pthread_cond_signal (&stock_cond);
+  unlock_stock ();
+  return ec;
+#else
+  return size? GPG_ERR_NOT_SUPPORTED : 0;
+#endif
+}
+
+
+/* Print the state of the stocks.  */
+void
+_gcry_primegen_dump_stats (void)
+{
+#ifdef HAVE_PTHREAD
+  struct stock_s *stock;
+
+  if (!stock_size)
+    return;
+  lock_stock ();
+  for (stock = stocks; stock; stock = stock->next)
+    log_info ("prime stock: %d/%d %s of %u bits (level %d);"
+              " %lu taken, %lu missed\n",
+              stock->nitems, stock_size,
+              stock->kind == STOCK_SECRET_PRIME? "secret primes" :
+              stock->kind == STOCK_DSA_GROUP? "DSA groups" : "Elgamal groups",
+              stock->nbits, stock->randomlevel, stock->taken, stock->missed);
+  unlock_stock ();
+#endif
+}
+
+
 /****************
  * Generate a prime number (stored in secure memory)
  */
@@ -245,6 +1172,18 @@ _gcry_generate_secret_prime (unsigned int nbits,
                              void *extra_check_arg)
 {
   gcry_mpi_t prime;
+  struct stock_item_s *item;
+
+  while ((item = take_stock_item (STOCK_SECRET_PRIME, nbits, 0,
+                                  random_level)))
+    {
+      prime = item->prime;
+      item->prime = NULL;
+      release_stock_item (item);
+      if (!extra_check || !extra_check (extra_check_arg, prime))
+        return prime;
+      gcry_mpi_release (prime);
+    }
 
   prime = gen_prime (nbits, 1, random_level, extra_check, extra_check_arg);
   progress('\n');
@@ -570,7 +1509,7 @@ prime_generate_internal (int need_q_factor,
 	  count2 = 0;
     }
   while (! ((nprime == pbits) && check_prime (prime, val_2, 5,
-                                              cb_func, cb_arg)));
+                                              cb_func, cb_arg, 0)));
 
   if (DBG_CIPHER)
     {
@@ -739,6 +1678,24 @@ _gcry_generate_elg_prime (int mode, unsigned pbits, unsigned qbits,
 			  gcry_mpi_t g, gcry_mpi_t **ret_factors)
 {
   gcry_mpi_t prime = NULL;
+  struct stock_item_s *item;
+
+  item = take_stock_item (mode == 1? STOCK_DSA_GROUP : STOCK_ELG_GROUP,
+                          pbits, qbits, GCRY_WEAK_RANDOM);
+  if (item)
+    {
+      prime = item->prime;
+      item->prime = NULL;
+      if (g && item->g)
+        mpi_set (g, item->g);
+      if (ret_factors)
+        {
+          *ret_factors = item->factors;
+          item->factors = NULL;
+        }
+      release_stock_item (item);
+      return prime;
+    }
 
   if (prime_generate_internal ((mode == 1), &prime, pbits, qbits, g,
                                ret_factors, GCRY_WEAK_RANDOM, 0, 0,
@@ -749,15 +1706,83 @@ _gcry_generate_elg_prime (int mode, unsigned pbits, unsigned qbits,
 }
 
 
+/* The candidates START + 2*CAND[IDX] tested by gen_prime.  */
+struct gen_prime_s
+{
+  gcry_mpi_t start;
+  unsigned short *cand;
+  unsigned int nbits;
+  int secret;
+  int (*extra_check)(void *, gcry_mpi_t);
+  void *extra_check_arg;
+  int dotcount;
+};
+
+
+/* Test candidate IDX of ARG, a struct gen_prime_s.  Return 1 if it is
+   a prime accepted by the extra check, -1 if it is a prime which is
+   too large and 0 otherwise.  */
+static int
+gen_prime_test (void *arg, unsigned int idx, int quiet)
+{
+  struct gen_prime_s *gp = arg;
+  gcry_mpi_t ptest, pminus1, val_2, result;
+  unsigned int count = 0;
+  int rc = 0;
+
+  val_2  = mpi_alloc_set_ui( 2 );
+  result = mpi_alloc_like( gp->start );
+  pminus1= mpi_alloc_like( gp->start );
+  ptest  = mpi_alloc_like( gp->start );
+
+  mpi_add_ui( ptest, gp->start, 2 * gp->cand[idx] );
+
+  /* Do a fast Fermat test now. */
+  mpi_sub_ui( pminus1, ptest, 1);
+  gcry_mpi_powm( result, val_2, pminus1, ptest );
+  if ( !mpi_cmp_ui( result, 1 ) )
+    {
+      /* Not composite, perform stronger tests */
+      if (is_prime(ptest, 5, &count, quiet ))
+        {
+          if (!mpi_test_bit( ptest, gp->nbits-1-gp->secret ))
+            rc = -1;
+          else if (gp->extra_check
+                   && gp->extra_check (gp->extra_check_arg, ptest))
+            {
+              /* The extra check told us that this prime is
+                 not of the caller's taste. */
+              if (!quiet)
+                progress ('/');
+            }
+          else
+            rc = 1; /* Got it. */
+        }
+    }
+  if (!rc && !quiet && ++gp->dotcount == 10 )
+    {
+      progress('.');
+      gp->dotcount = 0;
+    }
+
+  mpi_free(val_2);
+  mpi_free(result);
+  mpi_free(pminus1);
+  mpi_free(ptest);
+  return rc;
+}
+
+
 static gcry_mpi_t
 gen_prime (unsigned int nbits, int secret, int randomlevel,
            int (*extra_check)(void *, gcry_mpi_t), void *extra_check_arg)
 {
-  gcry_mpi_t prime, ptest, pminus1, val_2, val_3, result;
-  int i;
-  unsigned int x, step;
-  unsigned int count1, count2;
-  int *mods;
+  gcry_mpi_t prime, ptest;
+  struct gen_prime_s gp;
+  unsigned int k, n, idx;
+  unsigned short *residues;
+  unsigned char *bitmap;
+  int rc;
 
 /*   if (  DBG_CIPHER ) */
 /*     log_debug ("generate a prime of %u bits ", nbits ); */
@@ -765,18 +1790,26 @@ gen_prime (unsigned int nbits, int secret, int randomlevel,
   if (nbits < 16)
     log_fatal ("can't generate a prime with less than %d bits\n", 16);
 
-  mods = gcry_xcalloc( no_of_small_prime_numbers, sizeof *mods);
+  if (ath_mutex_lock (&sieve_lock))
+    log_fatal ("failed to acquire the sieve lock\n");
+  if (!sieve.initialized)
+    sieve_init ();
+  if (ath_mutex_unlock (&sieve_lock))
+    log_fatal ("failed to release the sieve lock\n");
+
+  residues = gcry_xmalloc (sieve.nprimes * sizeof *residues);
+  bitmap = gcry_xmalloc (SIEVE_BYTES);
   /* Make nbits fit into gcry_mpi_t implementation. */
-  val_2  = mpi_alloc_set_ui( 2 );
-  val_3 = mpi_alloc_set_ui( 3);
   prime  = secret? gcry_mpi_snew ( nbits ): gcry_mpi_new ( nbits );
-  result = mpi_alloc_like( prime );
-  pminus1= mpi_alloc_like( prime );
-  ptest  = mpi_alloc_like( prime );
-  count1 = count2 = 0;
+
+  gp.start = prime;
+  gp.cand = gcry_xmalloc (8 * SIEVE_BYTES * sizeof *gp.cand);
+  gp.nbits = nbits;
+  gp.secret = secret;
+  gp.extra_check = extra_check;
+  gp.extra_check_arg = extra_check_arg;
   for (;;)
     {  /* try forvever */
-      int dotcount=0;
 
       /* generate a random number */
       gcry_mpi_randomize( prime, nbits, randomlevel );
@@ -790,68 +1823,30 @@ gen_prime (unsigned int nbits, int secret, int randomlevel,
         mpi_set_bit (prime, nbits-2);
       mpi_set_bit(prime, 0);
 
-      /* Calculate all remainders. */
-      for (i=0; (x = small_prime_numbers[i]); i++ )
-        mods[i] = mpi_fdiv_r_ui(NULL, prime, x);
+      /* Remove the candidates with a small factor. */
+      sieve_interval (bitmap, prime, nbits, secret, residues);
+      for (n = k = 0; k < 8 * SIEVE_BYTES; k++)
+        if ((bitmap[k / 8] & (1 << (k % 8))))
+          gp.cand[n++] = k;
 
-      /* Now try some primes starting with prime. */
-      for(step=0; step < 20000; step += 2 )
+      /* Now try the remaining primes starting with prime. */
+      gp.dotcount = 0;
+      rc = prime_search (gen_prime_test, &gp, n, &idx);
+      if (rc > 0)
         {
-          /* Check against all the small primes we have in mods. */
-          count1++;
-          for (i=0; (x = small_prime_numbers[i]); i++ )
-            {
-              while ( mods[i] + step >= x )
-                mods[i] -= x;
-              if ( !(mods[i] + step) )
-                break;
-	    }
-          if ( x )
-            continue;   /* Found a multiple of an already known prime. */
-
-          mpi_add_ui( ptest, prime, step );
-
-          /* Do a fast Fermat test now. */
-          count2++;
-          mpi_sub_ui( pminus1, ptest, 1);
-          gcry_mpi_powm( result, val_2, pminus1, ptest );
-          if ( !mpi_cmp_ui( result, 1 ) )
-            {
-              /* Not composite, perform stronger tests */
-              if (is_prime(ptest, 5, &count2 ))
-                {
-                  if (!mpi_test_bit( ptest, nbits-1-secret ))
-                    {
-                      progress('\n');
-                      log_debug ("overflow in prime generation\n");
-                      break; /* Stop loop, continue with a new prime. */
-                    }
-
-                  if (extra_check && extra_check (extra_check_arg, ptest))
-                    {
-                      /* The extra check told us that this prime is
-                         not of the caller's taste. */
-                      progress ('/');
-                    }
-                  else
-                    {
-                      /* Got it. */
-                      mpi_free(val_2);
-                      mpi_free(val_3);
-                      mpi_free(result);
-                      mpi_free(pminus1);
-                      mpi_free(prime);
-                      gcry_free(mods);
-                      return ptest;
-                    }
-                }
-	    }
-          if (++dotcount == 10 )
-            {
-              progress('.');
-              dotcount = 0;
-	    }
-	}
+          ptest = mpi_alloc_like( prime );
+          mpi_add_ui( ptest, prime, 2 * gp.cand[idx] );
+          mpi_free(prime);
+          gcry_free(gp.cand);
+          gcry_free(residues);
+          gcry_free(bitmap);
+          return ptest;
+        }
+      else if (rc < 0)
+        {
+          progress('\n');
+          log_debug ("overflow in prime generation\n");
+        }
       progress(':'); /* restart with a new random value */
     }
 }
@@ -859,10 +1854,11 @@ gen_prime (unsigned int nbits, int secret, int randomlevel,
 /****************
  * Returns: true if this may be a prime
  * RM_ROUNDS gives the number of Rabin-Miller tests to run.
+ * If QUIET is set no progress is reported.
  */
 static int
 check_prime( gcry_mpi_t prime, gcry_mpi_t val_2, int rm_rounds,
-             gcry_prime_check_func_t cb_func, void *cb_arg)
+             gcry_prime_check_func_t cb_func, void *cb_arg, int quiet)
 {
   int i;
   unsigned int x;
@@ -886,7 +1882,8 @@ check_prime( gcry_mpi_t prime, gcry_mpi_t val_2, int rm_rounds,
       {
         /* Is composite. */
         mpi_free( result );
-        progress('.');
+        if (!quiet)
+          progress('.');
         return 0;
       }
     mpi_free( result );
@@ -895,23 +1892,25 @@ check_prime( gcry_mpi_t prime, gcry_mpi_t val_2, int rm_rounds,
   if (!cb_func || cb_func (cb_arg, GCRY_PRIME_CHECK_AT_MAYBE_PRIME, prime))
     {
       /* Perform stronger tests. */
-      if ( is_prime( prime, rm_rounds, &count ) )
+      if ( is_prime( prime, rm_rounds, &count, quiet ) )
         {
           if (!cb_func
               || cb_func (cb_arg, GCRY_PRIME_CHECK_AT_GOT_PRIME, prime))
             return 1; /* Probably a prime. */
         }
     }
-  progress('.');
+  if (!quiet)
+    progress('.');
   return 0;
 }
 
 
 /*
- * Return true if n is probably a prime
+ * Return true if n is probably a prime.  If QUIET is set no progress
+ * is reported.
  */
 static int
-is_prime (gcry_mpi_t n, int steps, unsigned int *count)
+is_prime (gcry_mpi_t n, int steps, unsigned int *count, int quiet)
 {
   gcry_mpi_t x = mpi_alloc( mpi_get_nlimbs( n ) );
   gcry_mpi_t y = mpi_alloc( mpi_get_nlimbs( n ) );
@@ -969,7 +1968,8 @@ is_prime (gcry_mpi_t n, int steps, unsigned int *count)
           if (mpi_cmp( y, nminus1 ) )
             goto leave; /* Not a prime. */
 	}
-      progress('+');
+      if (!quiet)
+        progress('+');
     }
   rc = 1; /* May be a prime. */
 
@@ -1181,7 +2181,7 @@ gcry_prime_check (gcry_mpi_t x, unsigned int flags)
 
   /* We use 64 rounds because the prime we are going to test is not
      guaranteed to be a random one. */
-  if (! check_prime (x, val_2, 64, NULL, NULL))
+  if (! check_prime (x, val_2, 64, NULL, NULL, 0))
     err = GPG_ERR_NO_PRIME;
 
   mpi_free (val_2);
@@ -1290,7 +2290,7 @@ find_x931_prime (const gcry_mpi_t pfirst)
      sufficient.  We do not have a Lucas test implementaion thus we
      can't do it in the X9.31 preferred way of running a few
      Rabin-Miller followed by one Lucas test.  */
-  while ( !check_prime (prime, val_2, 64, NULL, NULL) )
+  while ( !check_prime (prime, val_2, 64, NULL, NULL, 0) )
     mpi_add_ui (prime, prime, 2);
 
   mpi_free (val_2);
@@ -1299,6 +2299,51 @@ find_x931_prime (const gcry_mpi_t pfirst)
 }
 
 
+/* The candidates YP0 + (BASE+IDX)*P1P2 of _gcry_derive_x931_prime
+   are searched in chunks of this many.  */
+#define X931_SEARCH_CHUNK 256
+
+struct x931_search_s
+{
+  gcry_mpi_t yp0;
+  gcry_mpi_t p1p2;
+  gcry_mpi_t e;
+  unsigned int base;
+};
+
+
+/* Test candidate IDX of ARG, a struct x931_search_s.  Return true if
+   it is a prime and E is coprime to the prime minus 1.  */
+static int
+x931_test (void *arg, unsigned int idx, int quiet)
+{
+  struct x931_search_s *xs = arg;
+  gcry_mpi_t val_2 = mpi_alloc_set_ui (2);
+  gcry_mpi_t y = mpi_alloc_like (xs->yp0);
+  gcry_mpi_t ym1 = mpi_alloc_like (xs->yp0);
+  gcry_mpi_t gcdtmp = mpi_alloc_like (xs->yp0);
+  int rc;
+
+  mpi_mul_ui (y, xs->p1p2, xs->base + idx);
+  mpi_add (y, y, xs->yp0);
+  mpi_sub_ui (ym1, y, 1);
+  if (!gcry_mpi_gcd (gcdtmp, xs->e, ym1))
+    {
+      if (!quiet)
+        progress ('/');  /* gcd (e, y-1) != 1  */
+      rc = 0;
+    }
+  else
+    rc = check_prime (y, val_2, 64, NULL, NULL, quiet);
+
+  mpi_free (gcdtmp);
+  mpi_free (ym1);
+  mpi_free (y);
+  mpi_free (val_2);
+  return rc;
+}
+
+
 /* Generate a prime using the algorithm from X9.31 appendix B.4.
 
    This function requires that the provided public exponent E is odd.
@@ -1378,25 +2423,17 @@ _gcry_derive_x931_prime (const gcry_mpi_t xp,
    */
 
   {
-    gcry_mpi_t val_2 = mpi_alloc_set_ui (2);
-    gcry_mpi_t gcdtmp = mpi_alloc_like (yp0);
-    int gcdres;
-
-    mpi_sub_ui (p1p2, p1p2, 1); /* Adjust for loop body.  */
-    mpi_sub_ui (yp0, yp0, 1);   /* Ditto.  */
-    for (;;)
-      {
-        gcdres = gcry_mpi_gcd (gcdtmp, e, yp0);
-        mpi_add_ui (yp0, yp0, 1);
-        if (!gcdres)
-          progress ('/');  /* gcd (e, yp0-1) != 1  */
-        else if (check_prime (yp0, val_2, 64, NULL, NULL))
-          break; /* Found.  */
-        /* We add p1p2-1 because yp0 is incremented after the gcd test.  */
-        mpi_add (yp0, yp0, p1p2);
-      }
-    mpi_free (gcdtmp);
-    mpi_free (val_2);
+    struct x931_search_s xs;
+    unsigned int idx;
+
+    xs.yp0 = yp0;
+    xs.p1p2 = p1p2;
+    xs.e = e;
+    for (xs.base = 0; ; xs.base += X931_SEARCH_CHUNK)
+      if (prime_search (x931_test, &xs, X931_SEARCH_CHUNK, &idx))
+        break; /* Found.  */
+    mpi_mul_ui (p1p2, p1p2, xs.base + idx);
+    mpi_add (yp0, yp0, p1p2);
   }
 
   mpi_free (p1p2);
@@ -1503,7 +2540,7 @@ _gcry_generate_fips186_2_prime (unsigned int pbits, unsigned int qbits,
       mpi_set_bit (prime_q, 0);
 
       /* Step 4:  Test whether Q is prime using 64 round of Rabin-Miller.  */
-      if (check_prime (prime_q, val_2, 64, NULL, NULL))
+      if (check_prime (prime_q, val_2, 64, NULL, NULL, 0))
         break; /* Yes, Q is prime.  */
 
       /* Step 5.  */
@@ -1568,7 +2605,7 @@ _gcry_generate_fips186_2_prime (unsigned int pbits, unsigned int qbits,
       /* Step 10: If  p < 2^{L-1}  skip the primality test.  */
       /* Step 11 and 12: Primality test.  */
       if (mpi_get_nbits (prime_p) >= pbits-1
-          && check_prime (prime_p, val_2, 64, NULL, NULL) )
+          && check_prime (prime_p, val_2, 64, NULL, NULL, 0) )
         break; /* Yes, P is prime, continue with Step 15.  */
 
       /* Step 13: counter = counter + 1, offset = offset + n + 1. */
@@ -1745,7 +2782,7 @@ _gcry_generate_fips186_3_prime (unsigned int pbits, unsigned int qbits,
       /* Step 8:  Test whether Q is prime using 64 round of Rabin-Miller.
                   According to table C.1 this is sufficient for all
                   supported prime sizes (i.e. up 3072/256).  */
-      if (check_prime (prime_q, val_2, 64, NULL, NULL))
+      if (check_prime (prime_q, val_2, 64, NULL, NULL, 0))
         break; /* Yes, Q is prime.  */
 
       /* Step 8.  */
@@ -1811,7 +2848,7 @@ _gcry_generate_fips186_3_prime (unsigned int pbits, unsigned int qbits,
       /* Step 11.6: If  p < 2^{L-1}  skip the primality test.  */
       /* Step 11.7 and 11.8: Primality test.  */
       if (mpi_get_nbits (prime_p) >= pbits-1
-          && check_prime (prime_p, val_2, 64, NULL, NULL) )
+          && check_prime (prime_p, val_2, 64, NULL, NULL, 0) )
         break; /* Yes, P is prime, continue with Step 15.  */
 
       /* Step 11.9: counter = counter + 1, offset = offset + n + 1.
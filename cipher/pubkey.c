@@ -87,22 +87,37 @@ static gcry_module_t pubkeys_registered;
 /* This is the lock protecting PUBKEYS_REGISTERED.  */
 static ath_mutex_t pubkeys_registered_lock = ATH_MUTEX_INITIALIZER;;
 
+/* The lookup index of the default pubkeys.  It is set once after the
+   default pubkeys have been registered and may then be used without
+   holding PUBKEYS_REGISTERED_LOCK.  */
+static gcry_module_index_t volatile pubkeys_index;
+
+/* Set once a module has been added with _gcry_pk_register.  Until
+   then a miss in PUBKEYS_INDEX means that the algorithm is not known at
+   all and the list does not need to be searched.  */
+static int volatile pubkeys_user_registered;
+
 /* Flag to check whether the default pubkeys have already been
    registered.  */
 static int default_pubkeys_registered;
 
-/* Convenient macro for registering the default digests.  */
-#define REGISTER_DEFAULT_PUBKEYS                   \
-  do                                               \
-    {                                              \
-      ath_mutex_lock (&pubkeys_registered_lock);   \
-      if (! default_pubkeys_registered)            \
-        {                                          \
-          pk_register_default ();                  \
-          default_pubkeys_registered = 1;          \
-        }                                          \
-      ath_mutex_unlock (&pubkeys_registered_lock); \
-    }                                              \
+/* Convenient macro for registering the default digests.  Once the
+   lookup index has been published the defaults are known to be
+   registered and the lock is not required.  */
+#define REGISTER_DEFAULT_PUBKEYS                       \
+  do                                                   \
+    {                                                  \
+      if (! pubkeys_index)                             \
+        {                                              \
+          ath_mutex_lock (&pubkeys_registered_lock);   \
+          if (! default_pubkeys_registered)            \
+            {                                          \
+              pk_register_default ();                  \
+              default_pubkeys_registered = 1;          \
+            }                                          \
+          ath_mutex_unlock (&pubkeys_registered_lock); \
+        }                                              \
+    }                                                  \
   while (0)
 
 /* These dummy functions are used in case a cipher implementation
@@ -192,12 +207,28 @@ dummy_get_nbits (int algorithm, gcry_mpi_t *pkey)
   return 0;
 }
 
+/* Internal callback function.  Used via _gcry_module_index_new.  */
+static const char *
+pk_name_func (void *spec, int idx)
+{
+  gcry_pk_spec_t *pubkey = spec;
+  int i;
+
+  if (! idx)
+    return pubkey->name;
+  for (i = 0; pubkey->aliases[i]; i++)
+    if (i == idx - 1)
+      return pubkey->aliases[i];
+  return NULL;
+}
+
 /* Internal function.  Register all the pubkeys included in
    PUBKEY_TABLE.  Returns zero on success or an error code.  */
 static void
 pk_register_default (void)
 {
   gcry_err_code_t err = 0;
+  gcry_module_index_t index;
   int i;
 
   for (i = 0; (! err) && pubkey_table[i].pubkey; i++)
@@ -224,6 +255,10 @@ pk_register_default (void)
 
   if (err)
     BUG ();
+
+  index = _gcry_module_index_new (pubkeys_registered, pk_name_func, NULL);
+  if (index)
+    _gcry_module_index_publish (&pubkeys_index, index);
 }
 
 /* Internal callback function.  Used via _gcry_module_lookup.  */
@@ -253,6 +288,69 @@ gcry_pk_lookup_name (const char *name)
   return pubkey;
 }
 
+/* Internal function.  Return the module of the pubkey ALGORITHM with
+   its use counter incremented or NULL if it is not known.  The default
+   pubkeys are served from the lookup index without taking the lock.
+   The module needs to be released with pk_module_put.  */
+static gcry_module_t
+pk_module_get (int algorithm)
+{
+  gcry_module_index_t index = pubkeys_index;
+  gcry_module_t pubkey;
+
+  if (index)
+    {
+      pubkey = _gcry_module_index_lookup_id (index, algorithm);
+      if (pubkey || ! pubkeys_user_registered)
+        return pubkey;
+    }
+  else
+    REGISTER_DEFAULT_PUBKEYS;
+
+  ath_mutex_lock (&pubkeys_registered_lock);
+  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  ath_mutex_unlock (&pubkeys_registered_lock);
+
+  return pubkey;
+}
+
+/* Internal function.  Same as pk_module_get but look the module up
+   by its NAME or one of its aliases.  */
+static gcry_module_t
+pk_module_get_name (const char *name)
+{
+  gcry_module_index_t index = pubkeys_index;
+  gcry_module_t pubkey;
+
+  if (index)
+    {
+      pubkey = _gcry_module_index_lookup_name (index, name);
+      if (pubkey || ! pubkeys_user_registered)
+        return pubkey;
+    }
+  else
+    REGISTER_DEFAULT_PUBKEYS;
+
+  ath_mutex_lock (&pubkeys_registered_lock);
+  pubkey = gcry_pk_lookup_name (name);
+  ath_mutex_unlock (&pubkeys_registered_lock);
+
+  return pubkey;
+}
+
+/* Internal function.  Release a module returned by pk_module_get or
+   pk_module_get_name.  */
+static void
+pk_module_put (gcry_module_t pubkey)
+{
+  if (pubkey && ! (pubkey->flags & FLAG_MODULE_STATIC))
+    {
+      ath_mutex_lock (&pubkeys_registered_lock);
+      _gcry_module_release (pubkey);
+      ath_mutex_unlock (&pubkeys_registered_lock);
+    }
+}
+
 /* Register a new pubkey module whose specification can be found in
    PUBKEY.  On success, a new algorithm ID is stored in ALGORITHM_ID
    and a pointer representhing this module is stored in MODULE.  */
@@ -269,11 +367,17 @@ _gcry_pk_register (gcry_pk_spec_t *pubkey,
   if (fips_mode ())
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
+  /* Make sure that the default pubkeys are registered first so that
+     only they get served from the lookup index.  */
+  REGISTER_DEFAULT_PUBKEYS;
+
   ath_mutex_lock (&pubkeys_registered_lock);
   err = _gcry_module_add (&pubkeys_registered, 0,
 			  (void *) pubkey,
 			  (void *)(extraspec? extraspec : &dummy_extra_spec),
                           &mod);
+  if (! err)
+    pubkeys_user_registered = 1;
   ath_mutex_unlock (&pubkeys_registered_lock);
 
   if (! err)
@@ -317,16 +421,12 @@ gcry_pk_map_name (const char *string)
   if (!string)
     return 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = gcry_pk_lookup_name (string);
+  pubkey = pk_module_get_name (string);
   if (pubkey)
     {
       algorithm = pubkey->mod_id;
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return algorithm;
 }
@@ -341,18 +441,14 @@ gcry_pk_algo_name (int algorithm)
   gcry_module_t pubkey;
   const char *name;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       name = ((gcry_pk_spec_t *) pubkey->spec)->name;
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
   else
     name = "?";
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return name;
 }
@@ -367,10 +463,7 @@ _gcry_pk_aliased_algo_name (int algorithm)
   const char *name = NULL;
   gcry_module_t module;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       gcry_pk_spec_t *pubkey = (gcry_pk_spec_t *) module->spec;
@@ -378,9 +471,8 @@ _gcry_pk_aliased_algo_name (int algorithm)
       name = pubkey->aliases? *pubkey->aliases : NULL;
       if (!name || !*name)
         name = pubkey->name;
-      _gcry_module_release (module);
+      pk_module_put (module);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return name;
 }
@@ -413,10 +505,7 @@ check_pubkey_algo (int algorithm, unsigned use)
   gcry_pk_spec_t *pubkey;
   gcry_module_t module;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       pubkey = (gcry_pk_spec_t *) module->spec;
@@ -428,11 +517,10 @@ check_pubkey_algo (int algorithm, unsigned use)
 	err = GPG_ERR_WRONG_PUBKEY_ALGO;
       else if (module->flags & FLAG_MODULE_DISABLED)
 	err = GPG_ERR_PUBKEY_ALGO;
-      _gcry_module_release (module);
+      pk_module_put (module);
     }
   else
     err = GPG_ERR_PUBKEY_ALGO;
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return err;
 }
@@ -447,16 +535,12 @@ pubkey_get_npkey (int algorithm)
   gcry_module_t pubkey;
   int npkey = 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       npkey = strlen (((gcry_pk_spec_t *) pubkey->spec)->elements_pkey);
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return npkey;
 }
@@ -470,16 +554,12 @@ pubkey_get_nskey (int algorithm)
   gcry_module_t pubkey;
   int nskey = 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       nskey = strlen (((gcry_pk_spec_t *) pubkey->spec)->elements_skey);
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return nskey;
 }
@@ -493,16 +573,12 @@ pubkey_get_nsig (int algorithm)
   gcry_module_t pubkey;
   int nsig = 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       nsig = strlen (((gcry_pk_spec_t *) pubkey->spec)->elements_sig);
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return nsig;
 }
@@ -516,16 +592,12 @@ pubkey_get_nenc (int algorithm)
   gcry_module_t pubkey;
   int nenc = 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       nenc = strlen (((gcry_pk_spec_t *) pubkey->spec)->elements_enc);
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return nenc;
 }
@@ -550,10 +622,7 @@ pubkey_generate (int algorithm,
   gcry_err_code_t ec = GPG_ERR_PUBKEY_ALGO;
   gcry_module_t pubkey;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       pk_extra_spec_t *extraspec = pubkey->extraspec;
@@ -570,9 +639,8 @@ pubkey_generate (int algorithm,
           ec = ((gcry_pk_spec_t *) pubkey->spec)->generate
             (algorithm, nbits, use_e, skey, retfactors);
         }
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return ec;
 }
@@ -584,17 +652,13 @@ pubkey_check_secret_key (int algorithm, gcry_mpi_t *skey)
   gcry_err_code_t err = GPG_ERR_PUBKEY_ALGO;
   gcry_module_t pubkey;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     {
       err = ((gcry_pk_spec_t *) pubkey->spec)->check_secret_key
         (algorithm, skey);
-      _gcry_module_release (pubkey);
+      pk_module_put (pubkey);
     }
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return err;
 }
@@ -626,19 +690,15 @@ pubkey_encrypt (int algorithm, gcry_mpi_t *resarr, gcry_mpi_t data,
       log_mpidump ("  data:", data);
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       pubkey = (gcry_pk_spec_t *) module->spec;
       rc = pubkey->encrypt (algorithm, resarr, data, pkey, flags);
-      _gcry_module_release (module);
-      goto ready;
+      pk_module_put (module);
     }
-  rc = GPG_ERR_PUBKEY_ALGO;
-
- ready:
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  else
+    rc = GPG_ERR_PUBKEY_ALGO;
 
   if (!rc && DBG_CIPHER && !fips_mode ())
     {
@@ -675,20 +735,15 @@ pubkey_decrypt (int algorithm, gcry_mpi_t *result, gcry_mpi_t *data,
 	log_mpidump ("  data:", data[i]);
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       pubkey = (gcry_pk_spec_t *) module->spec;
       rc = pubkey->decrypt (algorithm, result, data, skey, flags);
-      _gcry_module_release (module);
-      goto ready;
+      pk_module_put (module);
     }
-
-  rc = GPG_ERR_PUBKEY_ALGO;
-
- ready:
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  else
+    rc = GPG_ERR_PUBKEY_ALGO;
 
   if (!rc && DBG_CIPHER && !fips_mode ())
     log_mpidump (" plain:", *result);
@@ -720,20 +775,15 @@ pubkey_sign (int algorithm, gcry_mpi_t *resarr, gcry_mpi_t data,
       log_mpidump("  data:", data );
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       pubkey = (gcry_pk_spec_t *) module->spec;
       rc = pubkey->sign (algorithm, resarr, data, skey);
-      _gcry_module_release (module);
-      goto ready;
+      pk_module_put (module);
     }
-
-  rc = GPG_ERR_PUBKEY_ALGO;
-
- ready:
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  else
+    rc = GPG_ERR_PUBKEY_ALGO;
 
   if (!rc && DBG_CIPHER && !fips_mode ())
     for (i = 0; i < pubkey_get_nsig (algorithm); i++)
@@ -766,20 +816,15 @@ pubkey_verify (int algorithm, gcry_mpi_t hash, gcry_mpi_t *data,
       log_mpidump ("  hash", hash);
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  module = pk_module_get (algorithm);
   if (module)
     {
       pubkey = (gcry_pk_spec_t *) module->spec;
       rc = pubkey->verify (algorithm, hash, data, pkey, cmp, opaquev);
-      _gcry_module_release (module);
-      goto ready;
+      pk_module_put (module);
     }
-
-  rc = GPG_ERR_PUBKEY_ALGO;
-
- ready:
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  else
+    rc = GPG_ERR_PUBKEY_ALGO;
   return rc;
 }
 
@@ -2022,9 +2067,7 @@ sexp_to_key (gcry_sexp_t sexp, int want_private, const char *override_elems,
       return GPG_ERR_INV_OBJ;      /* Invalid structure of object. */
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name (name);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name (name);
 
   /* Fixme: We should make sure that an ECC key is always named "ecc"
      and not "ecdsa".  "ecdsa" should be used for the signature
@@ -2071,9 +2114,7 @@ sexp_to_key (gcry_sexp_t sexp, int want_private, const char *override_elems,
     {
       gcry_free (array);
 
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module);
     }
   else
     {
@@ -2130,9 +2171,7 @@ sexp_to_sig (gcry_sexp_t sexp, gcry_mpi_t **retarray,
       name = _gcry_sexp_nth_string (l2, 0);
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name (name);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name (name);
   gcry_free (name);
   name = NULL;
 
@@ -2158,9 +2197,7 @@ sexp_to_sig (gcry_sexp_t sexp, gcry_mpi_t **retarray,
 
   if (err)
     {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module);
 
       gcry_free (array);
     }
@@ -2394,9 +2431,7 @@ sexp_to_enc (gcry_sexp_t sexp, gcry_mpi_t **retarray, gcry_module_t *retalgo,
       l2 = NULL;
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name (name);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name (name);
 
   if (!module)
     {
@@ -2422,9 +2457,7 @@ sexp_to_enc (gcry_sexp_t sexp, gcry_mpi_t **retarray, gcry_module_t *retalgo,
 
   if (err)
     {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module);
       gcry_free (array);
       gcry_free (ctx->label);
       ctx->label = NULL;
@@ -2972,11 +3005,7 @@ gcry_pk_encrypt (gcry_sexp_t *r_ciph, gcry_sexp_t s_data, gcry_sexp_t s_pkey)
     }
 
   if (module)
-    {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
-    }
+    pk_module_put (module);
 
   gcry_free (ctx.label);
 
@@ -3097,12 +3126,8 @@ gcry_pk_decrypt (gcry_sexp_t *r_plain, gcry_sexp_t s_data, gcry_sexp_t s_skey)
 
   if (module_key || module_enc)
     {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      if (module_key)
-	_gcry_module_release (module_key);
-      if (module_enc)
-	_gcry_module_release (module_enc);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module_key);
+      pk_module_put (module_enc);
     }
 
   gcry_free (ctx.label);
@@ -3329,18 +3354,130 @@ gcry_pk_verify (gcry_sexp_t s_sig, gcry_sexp_t s_hash, gcry_sexp_t s_pkey)
 
   if (module_key || module_sig)
     {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      if (module_key)
-	_gcry_module_release (module_key);
-      if (module_sig)
-	_gcry_module_release (module_sig);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module_key);
+      pk_module_put (module_sig);
     }
 
   return gcry_error (rc);
 }
 
 
+/* Number of parsed public keys kept by gcry_pk_verify_batch.  */
+#define VERIFY_BATCH_KEYS 8
+
+/*
+   Verify a batch of signatures.
+
+   This is the same as calling gcry_pk_verify for each of the NITEMS
+   items but a public key used by several items is parsed only once.
+   Keys are recognized by the S-expression object and not by their
+   value; thus the caller should use the same object for all items
+   signed by the same key.  The result of each item is stored in the
+   array RESULTS if it is not NULL.  Returns 0 if all signatures are
+   good or the error code of the first failed item.  */
+gcry_error_t
+gcry_pk_verify_batch (const gcry_pk_verify_item_t *items, size_t nitems,
+                      gcry_error_t *results)
+{
+  struct
+  {
+    gcry_sexp_t s_pkey;
+    gcry_mpi_t *pkey;
+    gcry_module_t module;
+    unsigned int nbits;
+  } keys[VERIFY_BATCH_KEYS];
+  int nkeys = 0, oldest = 0;
+  gcry_module_t module_sig;
+  gcry_mpi_t hash, *sig;
+  struct pk_encoding_ctx ctx;
+  gcry_err_code_t rc, first_rc = 0;
+  size_t n;
+  int k;
+
+  REGISTER_DEFAULT_PUBKEYS;
+
+  for (n = 0; n < nitems; n++)
+    {
+      module_sig = NULL;
+      sig = NULL;
+      hash = NULL;
+
+      for (k = 0; k < nkeys; k++)
+        if (keys[k].s_pkey == items[n].pkey)
+          break;
+      if (k == nkeys)
+        {
+          gcry_mpi_t *pkey;
+          gcry_module_t module;
+
+          rc = sexp_to_key (items[n].pkey, 0, NULL, &pkey, &module);
+          if (rc)
+            goto next;
+
+          if (nkeys < VERIFY_BATCH_KEYS)
+            k = nkeys++;
+          else
+            {
+              /* Replace the key which has been parsed first.  */
+              k = oldest;
+              oldest = (oldest + 1) % VERIFY_BATCH_KEYS;
+              release_mpi_array (keys[k].pkey);
+              gcry_free (keys[k].pkey);
+              pk_module_put (keys[k].module);
+            }
+          keys[k].s_pkey = items[n].pkey;
+          keys[k].pkey = pkey;
+          keys[k].module = module;
+          keys[k].nbits = ((gcry_pk_spec_t *) module->spec)->get_nbits
+            (module->mod_id, pkey);
+        }
+
+      rc = sexp_to_sig (items[n].sigval, &sig, &module_sig);
+      if (rc)
+        goto next;
+
+      if (keys[k].module->mod_id != module_sig->mod_id)
+        {
+          rc = GPG_ERR_CONFLICT;
+          goto next;
+        }
+
+      init_encoding_ctx (&ctx, PUBKEY_OP_VERIFY, keys[k].nbits);
+      rc = sexp_data_to_mpi (items[n].data, &hash, &ctx);
+      if (rc)
+        goto next;
+
+      rc = pubkey_verify (keys[k].module->mod_id, hash, sig, keys[k].pkey,
+                          ctx.verify_cmp, &ctx);
+
+    next:
+      if (sig)
+        {
+          release_mpi_array (sig);
+          gcry_free (sig);
+        }
+      if (hash)
+        mpi_free (hash);
+      if (module_sig)
+        pk_module_put (module_sig);
+
+      if (results)
+        results[n] = gcry_error (rc);
+      if (rc && !first_rc)
+        first_rc = rc;
+    }
+
+  for (k = 0; k < nkeys; k++)
+    {
+      release_mpi_array (keys[k].pkey);
+      gcry_free (keys[k].pkey);
+      pk_module_put (keys[k].module);
+    }
+
+  return gcry_error (first_rc);
+}
+
+
 /*
    Test a key.
 
@@ -3454,9 +3591,7 @@ gcry_pk_genkey (gcry_sexp_t *r_key, gcry_sexp_t s_parms)
       goto leave;
     }
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name (name);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name (name);
   gcry_free (name);
   name = NULL;
   if (!module)
@@ -3663,11 +3798,7 @@ gcry_pk_genkey (gcry_sexp_t *r_key, gcry_sexp_t s_parms)
   gcry_sexp_release (list);
 
   if (module)
-    {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
-    }
+    pk_module_put (module);
 
   return gcry_error (rc);
 }
@@ -3698,9 +3829,7 @@ gcry_pk_get_nbits (gcry_sexp_t key)
   pubkey = (gcry_pk_spec_t *) module->spec;
   nbits = (*pubkey->get_nbits) (module->mod_id, keyarr);
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  _gcry_module_release (module);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  pk_module_put (module);
 
   release_mpi_array (keyarr);
   gcry_free (keyarr);
@@ -3752,9 +3881,7 @@ gcry_pk_get_keygrip (gcry_sexp_t key, unsigned char *array)
   if (!name)
     goto fail; /* Invalid structure of object. */
 
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name (name);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name (name);
 
   if (!module)
     goto fail; /* Unknown algorithm.  */
@@ -3867,9 +3994,7 @@ gcry_pk_get_curve (gcry_sexp_t key, int iterator, unsigned int *r_nbits)
     }
   else
     {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      module = gcry_pk_lookup_name ("ecc");
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      module = pk_module_get_name ("ecc");
       if (!module)
         goto leave;
     }
@@ -3887,11 +4012,7 @@ gcry_pk_get_curve (gcry_sexp_t key, int iterator, unsigned int *r_nbits)
       gcry_free (pkey);
     }
   if (module)
-    {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
-    }
+    pk_module_put (module);
   gcry_free (name);
   gcry_sexp_release (list);
   return result;
@@ -3909,20 +4030,14 @@ gcry_pk_get_param (int algo, const char *name)
   if (algo != GCRY_PK_ECDSA && algo != GCRY_PK_ECDH)
     return NULL;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = gcry_pk_lookup_name ("ecc");
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  module = pk_module_get_name ("ecc");
   if (module)
     {
       extraspec = module->extraspec;
       if (extraspec && extraspec->get_curve_param)
         result = extraspec->get_curve_param (name);
 
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
+      pk_module_put (module);
     }
   return result;
 }
@@ -3998,16 +4113,12 @@ gcry_pk_algo_info (int algorithm, int what, void *buffer, size_t *nbytes)
 	gcry_module_t pubkey;
 	int use = 0;
 
-	REGISTER_DEFAULT_PUBKEYS;
-
-	ath_mutex_lock (&pubkeys_registered_lock);
-	pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+	pubkey = pk_module_get (algorithm);
 	if (pubkey)
 	  {
 	    use = ((gcry_pk_spec_t *) pubkey->spec)->use;
-	    _gcry_module_release (pubkey);
+	    pk_module_put (pubkey);
 	  }
-	ath_mutex_unlock (&pubkeys_registered_lock);
 
 	/* FIXME? */
 	*nbytes = use;
@@ -4070,15 +4181,11 @@ _gcry_pk_module_lookup (int algorithm, gcry_module_t *module)
   gcry_err_code_t err = GPG_ERR_NO_ERROR;
   gcry_module_t pubkey;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algorithm);
+  pubkey = pk_module_get (algorithm);
   if (pubkey)
     *module = pubkey;
   else
     err = GPG_ERR_PUBKEY_ALGO;
-  ath_mutex_unlock (&pubkeys_registered_lock);
 
   return err;
 }
@@ -4087,9 +4194,7 @@ _gcry_pk_module_lookup (int algorithm, gcry_module_t *module)
 void
 _gcry_pk_module_release (gcry_module_t module)
 {
-  ath_mutex_lock (&pubkeys_registered_lock);
-  _gcry_module_release (module);
-  ath_mutex_unlock (&pubkeys_registered_lock);
+  pk_module_put (module);
 }
 
 /* Get a list consisting of the IDs of the loaded pubkey modules.  If
@@ -4120,13 +4225,9 @@ _gcry_pk_selftest (int algo, int extended, selftest_report_func_t report)
   pk_extra_spec_t *extraspec = NULL;
   gcry_err_code_t ec = 0;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
-  ath_mutex_lock (&pubkeys_registered_lock);
-  module = _gcry_module_lookup_id (pubkeys_registered, algo);
+  module = pk_module_get (algo);
   if (module && !(module->flags & FLAG_MODULE_DISABLED))
     extraspec = module->extraspec;
-  ath_mutex_unlock (&pubkeys_registered_lock);
   if (extraspec && extraspec->selftest)
     ec = extraspec->selftest (algo, extended, report);
   else
@@ -4140,11 +4241,7 @@ _gcry_pk_selftest (int algo, int extended, selftest_report_func_t report)
     }
 
   if (module)
-    {
-      ath_mutex_lock (&pubkeys_registered_lock);
-      _gcry_module_release (module);
-      ath_mutex_unlock (&pubkeys_registered_lock);
-    }
+    pk_module_put (module);
   return gpg_error (ec);
 }
 
@@ -4159,13 +4256,11 @@ _gcry_pk_get_elements (int algo, char **enc, char **sig)
   char *enc_cp;
   char *sig_cp;
 
-  REGISTER_DEFAULT_PUBKEYS;
-
   enc_cp = NULL;
   sig_cp = NULL;
   spec = NULL;
 
-  pubkey = _gcry_module_lookup_id (pubkeys_registered, algo);
+  pubkey = pk_module_get (algo);
   if (! pubkey)
     {
       err = GPG_ERR_INTERNAL;
@@ -4201,7 +4296,7 @@ _gcry_pk_get_elements (int algo, char **enc, char **sig)
 
  out:
 
-  _gcry_module_release (pubkey);
+  pk_module_put (pubkey);
   if (err)
     {
       free (enc_cp);
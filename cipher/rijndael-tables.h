@@ -1684,3 +1684,145 @@ static const u32 rcon[30] =
     0xd8, 0xab, 0x4d, 0x9a, 0x2f, 0x5e, 0xbc, 0x63, 0xc6, 0x97, 0x35,
     0x6a, 0xd4, 0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91
   };
+
+
+#ifdef USE_SSSE3
+/* Tables for the vector permute implementation using the SSSE3 PSHUFB
+   instruction.  The state is kept in a representation of GF(2^8) as
+   GF(2^4)[Y]/(Y^2 + 2Y + 2), where GF(2^4) uses the polynomial
+   x^4 + x + 1; the high nibble of a byte is the coefficient of Y.
+   In this representation the inversion of the S-box can be computed
+   with only 16 entry lookups and XORs, and every lookup is done by
+   PSHUFB on all 16 bytes of the state at once.  Thus no table access
+   depends on the key or the data.  An index with the high bit set
+   yields a zero (this is used for 1/0 = 0x80).  */
+
+/* The low nibble mask and the nibble inverse tables 1/x and 2/x.  */
+static const unsigned char vp_mask[16] ATTR_ALIGNED_16 =
+  { 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f };
+
+static const unsigned char vp_inv[16] ATTR_ALIGNED_16 =
+  { 0x80, 0x01, 0x09, 0x0e, 0x0d, 0x0b, 0x07, 0x06,
+    0x0f, 0x02, 0x0c, 0x05, 0x0a, 0x04, 0x03, 0x08 };
+
+static const unsigned char vp_inva[16] ATTR_ALIGNED_16 =
+  { 0x80, 0x02, 0x01, 0x0f, 0x09, 0x05, 0x0e, 0x0c,
+    0x0d, 0x04, 0x0b, 0x0a, 0x07, 0x08, 0x06, 0x03 };
+
+/* Change of representation for the input block, indexed by the low
+   and the high nibble.  For decryption this includes the inverse of
+   the affine transformation of the S-box.  */
+static const unsigned char vp_enc_ipt[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x01, 0x1c, 0x1d, 0x2d, 0x2c, 0x31, 0x30,
+      0x27, 0x26, 0x3b, 0x3a, 0x0a, 0x0b, 0x16, 0x17 },
+    { 0x00, 0x86, 0xfd, 0x7b, 0x8e, 0x08, 0x73, 0xf5,
+      0x77, 0xf1, 0x8a, 0x0c, 0xf9, 0x7f, 0x04, 0x82 }
+  };
+
+static const unsigned char vp_dec_ipt[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0xb5, 0xdc, 0x69, 0xdb, 0x6e, 0x07, 0xb2,
+      0x14, 0xa1, 0xc8, 0x7d, 0xcf, 0x7a, 0x13, 0xa6 },
+    { 0x00, 0xa7, 0xa8, 0x0f, 0xed, 0x4a, 0x45, 0xe2,
+      0xd1, 0x76, 0x79, 0xde, 0x3c, 0x9b, 0x94, 0x33 }
+  };
+
+/* Output tables indexed by the two values returned by the inversion.
+   They yield S(x) and 2*S(x) in the internal representation but
+   without the constant 0x63 of the S-box; that constant is folded
+   into the round keys.  vp_sbo is used in the last round and yields
+   the standard representation.  */
+static const unsigned char vp_sb1[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0xc3, 0x4f, 0x0c, 0xfc, 0x7c, 0x43, 0x80,
+      0xcf, 0x33, 0x3f, 0x70, 0xbf, 0xb3, 0xf0, 0x8c },
+    { 0x00, 0xe6, 0x72, 0xb7, 0xe5, 0xc6, 0xc5, 0x23,
+      0x51, 0xb4, 0x03, 0x71, 0x20, 0x97, 0x52, 0x94 }
+  };
+
+static const unsigned char vp_sb2[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x7c, 0x20, 0xcf, 0x92, 0x01, 0xef, 0x93,
+      0xb3, 0x21, 0xee, 0xce, 0x7d, 0xb2, 0x5d, 0x5c },
+    { 0x00, 0xd1, 0xe5, 0xf7, 0xe6, 0x25, 0x12, 0xc3,
+      0x26, 0xc0, 0x37, 0xd2, 0xf4, 0x03, 0x11, 0x34 }
+  };
+
+static const unsigned char vp_sbo[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0xcb, 0xd7, 0xb0, 0x21, 0x8d, 0x67, 0xac,
+      0x7b, 0x5a, 0xea, 0x3d, 0x46, 0xf6, 0x91, 0x1c },
+    { 0x00, 0x9f, 0x61, 0x16, 0xc2, 0x2a, 0x77, 0xe8,
+      0x89, 0x4b, 0x5d, 0x3c, 0xb5, 0xa3, 0xd4, 0xfe }
+  };
+
+/* Ditto for decryption; these yield 14, 11, 13 and 9 times the
+   inverse S-box.  */
+static const unsigned char vp_dsb14[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0xeb, 0xa6, 0xb9, 0x7b, 0x8f, 0x1f, 0xf4,
+      0x52, 0x29, 0x90, 0x36, 0x64, 0xdd, 0xc2, 0x4d },
+    { 0x00, 0xfd, 0xdf, 0x65, 0x9d, 0xda, 0xba, 0x47,
+      0x98, 0x05, 0x60, 0xbf, 0x27, 0x42, 0xf8, 0x22 }
+  };
+
+static const unsigned char vp_dsb11[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0xc2, 0x4d, 0xeb, 0xdd, 0xb9, 0xa6, 0x64,
+      0x29, 0xf4, 0x1f, 0x52, 0x7b, 0x90, 0x36, 0x8f },
+    { 0x00, 0xf8, 0x22, 0xfd, 0x42, 0x65, 0xdf, 0x27,
+      0x05, 0x47, 0xba, 0x98, 0x9d, 0x60, 0xbf, 0xda }
+  };
+
+static const unsigned char vp_dsb13[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x7c, 0x1b, 0x3d, 0x15, 0x4f, 0x26, 0x5a,
+      0x41, 0x54, 0x69, 0x72, 0x33, 0x0e, 0x28, 0x67 },
+    { 0x00, 0x77, 0xb2, 0xb0, 0xb6, 0xc3, 0x02, 0x75,
+      0xc7, 0x71, 0xc1, 0x73, 0xb4, 0x04, 0x06, 0xc5 }
+  };
+
+static const unsigned char vp_dsb9[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x27, 0xbf, 0x47, 0xda, 0x05, 0xf8, 0xdf,
+      0x60, 0xba, 0xfd, 0x42, 0x22, 0x65, 0x9d, 0x98 },
+    { 0x00, 0x01, 0x8c, 0x2e, 0xa8, 0x0b, 0xa2, 0xa3,
+      0x2f, 0x87, 0xa9, 0x25, 0x0a, 0x24, 0x86, 0x8d }
+  };
+
+static const unsigned char vp_dsbo[2][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x3b, 0xe4, 0xc8, 0x03, 0x14, 0x2c, 0x17,
+      0xf3, 0xf0, 0x38, 0xdc, 0x2f, 0xe7, 0xcb, 0xdf },
+    { 0x00, 0x24, 0x91, 0x19, 0x23, 0x8f, 0x88, 0xac,
+      0x3d, 0x1e, 0x07, 0x96, 0xab, 0xb2, 0x3a, 0xb5 }
+  };
+
+/* ShiftRows combined with the rotations of MixColumns; same for the
+   inverse operations.  */
+static const unsigned char vp_mc[4][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x05, 0x0a, 0x0f, 0x04, 0x09, 0x0e, 0x03,
+      0x08, 0x0d, 0x02, 0x07, 0x0c, 0x01, 0x06, 0x0b },
+    { 0x05, 0x0a, 0x0f, 0x00, 0x09, 0x0e, 0x03, 0x04,
+      0x0d, 0x02, 0x07, 0x08, 0x01, 0x06, 0x0b, 0x0c },
+    { 0x0a, 0x0f, 0x00, 0x05, 0x0e, 0x03, 0x04, 0x09,
+      0x02, 0x07, 0x08, 0x0d, 0x06, 0x0b, 0x0c, 0x01 },
+    { 0x0f, 0x00, 0x05, 0x0a, 0x03, 0x04, 0x09, 0x0e,
+      0x07, 0x08, 0x0d, 0x02, 0x0b, 0x0c, 0x01, 0x06 }
+  };
+
+static const unsigned char vp_imc[4][16] ATTR_ALIGNED_16 =
+  {
+    { 0x00, 0x0d, 0x0a, 0x07, 0x04, 0x01, 0x0e, 0x0b,
+      0x08, 0x05, 0x02, 0x0f, 0x0c, 0x09, 0x06, 0x03 },
+    { 0x0d, 0x0a, 0x07, 0x00, 0x01, 0x0e, 0x0b, 0x04,
+      0x05, 0x02, 0x0f, 0x08, 0x09, 0x06, 0x03, 0x0c },
+    { 0x0a, 0x07, 0x00, 0x0d, 0x0e, 0x0b, 0x04, 0x01,
+      0x02, 0x0f, 0x08, 0x05, 0x06, 0x03, 0x0c, 0x09 },
+    { 0x07, 0x00, 0x0d, 0x0a, 0x0b, 0x04, 0x01, 0x0e,
+      0x0f, 0x08, 0x05, 0x02, 0x03, 0x0c, 0x09, 0x06 }
+  };
+#endif /*USE_SSSE3*/
@@ -45,6 +45,7 @@
 #include "types.h"  /* for byte and u32 typedefs */
 #include "g10lib.h"
 #include "cipher.h"
+#include "bufhelp.h"
 
 #define MAXKC			(256/32)
 #define MAXROUNDS		14
@@ -73,11 +74,23 @@
    gcc 3.  However, to be on the safe side we require at least gcc 4.  */
 #undef USE_AESNI
 #ifdef ENABLE_AESNI_SUPPORT
-# if defined (__i386__) && SIZEOF_UNSIGNED_LONG == 4 && __GNUC__ >= 4
+# if ((defined (__i386__) && SIZEOF_UNSIGNED_LONG == 4) \
+      || defined (__x86_64__)) && __GNUC__ >= 4
 #  define USE_AESNI 1
 # endif
 #endif /* ENABLE_AESNI_SUPPORT */
 
+/* USE_SSSE3 indicates whether to compile with the vector permute
+   implementation using the Intel SSSE3 instructions.  It is used if
+   AES-NI is not available.  */
+#undef USE_SSSE3
+#ifdef ENABLE_SSSE3_SUPPORT
+# if ((defined (__i386__) && SIZEOF_UNSIGNED_LONG == 4) \
+      || defined (__x86_64__)) && __GNUC__ >= 4
+#  define USE_SSSE3 1
+# endif
+#endif /*ENABLE_SSSE3_SUPPORT*/
+
 #ifdef USE_AESNI
   typedef int m128i_t __attribute__ ((__vector_size__ (16)));
 #endif /*USE_AESNI*/
@@ -124,6 +137,9 @@ typedef struct
 #ifdef USE_AESNI
   int use_aesni;            /* AES-NI shall be used.  */
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  int use_ssse3;            /* SSSE3 shall be used.  */
+#endif /*USE_SSSE3*/
 } RIJNDAEL_context ATTR_ALIGNED_16;
 
 /* Macros defining alias for the keyschedules.  */
@@ -147,11 +163,37 @@ typedef struct
                      "pxor %%xmm3, %%xmm3\n"                            \
                      "pxor %%xmm4, %%xmm4\n":: );                       \
   } while (0)
+# define aesni_cleanup_5()                                              \
+  do { asm volatile ("pxor %%xmm5, %%xmm5\n":: ); } while (0)
+# define aesni_cleanup_6_7()                                            \
+  do { asm volatile ("pxor %%xmm6, %%xmm6\n\t"                          \
+                     "pxor %%xmm7, %%xmm7\n":: );                       \
+  } while (0)
+# ifdef __x86_64__
+#  define aesni_cleanup_8_11()                                          \
+  do { asm volatile ("pxor %%xmm8, %%xmm8\n\t"                          \
+                     "pxor %%xmm9, %%xmm9\n\t"                          \
+                     "pxor %%xmm10, %%xmm10\n\t"                        \
+                     "pxor %%xmm11, %%xmm11\n":: );                     \
+  } while (0)
+# endif
 #else
 # define aesni_prepare() do { } while (0)
 # define aesni_cleanup() do { } while (0)
 #endif
 
+/* Ditto for the SSSE3 code, which uses the registers xmm0 to xmm4.  */
+#ifdef USE_SSSE3
+# define ssse3_prepare() do { } while (0)
+# define ssse3_cleanup()                                                \
+  do { asm volatile ("pxor %%xmm0, %%xmm0\n\t"                          \
+                     "pxor %%xmm1, %%xmm1\n\t"                          \
+                     "pxor %%xmm2, %%xmm2\n\t"                          \
+                     "pxor %%xmm3, %%xmm3\n\t"                          \
+                     "pxor %%xmm4, %%xmm4\n":: );                       \
+  } while (0)
+#endif /*USE_SSSE3*/
+
 
 /* All the numbers.  */
 #include "rijndael-tables.h"
@@ -170,6 +212,11 @@ static void do_aesni_ctr_4 (const RIJNDAEL_context *ctx, unsigned char *ctr,
   __attribute__ ((__noinline__));
 #endif /*USE_AESNI*/
 
+#ifdef USE_SSSE3
+static void do_ssse3_sub_word (byte *w);
+static void prepare_ssse3_keys (RIJNDAEL_context *ctx);
+#endif /*USE_SSSE3*/
+
 static const char *selftest(void);
 
 
@@ -196,6 +243,9 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
     byte tk[MAXKC][4];
   } tk;
 #define tk tk.tk
+#ifdef USE_SSSE3
+  byte sw[4];
+#endif /*USE_SSSE3*/
 
   /* The on-the-fly self tests are only run in non-fips mode. In fips
      mode explicit self-tests are required.  Actually the on-the-fly
@@ -221,6 +271,9 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
 #ifdef USE_AESNI
   ctx->use_aesni = 0;
 #endif
+#ifdef USE_SSSE3
+  ctx->use_ssse3 = 0;
+#endif
 
   if( keylen == 128/8 )
     {
@@ -243,6 +296,12 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
         {
           ctx->use_aesni = 1;
         }
+#endif
+#ifdef USE_SSSE3
+      else if ((_gcry_get_hw_features () & HWF_INTEL_SSSE3))
+        {
+          ctx->use_ssse3 = 1;
+        }
 #endif
     }
   else if ( keylen == 192/8 )
@@ -259,6 +318,12 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
         {
           ctx->use_aesni = 1;
         }
+#endif
+#ifdef USE_SSSE3
+      else if ((_gcry_get_hw_features () & HWF_INTEL_SSSE3))
+        {
+          ctx->use_ssse3 = 1;
+        }
 #endif
     }
   else if ( keylen == 256/8 )
@@ -275,6 +340,12 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
         {
           ctx->use_aesni = 1;
         }
+#endif
+#ifdef USE_SSSE3
+      else if ((_gcry_get_hw_features () & HWF_INTEL_SSSE3))
+        {
+          ctx->use_ssse3 = 1;
+        }
 #endif
     }
   else
@@ -382,10 +453,24 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
         {
           /* While not enough round key material calculated calculate
              new values.  */
-          tk[0][0] ^= S[tk[KC-1][1]];
-          tk[0][1] ^= S[tk[KC-1][2]];
-          tk[0][2] ^= S[tk[KC-1][3]];
-          tk[0][3] ^= S[tk[KC-1][0]];
+#ifdef USE_SSSE3
+          if (ctx->use_ssse3)
+            {
+              memcpy (sw, tk[KC-1], 4);
+              do_ssse3_sub_word (sw);
+              tk[0][0] ^= sw[1];
+              tk[0][1] ^= sw[2];
+              tk[0][2] ^= sw[3];
+              tk[0][3] ^= sw[0];
+            }
+          else
+#endif /*USE_SSSE3*/
+            {
+              tk[0][0] ^= S[tk[KC-1][1]];
+              tk[0][1] ^= S[tk[KC-1][2]];
+              tk[0][2] ^= S[tk[KC-1][3]];
+              tk[0][3] ^= S[tk[KC-1][0]];
+            }
           tk[0][0] ^= rcon[rconpointer++];
 
           if (KC != 8)
@@ -401,10 +486,24 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
                 {
                   *((u32_a_t*)tk[j]) ^= *((u32_a_t*)tk[j-1]);
                 }
-              tk[KC/2][0] ^= S[tk[KC/2 - 1][0]];
-              tk[KC/2][1] ^= S[tk[KC/2 - 1][1]];
-              tk[KC/2][2] ^= S[tk[KC/2 - 1][2]];
-              tk[KC/2][3] ^= S[tk[KC/2 - 1][3]];
+#ifdef USE_SSSE3
+              if (ctx->use_ssse3)
+                {
+                  memcpy (sw, tk[KC/2 - 1], 4);
+                  do_ssse3_sub_word (sw);
+                  tk[KC/2][0] ^= sw[0];
+                  tk[KC/2][1] ^= sw[1];
+                  tk[KC/2][2] ^= sw[2];
+                  tk[KC/2][3] ^= sw[3];
+                }
+              else
+#endif /*USE_SSSE3*/
+                {
+                  tk[KC/2][0] ^= S[tk[KC/2 - 1][0]];
+                  tk[KC/2][1] ^= S[tk[KC/2 - 1][1]];
+                  tk[KC/2][2] ^= S[tk[KC/2 - 1][2]];
+                  tk[KC/2][3] ^= S[tk[KC/2 - 1][3]];
+                }
               for (j = KC/2 + 1; j < KC; j++)
                 {
                   *((u32_a_t*)tk[j]) ^= *((u32_a_t*)tk[j-1]);
@@ -426,6 +525,16 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
             }
         }
 #undef W
+
+#ifdef USE_SSSE3
+      if (ctx->use_ssse3)
+        {
+          prepare_ssse3_keys (ctx);
+          ctx->decryption_prepared = 1;
+          ssse3_cleanup ();
+          wipememory (sw, sizeof sw);
+        }
+#endif /*USE_SSSE3*/
     }
 
   return 0;
@@ -515,6 +624,72 @@ prepare_decryption( RIJNDAEL_context *ctx )
     }
 }
 
+
+#ifdef USE_SSSE3
+/* Multiply X by 2 in GF(2^8) without a data dependent branch.  */
+#define vp_xtime(x)  ((((x) << 1) ^ (0x1b & -((x) >> 7))) & 0xff)
+
+/* Change the representation of byte X using the nibble tables TBL.
+   The tables are 16 bytes each and thus the lookups do not reveal
+   anything via the cache.  */
+#define vp_transform(tbl, x)  ((tbl)[0][(x) & 15] ^ (tbl)[1][(x) >> 4])
+
+/* Convert the standard key schedule into the ones used by the SSSE3
+   code.  The constants of the S-box are folded into the round keys:
+   0x6e is the constant 0x63 and 0x2c the constant 0x05 of the
+   inverse S-box in the internal representation.  The decryption key
+   schedule is prepared right away.  */
+static void
+prepare_ssse3_keys (RIJNDAEL_context *ctx)
+{
+  int rounds = ctx->rounds;
+  byte *ek = ctx->keyschenc[0][0];
+  byte *dk = ctx->keyschdec[0][0];
+  byte m[4][4];
+  byte a, a2, a4, a8;
+  int r, c, i;
+
+  /* The decryption keys are those of the equivalent inverse cipher.
+     They need to be computed before the encryption keys are
+     converted.  */
+  for (i = 0; i < 16; i++)
+    dk[i] = vp_transform (vp_dec_ipt, ek[16*rounds + i]) ^ 0x2c;
+  for (r = 1; r < rounds; r++)
+    for (c = 0; c < 16; c += 4)
+      {
+        for (i = 0; i < 4; i++)
+          {
+            a  = ek[16*(rounds - r) + c + i];
+            a2 = vp_xtime (a);
+            a4 = vp_xtime (a2);
+            a8 = vp_xtime (a4);
+            m[i][0] = a8 ^ a4 ^ a2;   /* 14 * a  */
+            m[i][1] = a8 ^ a2 ^ a;    /* 11 * a  */
+            m[i][2] = a8 ^ a4 ^ a;    /* 13 * a  */
+            m[i][3] = a8 ^ a;         /*  9 * a  */
+          }
+        for (i = 0; i < 4; i++)
+          {
+            a = (m[i][0] ^ m[(i+1)&3][1] ^ m[(i+2)&3][2] ^ m[(i+3)&3][3]);
+            dk[16*r + c + i] = vp_transform (vp_dec_ipt, a) ^ 0x2c;
+          }
+      }
+  memcpy (dk + 16*rounds, ek, 16);
+
+  for (i = 0; i < 16; i++)
+    ek[i] = vp_transform (vp_enc_ipt, ek[i]);
+  for (r = 1; r < rounds; r++)
+    for (i = 0; i < 16; i++)
+      ek[16*r + i] = vp_transform (vp_enc_ipt, ek[16*r + i]) ^ 0x6e;
+  for (i = 0; i < 16; i++)
+    ek[16*rounds + i] ^= 0x63;
+
+  wipememory (m, sizeof m);
+}
+#undef vp_xtime
+#undef vp_transform
+#endif /*USE_SSSE3*/
+
 
 /* Encrypt one block.  A and B need to be aligned on a 4 byte
    boundary.  A and B may be the same. */
@@ -706,40 +881,39 @@ do_aesni_enc_aligned (const RIJNDAEL_context *ctx,
      aligned but that is a special case.  We should better implement
      CFB direct in asm.  */
   asm volatile ("movdqu %[src], %%xmm0\n\t"     /* xmm0 := *a     */
-                "movl   %[key], %%esi\n\t"      /* esi  := keyschenc */
-                "movdqa (%%esi), %%xmm1\n\t"    /* xmm1 := key[0] */
+                "movdqa (%[key]), %%xmm1\n\t"    /* xmm1 := key[0] */
                 "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 ^= key[0] */
-                "movdqa 0x10(%%esi), %%xmm1\n\t"
+                "movdqa 0x10(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x20(%%esi), %%xmm1\n\t"
+                "movdqa 0x20(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x30(%%esi), %%xmm1\n\t"
+                "movdqa 0x30(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x40(%%esi), %%xmm1\n\t"
+                "movdqa 0x40(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x50(%%esi), %%xmm1\n\t"
+                "movdqa 0x50(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x60(%%esi), %%xmm1\n\t"
+                "movdqa 0x60(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x70(%%esi), %%xmm1\n\t"
+                "movdqa 0x70(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x80(%%esi), %%xmm1\n\t"
+                "movdqa 0x80(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x90(%%esi), %%xmm1\n\t"
+                "movdqa 0x90(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xa0(%%esi), %%xmm1\n\t"
+                "movdqa 0xa0(%[key]), %%xmm1\n\t"
                 "cmp $10, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xb0(%%esi), %%xmm1\n\t"
+                "movdqa 0xb0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xc0(%%esi), %%xmm1\n\t"
+                "movdqa 0xc0(%[key]), %%xmm1\n\t"
                 "cmp $12, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xd0(%%esi), %%xmm1\n\t"
+                "movdqa 0xd0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xe0(%%esi), %%xmm1\n"
+                "movdqa 0xe0(%[key]), %%xmm1\n"
 
                 ".Lenclast%=:\n\t"
                 aesenclast_xmm1_xmm0
@@ -748,7 +922,7 @@ do_aesni_enc_aligned (const RIJNDAEL_context *ctx,
                 : [src] "m" (*a),
                   [key] "r" (ctx->keyschenc),
                   [rounds] "r" (ctx->rounds)
-                : "%esi", "cc", "memory");
+                : "cc", "memory");
 #undef aesenc_xmm1_xmm0
 #undef aesenclast_xmm1_xmm0
 }
@@ -761,40 +935,39 @@ do_aesni_dec_aligned (const RIJNDAEL_context *ctx,
 #define aesdec_xmm1_xmm0      ".byte 0x66, 0x0f, 0x38, 0xde, 0xc1\n\t"
 #define aesdeclast_xmm1_xmm0  ".byte 0x66, 0x0f, 0x38, 0xdf, 0xc1\n\t"
   asm volatile ("movdqu %[src], %%xmm0\n\t"     /* xmm0 := *a     */
-                "movl   %[key], %%esi\n\t"
-                "movdqa (%%esi), %%xmm1\n\t"
+                "movdqa (%[key]), %%xmm1\n\t"
                 "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 ^= key[0] */
-                "movdqa 0x10(%%esi), %%xmm1\n\t"
+                "movdqa 0x10(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x20(%%esi), %%xmm1\n\t"
+                "movdqa 0x20(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x30(%%esi), %%xmm1\n\t"
+                "movdqa 0x30(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x40(%%esi), %%xmm1\n\t"
+                "movdqa 0x40(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x50(%%esi), %%xmm1\n\t"
+                "movdqa 0x50(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x60(%%esi), %%xmm1\n\t"
+                "movdqa 0x60(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x70(%%esi), %%xmm1\n\t"
+                "movdqa 0x70(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x80(%%esi), %%xmm1\n\t"
+                "movdqa 0x80(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0x90(%%esi), %%xmm1\n\t"
+                "movdqa 0x90(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0xa0(%%esi), %%xmm1\n\t"
+                "movdqa 0xa0(%[key]), %%xmm1\n\t"
                 "cmp $10, %[rounds]\n\t"
                 "jz .Ldeclast%=\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0xb0(%%esi), %%xmm1\n\t"
+                "movdqa 0xb0(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0xc0(%%esi), %%xmm1\n\t"
+                "movdqa 0xc0(%[key]), %%xmm1\n\t"
                 "cmp $12, %[rounds]\n\t"
                 "jz .Ldeclast%=\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0xd0(%%esi), %%xmm1\n\t"
+                "movdqa 0xd0(%[key]), %%xmm1\n\t"
                 aesdec_xmm1_xmm0
-                "movdqa 0xe0(%%esi), %%xmm1\n"
+                "movdqa 0xe0(%[key]), %%xmm1\n"
 
                 ".Ldeclast%=:\n\t"
                 aesdeclast_xmm1_xmm0
@@ -803,7 +976,7 @@ do_aesni_dec_aligned (const RIJNDAEL_context *ctx,
                 : [src] "m" (*a),
                   [key] "r" (ctx->keyschdec),
                   [rounds] "r" (ctx->rounds)
-                : "%esi", "cc", "memory");
+                : "cc", "memory");
 #undef aesdec_xmm1_xmm0
 #undef aesdeclast_xmm1_xmm0
 }
@@ -820,47 +993,46 @@ do_aesni_cfb (const RIJNDAEL_context *ctx, int decrypt_flag,
 #define aesenc_xmm1_xmm0      ".byte 0x66, 0x0f, 0x38, 0xdc, 0xc1\n\t"
 #define aesenclast_xmm1_xmm0  ".byte 0x66, 0x0f, 0x38, 0xdd, 0xc1\n\t"
   asm volatile ("movdqa %[iv], %%xmm0\n\t"      /* xmm0 := IV     */
-                "movl   %[key], %%esi\n\t"      /* esi  := keyschenc */
-                "movdqa (%%esi), %%xmm1\n\t"    /* xmm1 := key[0] */
+                "movdqa (%[key]), %%xmm1\n\t"    /* xmm1 := key[0] */
                 "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 ^= key[0] */
-                "movdqa 0x10(%%esi), %%xmm1\n\t"
+                "movdqa 0x10(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x20(%%esi), %%xmm1\n\t"
+                "movdqa 0x20(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x30(%%esi), %%xmm1\n\t"
+                "movdqa 0x30(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x40(%%esi), %%xmm1\n\t"
+                "movdqa 0x40(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x50(%%esi), %%xmm1\n\t"
+                "movdqa 0x50(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x60(%%esi), %%xmm1\n\t"
+                "movdqa 0x60(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x70(%%esi), %%xmm1\n\t"
+                "movdqa 0x70(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x80(%%esi), %%xmm1\n\t"
+                "movdqa 0x80(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x90(%%esi), %%xmm1\n\t"
+                "movdqa 0x90(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xa0(%%esi), %%xmm1\n\t"
+                "movdqa 0xa0(%[key]), %%xmm1\n\t"
                 "cmp $10, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xb0(%%esi), %%xmm1\n\t"
+                "movdqa 0xb0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xc0(%%esi), %%xmm1\n\t"
+                "movdqa 0xc0(%[key]), %%xmm1\n\t"
                 "cmp $12, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xd0(%%esi), %%xmm1\n\t"
+                "movdqa 0xd0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xe0(%%esi), %%xmm1\n"
+                "movdqa 0xe0(%[key]), %%xmm1\n"
 
                 ".Lenclast%=:\n\t"
                 aesenclast_xmm1_xmm0
                 "movdqu %[src], %%xmm1\n\t"      /* Save input.  */
                 "pxor %%xmm1, %%xmm0\n\t"        /* xmm0 = input ^ IV  */
 
-                "cmp $1, %[decrypt]\n\t"
+                "cmpl $1, %[decrypt]\n\t"
                 "jz .Ldecrypt_%=\n\t"
                 "movdqa %%xmm0, %[iv]\n\t"       /* [encrypt] Store IV.  */
                 "jmp .Lleave_%=\n"
@@ -870,10 +1042,10 @@ do_aesni_cfb (const RIJNDAEL_context *ctx, int decrypt_flag,
                 "movdqu %%xmm0, %[dst]\n"        /* Store output.   */
                 : [iv] "+m" (*iv), [dst] "=m" (*b)
                 : [src] "m" (*a),
-                  [key] "g" (ctx->keyschenc),
-                  [rounds] "g" (ctx->rounds),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds),
                   [decrypt] "m" (decrypt_flag)
-                : "%esi", "cc", "memory");
+                : "cc", "memory");
 #undef aesenc_xmm1_xmm0
 #undef aesenclast_xmm1_xmm0
 }
@@ -899,40 +1071,39 @@ do_aesni_ctr (const RIJNDAEL_context *ctx,
                 "pshufb %[mask], %%xmm2\n\t"
                 "movdqa %%xmm2, %[ctr]\n"       /* Update CTR.         */
 
-                "movl   %[key], %%esi\n\t"      /* esi  := keyschenc */
-                "movdqa (%%esi), %%xmm1\n\t"    /* xmm1 := key[0]    */
+                "movdqa (%[key]), %%xmm1\n\t"    /* xmm1 := key[0]    */
                 "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 ^= key[0]    */
-                "movdqa 0x10(%%esi), %%xmm1\n\t"
+                "movdqa 0x10(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x20(%%esi), %%xmm1\n\t"
+                "movdqa 0x20(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x30(%%esi), %%xmm1\n\t"
+                "movdqa 0x30(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x40(%%esi), %%xmm1\n\t"
+                "movdqa 0x40(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x50(%%esi), %%xmm1\n\t"
+                "movdqa 0x50(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x60(%%esi), %%xmm1\n\t"
+                "movdqa 0x60(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x70(%%esi), %%xmm1\n\t"
+                "movdqa 0x70(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x80(%%esi), %%xmm1\n\t"
+                "movdqa 0x80(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0x90(%%esi), %%xmm1\n\t"
+                "movdqa 0x90(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xa0(%%esi), %%xmm1\n\t"
+                "movdqa 0xa0(%[key]), %%xmm1\n\t"
                 "cmp $10, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xb0(%%esi), %%xmm1\n\t"
+                "movdqa 0xb0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xc0(%%esi), %%xmm1\n\t"
+                "movdqa 0xc0(%[key]), %%xmm1\n\t"
                 "cmp $12, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xd0(%%esi), %%xmm1\n\t"
+                "movdqa 0xd0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
-                "movdqa 0xe0(%%esi), %%xmm1\n"
+                "movdqa 0xe0(%[key]), %%xmm1\n"
 
                 ".Lenclast%=:\n\t"
                 aesenclast_xmm1_xmm0
@@ -942,8 +1113,8 @@ do_aesni_ctr (const RIJNDAEL_context *ctx,
 
                 : [ctr] "+m" (*ctr), [dst] "=m" (*b)
                 : [src] "m" (*a),
-                  [key] "g" (ctx->keyschenc),
-                  [rounds] "g" (ctx->rounds),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds),
                   [mask] "m" (*be_mask)
                 : "%esi", "cc", "memory");
 #undef aesenc_xmm1_xmm0
@@ -969,7 +1140,7 @@ do_aesni_ctr_4 (const RIJNDAEL_context *ctx,
     { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
 
   /* Register usage:
-      esi   keyschedule
+      esi   temp
       xmm0  CTR-0
       xmm1  temp / round key
       xmm2  CTR-1
@@ -996,82 +1167,81 @@ do_aesni_ctr_4 (const RIJNDAEL_context *ctx,
                 "pshufb %[mask], %%xmm5\n\t"    /* xmm5 := be(xmm5) */
                 "movdqa %%xmm5, %[ctr]\n"       /* Update CTR.      */
 
-                "movl   %[key], %%esi\n\t"      /* esi  := keyschenc */
-                "movdqa (%%esi), %%xmm1\n\t"    /* xmm1 := key[0]    */
+                "movdqa (%[key]), %%xmm1\n\t"    /* xmm1 := key[0]    */
                 "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 ^= key[0]    */
                 "pxor   %%xmm1, %%xmm2\n\t"     /* xmm2 ^= key[0]    */
                 "pxor   %%xmm1, %%xmm3\n\t"     /* xmm3 ^= key[0]    */
                 "pxor   %%xmm1, %%xmm4\n\t"     /* xmm4 ^= key[0]    */
-                "movdqa 0x10(%%esi), %%xmm1\n\t"
+                "movdqa 0x10(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x20(%%esi), %%xmm1\n\t"
+                "movdqa 0x20(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x30(%%esi), %%xmm1\n\t"
+                "movdqa 0x30(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x40(%%esi), %%xmm1\n\t"
+                "movdqa 0x40(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x50(%%esi), %%xmm1\n\t"
+                "movdqa 0x50(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x60(%%esi), %%xmm1\n\t"
+                "movdqa 0x60(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x70(%%esi), %%xmm1\n\t"
+                "movdqa 0x70(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x80(%%esi), %%xmm1\n\t"
+                "movdqa 0x80(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0x90(%%esi), %%xmm1\n\t"
+                "movdqa 0x90(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0xa0(%%esi), %%xmm1\n\t"
+                "movdqa 0xa0(%[key]), %%xmm1\n\t"
                 "cmp $10, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0xb0(%%esi), %%xmm1\n\t"
+                "movdqa 0xb0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0xc0(%%esi), %%xmm1\n\t"
+                "movdqa 0xc0(%[key]), %%xmm1\n\t"
                 "cmp $12, %[rounds]\n\t"
                 "jz .Lenclast%=\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0xd0(%%esi), %%xmm1\n\t"
+                "movdqa 0xd0(%[key]), %%xmm1\n\t"
                 aesenc_xmm1_xmm0
                 aesenc_xmm1_xmm2
                 aesenc_xmm1_xmm3
                 aesenc_xmm1_xmm4
-                "movdqa 0xe0(%%esi), %%xmm1\n"
+                "movdqa 0xe0(%[key]), %%xmm1\n"
 
                 ".Lenclast%=:\n\t"
                 aesenclast_xmm1_xmm0
@@ -1097,8 +1267,8 @@ do_aesni_ctr_4 (const RIJNDAEL_context *ctx,
 
                 : [ctr] "+m" (*ctr), [dst] "=m" (*b)
                 : [src] "m" (*a),
-                  [key] "g" (ctx->keyschenc),
-                  [rounds] "g" (ctx->rounds),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds),
                   [mask] "m" (*be_mask)
                 : "%esi", "cc", "memory");
 #undef aesenc_xmm1_xmm0
@@ -1112,6 +1282,588 @@ do_aesni_ctr_4 (const RIJNDAEL_context *ctx,
 }
 
 
+/* The functions below process 4 or 8 blocks at a time to hide the
+   latency of the AES instructions.  They share these opcode macros;
+   the naming is <insn>_<src>_<dst> and the round key is always kept
+   in xmm1.  The 8 block variants need the additional SSE registers
+   of x86-64.  */
+#define aesenc_xmm1_xmm0      ".byte 0x66, 0x0f, 0x38, 0xdc, 0xc1\n\t"
+#define aesenc_xmm1_xmm2      ".byte 0x66, 0x0f, 0x38, 0xdc, 0xd1\n\t"
+#define aesenc_xmm1_xmm3      ".byte 0x66, 0x0f, 0x38, 0xdc, 0xd9\n\t"
+#define aesenc_xmm1_xmm4      ".byte 0x66, 0x0f, 0x38, 0xdc, 0xe1\n\t"
+#define aesenc_xmm1_xmm8      ".byte 0x66, 0x44, 0x0f, 0x38, 0xdc, 0xc1\n\t"
+#define aesenc_xmm1_xmm9      ".byte 0x66, 0x44, 0x0f, 0x38, 0xdc, 0xc9\n\t"
+#define aesenc_xmm1_xmm10     ".byte 0x66, 0x44, 0x0f, 0x38, 0xdc, 0xd1\n\t"
+#define aesenc_xmm1_xmm11     ".byte 0x66, 0x44, 0x0f, 0x38, 0xdc, 0xd9\n\t"
+#define aesenclast_xmm1_xmm0  ".byte 0x66, 0x0f, 0x38, 0xdd, 0xc1\n\t"
+#define aesenclast_xmm1_xmm2  ".byte 0x66, 0x0f, 0x38, 0xdd, 0xd1\n\t"
+#define aesenclast_xmm1_xmm3  ".byte 0x66, 0x0f, 0x38, 0xdd, 0xd9\n\t"
+#define aesenclast_xmm1_xmm4  ".byte 0x66, 0x0f, 0x38, 0xdd, 0xe1\n\t"
+#define aesenclast_xmm1_xmm8  ".byte 0x66, 0x44, 0x0f, 0x38, 0xdd, 0xc1\n\t"
+#define aesenclast_xmm1_xmm9  ".byte 0x66, 0x44, 0x0f, 0x38, 0xdd, 0xc9\n\t"
+#define aesenclast_xmm1_xmm10 ".byte 0x66, 0x44, 0x0f, 0x38, 0xdd, 0xd1\n\t"
+#define aesenclast_xmm1_xmm11 ".byte 0x66, 0x44, 0x0f, 0x38, 0xdd, 0xd9\n\t"
+#define aesdec_xmm1_xmm0      ".byte 0x66, 0x0f, 0x38, 0xde, 0xc1\n\t"
+#define aesdec_xmm1_xmm2      ".byte 0x66, 0x0f, 0x38, 0xde, 0xd1\n\t"
+#define aesdec_xmm1_xmm3      ".byte 0x66, 0x0f, 0x38, 0xde, 0xd9\n\t"
+#define aesdec_xmm1_xmm4      ".byte 0x66, 0x0f, 0x38, 0xde, 0xe1\n\t"
+#define aesdec_xmm1_xmm8      ".byte 0x66, 0x44, 0x0f, 0x38, 0xde, 0xc1\n\t"
+#define aesdec_xmm1_xmm9      ".byte 0x66, 0x44, 0x0f, 0x38, 0xde, 0xc9\n\t"
+#define aesdec_xmm1_xmm10     ".byte 0x66, 0x44, 0x0f, 0x38, 0xde, 0xd1\n\t"
+#define aesdec_xmm1_xmm11     ".byte 0x66, 0x44, 0x0f, 0x38, 0xde, 0xd9\n\t"
+#define aesdeclast_xmm1_xmm0  ".byte 0x66, 0x0f, 0x38, 0xdf, 0xc1\n\t"
+#define aesdeclast_xmm1_xmm2  ".byte 0x66, 0x0f, 0x38, 0xdf, 0xd1\n\t"
+#define aesdeclast_xmm1_xmm3  ".byte 0x66, 0x0f, 0x38, 0xdf, 0xd9\n\t"
+#define aesdeclast_xmm1_xmm4  ".byte 0x66, 0x0f, 0x38, 0xdf, 0xe1\n\t"
+#define aesdeclast_xmm1_xmm8  ".byte 0x66, 0x44, 0x0f, 0x38, 0xdf, 0xc1\n\t"
+#define aesdeclast_xmm1_xmm9  ".byte 0x66, 0x44, 0x0f, 0x38, 0xdf, 0xc9\n\t"
+#define aesdeclast_xmm1_xmm10 ".byte 0x66, 0x44, 0x0f, 0x38, 0xdf, 0xd1\n\t"
+#define aesdeclast_xmm1_xmm11 ".byte 0x66, 0x44, 0x0f, 0x38, 0xdf, 0xd9\n\t"
+
+/* One round on all blocks held in xmm0, xmm2, xmm3, xmm4 and, for 8
+   blocks, in xmm8 to xmm11.  */
+#define aesenc_4      aesenc_xmm1_xmm0 aesenc_xmm1_xmm2 \
+                      aesenc_xmm1_xmm3 aesenc_xmm1_xmm4
+#define aesenclast_4  aesenclast_xmm1_xmm0 aesenclast_xmm1_xmm2 \
+                      aesenclast_xmm1_xmm3 aesenclast_xmm1_xmm4
+#define aesdec_4      aesdec_xmm1_xmm0 aesdec_xmm1_xmm2 \
+                      aesdec_xmm1_xmm3 aesdec_xmm1_xmm4
+#define aesdeclast_4  aesdeclast_xmm1_xmm0 aesdeclast_xmm1_xmm2 \
+                      aesdeclast_xmm1_xmm3 aesdeclast_xmm1_xmm4
+#define aesenc_8      aesenc_4 aesenc_xmm1_xmm8 aesenc_xmm1_xmm9 \
+                      aesenc_xmm1_xmm10 aesenc_xmm1_xmm11
+#define aesenclast_8  aesenclast_4 aesenclast_xmm1_xmm8 \
+                      aesenclast_xmm1_xmm9 aesenclast_xmm1_xmm10 \
+                      aesenclast_xmm1_xmm11
+#define aesdec_8      aesdec_4 aesdec_xmm1_xmm8 aesdec_xmm1_xmm9 \
+                      aesdec_xmm1_xmm10 aesdec_xmm1_xmm11
+#define aesdeclast_8  aesdeclast_4 aesdeclast_xmm1_xmm8 \
+                      aesdeclast_xmm1_xmm9 aesdeclast_xmm1_xmm10 \
+                      aesdeclast_xmm1_xmm11
+
+/* XOR the first round key into all blocks.  */
+#define pxor_key_4    "pxor   %%xmm1, %%xmm0\n\t"                       \
+                      "pxor   %%xmm1, %%xmm2\n\t"                       \
+                      "pxor   %%xmm1, %%xmm3\n\t"                       \
+                      "pxor   %%xmm1, %%xmm4\n\t"
+#define pxor_key_8    pxor_key_4                                        \
+                      "pxor   %%xmm1, %%xmm8\n\t"                       \
+                      "pxor   %%xmm1, %%xmm9\n\t"                       \
+                      "pxor   %%xmm1, %%xmm10\n\t"                      \
+                      "pxor   %%xmm1, %%xmm11\n\t"
+
+/* The rounds 1 to ROUNDS using the key schedule at %[key].  ROUND and
+   LASTROUND are the above macros for the instructions to use.  */
+#define aesni_rounds(round, lastround)                                  \
+  "movdqa 0x10(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x20(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x30(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x40(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x50(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x60(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x70(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x80(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0x90(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0xa0(%[key]), %%xmm1\n\t"                                     \
+  "cmp $10, %[rounds]\n\t"                                              \
+  "jz .Llast%=\n\t"                                                     \
+  round                                                                 \
+  "movdqa 0xb0(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0xc0(%[key]), %%xmm1\n\t"                                     \
+  "cmp $12, %[rounds]\n\t"                                              \
+  "jz .Llast%=\n\t"                                                     \
+  round                                                                 \
+  "movdqa 0xd0(%[key]), %%xmm1\n\t"                                     \
+  round                                                                 \
+  "movdqa 0xe0(%[key]), %%xmm1\n"                                       \
+  ".Llast%=:\n\t"                                                       \
+  lastround
+
+
+/* Decrypt 4 blocks in CBC mode.  IV is updated.  */
+static void
+do_aesni_cbc_dec_4 (const RIJNDAEL_context *ctx, unsigned char *iv,
+                    unsigned char *b, const unsigned char *a)
+{
+  asm volatile ("movdqu (%[src]), %%xmm0\n\t"
+                "movdqu 0x10(%[src]), %%xmm2\n\t"
+                "movdqu 0x20(%[src]), %%xmm3\n\t"
+                "movdqu 0x30(%[src]), %%xmm4\n\t"
+                "movdqa (%[key]), %%xmm1\n\t"
+                pxor_key_4
+                aesni_rounds (aesdec_4, aesdeclast_4)
+
+                "movdqu (%[iv]), %%xmm5\n\t"      /* P[i] ^= C[i-1]  */
+                "pxor   %%xmm5, %%xmm0\n\t"
+                "movdqu (%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm2\n\t"
+                "movdqu 0x10(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm3\n\t"
+                "movdqu 0x20(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm4\n\t"
+                "movdqu 0x30(%[src]), %%xmm5\n\t" /* Update IV.  */
+                "movdqu %%xmm5, (%[iv])\n\t"
+
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm2, 0x10(%[dst])\n\t"
+                "movdqu %%xmm3, 0x20(%[dst])\n\t"
+                "movdqu %%xmm4, 0x30(%[dst])\n"
+                :
+                : [iv] "r" (iv),
+                  [dst] "r" (b),
+                  [src] "r" (a),
+                  [key] "r" (ctx->keyschdec),
+                  [rounds] "r" (ctx->rounds)
+                : "cc", "memory");
+}
+
+
+/* Decrypt 4 blocks in CFB mode.  IV is updated.  */
+static void
+do_aesni_cfb_dec_4 (const RIJNDAEL_context *ctx, unsigned char *iv,
+                    unsigned char *b, const unsigned char *a)
+{
+  asm volatile ("movdqu (%[iv]), %%xmm0\n\t"      /* Encrypt C[i-1].  */
+                "movdqu (%[src]), %%xmm2\n\t"
+                "movdqu 0x10(%[src]), %%xmm3\n\t"
+                "movdqu 0x20(%[src]), %%xmm4\n\t"
+                "movdqa (%[key]), %%xmm1\n\t"
+                pxor_key_4
+                aesni_rounds (aesenc_4, aesenclast_4)
+
+                "movdqu (%[src]), %%xmm5\n\t"     /* P[i] = C[i] ^ E  */
+                "pxor   %%xmm5, %%xmm0\n\t"
+                "movdqu 0x10(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm2\n\t"
+                "movdqu 0x20(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm3\n\t"
+                "movdqu 0x30(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm4\n\t"
+                "movdqu %%xmm5, (%[iv])\n\t"      /* Update IV.  */
+
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm2, 0x10(%[dst])\n\t"
+                "movdqu %%xmm3, 0x20(%[dst])\n\t"
+                "movdqu %%xmm4, 0x30(%[dst])\n"
+                :
+                : [iv] "r" (iv),
+                  [dst] "r" (b),
+                  [src] "r" (a),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds)
+                : "cc", "memory");
+}
+
+
+/* Multiply the XTS tweak in xmm5 by x.  The carries out of the two
+   quadwords are taken from their sign bits: the carry out of bit 127
+   is reduced with 0x87 and the carry out of bit 63 goes to bit 64.
+   xmm7 holds the constant {0x87, 0, 1, 0} and xmm6 is a temporary.  */
+#define xts_next_tweak                                                  \
+  "movdqa %%xmm5, %%xmm6\n\t"                                           \
+  "psrad  $31, %%xmm6\n\t"                                              \
+  "paddq  %%xmm5, %%xmm5\n\t"                                           \
+  "pshufd $0x13, %%xmm6, %%xmm6\n\t"                                    \
+  "pand   %%xmm7, %%xmm6\n\t"                                           \
+  "pxor   %%xmm6, %%xmm5\n\t"
+
+/* XOR the tweak into the block in REG and store the tweak at OFF(dst),
+   from where it is taken again after the encryption.  */
+#define xts_whiten(off, reg)                                            \
+  "movdqu %%xmm5, " off "(%[dst])\n\t"                                  \
+  "pxor   %%xmm5, " reg "\n\t"                                          \
+  xts_next_tweak
+
+#define xts_unwhiten(off, reg)                                          \
+  "movdqu " off "(%[dst]), %%xmm6\n\t"                                  \
+  "pxor   %%xmm6, " reg "\n\t"                                          \
+  "movdqu " reg ", " off "(%[dst])\n\t"
+
+#define xts_whiten_4  xts_whiten ("0x00", "%%xmm0")                     \
+                      xts_whiten ("0x10", "%%xmm2")                     \
+                      xts_whiten ("0x20", "%%xmm3")                     \
+                      xts_whiten ("0x30", "%%xmm4")
+#define xts_whiten_8  xts_whiten_4                                      \
+                      xts_whiten ("0x40", "%%xmm8")                     \
+                      xts_whiten ("0x50", "%%xmm9")                     \
+                      xts_whiten ("0x60", "%%xmm10")                    \
+                      xts_whiten ("0x70", "%%xmm11")
+#define xts_unwhiten_4  xts_unwhiten ("0x00", "%%xmm0")                 \
+                        xts_unwhiten ("0x10", "%%xmm2")                 \
+                        xts_unwhiten ("0x20", "%%xmm3")                 \
+                        xts_unwhiten ("0x30", "%%xmm4")
+#define xts_unwhiten_8  xts_unwhiten_4                                  \
+                        xts_unwhiten ("0x40", "%%xmm8")                 \
+                        xts_unwhiten ("0x50", "%%xmm9")                 \
+                        xts_unwhiten ("0x60", "%%xmm10")                \
+                        xts_unwhiten ("0x70", "%%xmm11")
+
+#define xts_load_4    "movdqu (%[src]), %%xmm0\n\t"                     \
+                      "movdqu 0x10(%[src]), %%xmm2\n\t"                 \
+                      "movdqu 0x20(%[src]), %%xmm3\n\t"                 \
+                      "movdqu 0x30(%[src]), %%xmm4\n\t"
+#define xts_load_8    xts_load_4                                        \
+                      "movdqu 0x40(%[src]), %%xmm8\n\t"                 \
+                      "movdqu 0x50(%[src]), %%xmm9\n\t"                 \
+                      "movdqu 0x60(%[src]), %%xmm10\n\t"                \
+                      "movdqu 0x70(%[src]), %%xmm11\n\t"
+
+static const unsigned char xts_gfmul_const[16] __attribute__ ((aligned (16))) =
+  { 0x87, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0 };
+
+/* Encrypt or decrypt 4 blocks in XTS mode.  All source blocks are
+   loaded before the tweaks are stored to the destination, thus A and
+   B may be the same.  TWEAK is updated.  */
+static void
+do_aesni_xts_4 (const RIJNDAEL_context *ctx, int decrypt_flag,
+                unsigned char *tweak,
+                unsigned char *b, const unsigned char *a)
+{
+  if (decrypt_flag)
+    asm volatile (xts_load_4
+                  "movdqu (%[tweak]), %%xmm5\n\t"
+                  "movdqa %[mask], %%xmm7\n\t"
+                  xts_whiten_4
+                  "movdqu %%xmm5, (%[tweak])\n\t"
+                  "movdqa (%[key]), %%xmm1\n\t"
+                  pxor_key_4
+                  aesni_rounds (aesdec_4, aesdeclast_4)
+                  xts_unwhiten_4
+                  :
+                  : [tweak] "r" (tweak),
+                    [dst] "r" (b),
+                    [src] "r" (a),
+                    [key] "r" (ctx->keyschdec),
+                    [rounds] "r" (ctx->rounds),
+                    [mask] "m" (*xts_gfmul_const)
+                  : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+                    "xmm4", "xmm5", "xmm6", "xmm7");
+  else
+    asm volatile (xts_load_4
+                  "movdqu (%[tweak]), %%xmm5\n\t"
+                  "movdqa %[mask], %%xmm7\n\t"
+                  xts_whiten_4
+                  "movdqu %%xmm5, (%[tweak])\n\t"
+                  "movdqa (%[key]), %%xmm1\n\t"
+                  pxor_key_4
+                  aesni_rounds (aesenc_4, aesenclast_4)
+                  xts_unwhiten_4
+                  :
+                  : [tweak] "r" (tweak),
+                    [dst] "r" (b),
+                    [src] "r" (a),
+                    [key] "r" (ctx->keyschenc),
+                    [rounds] "r" (ctx->rounds),
+                    [mask] "m" (*xts_gfmul_const)
+                  : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+                    "xmm4", "xmm5", "xmm6", "xmm7");
+}
+
+#ifdef __x86_64__
+/* Decrypt 8 blocks in CBC mode.  IV is updated.  */
+static void
+do_aesni_cbc_dec_8 (const RIJNDAEL_context *ctx, unsigned char *iv,
+                    unsigned char *b, const unsigned char *a)
+{
+  asm volatile ("movdqu (%[src]), %%xmm0\n\t"
+                "movdqu 0x10(%[src]), %%xmm2\n\t"
+                "movdqu 0x20(%[src]), %%xmm3\n\t"
+                "movdqu 0x30(%[src]), %%xmm4\n\t"
+                "movdqu 0x40(%[src]), %%xmm8\n\t"
+                "movdqu 0x50(%[src]), %%xmm9\n\t"
+                "movdqu 0x60(%[src]), %%xmm10\n\t"
+                "movdqu 0x70(%[src]), %%xmm11\n\t"
+                "movdqa (%[key]), %%xmm1\n\t"
+                pxor_key_8
+                aesni_rounds (aesdec_8, aesdeclast_8)
+
+                "movdqu (%[iv]), %%xmm5\n\t"      /* P[i] ^= C[i-1]  */
+                "pxor   %%xmm5, %%xmm0\n\t"
+                "movdqu (%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm2\n\t"
+                "movdqu 0x10(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm3\n\t"
+                "movdqu 0x20(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm4\n\t"
+                "movdqu 0x30(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm8\n\t"
+                "movdqu 0x40(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm9\n\t"
+                "movdqu 0x50(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm10\n\t"
+                "movdqu 0x60(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm11\n\t"
+                "movdqu 0x70(%[src]), %%xmm5\n\t" /* Update IV.  */
+                "movdqu %%xmm5, (%[iv])\n\t"
+
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm2, 0x10(%[dst])\n\t"
+                "movdqu %%xmm3, 0x20(%[dst])\n\t"
+                "movdqu %%xmm4, 0x30(%[dst])\n\t"
+                "movdqu %%xmm8, 0x40(%[dst])\n\t"
+                "movdqu %%xmm9, 0x50(%[dst])\n\t"
+                "movdqu %%xmm10, 0x60(%[dst])\n\t"
+                "movdqu %%xmm11, 0x70(%[dst])\n"
+                :
+                : [iv] "r" (iv),
+                  [dst] "r" (b),
+                  [src] "r" (a),
+                  [key] "r" (ctx->keyschdec),
+                  [rounds] "r" (ctx->rounds)
+                : "cc", "memory", "xmm8", "xmm9", "xmm10", "xmm11");
+}
+
+
+/* Decrypt 8 blocks in CFB mode.  IV is updated.  */
+static void
+do_aesni_cfb_dec_8 (const RIJNDAEL_context *ctx, unsigned char *iv,
+                    unsigned char *b, const unsigned char *a)
+{
+  asm volatile ("movdqu (%[iv]), %%xmm0\n\t"      /* Encrypt C[i-1].  */
+                "movdqu (%[src]), %%xmm2\n\t"
+                "movdqu 0x10(%[src]), %%xmm3\n\t"
+                "movdqu 0x20(%[src]), %%xmm4\n\t"
+                "movdqu 0x30(%[src]), %%xmm8\n\t"
+                "movdqu 0x40(%[src]), %%xmm9\n\t"
+                "movdqu 0x50(%[src]), %%xmm10\n\t"
+                "movdqu 0x60(%[src]), %%xmm11\n\t"
+                "movdqa (%[key]), %%xmm1\n\t"
+                pxor_key_8
+                aesni_rounds (aesenc_8, aesenclast_8)
+
+                "movdqu (%[src]), %%xmm5\n\t"     /* P[i] = C[i] ^ E  */
+                "pxor   %%xmm5, %%xmm0\n\t"
+                "movdqu 0x10(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm2\n\t"
+                "movdqu 0x20(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm3\n\t"
+                "movdqu 0x30(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm4\n\t"
+                "movdqu 0x40(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm8\n\t"
+                "movdqu 0x50(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm9\n\t"
+                "movdqu 0x60(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm10\n\t"
+                "movdqu 0x70(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm11\n\t"
+                "movdqu %%xmm5, (%[iv])\n\t"      /* Update IV.  */
+
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm2, 0x10(%[dst])\n\t"
+                "movdqu %%xmm3, 0x20(%[dst])\n\t"
+                "movdqu %%xmm4, 0x30(%[dst])\n\t"
+                "movdqu %%xmm8, 0x40(%[dst])\n\t"
+                "movdqu %%xmm9, 0x50(%[dst])\n\t"
+                "movdqu %%xmm10, 0x60(%[dst])\n\t"
+                "movdqu %%xmm11, 0x70(%[dst])\n"
+                :
+                : [iv] "r" (iv),
+                  [dst] "r" (b),
+                  [src] "r" (a),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds)
+                : "cc", "memory", "xmm8", "xmm9", "xmm10", "xmm11");
+}
+
+
+/* Eight blocks at a time variant of do_aesni_ctr.  */
+static void
+do_aesni_ctr_8 (const RIJNDAEL_context *ctx,
+                unsigned char *ctr, unsigned char *b, const unsigned char *a)
+{
+  static unsigned char be_mask[16] __attribute__ ((aligned (16))) =
+    { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+
+  /* Register usage:
+      xmm0, xmm2-4, xmm8-11  CTR-0 to CTR-7
+      xmm1  round key
+      xmm5  temp
+      xmm6  counter (little-endian)
+      xmm7  1
+   */
+  asm volatile ("movdqa %[ctr], %%xmm0\n\t"     /* xmm0 := CTR        */
+                "movdqa %%xmm0, %%xmm6\n\t"
+                "pshufb %[mask], %%xmm6\n\t"    /* xmm6 := le(CTR)    */
+                "mov    $1, %%esi\n\t"
+                "movd   %%esi, %%xmm7\n\t"      /* xmm7 := 1          */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm2\n\t"
+                "pshufb %[mask], %%xmm2\n\t"    /* xmm2 := be(CTR+1)  */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm3\n\t"
+                "pshufb %[mask], %%xmm3\n\t"    /* xmm3 := be(CTR+2)  */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm4\n\t"
+                "pshufb %[mask], %%xmm4\n\t"    /* xmm4 := be(CTR+3)  */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm8\n\t"
+                "pshufb %[mask], %%xmm8\n\t"    /* xmm8 := be(CTR+4)  */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm9\n\t"
+                "pshufb %[mask], %%xmm9\n\t"    /* xmm9 := be(CTR+5)  */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm10\n\t"
+                "pshufb %[mask], %%xmm10\n\t"   /* xmm10 := be(CTR+6) */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "movdqa %%xmm6, %%xmm11\n\t"
+                "pshufb %[mask], %%xmm11\n\t"   /* xmm11 := be(CTR+7) */
+                "paddq  %%xmm7, %%xmm6\n\t"
+                "pshufb %[mask], %%xmm6\n\t"
+                "movdqa %%xmm6, %[ctr]\n\t"     /* Update CTR.        */
+
+                "movdqa (%[key]), %%xmm1\n\t"
+                pxor_key_8
+                aesni_rounds (aesenc_8, aesenclast_8)
+
+                "movdqu (%[src]), %%xmm5\n\t"   /* EncCTR ^= input    */
+                "pxor   %%xmm5, %%xmm0\n\t"
+                "movdqu 0x10(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm2\n\t"
+                "movdqu 0x20(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm3\n\t"
+                "movdqu 0x30(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm4\n\t"
+                "movdqu 0x40(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm8\n\t"
+                "movdqu 0x50(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm9\n\t"
+                "movdqu 0x60(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm10\n\t"
+                "movdqu 0x70(%[src]), %%xmm5\n\t"
+                "pxor   %%xmm5, %%xmm11\n\t"
+
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm2, 0x10(%[dst])\n\t"
+                "movdqu %%xmm3, 0x20(%[dst])\n\t"
+                "movdqu %%xmm4, 0x30(%[dst])\n\t"
+                "movdqu %%xmm8, 0x40(%[dst])\n\t"
+                "movdqu %%xmm9, 0x50(%[dst])\n\t"
+                "movdqu %%xmm10, 0x60(%[dst])\n\t"
+                "movdqu %%xmm11, 0x70(%[dst])\n"
+                : [ctr] "+m" (*ctr)
+                : [dst] "r" (b),
+                  [src] "r" (a),
+                  [key] "r" (ctx->keyschenc),
+                  [rounds] "r" (ctx->rounds),
+                  [mask] "m" (*be_mask)
+                : "%esi", "cc", "memory",
+                  "xmm8", "xmm9", "xmm10", "xmm11");
+}
+
+/* Eight blocks at a time variant of do_aesni_xts_4.  */
+static void
+do_aesni_xts_8 (const RIJNDAEL_context *ctx, int decrypt_flag,
+                unsigned char *tweak,
+                unsigned char *b, const unsigned char *a)
+{
+  if (decrypt_flag)
+    asm volatile (xts_load_8
+                  "movdqu (%[tweak]), %%xmm5\n\t"
+                  "movdqa %[mask], %%xmm7\n\t"
+                  xts_whiten_8
+                  "movdqu %%xmm5, (%[tweak])\n\t"
+                  "movdqa (%[key]), %%xmm1\n\t"
+                  pxor_key_8
+                  aesni_rounds (aesdec_8, aesdeclast_8)
+                  xts_unwhiten_8
+                  :
+                  : [tweak] "r" (tweak),
+                    [dst] "r" (b),
+                    [src] "r" (a),
+                    [key] "r" (ctx->keyschdec),
+                    [rounds] "r" (ctx->rounds),
+                    [mask] "m" (*xts_gfmul_const)
+                  : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+                    "xmm4", "xmm5", "xmm6", "xmm7",
+                    "xmm8", "xmm9", "xmm10", "xmm11");
+  else
+    asm volatile (xts_load_8
+                  "movdqu (%[tweak]), %%xmm5\n\t"
+                  "movdqa %[mask], %%xmm7\n\t"
+                  xts_whiten_8
+                  "movdqu %%xmm5, (%[tweak])\n\t"
+                  "movdqa (%[key]), %%xmm1\n\t"
+                  pxor_key_8
+                  aesni_rounds (aesenc_8, aesenclast_8)
+                  xts_unwhiten_8
+                  :
+                  : [tweak] "r" (tweak),
+                    [dst] "r" (b),
+                    [src] "r" (a),
+                    [key] "r" (ctx->keyschenc),
+                    [rounds] "r" (ctx->rounds),
+                    [mask] "m" (*xts_gfmul_const)
+                  : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+                    "xmm4", "xmm5", "xmm6", "xmm7",
+                    "xmm8", "xmm9", "xmm10", "xmm11");
+}
+#endif /*__x86_64__*/
+
+#undef aesenc_xmm1_xmm0
+#undef aesenc_xmm1_xmm2
+#undef aesenc_xmm1_xmm3
+#undef aesenc_xmm1_xmm4
+#undef aesenc_xmm1_xmm8
+#undef aesenc_xmm1_xmm9
+#undef aesenc_xmm1_xmm10
+#undef aesenc_xmm1_xmm11
+#undef aesenclast_xmm1_xmm0
+#undef aesenclast_xmm1_xmm2
+#undef aesenclast_xmm1_xmm3
+#undef aesenclast_xmm1_xmm4
+#undef aesenclast_xmm1_xmm8
+#undef aesenclast_xmm1_xmm9
+#undef aesenclast_xmm1_xmm10
+#undef aesenclast_xmm1_xmm11
+#undef aesdec_xmm1_xmm0
+#undef aesdec_xmm1_xmm2
+#undef aesdec_xmm1_xmm3
+#undef aesdec_xmm1_xmm4
+#undef aesdec_xmm1_xmm8
+#undef aesdec_xmm1_xmm9
+#undef aesdec_xmm1_xmm10
+#undef aesdec_xmm1_xmm11
+#undef aesdeclast_xmm1_xmm0
+#undef aesdeclast_xmm1_xmm2
+#undef aesdeclast_xmm1_xmm3
+#undef aesdeclast_xmm1_xmm4
+#undef aesdeclast_xmm1_xmm8
+#undef aesdeclast_xmm1_xmm9
+#undef aesdeclast_xmm1_xmm10
+#undef aesdeclast_xmm1_xmm11
+#undef aesenc_4
+#undef aesenclast_4
+#undef aesdec_4
+#undef aesdeclast_4
+#undef aesenc_8
+#undef aesenclast_8
+#undef aesdec_8
+#undef aesdeclast_8
+#undef pxor_key_4
+#undef pxor_key_8
+#undef aesni_rounds
+#undef xts_next_tweak
+#undef xts_whiten
+#undef xts_unwhiten
+#undef xts_whiten_4
+#undef xts_whiten_8
+#undef xts_unwhiten_4
+#undef xts_unwhiten_8
+#undef xts_load_4
+#undef xts_load_8
+
+
 static void
 do_aesni (RIJNDAEL_context *ctx, int decrypt_flag,
           unsigned char *bx, const unsigned char *ax)
@@ -1132,6 +1884,217 @@ do_aesni (RIJNDAEL_context *ctx, int decrypt_flag,
 #endif /*USE_AESNI*/
 
 
+#ifdef USE_SSSE3
+/* The vector permute implementation.  See rijndael-tables.h for a
+   description of the representation.  The macros below are the asm
+   fragments shared by the functions; they expect the tables as named
+   operands.  The state is kept in xmm0 and xmm1 to xmm4 are used as
+   temporary registers.  */
+
+/* Change the representation of xmm0 using the tables IPT0 and IPT1.  */
+#define VP_TRANSFORM                                                    \
+  "movdqa %%xmm0, %%xmm1\n\t"                                           \
+  "psrld  $4, %%xmm1\n\t"                                               \
+  "pand   %[mask], %%xmm0\n\t"                                          \
+  "pand   %[mask], %%xmm1\n\t"                                          \
+  "movdqa %[ipt0], %%xmm2\n\t"                                          \
+  "pshufb %%xmm0, %%xmm2\n\t"                                           \
+  "movdqa %[ipt1], %%xmm0\n\t"                                          \
+  "pshufb %%xmm1, %%xmm0\n\t"                                           \
+  "pxor   %%xmm2, %%xmm0\n\t"
+
+/* Invert the bytes of xmm0 in GF(2^8).  With I being the high and K
+   the low nibble the result is returned as IO in xmm2 and JO in
+   xmm3.  */
+#define VP_INVERT                                                       \
+  "movdqa %%xmm0, %%xmm1\n\t"                                           \
+  "psrld  $4, %%xmm1\n\t"                                               \
+  "pand   %[mask], %%xmm0\n\t"          /* xmm0 := k              */    \
+  "pand   %[mask], %%xmm1\n\t"          /* xmm1 := i              */    \
+  "movdqa %[inva], %%xmm2\n\t"                                          \
+  "pshufb %%xmm0, %%xmm2\n\t"           /* xmm2 := 2/k            */    \
+  "pxor   %%xmm1, %%xmm0\n\t"           /* xmm0 := j = i + k      */    \
+  "movdqa %[inv], %%xmm3\n\t"                                           \
+  "pshufb %%xmm1, %%xmm3\n\t"                                           \
+  "pxor   %%xmm2, %%xmm3\n\t"           /* xmm3 := 1/i + 2/k      */    \
+  "movdqa %[inv], %%xmm4\n\t"                                           \
+  "pshufb %%xmm0, %%xmm4\n\t"                                           \
+  "pxor   %%xmm2, %%xmm4\n\t"           /* xmm4 := 1/j + 2/k      */    \
+  "movdqa %[inv], %%xmm2\n\t"                                           \
+  "pshufb %%xmm3, %%xmm2\n\t"                                           \
+  "pxor   %%xmm0, %%xmm2\n\t"           /* xmm2 := io             */    \
+  "movdqa %[inv], %%xmm3\n\t"                                           \
+  "pshufb %%xmm4, %%xmm3\n\t"                                           \
+  "pxor   %%xmm1, %%xmm3\n\t"           /* xmm3 := jo             */
+
+/* Compute REG := TBL_0[io] ^ TBL_1[jo] after VP_INVERT.  */
+#define VP_LOOKUP(tbl, reg)                                             \
+  "movdqa %[" #tbl "_0], %%" #reg "\n\t"                                \
+  "pshufb %%xmm2, %%" #reg "\n\t"                                       \
+  "movdqa %[" #tbl "_1], %%xmm4\n\t"                                    \
+  "pshufb %%xmm3, %%xmm4\n\t"                                           \
+  "pxor   %%xmm4, %%" #reg "\n\t"
+
+
+/* Apply the S-box to the 4 bytes at W.  This is used by the key
+   setup so that it does not need the S table.  */
+static void
+do_ssse3_sub_word (byte *w)
+{
+  asm volatile ("movd   (%[w]), %%xmm0\n\t"
+                VP_TRANSFORM
+                VP_INVERT
+                VP_LOOKUP (sbo, xmm0)
+                "movl   $0x63636363, %%eax\n\t"
+                "movd   %%eax, %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                "movd   %%xmm0, (%[w])\n"
+                :
+                : [w] "r" (w),
+                  [mask] "m" (*vp_mask),
+                  [inv] "m" (*vp_inv),
+                  [inva] "m" (*vp_inva),
+                  [ipt0] "m" (*vp_enc_ipt[0]),
+                  [ipt1] "m" (*vp_enc_ipt[1]),
+                  [sbo_0] "m" (*vp_sbo[0]),
+                  [sbo_1] "m" (*vp_sbo[1])
+                : "%eax", "cc", "memory",
+                  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+
+/* Encrypt one block from A to B.  A and B may be the same and need
+   not to be aligned.  */
+static void
+do_ssse3_enc (const RIJNDAEL_context *ctx,
+              unsigned char *b, const unsigned char *a)
+{
+  const byte *key = ctx->keyschenc[0][0];
+  unsigned int n = ctx->rounds - 1;
+
+  asm volatile ("movdqu %[src], %%xmm0\n\t"
+                VP_TRANSFORM
+                "pxor   (%[key]), %%xmm0\n"     /* xmm0 ^= key[0]   */
+
+                ".Lround%=:\n\t"
+                "add    $16, %[key]\n\t"
+                VP_INVERT
+                VP_LOOKUP (sb1, xmm0)           /* xmm0 := S        */
+                VP_LOOKUP (sb2, xmm1)           /* xmm1 := 2S       */
+                "movdqa %%xmm0, %%xmm2\n\t"
+                "movdqa %%xmm0, %%xmm3\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"     /* xmm0 := 3S       */
+                "pshufb %[mc0], %%xmm1\n\t"     /* ShiftRows and    */
+                "pshufb %[mc1], %%xmm0\n\t"     /*   MixColumns.    */
+                "pshufb %[mc2], %%xmm2\n\t"
+                "pshufb %[mc3], %%xmm3\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                "pxor   %%xmm2, %%xmm0\n\t"
+                "pxor   %%xmm3, %%xmm0\n\t"
+                "pxor   (%[key]), %%xmm0\n\t"   /* xmm0 ^= key[i]   */
+                "dec    %[n]\n\t"
+                "jnz    .Lround%=\n\t"
+
+                "add    $16, %[key]\n\t"        /* Last round.      */
+                VP_INVERT
+                VP_LOOKUP (sbo, xmm0)
+                "pshufb %[mc0], %%xmm0\n\t"
+                "pxor   (%[key]), %%xmm0\n\t"
+                "movdqu %%xmm0, %[dst]\n"
+                : [dst] "=m" (*b),
+                  [key] "+r" (key),
+                  [n] "+r" (n)
+                : [src] "m" (*a),
+                  [mask] "m" (*vp_mask),
+                  [inv] "m" (*vp_inv),
+                  [inva] "m" (*vp_inva),
+                  [ipt0] "m" (*vp_enc_ipt[0]),
+                  [ipt1] "m" (*vp_enc_ipt[1]),
+                  [sb1_0] "m" (*vp_sb1[0]),
+                  [sb1_1] "m" (*vp_sb1[1]),
+                  [sb2_0] "m" (*vp_sb2[0]),
+                  [sb2_1] "m" (*vp_sb2[1]),
+                  [sbo_0] "m" (*vp_sbo[0]),
+                  [sbo_1] "m" (*vp_sbo[1]),
+                  [mc0] "m" (*vp_mc[0]),
+                  [mc1] "m" (*vp_mc[1]),
+                  [mc2] "m" (*vp_mc[2]),
+                  [mc3] "m" (*vp_mc[3])
+                : "cc", "memory",
+                  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+
+/* Decrypt one block from A to B.  A and B may be the same and need
+   not to be aligned.  */
+static void
+do_ssse3_dec (const RIJNDAEL_context *ctx,
+              unsigned char *b, const unsigned char *a)
+{
+  const byte *key = ctx->keyschdec[0][0];
+  unsigned int n = ctx->rounds - 1;
+
+  asm volatile ("movdqu %[src], %%xmm0\n\t"
+                VP_TRANSFORM
+                "pxor   (%[key]), %%xmm0\n"     /* xmm0 ^= key[0]   */
+
+                ".Lround%=:\n\t"
+                "add    $16, %[key]\n\t"
+                VP_INVERT
+                VP_LOOKUP (dsb14, xmm0)         /* InvShiftRows and */
+                "pshufb %[imc0], %%xmm0\n\t"    /*   InvMixColumns. */
+                VP_LOOKUP (dsb11, xmm1)
+                "pshufb %[imc1], %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                VP_LOOKUP (dsb13, xmm1)
+                "pshufb %[imc2], %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                VP_LOOKUP (dsb9, xmm1)
+                "pshufb %[imc3], %%xmm1\n\t"
+                "pxor   %%xmm1, %%xmm0\n\t"
+                "pxor   (%[key]), %%xmm0\n\t"   /* xmm0 ^= key[i]   */
+                "dec    %[n]\n\t"
+                "jnz    .Lround%=\n\t"
+
+                "add    $16, %[key]\n\t"        /* Last round.      */
+                VP_INVERT
+                VP_LOOKUP (dsbo, xmm0)
+                "pshufb %[imc0], %%xmm0\n\t"
+                "pxor   (%[key]), %%xmm0\n\t"
+                "movdqu %%xmm0, %[dst]\n"
+                : [dst] "=m" (*b),
+                  [key] "+r" (key),
+                  [n] "+r" (n)
+                : [src] "m" (*a),
+                  [mask] "m" (*vp_mask),
+                  [inv] "m" (*vp_inv),
+                  [inva] "m" (*vp_inva),
+                  [ipt0] "m" (*vp_dec_ipt[0]),
+                  [ipt1] "m" (*vp_dec_ipt[1]),
+                  [dsb14_0] "m" (*vp_dsb14[0]),
+                  [dsb14_1] "m" (*vp_dsb14[1]),
+                  [dsb11_0] "m" (*vp_dsb11[0]),
+                  [dsb11_1] "m" (*vp_dsb11[1]),
+                  [dsb13_0] "m" (*vp_dsb13[0]),
+                  [dsb13_1] "m" (*vp_dsb13[1]),
+                  [dsb9_0] "m" (*vp_dsb9[0]),
+                  [dsb9_1] "m" (*vp_dsb9[1]),
+                  [dsbo_0] "m" (*vp_dsbo[0]),
+                  [dsbo_1] "m" (*vp_dsbo[1]),
+                  [imc0] "m" (*vp_imc[0]),
+                  [imc1] "m" (*vp_imc[1]),
+                  [imc2] "m" (*vp_imc[2]),
+                  [imc3] "m" (*vp_imc[3])
+                : "cc", "memory",
+                  "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+#undef VP_TRANSFORM
+#undef VP_INVERT
+#undef VP_LOOKUP
+#endif /*USE_SSSE3*/
+
+
 static void
 rijndael_encrypt (void *context, byte *b, const byte *a)
 {
@@ -1154,6 +2117,14 @@ rijndael_encrypt (void *context, byte *b, const byte *a)
       aesni_cleanup ();
     }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  else if (ctx->use_ssse3)
+    {
+      ssse3_prepare ();
+      do_ssse3_enc (ctx, b, a);
+      ssse3_cleanup ();
+    }
+#endif /*USE_SSSE3*/
   else
     {
       do_encrypt (ctx, b, a);
@@ -1206,6 +2177,19 @@ _gcry_aes_cfb_enc (void *context, unsigned char *iv,
       aesni_cleanup ();
     }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  else if (ctx->use_ssse3)
+    {
+      ssse3_prepare ();
+      for ( ;nblocks; nblocks-- )
+        {
+          do_ssse3_enc (ctx, iv, iv);
+          for (ivp=iv,i=0; i < BLOCKSIZE; i++ )
+            *outbuf++ = (*ivp++ ^= *inbuf++);
+        }
+      ssse3_cleanup ();
+    }
+#endif /*USE_SSSE3*/
   else
     {
       for ( ;nblocks; nblocks-- )
@@ -1241,6 +2225,10 @@ _gcry_aes_cbc_enc (void *context, unsigned char *iv,
   if (ctx->use_aesni)
     aesni_prepare ();
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_prepare ();
+#endif /*USE_SSSE3*/
 
   for ( ;nblocks; nblocks-- )
     {
@@ -1257,6 +2245,10 @@ _gcry_aes_cbc_enc (void *context, unsigned char *iv,
       else if (ctx->use_aesni)
         do_aesni (ctx, 0, outbuf, outbuf);
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+      else if (ctx->use_ssse3)
+        do_ssse3_enc (ctx, outbuf, outbuf);
+#endif /*USE_SSSE3*/
       else
         do_encrypt (ctx, outbuf, outbuf );
 
@@ -1270,6 +2262,10 @@ _gcry_aes_cbc_enc (void *context, unsigned char *iv,
   if (ctx->use_aesni)
     aesni_cleanup ();
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_cleanup ();
+#endif /*USE_SSSE3*/
 
   _gcry_burn_stack (48 + 2*sizeof(int));
 }
@@ -1297,6 +2293,15 @@ _gcry_aes_ctr_enc (void *context, unsigned char *ctr,
   else if (ctx->use_aesni)
     {
       aesni_prepare ();
+#ifdef __x86_64__
+      for ( ;nblocks > 7 ; nblocks -= 8 )
+        {
+          do_aesni_ctr_8 (ctx, ctr, outbuf, inbuf);
+          outbuf += 8*BLOCKSIZE;
+          inbuf  += 8*BLOCKSIZE;
+        }
+      aesni_cleanup_8_11 ();
+#endif /*__x86_64__*/
       for ( ;nblocks > 3 ; nblocks -= 4 )
         {
           do_aesni_ctr_4 (ctx, ctr, outbuf, inbuf);
@@ -1311,8 +2316,31 @@ _gcry_aes_ctr_enc (void *context, unsigned char *ctr,
         }
       aesni_cleanup ();
       aesni_cleanup_2_4 ();
+      aesni_cleanup_5 ();
     }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  else if (ctx->use_ssse3)
+    {
+      unsigned char tmp[BLOCKSIZE];
+
+      ssse3_prepare ();
+      for ( ;nblocks; nblocks-- )
+        {
+          do_ssse3_enc (ctx, tmp, ctr);
+          for (p=tmp, i=0; i < BLOCKSIZE; i++)
+            *outbuf++ = (*p++ ^ *inbuf++);
+          for (i = BLOCKSIZE; i > 0; i--)
+            {
+              ctr[i-1]++;
+              if (ctr[i-1])
+                break;
+            }
+        }
+      ssse3_cleanup ();
+      wipememory (tmp, sizeof tmp);
+    }
+#endif /*USE_SSSE3*/
   else
     {
       union { unsigned char x1[16]; u32 x32[4]; } tmp;
@@ -1338,6 +2366,88 @@ _gcry_aes_ctr_enc (void *context, unsigned char *ctr,
 }
 
 
+/* Bulk encryption or decryption of complete blocks in GCM mode.  The
+   counter CTR is used and updated as in CTR mode; the caller needs to
+   make sure that its low 32 bits do not wrap within NBLOCKS blocks.
+   The ciphertext is hashed into HASH using the GHASH context GHASH.
+   With AES-NI the AES and the GHASH computation are done in steps of
+   up to eight blocks so that the data is still in the cache for the second
+   pass.  This function is only intended for the bulk encryption
+   feature of cipher.c.  */
+void
+_gcry_aes_gcm_crypt (void *context, unsigned char *ctr,
+                     ghash_context_t *ghash, unsigned char *hash,
+                     void *outbuf_arg, const void *inbuf_arg,
+                     unsigned int nblocks, int encrypt)
+{
+  RIJNDAEL_context *ctx = context;
+  unsigned char *outbuf = outbuf_arg;
+  const unsigned char *inbuf = inbuf_arg;
+  unsigned int n;
+
+  if (0)
+    ;
+#ifdef USE_AESNI
+  else if (ctx->use_aesni)
+    {
+      aesni_prepare ();
+#ifdef __x86_64__
+      for ( ;nblocks > 7 ; nblocks -= 8 )
+        {
+          if (!encrypt)
+            _gcry_ghash (ghash, hash, inbuf, 8);
+          do_aesni_ctr_8 (ctx, ctr, outbuf, inbuf);
+          if (encrypt)
+            _gcry_ghash (ghash, hash, outbuf, 8);
+          outbuf += 8*BLOCKSIZE;
+          inbuf  += 8*BLOCKSIZE;
+        }
+      aesni_cleanup_8_11 ();
+#endif /*__x86_64__*/
+      for ( ;nblocks > 3 ; nblocks -= 4 )
+        {
+          if (!encrypt)
+            _gcry_ghash (ghash, hash, inbuf, 4);
+          do_aesni_ctr_4 (ctx, ctr, outbuf, inbuf);
+          if (encrypt)
+            _gcry_ghash (ghash, hash, outbuf, 4);
+          outbuf += 4*BLOCKSIZE;
+          inbuf  += 4*BLOCKSIZE;
+        }
+      for ( ;nblocks; nblocks-- )
+        {
+          if (!encrypt)
+            _gcry_ghash (ghash, hash, inbuf, 1);
+          do_aesni_ctr (ctx, ctr, outbuf, inbuf);
+          if (encrypt)
+            _gcry_ghash (ghash, hash, outbuf, 1);
+          outbuf += BLOCKSIZE;
+          inbuf  += BLOCKSIZE;
+        }
+      aesni_cleanup ();
+      aesni_cleanup_2_4 ();
+      aesni_cleanup_5 ();
+    }
+#endif /*USE_AESNI*/
+  else
+    {
+      /* Process the data in chunks which fit into the L1 cache.  */
+      for ( ;nblocks; nblocks -= n )
+        {
+          n = nblocks < 64? nblocks : 64;
+          if (!encrypt)
+            _gcry_ghash (ghash, hash, inbuf, n);
+          _gcry_aes_ctr_enc (ctx, ctr, outbuf, inbuf, n);
+          if (encrypt)
+            _gcry_ghash (ghash, hash, outbuf, n);
+          outbuf += n*BLOCKSIZE;
+          inbuf  += n*BLOCKSIZE;
+        }
+    }
+}
+
+
+
 
 /* Decrypt one block.  A and B need to be aligned on a 4 byte boundary
    and the decryption must have been prepared.  A and B may be the
@@ -1492,6 +2602,14 @@ rijndael_decrypt (void *context, byte *b, const byte *a)
       aesni_cleanup ();
     }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  else if (ctx->use_ssse3)
+    {
+      ssse3_prepare ();
+      do_ssse3_dec (ctx, b, a);
+      ssse3_cleanup ();
+    }
+#endif /*USE_SSSE3*/
   else
     {
       do_decrypt (ctx, b, a);
@@ -1538,6 +2656,21 @@ _gcry_aes_cfb_dec (void *context, unsigned char *iv,
   else if (ctx->use_aesni)
     {
       aesni_prepare ();
+#ifdef __x86_64__
+      for ( ;nblocks > 7 ; nblocks -= 8 )
+        {
+          do_aesni_cfb_dec_8 (ctx, iv, outbuf, inbuf);
+          outbuf += 8*BLOCKSIZE;
+          inbuf  += 8*BLOCKSIZE;
+        }
+      aesni_cleanup_8_11 ();
+#endif /*__x86_64__*/
+      for ( ;nblocks > 3 ; nblocks -= 4 )
+        {
+          do_aesni_cfb_dec_4 (ctx, iv, outbuf, inbuf);
+          outbuf += 4*BLOCKSIZE;
+          inbuf  += 4*BLOCKSIZE;
+        }
       for ( ;nblocks; nblocks-- )
         {
           do_aesni_cfb (ctx, 1, iv, outbuf, inbuf);
@@ -1545,8 +2678,27 @@ _gcry_aes_cfb_dec (void *context, unsigned char *iv,
           inbuf  += BLOCKSIZE;
         }
       aesni_cleanup ();
+      aesni_cleanup_2_4 ();
+      aesni_cleanup_5 ();
     }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  else if (ctx->use_ssse3)
+    {
+      ssse3_prepare ();
+      for ( ;nblocks; nblocks-- )
+        {
+          do_ssse3_enc (ctx, iv, iv);
+          for (ivp=iv,i=0; i < BLOCKSIZE; i++ )
+            {
+              temp = *inbuf++;
+              *outbuf++ = *ivp ^ temp;
+              *ivp++ = temp;
+            }
+        }
+      ssse3_cleanup ();
+    }
+#endif /*USE_SSSE3*/
   else
     {
       for ( ;nblocks; nblocks-- )
@@ -1583,8 +2735,37 @@ _gcry_aes_cbc_dec (void *context, unsigned char *iv,
 
 #ifdef USE_AESNI
   if (ctx->use_aesni)
-    aesni_prepare ();
+    {
+      aesni_prepare ();
+      if (!ctx->decryption_prepared )
+        {
+          prepare_decryption ( ctx );
+          ctx->decryption_prepared = 1;
+        }
+#ifdef __x86_64__
+      for ( ;nblocks > 7 ; nblocks -= 8 )
+        {
+          do_aesni_cbc_dec_8 (ctx, iv, outbuf, inbuf);
+          outbuf += 8*BLOCKSIZE;
+          inbuf  += 8*BLOCKSIZE;
+        }
+      aesni_cleanup_8_11 ();
+#endif /*__x86_64__*/
+      for ( ;nblocks > 3 ; nblocks -= 4 )
+        {
+          do_aesni_cbc_dec_4 (ctx, iv, outbuf, inbuf);
+          outbuf += 4*BLOCKSIZE;
+          inbuf  += 4*BLOCKSIZE;
+        }
+      aesni_cleanup_2_4 ();
+      aesni_cleanup_5 ();
+      /* The remaining blocks are done by the loop below.  */
+    }
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_prepare ();
+#endif /*USE_SSSE3*/
 
   for ( ;nblocks; nblocks-- )
     {
@@ -1602,6 +2783,10 @@ _gcry_aes_cbc_dec (void *context, unsigned char *iv,
       else if (ctx->use_aesni)
         do_aesni (ctx, 1, outbuf, inbuf);
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+      else if (ctx->use_ssse3)
+        do_ssse3_dec (ctx, outbuf, inbuf);
+#endif /*USE_SSSE3*/
       else
         do_decrypt (ctx, outbuf, inbuf);
 
@@ -1616,11 +2801,125 @@ _gcry_aes_cbc_dec (void *context, unsigned char *iv,
   if (ctx->use_aesni)
     aesni_cleanup ();
 #endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_cleanup ();
+#endif /*USE_SSSE3*/
 
   _gcry_burn_stack (48 + 2*sizeof(int) + BLOCKSIZE + 4*sizeof (char*));
 }
 
 
+/* Multiply the XTS tweak T by x; see do_aesni_xts_4.  */
+static void
+xts_mul_x (unsigned char *t)
+{
+  u64 lo = buf_get_le64 (t);
+  u64 hi = buf_get_le64 (t + 8);
+  u64 carry = hi >> 63;
+
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (0x87 & -carry);
+  buf_put_le64 (t, lo);
+  buf_put_le64 (t + 8, hi);
+}
+
+
+/* Bulk encryption or decryption of complete blocks in XTS mode.
+   TWEAK is the tweak of the first block, already encrypted with the
+   tweak key; it is updated for the next block.  With AES-NI the tweaks
+   are computed in the SSE registers and up to eight blocks are
+   processed at once.  This function is only intended for the bulk
+   encryption feature of cipher.c.  */
+void
+_gcry_aes_xts_crypt (void *context, unsigned char *tweak,
+                     void *outbuf_arg, const void *inbuf_arg,
+                     unsigned int nblocks, int encrypt)
+{
+  RIJNDAEL_context *ctx = context;
+  unsigned char *outbuf = outbuf_arg;
+  const unsigned char *inbuf = inbuf_arg;
+
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    {
+      aesni_prepare ();
+      if (!encrypt && !ctx->decryption_prepared)
+        {
+          prepare_decryption (ctx);
+          ctx->decryption_prepared = 1;
+        }
+#ifdef __x86_64__
+      for ( ;nblocks > 7 ; nblocks -= 8 )
+        {
+          do_aesni_xts_8 (ctx, !encrypt, tweak, outbuf, inbuf);
+          outbuf += 8*BLOCKSIZE;
+          inbuf  += 8*BLOCKSIZE;
+        }
+      aesni_cleanup_8_11 ();
+#endif /*__x86_64__*/
+      for ( ;nblocks > 3 ; nblocks -= 4 )
+        {
+          do_aesni_xts_4 (ctx, !encrypt, tweak, outbuf, inbuf);
+          outbuf += 4*BLOCKSIZE;
+          inbuf  += 4*BLOCKSIZE;
+        }
+      aesni_cleanup_2_4 ();
+      aesni_cleanup_5 ();
+      aesni_cleanup_6_7 ();
+      /* The remaining blocks are done by the loop below.  */
+    }
+#endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_prepare ();
+#endif /*USE_SSSE3*/
+
+  for ( ;nblocks; nblocks-- )
+    {
+      buf_xor (outbuf, inbuf, tweak, BLOCKSIZE);
+      if (0)
+        ;
+#ifdef USE_PADLOCK
+      else if (ctx->use_padlock)
+        do_padlock (ctx, !encrypt, outbuf, outbuf);
+#endif /*USE_PADLOCK*/
+#ifdef USE_AESNI
+      else if (ctx->use_aesni)
+        do_aesni (ctx, !encrypt, outbuf, outbuf);
+#endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+      else if (ctx->use_ssse3)
+        {
+          if (encrypt)
+            do_ssse3_enc (ctx, outbuf, outbuf);
+          else
+            do_ssse3_dec (ctx, outbuf, outbuf);
+        }
+#endif /*USE_SSSE3*/
+      else if (encrypt)
+        do_encrypt (ctx, outbuf, outbuf);
+      else
+        do_decrypt (ctx, outbuf, outbuf);
+      buf_xor (outbuf, outbuf, tweak, BLOCKSIZE);
+      xts_mul_x (tweak);
+      inbuf += BLOCKSIZE;
+      outbuf += BLOCKSIZE;
+    }
+
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    aesni_cleanup ();
+#endif /*USE_AESNI*/
+#ifdef USE_SSSE3
+  if (ctx->use_ssse3)
+    ssse3_cleanup ();
+#endif /*USE_SSSE3*/
+
+  _gcry_burn_stack (48 + 2*sizeof(int) + 4*sizeof (char*));
+}
+
+
 
 
 /* Run the self-tests for AES 128.  Returns NULL on success. */
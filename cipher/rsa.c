@@ -704,7 +704,7 @@ secret(gcry_mpi_t output, gcry_mpi_t input, RSA_secret_key *skey )
 {
   if (!skey->p || !skey->q || !skey->u)
     {
-      mpi_powm (output, input, skey->d, skey->n);
+      mpi_powm_sec (output, input, skey->d, skey->n);
     }
   else
     {
@@ -715,11 +715,11 @@ secret(gcry_mpi_t output, gcry_mpi_t input, RSA_secret_key *skey )
       /* m1 = c ^ (d mod (p-1)) mod p */
       mpi_sub_ui( h, skey->p, 1  );
       mpi_fdiv_r( h, skey->d, h );
-      mpi_powm( m1, input, h, skey->p );
+      mpi_powm_sec( m1, input, h, skey->p );
       /* m2 = c ^ (d mod (q-1)) mod q */
       mpi_sub_ui( h, skey->q, 1  );
       mpi_fdiv_r( h, skey->d, h );
-      mpi_powm( m2, input, h, skey->q );
+      mpi_powm_sec( m2, input, h, skey->q );
       /* h = u * ( m2 - m1 ) mod q */
       mpi_sub( h, m2, m1 );
       if ( mpi_is_neg( h ) )
@@ -38,6 +38,7 @@
 
 #include "g10lib.h"
 #include "bithelp.h"
+#include "bufhelp.h"
 #include "cipher.h"
 #include "hash-common.h"
 
@@ -238,41 +239,49 @@ sha1_write( void *context, const void *inbuf_arg, size_t inlen)
 {
   const unsigned char *inbuf = inbuf_arg;
   SHA1_CONTEXT *hd = context;
+  int burn = 0;
   size_t nblocks;
 
   if (hd->count == 64)  /* Flush the buffer. */
     {
       TRANSFORM( hd, hd->buf, 1 );
-      _gcry_burn_stack (88+4*sizeof(void*));
       hd->count = 0;
       hd->nblocks++;
+      burn = 1;
     }
   if (!inbuf)
-    return;
+    goto leave;
 
   if (hd->count)
     {
       for (; inlen && hd->count < 64; inlen--)
         hd->buf[hd->count++] = *inbuf++;
-      sha1_write (hd, NULL, 0);
-      if (!inlen)
-        return;
+      if (hd->count < 64)
+        goto leave;
+      TRANSFORM( hd, hd->buf, 1 );
+      hd->count = 0;
+      hd->nblocks++;
+      burn = 1;
     }
 
   nblocks = inlen / 64;
   if (nblocks)
     {
       TRANSFORM (hd, inbuf, nblocks);
-      hd->count = 0;
       hd->nblocks += nblocks;
       inlen -= nblocks * 64;
       inbuf += nblocks * 64;
+      burn = 1;
     }
-  _gcry_burn_stack (88+4*sizeof(void*));
 
   /* Save remaining bytes.  */
   for (; inlen && hd->count < 64; inlen--)
     hd->buf[hd->count++] = *inbuf++;
+
+ leave:
+  /* Burn the stack only once for the entire write.  */
+  if (burn)
+    _gcry_burn_stack (88+4*sizeof(void*));
 }
 
 
@@ -373,6 +382,171 @@ _gcry_sha1_hash_buffer (void *outbuf, const void *buffer, size_t length)
 }
 
 
+
+#ifdef USE_MD_BATCH
+/*
+   Multi-buffer implementation hashing 8 messages in parallel.  Each
+   vector holds the same word of all lanes; thus the state is an array
+   of 5 vectors and word I of lane L is found at index I*8+L.
+ */
+#define SHA1_LANES 8
+
+typedef u32 sha1_vec_t __attribute__ ((vector_size (4 * SHA1_LANES)));
+
+#define VROL(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define VLOAD(b,i) ((sha1_vec_t){ buf_get_be32 ((b)[0] + 4*(i)),   \
+                                  buf_get_be32 ((b)[1] + 4*(i)),   \
+                                  buf_get_be32 ((b)[2] + 4*(i)),   \
+                                  buf_get_be32 ((b)[3] + 4*(i)),   \
+                                  buf_get_be32 ((b)[4] + 4*(i)),   \
+                                  buf_get_be32 ((b)[5] + 4*(i)),   \
+                                  buf_get_be32 ((b)[6] + 4*(i)),   \
+                                  buf_get_be32 ((b)[7] + 4*(i)) })
+
+static void
+sha1_batch_transform (void *state, const unsigned char **blocks)
+{
+  sha1_vec_t *hd = state;
+  sha1_vec_t a, b, c, d, e, f, tm;
+  sha1_vec_t x[16];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    x[i] = VLOAD (blocks, i);
+
+  a = hd[0];
+  b = hd[1];
+  c = hd[2];
+  d = hd[3];
+  e = hd[4];
+
+  for (i = 0; i < 80; i++)
+    {
+      if (i >= 16)
+        {
+          tm = (x[i & 0x0f] ^ x[(i - 14) & 0x0f]
+                ^ x[(i - 8) & 0x0f] ^ x[(i - 3) & 0x0f]);
+          x[i & 0x0f] = VROL (tm, 1);
+        }
+      if (i < 20)
+        f = F1 (b, c, d) + (u32)K1;
+      else if (i < 40)
+        f = F2 (b, c, d) + (u32)K2;
+      else if (i < 60)
+        f = F3 (b, c, d) + (u32)K3;
+      else
+        f = F4 (b, c, d) + (u32)K4;
+      tm = VROL (a, 5) + f + e + x[i & 0x0f];
+      e = d;
+      d = c;
+      c = VROL (b, 30);
+      b = a;
+      a = tm;
+    }
+
+  hd[0] += a;
+  hd[1] += b;
+  hd[2] += c;
+  hd[3] += d;
+  hd[4] += e;
+}
+
+#undef VROL
+#undef VLOAD
+
+/* Copy the chaining variables of CONTEXT into LANE of STATE.  */
+static void
+sha1_batch_set_lane (void *state, int lane, const void *context)
+{
+  const SHA1_CONTEXT *hd = context;
+  u32 *s = (u32 *)state + lane;
+
+  s[0 * SHA1_LANES] = hd->h0;
+  s[1 * SHA1_LANES] = hd->h1;
+  s[2 * SHA1_LANES] = hd->h2;
+  s[3 * SHA1_LANES] = hd->h3;
+  s[4 * SHA1_LANES] = hd->h4;
+}
+
+static void
+sha1_batch_init_lane (void *state, int lane)
+{
+  SHA1_CONTEXT hd;
+
+  sha1_init (&hd);
+  sha1_batch_set_lane (state, lane, &hd);
+}
+
+static void
+sha1_batch_read_lane (void *state, int lane, unsigned char *digest)
+{
+  u32 *s = (u32 *)state + lane;
+  int i;
+
+  for (i = 0; i < 5; i++)
+    buf_put_be32 (digest + 4 * i, s[i * SHA1_LANES]);
+}
+
+static const md_batch_spec_t sha1_batch_spec =
+  {
+    SHA1_LANES, 64, 8, 5 * sizeof (sha1_vec_t),
+    sha1_batch_init_lane, sha1_batch_set_lane, sha1_batch_transform,
+    sha1_batch_read_lane
+  };
+
+static void
+sha1_hash_batch (const gcry_md_batch_item_t *items, size_t nitems)
+{
+  _gcry_md_batch_process (&sha1_batch_spec, items, nitems);
+  _gcry_burn_stack (32 * sizeof (sha1_vec_t));
+}
+#endif /*USE_MD_BATCH*/
+
+
+/* The compression function for the PBKDF2 iterations.  */
+static unsigned int
+sha1_pbkdf2_transform (void *context, const unsigned char *block)
+{
+  transform (context, block, 1);
+  return 88+4*sizeof(void*);
+}
+
+static void
+sha1_pbkdf2_read (void *context, unsigned char *digest)
+{
+  SHA1_CONTEXT *hd = context;
+
+  buf_put_be32 (digest, hd->h0);
+  buf_put_be32 (digest + 4, hd->h1);
+  buf_put_be32 (digest + 8, hd->h2);
+  buf_put_be32 (digest + 12, hd->h3);
+  buf_put_be32 (digest + 16, hd->h4);
+}
+
+static const md_pbkdf2_spec_t sha1_pbkdf2_spec =
+  {
+    64, 8, 20, sizeof (SHA1_CONTEXT),
+    sha1_pbkdf2_transform, sha1_pbkdf2_read,
+#ifdef USE_MD_BATCH
+    &sha1_batch_spec
+#else
+    NULL
+#endif
+  };
+
+static void
+sha1_pbkdf2_iterate (const void *inner, const void *outer,
+                     unsigned char *u, unsigned char *t,
+                     size_t n, unsigned long count)
+{
+  _gcry_hash_pbkdf2_iterate (&sha1_pbkdf2_spec, inner, outer,
+                             u, t, n, count);
+#ifdef USE_MD_BATCH
+  _gcry_burn_stack (32 * sizeof (sha1_vec_t));
+#endif
+}
+
+
 
 /*
      Self-test section.
@@ -473,5 +647,11 @@ gcry_md_spec_t _gcry_digest_spec_sha1 =
   };
 md_extra_spec_t _gcry_digest_extraspec_sha1 =
   {
-    run_selftests
+    run_selftests,
+#ifdef USE_MD_BATCH
+    sha1_hash_batch,
+#else
+    NULL,
+#endif
+    sha1_pbkdf2_iterate
   };
@@ -42,6 +42,7 @@
 
 #include "g10lib.h"
 #include "bithelp.h"
+#include "bufhelp.h"
 #include "cipher.h"
 #include "hash-common.h"
 
@@ -50,9 +51,39 @@ typedef struct {
   u32  nblocks;
   byte buf[64];
   int  count;
+#ifdef USE_SHA_SSSE3
+  unsigned int use_ssse3:1;
+#endif
+#ifdef USE_SHA_AVX
+  unsigned int use_avx:1;
+#endif
+#ifdef USE_SHA_AVX2
+  unsigned int use_avx2:1;
+#endif
 } SHA256_CONTEXT;
 
 
+/* Select the transform function to be used for HD.  */
+static void
+init_hw_features (SHA256_CONTEXT *hd)
+{
+#ifdef USE_SHA_SIMD
+  unsigned int features = _gcry_get_hw_features ();
+#endif
+
+#ifdef USE_SHA_SSSE3
+  hd->use_ssse3 = !!(features & HWF_INTEL_SSSE3);
+#endif
+#ifdef USE_SHA_AVX
+  hd->use_avx = !!(features & HWF_INTEL_AVX);
+#endif
+#ifdef USE_SHA_AVX2
+  hd->use_avx2 = !!(features & HWF_INTEL_AVX2);
+#endif
+  (void)hd;
+}
+
+
 static void
 sha256_init (void *context)
 {
@@ -69,6 +100,7 @@ sha256_init (void *context)
 
   hd->nblocks = 0;
   hd->count = 0;
+  init_hw_features (hd);
 }
 
 
@@ -88,28 +120,12 @@ sha224_init (void *context)
 
   hd->nblocks = 0;
   hd->count = 0;
+  init_hw_features (hd);
 }
 
 
-/*
-  Transform the message X which consists of 16 32-bit-words. See FIPS
-  180-2 for details.  */
 #define S0(x) (ror ((x), 7) ^ ror ((x), 18) ^ ((x) >> 3))       /* (4.6) */
 #define S1(x) (ror ((x), 17) ^ ror ((x), 19) ^ ((x) >> 10))     /* (4.7) */
-#define R(a,b,c,d,e,f,g,h,k,w) do                                 \
-          {                                                       \
-            t1 = (h) + Sum1((e)) + Cho((e),(f),(g)) + (k) + (w);  \
-            t2 = Sum0((a)) + Maj((a),(b),(c));                    \
-            h = g;                                                \
-            g = f;                                                \
-            f = e;                                                \
-            e = d + t1;                                           \
-            d = c;                                                \
-            c = b;                                                \
-            b = a;                                                \
-            a = t1 + t2;                                          \
-          } while (0)
-
 /* (4.2) same as SHA-1's F1.  */
 static inline u32
 Cho (u32 x, u32 y, u32 z)
@@ -139,10 +155,9 @@ Sum1 (u32 x)
 }
 
 
-static void
-transform (SHA256_CONTEXT *hd, const unsigned char *data)
-{
-  static const u32 K[64] = {
+/* The round constants.  */
+static const u32 K[64] =
+  {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
     0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -161,9 +176,13 @@ transform (SHA256_CONTEXT *hd, const unsigned char *data)
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
   };
 
+
+/* Run the 64 rounds on the chaining variables of HD.  WK[I*STRIDE]
+   is word I of the message schedule plus the round constant K[I].  */
+static inline void
+do_rounds (SHA256_CONTEXT *hd, const u32 *wk, const int stride)
+{
   u32 a,b,c,d,e,f,g,h,t1,t2;
-  u32 x[16];
-  u32 w[64];
   int i;
 
   a = hd->h0;
@@ -175,75 +194,47 @@ transform (SHA256_CONTEXT *hd, const unsigned char *data)
   g = hd->h6;
   h = hd->h7;
 
-#ifdef WORDS_BIGENDIAN
-  memcpy (x, data, 64);
-#else
-  {
-    byte *p2;
-
-    for (i=0, p2=(byte*)x; i < 16; i++, p2 += 4 )
-      {
-        p2[3] = *data++;
-        p2[2] = *data++;
-        p2[1] = *data++;
-        p2[0] = *data++;
-      }
-  }
-#endif
-
-  for (i=0; i < 16; i++)
-    w[i] = x[i];
-  for (; i < 64; i++)
-    w[i] = S1(w[i-2]) + w[i-7] + S0(w[i-15]) + w[i-16];
-
-  for (i=0; i < 64;)
+  for (i=0; i < 64; i += 8, wk += 8 * stride)
     {
-#if 0
-      R(a,b,c,d,e,f,g,h,K[i],w[i]);
-      i++;
-#else
-      t1 = h + Sum1 (e) + Cho (e, f, g) + K[i] + w[i];
+      t1 = h + Sum1 (e) + Cho (e, f, g) + wk[0];
       t2 = Sum0 (a) + Maj (a, b, c);
       d += t1;
       h  = t1 + t2;
 
-      t1 = g + Sum1 (d) + Cho (d, e, f) + K[i+1] + w[i+1];
+      t1 = g + Sum1 (d) + Cho (d, e, f) + wk[1 * stride];
       t2 = Sum0 (h) + Maj (h, a, b);
       c += t1;
       g  = t1 + t2;
 
-      t1 = f + Sum1 (c) + Cho (c, d, e) + K[i+2] + w[i+2];
+      t1 = f + Sum1 (c) + Cho (c, d, e) + wk[2 * stride];
       t2 = Sum0 (g) + Maj (g, h, a);
       b += t1;
       f  = t1 + t2;
 
-      t1 = e + Sum1 (b) + Cho (b, c, d) + K[i+3] + w[i+3];
+      t1 = e + Sum1 (b) + Cho (b, c, d) + wk[3 * stride];
       t2 = Sum0 (f) + Maj (f, g, h);
       a += t1;
       e  = t1 + t2;
 
-      t1 = d + Sum1 (a) + Cho (a, b, c) + K[i+4] + w[i+4];
+      t1 = d + Sum1 (a) + Cho (a, b, c) + wk[4 * stride];
       t2 = Sum0 (e) + Maj (e, f, g);
       h += t1;
       d  = t1 + t2;
 
-      t1 = c + Sum1 (h) + Cho (h, a, b) + K[i+5] + w[i+5];
+      t1 = c + Sum1 (h) + Cho (h, a, b) + wk[5 * stride];
       t2 = Sum0 (d) + Maj (d, e, f);
       g += t1;
       c  = t1 + t2;
 
-      t1 = b + Sum1 (g) + Cho (g, h, a) + K[i+6] + w[i+6];
+      t1 = b + Sum1 (g) + Cho (g, h, a) + wk[6 * stride];
       t2 = Sum0 (c) + Maj (c, d, e);
       f += t1;
       b  = t1 + t2;
 
-      t1 = a + Sum1 (f) + Cho (f, g, h) + K[i+7] + w[i+7];
+      t1 = a + Sum1 (f) + Cho (f, g, h) + wk[7 * stride];
       t2 = Sum0 (b) + Maj (b, c, d);
       e += t1;
       a  = t1 + t2;
-
-      i += 8;
-#endif
     }
 
   hd->h0 += a;
@@ -255,9 +246,142 @@ transform (SHA256_CONTEXT *hd, const unsigned char *data)
   hd->h6 += g;
   hd->h7 += h;
 }
+
+
+/* Transform the block at DATA using portable C code.  */
+static void
+transform_blk (SHA256_CONTEXT *hd, const unsigned char *data)
+{
+  u32 w[64];
+  int i;
+
+#ifdef WORDS_BIGENDIAN
+  memcpy (w, data, 64);
+#else
+  {
+    byte *p2;
+
+    for (i=0, p2=(byte*)w; i < 16; i++, p2 += 4 )
+      {
+        p2[3] = *data++;
+        p2[2] = *data++;
+        p2[1] = *data++;
+        p2[0] = *data++;
+      }
+  }
+#endif
+
+  for (i=16; i < 64; i++)
+    w[i] = S1(w[i-2]) + w[i-7] + S0(w[i-15]) + w[i-16];
+  for (i=0; i < 64; i++)
+    w[i] += K[i];
+
+  do_rounds (hd, w, 1);
+}
+
+
+#ifdef USE_SHA_SIMD
+/* Transform NBLOCKS blocks at DATA; NBLOCKS must be a multiple of 8.
+   The message schedule of 8 blocks is computed at once with each
+   block in one lane of the vectors; the rounds are then run for each
+   block using the scalar code.  This function is compiled for several
+   targets and thus needs to be inlined.  */
+#define VROR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define VS0(x) (VROR ((x), 7) ^ VROR ((x), 18) ^ ((x) >> 3))
+#define VS1(x) (VROR ((x), 17) ^ VROR ((x), 19) ^ ((x) >> 10))
+
+static inline __attribute__ ((always_inline)) unsigned int
+transform_simd (SHA256_CONTEXT *hd, const unsigned char *data, size_t nblocks)
+{
+  sha_simd_vec_t w[64];
+  int i, j;
+
+  for (; nblocks; nblocks -= SHA_SIMD_LANES, data += SHA_SIMD_LANES * 64)
+    {
+      sha_simd_load_blocks (w, data);
+      for (i = 16; i < 64; i++)
+        w[i] = VS1 (w[i-2]) + w[i-7] + VS0 (w[i-15]) + w[i-16];
+      for (i = 0; i < 64; i++)
+        w[i] += K[i];
+
+      for (j = 0; j < SHA_SIMD_LANES; j++)
+        do_rounds (hd, (u32 *)w + j, SHA_SIMD_LANES);
+    }
+
+  return sizeof w + 16 * sizeof (void *);
+}
+
+#undef VROR
+#undef VS0
+#undef VS1
+#endif /*USE_SHA_SIMD*/
+
+#ifdef USE_SHA_SSSE3
+static __attribute__ ((target ("ssse3"))) unsigned int
+transform_ssse3 (SHA256_CONTEXT *hd, const unsigned char *data,
+                 size_t nblocks)
+{
+  return transform_simd (hd, data, nblocks);
+}
+#endif /*USE_SHA_SSSE3*/
+
+#ifdef USE_SHA_AVX
+static __attribute__ ((target ("avx"))) unsigned int
+transform_avx (SHA256_CONTEXT *hd, const unsigned char *data,
+               size_t nblocks)
+{
+  return transform_simd (hd, data, nblocks);
+}
+#endif /*USE_SHA_AVX*/
+
+#ifdef USE_SHA_AVX2
+static __attribute__ ((target ("avx2"))) unsigned int
+transform_avx2 (SHA256_CONTEXT *hd, const unsigned char *data,
+                size_t nblocks)
+{
+  return transform_simd (hd, data, nblocks);
+}
+#endif /*USE_SHA_AVX2*/
+
+
+/* Transform the NBLOCKS blocks at DATA, each consisting of 16 32-bit
+   words.  See FIPS 180-2 for details.  Returns the number of bytes of
+   stack which should be burned.  */
+static unsigned int
+transform (SHA256_CONTEXT *hd, const unsigned char *data, size_t nblocks)
+{
+  unsigned int burn = 64*4 + 16 * sizeof (void *);
+#ifdef USE_SHA_SIMD
+  size_t n = nblocks - nblocks % SHA_SIMD_LANES;
+
+  if (!n)
+    ;
+#ifdef USE_SHA_AVX2
+  else if (hd->use_avx2)
+    burn = transform_avx2 (hd, data, n);
+#endif
+#ifdef USE_SHA_AVX
+  else if (hd->use_avx)
+    burn = transform_avx (hd, data, n);
+#endif
+#ifdef USE_SHA_SSSE3
+  else if (hd->use_ssse3)
+    burn = transform_ssse3 (hd, data, n);
+#endif
+  else
+    n = 0;
+  nblocks -= n;
+  data += n * 64;
+#endif /*USE_SHA_SIMD*/
+
+  /* Use the portable code for the remaining blocks.  */
+  for (; nblocks; nblocks--, data += 64)
+    transform_blk (hd, data);
+
+  return burn;
+}
 #undef S0
 #undef S1
-#undef R
 
 
 /* Update the message digest with the contents of INBUF with length
@@ -267,36 +391,45 @@ sha256_write (void *context, const void *inbuf_arg, size_t inlen)
 {
   const unsigned char *inbuf = inbuf_arg;
   SHA256_CONTEXT *hd = context;
+  unsigned int burn, stack_burn = 0;
+  size_t nblocks;
 
   if (hd->count == 64)
     { /* flush the buffer */
-      transform (hd, hd->buf);
-      _gcry_burn_stack (74*4+32);
+      stack_burn = transform (hd, hd->buf, 1);
       hd->count = 0;
       hd->nblocks++;
     }
   if (!inbuf)
-    return;
+    goto leave;
+
   if (hd->count)
     {
       for (; inlen && hd->count < 64; inlen--)
         hd->buf[hd->count++] = *inbuf++;
-      sha256_write (hd, NULL, 0);
-      if (!inlen)
-        return;
+      if (hd->count < 64)
+        goto leave;
+      burn = transform (hd, hd->buf, 1);
+      stack_burn = burn > stack_burn? burn : stack_burn;
+      hd->count = 0;
+      hd->nblocks++;
     }
 
-  while (inlen >= 64)
+  nblocks = inlen / 64;
+  if (nblocks)
     {
-      transform (hd, inbuf);
-      hd->count = 0;
-      hd->nblocks++;
-      inlen -= 64;
-      inbuf += 64;
+      burn = transform (hd, inbuf, nblocks);
+      stack_burn = burn > stack_burn? burn : stack_burn;
+      hd->nblocks += nblocks;
+      inlen -= nblocks * 64;
+      inbuf += nblocks * 64;
     }
-  _gcry_burn_stack (74*4+32);
   for (; inlen && hd->count < 64; inlen--)
     hd->buf[hd->count++] = *inbuf++;
+
+ leave:
+  if (stack_burn)
+    _gcry_burn_stack (stack_burn);
 }
 
 
@@ -310,6 +443,7 @@ sha256_final(void *context)
 {
   SHA256_CONTEXT *hd = context;
   u32 t, msb, lsb;
+  unsigned int burn;
   byte *p;
 
   sha256_write (hd, NULL, 0); /* flush */;
@@ -351,8 +485,8 @@ sha256_final(void *context)
   hd->buf[61] = lsb >> 16;
   hd->buf[62] = lsb >>  8;
   hd->buf[63] = lsb;
-  transform (hd, hd->buf);
-  _gcry_burn_stack (74*4+32);
+  burn = transform (hd, hd->buf, 1);
+  _gcry_burn_stack (burn);
 
   p = hd->buf;
 #ifdef WORDS_BIGENDIAN
@@ -381,6 +515,243 @@ sha256_read (void *context)
 }
 
 
+
+#ifdef USE_MD_BATCH
+/*
+   Multi-buffer implementation hashing 8 messages in parallel.  Each
+   vector holds the same word of all lanes; thus the state is an array
+   of 8 vectors and word I of lane L is found at index I*8+L.
+ */
+#define SHA256_LANES 8
+
+typedef u32 sha256_vec_t __attribute__ ((vector_size (4 * SHA256_LANES)));
+
+#define VROR(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define VCHO(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define VMAJ(x,y,z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define VSUM0(x) (VROR ((x), 2) ^ VROR ((x), 13) ^ VROR ((x), 22))
+#define VSUM1(x) (VROR ((x), 6) ^ VROR ((x), 11) ^ VROR ((x), 25))
+#define VS0(x) (VROR ((x), 7) ^ VROR ((x), 18) ^ ((x) >> 3))
+#define VS1(x) (VROR ((x), 17) ^ VROR ((x), 19) ^ ((x) >> 10))
+#define VLOAD(b,i) ((sha256_vec_t){ buf_get_be32 ((b)[0] + 4*(i)),   \
+                                    buf_get_be32 ((b)[1] + 4*(i)),   \
+                                    buf_get_be32 ((b)[2] + 4*(i)),   \
+                                    buf_get_be32 ((b)[3] + 4*(i)),   \
+                                    buf_get_be32 ((b)[4] + 4*(i)),   \
+                                    buf_get_be32 ((b)[5] + 4*(i)),   \
+                                    buf_get_be32 ((b)[6] + 4*(i)),   \
+                                    buf_get_be32 ((b)[7] + 4*(i)) })
+
+static void
+sha256_batch_transform (void *state, const unsigned char **blocks)
+{
+  sha256_vec_t *hd = state;
+  sha256_vec_t a, b, c, d, e, f, g, h, t1, t2;
+  sha256_vec_t w[16];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = VLOAD (blocks, i);
+
+  a = hd[0];
+  b = hd[1];
+  c = hd[2];
+  d = hd[3];
+  e = hd[4];
+  f = hd[5];
+  g = hd[6];
+  h = hd[7];
+
+  for (i = 0; i < 64; i++)
+    {
+      if (i >= 16)
+        w[i & 15] += (VS1 (w[(i - 2) & 15]) + w[(i - 7) & 15]
+                      + VS0 (w[(i - 15) & 15]));
+      t1 = h + VSUM1 (e) + VCHO (e, f, g) + K[i] + w[i & 15];
+      t2 = VSUM0 (a) + VMAJ (a, b, c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  hd[0] += a;
+  hd[1] += b;
+  hd[2] += c;
+  hd[3] += d;
+  hd[4] += e;
+  hd[5] += f;
+  hd[6] += g;
+  hd[7] += h;
+}
+
+#undef VROR
+#undef VCHO
+#undef VMAJ
+#undef VSUM0
+#undef VSUM1
+#undef VS0
+#undef VS1
+#undef VLOAD
+
+/* Copy the chaining variables of CONTEXT into LANE of STATE.  */
+static void
+sha256_batch_set_lane (void *state, int lane, const void *context)
+{
+  const SHA256_CONTEXT *hd = context;
+  u32 *s = (u32 *)state + lane;
+
+  s[0 * SHA256_LANES] = hd->h0;
+  s[1 * SHA256_LANES] = hd->h1;
+  s[2 * SHA256_LANES] = hd->h2;
+  s[3 * SHA256_LANES] = hd->h3;
+  s[4 * SHA256_LANES] = hd->h4;
+  s[5 * SHA256_LANES] = hd->h5;
+  s[6 * SHA256_LANES] = hd->h6;
+  s[7 * SHA256_LANES] = hd->h7;
+}
+
+static void
+sha256_batch_init_lane (void *state, int lane)
+{
+  SHA256_CONTEXT hd;
+
+  sha256_init (&hd);
+  sha256_batch_set_lane (state, lane, &hd);
+}
+
+static void
+sha224_batch_init_lane (void *state, int lane)
+{
+  SHA256_CONTEXT hd;
+
+  sha224_init (&hd);
+  sha256_batch_set_lane (state, lane, &hd);
+}
+
+static void
+sha256_batch_read_lane (void *state, int lane, unsigned char *digest)
+{
+  u32 *s = (u32 *)state + lane;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    buf_put_be32 (digest + 4 * i, s[i * SHA256_LANES]);
+}
+
+static void
+sha224_batch_read_lane (void *state, int lane, unsigned char *digest)
+{
+  u32 *s = (u32 *)state + lane;
+  int i;
+
+  for (i = 0; i < 7; i++)
+    buf_put_be32 (digest + 4 * i, s[i * SHA256_LANES]);
+}
+
+static const md_batch_spec_t sha256_batch_spec =
+  {
+    SHA256_LANES, 64, 8, 8 * sizeof (sha256_vec_t),
+    sha256_batch_init_lane, sha256_batch_set_lane, sha256_batch_transform,
+    sha256_batch_read_lane
+  };
+
+static const md_batch_spec_t sha224_batch_spec =
+  {
+    SHA256_LANES, 64, 8, 8 * sizeof (sha256_vec_t),
+    sha224_batch_init_lane, sha256_batch_set_lane, sha256_batch_transform,
+    sha224_batch_read_lane
+  };
+
+static void
+sha256_hash_batch (const gcry_md_batch_item_t *items, size_t nitems)
+{
+  _gcry_md_batch_process (&sha256_batch_spec, items, nitems);
+  _gcry_burn_stack (32 * sizeof (sha256_vec_t));
+}
+
+static void
+sha224_hash_batch (const gcry_md_batch_item_t *items, size_t nitems)
+{
+  _gcry_md_batch_process (&sha224_batch_spec, items, nitems);
+  _gcry_burn_stack (32 * sizeof (sha256_vec_t));
+}
+#endif /*USE_MD_BATCH*/
+
+
+/* The compression function for the PBKDF2 iterations.  */
+static unsigned int
+sha256_pbkdf2_transform (void *context, const unsigned char *block)
+{
+  return transform (context, block, 1);
+}
+
+static void
+sha256_pbkdf2_read (void *context, unsigned char *digest)
+{
+  SHA256_CONTEXT *hd = context;
+
+  buf_put_be32 (digest, hd->h0);
+  buf_put_be32 (digest + 4, hd->h1);
+  buf_put_be32 (digest + 8, hd->h2);
+  buf_put_be32 (digest + 12, hd->h3);
+  buf_put_be32 (digest + 16, hd->h4);
+  buf_put_be32 (digest + 20, hd->h5);
+  buf_put_be32 (digest + 24, hd->h6);
+  buf_put_be32 (digest + 28, hd->h7);
+}
+
+static const md_pbkdf2_spec_t sha256_pbkdf2_spec =
+  {
+    64, 8, 32, sizeof (SHA256_CONTEXT),
+    sha256_pbkdf2_transform, sha256_pbkdf2_read,
+#ifdef USE_MD_BATCH
+    &sha256_batch_spec
+#else
+    NULL
+#endif
+  };
+
+static const md_pbkdf2_spec_t sha224_pbkdf2_spec =
+  {
+    64, 8, 28, sizeof (SHA256_CONTEXT),
+    sha256_pbkdf2_transform, sha256_pbkdf2_read,
+#ifdef USE_MD_BATCH
+    &sha224_batch_spec
+#else
+    NULL
+#endif
+  };
+
+static void
+sha256_pbkdf2_iterate (const void *inner, const void *outer,
+                       unsigned char *u, unsigned char *t,
+                       size_t n, unsigned long count)
+{
+  _gcry_hash_pbkdf2_iterate (&sha256_pbkdf2_spec, inner, outer,
+                             u, t, n, count);
+#ifdef USE_MD_BATCH
+  _gcry_burn_stack (32 * sizeof (sha256_vec_t));
+#endif
+}
+
+static void
+sha224_pbkdf2_iterate (const void *inner, const void *outer,
+                       unsigned char *u, unsigned char *t,
+                       size_t n, unsigned long count)
+{
+  _gcry_hash_pbkdf2_iterate (&sha224_pbkdf2_spec, inner, outer,
+                             u, t, n, count);
+#ifdef USE_MD_BATCH
+  _gcry_burn_stack (32 * sizeof (sha256_vec_t));
+#endif
+}
+
+
 
 /*
      Self-test section.
@@ -539,7 +910,13 @@ gcry_md_spec_t _gcry_digest_spec_sha224 =
   };
 md_extra_spec_t _gcry_digest_extraspec_sha224 =
   {
-    run_selftests
+    run_selftests,
+#ifdef USE_MD_BATCH
+    sha224_hash_batch,
+#else
+    NULL,
+#endif
+    sha224_pbkdf2_iterate
   };
 
 gcry_md_spec_t _gcry_digest_spec_sha256 =
@@ -550,5 +927,11 @@ gcry_md_spec_t _gcry_digest_spec_sha256 =
   };
 md_extra_spec_t _gcry_digest_extraspec_sha256 =
   {
-    run_selftests
+    run_selftests,
+#ifdef USE_MD_BATCH
+    sha256_hash_batch,
+#else
+    NULL,
+#endif
+    sha256_pbkdf2_iterate
   };
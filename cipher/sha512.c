@@ -50,6 +50,7 @@
 #include <string.h>
 #include "g10lib.h"
 #include "bithelp.h"
+#include "bufhelp.h"
 #include "cipher.h"
 #include "hash-common.h"
 
@@ -128,6 +129,52 @@ Sum1 (u64 x)
   return (ROTR (x, 14) ^ ROTR (x, 18) ^ ROTR (x, 41));
 }
 
+/* The round constants.  */
+static const u64 k[] =
+  {
+    U64_C(0x428a2f98d728ae22), U64_C(0x7137449123ef65cd),
+    U64_C(0xb5c0fbcfec4d3b2f), U64_C(0xe9b5dba58189dbbc),
+    U64_C(0x3956c25bf348b538), U64_C(0x59f111f1b605d019),
+    U64_C(0x923f82a4af194f9b), U64_C(0xab1c5ed5da6d8118),
+    U64_C(0xd807aa98a3030242), U64_C(0x12835b0145706fbe),
+    U64_C(0x243185be4ee4b28c), U64_C(0x550c7dc3d5ffb4e2),
+    U64_C(0x72be5d74f27b896f), U64_C(0x80deb1fe3b1696b1),
+    U64_C(0x9bdc06a725c71235), U64_C(0xc19bf174cf692694),
+    U64_C(0xe49b69c19ef14ad2), U64_C(0xefbe4786384f25e3),
+    U64_C(0x0fc19dc68b8cd5b5), U64_C(0x240ca1cc77ac9c65),
+    U64_C(0x2de92c6f592b0275), U64_C(0x4a7484aa6ea6e483),
+    U64_C(0x5cb0a9dcbd41fbd4), U64_C(0x76f988da831153b5),
+    U64_C(0x983e5152ee66dfab), U64_C(0xa831c66d2db43210),
+    U64_C(0xb00327c898fb213f), U64_C(0xbf597fc7beef0ee4),
+    U64_C(0xc6e00bf33da88fc2), U64_C(0xd5a79147930aa725),
+    U64_C(0x06ca6351e003826f), U64_C(0x142929670a0e6e70),
+    U64_C(0x27b70a8546d22ffc), U64_C(0x2e1b21385c26c926),
+    U64_C(0x4d2c6dfc5ac42aed), U64_C(0x53380d139d95b3df),
+    U64_C(0x650a73548baf63de), U64_C(0x766a0abb3c77b2a8),
+    U64_C(0x81c2c92e47edaee6), U64_C(0x92722c851482353b),
+    U64_C(0xa2bfe8a14cf10364), U64_C(0xa81a664bbc423001),
+    U64_C(0xc24b8b70d0f89791), U64_C(0xc76c51a30654be30),
+    U64_C(0xd192e819d6ef5218), U64_C(0xd69906245565a910),
+    U64_C(0xf40e35855771202a), U64_C(0x106aa07032bbd1b8),
+    U64_C(0x19a4c116b8d2d0c8), U64_C(0x1e376c085141ab53),
+    U64_C(0x2748774cdf8eeb99), U64_C(0x34b0bcb5e19b48a8),
+    U64_C(0x391c0cb3c5c95a63), U64_C(0x4ed8aa4ae3418acb),
+    U64_C(0x5b9cca4f7763e373), U64_C(0x682e6ff3d6b2b8a3),
+    U64_C(0x748f82ee5defb2fc), U64_C(0x78a5636f43172f60),
+    U64_C(0x84c87814a1f0ab72), U64_C(0x8cc702081a6439ec),
+    U64_C(0x90befffa23631e28), U64_C(0xa4506cebde82bde9),
+    U64_C(0xbef9a3f7b2c67915), U64_C(0xc67178f2e372532b),
+    U64_C(0xca273eceea26619c), U64_C(0xd186b8c721c0c207),
+    U64_C(0xeada7dd6cde0eb1e), U64_C(0xf57d4f7fee6ed178),
+    U64_C(0x06f067aa72176fba), U64_C(0x0a637dc5a2c898a6),
+    U64_C(0x113f9804bef90dae), U64_C(0x1b710b35131c471b),
+    U64_C(0x28db77f523047d84), U64_C(0x32caab7b40c72493),
+    U64_C(0x3c9ebe0a15c9bebc), U64_C(0x431d67c49c100d4c),
+    U64_C(0x4cc5d4becb3e42b6), U64_C(0x597f299cfc657e2a),
+    U64_C(0x5fcb6fab3ad6faec), U64_C(0x6c44198c4a475817)
+  };
+
+
 /****************
  * Transform the message W which consists of 16 64-bit-words
  */
@@ -137,49 +184,6 @@ transform (SHA512_CONTEXT *hd, const unsigned char *data)
   u64 a, b, c, d, e, f, g, h;
   u64 w[80];
   int t;
-  static const u64 k[] =
-    {
-      U64_C(0x428a2f98d728ae22), U64_C(0x7137449123ef65cd),
-      U64_C(0xb5c0fbcfec4d3b2f), U64_C(0xe9b5dba58189dbbc),
-      U64_C(0x3956c25bf348b538), U64_C(0x59f111f1b605d019),
-      U64_C(0x923f82a4af194f9b), U64_C(0xab1c5ed5da6d8118),
-      U64_C(0xd807aa98a3030242), U64_C(0x12835b0145706fbe),
-      U64_C(0x243185be4ee4b28c), U64_C(0x550c7dc3d5ffb4e2),
-      U64_C(0x72be5d74f27b896f), U64_C(0x80deb1fe3b1696b1),
-      U64_C(0x9bdc06a725c71235), U64_C(0xc19bf174cf692694),
-      U64_C(0xe49b69c19ef14ad2), U64_C(0xefbe4786384f25e3),
-      U64_C(0x0fc19dc68b8cd5b5), U64_C(0x240ca1cc77ac9c65),
-      U64_C(0x2de92c6f592b0275), U64_C(0x4a7484aa6ea6e483),
-      U64_C(0x5cb0a9dcbd41fbd4), U64_C(0x76f988da831153b5),
-      U64_C(0x983e5152ee66dfab), U64_C(0xa831c66d2db43210),
-      U64_C(0xb00327c898fb213f), U64_C(0xbf597fc7beef0ee4),
-      U64_C(0xc6e00bf33da88fc2), U64_C(0xd5a79147930aa725),
-      U64_C(0x06ca6351e003826f), U64_C(0x142929670a0e6e70),
-      U64_C(0x27b70a8546d22ffc), U64_C(0x2e1b21385c26c926),
-      U64_C(0x4d2c6dfc5ac42aed), U64_C(0x53380d139d95b3df),
-      U64_C(0x650a73548baf63de), U64_C(0x766a0abb3c77b2a8),
-      U64_C(0x81c2c92e47edaee6), U64_C(0x92722c851482353b),
-      U64_C(0xa2bfe8a14cf10364), U64_C(0xa81a664bbc423001),
-      U64_C(0xc24b8b70d0f89791), U64_C(0xc76c51a30654be30),
-      U64_C(0xd192e819d6ef5218), U64_C(0xd69906245565a910),
-      U64_C(0xf40e35855771202a), U64_C(0x106aa07032bbd1b8),
-      U64_C(0x19a4c116b8d2d0c8), U64_C(0x1e376c085141ab53),
-      U64_C(0x2748774cdf8eeb99), U64_C(0x34b0bcb5e19b48a8),
-      U64_C(0x391c0cb3c5c95a63), U64_C(0x4ed8aa4ae3418acb),
-      U64_C(0x5b9cca4f7763e373), U64_C(0x682e6ff3d6b2b8a3),
-      U64_C(0x748f82ee5defb2fc), U64_C(0x78a5636f43172f60),
-      U64_C(0x84c87814a1f0ab72), U64_C(0x8cc702081a6439ec),
-      U64_C(0x90befffa23631e28), U64_C(0xa4506cebde82bde9),
-      U64_C(0xbef9a3f7b2c67915), U64_C(0xc67178f2e372532b),
-      U64_C(0xca273eceea26619c), U64_C(0xd186b8c721c0c207),
-      U64_C(0xeada7dd6cde0eb1e), U64_C(0xf57d4f7fee6ed178),
-      U64_C(0x06f067aa72176fba), U64_C(0x0a637dc5a2c898a6),
-      U64_C(0x113f9804bef90dae), U64_C(0x1b710b35131c471b),
-      U64_C(0x28db77f523047d84), U64_C(0x32caab7b40c72493),
-      U64_C(0x3c9ebe0a15c9bebc), U64_C(0x431d67c49c100d4c),
-      U64_C(0x4cc5d4becb3e42b6), U64_C(0x597f299cfc657e2a),
-      U64_C(0x5fcb6fab3ad6faec), U64_C(0x6c44198c4a475817)
-    };
 
   /* get values from the chaining vars */
   a = hd->h0;
@@ -437,6 +441,240 @@ sha512_read (void *context)
 }
 
 
+
+#ifdef USE_MD_BATCH
+/*
+   Multi-buffer implementation hashing 4 messages in parallel.  Each
+   vector holds the same word of all lanes; thus the state is an array
+   of 8 vectors and word I of lane L is found at index I*4+L.
+ */
+#define SHA512_LANES 4
+
+typedef u64 sha512_vec_t __attribute__ ((vector_size (8 * SHA512_LANES)));
+
+#define VROTR(x,n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define VCH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define VMAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define VSUM0(x) (VROTR ((x), 28) ^ VROTR ((x), 34) ^ VROTR ((x), 39))
+#define VSUM1(x) (VROTR ((x), 14) ^ VROTR ((x), 18) ^ VROTR ((x), 41))
+#define VS0(x) (VROTR ((x), 1) ^ VROTR ((x), 8) ^ ((x) >> 7))
+#define VS1(x) (VROTR ((x), 19) ^ VROTR ((x), 61) ^ ((x) >> 6))
+#define VLOAD(b,i) ((sha512_vec_t){ buf_get_be64 ((b)[0] + 8*(i)),   \
+                                    buf_get_be64 ((b)[1] + 8*(i)),   \
+                                    buf_get_be64 ((b)[2] + 8*(i)),   \
+                                    buf_get_be64 ((b)[3] + 8*(i)) })
+
+static void
+sha512_batch_transform (void *state, const unsigned char **blocks)
+{
+  sha512_vec_t *hd = state;
+  sha512_vec_t a, b, c, d, e, f, g, h, t1, t2;
+  sha512_vec_t w[16];
+  int t;
+
+  for (t = 0; t < 16; t++)
+    w[t] = VLOAD (blocks, t);
+
+  a = hd[0];
+  b = hd[1];
+  c = hd[2];
+  d = hd[3];
+  e = hd[4];
+  f = hd[5];
+  g = hd[6];
+  h = hd[7];
+
+  for (t = 0; t < 80; t++)
+    {
+      if (t >= 16)
+        w[t & 15] += (VS1 (w[(t - 2) & 15]) + w[(t - 7) & 15]
+                      + VS0 (w[(t - 15) & 15]));
+      t1 = h + VSUM1 (e) + VCH (e, f, g) + k[t] + w[t & 15];
+      t2 = VSUM0 (a) + VMAJ (a, b, c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  hd[0] += a;
+  hd[1] += b;
+  hd[2] += c;
+  hd[3] += d;
+  hd[4] += e;
+  hd[5] += f;
+  hd[6] += g;
+  hd[7] += h;
+}
+
+#undef VROTR
+#undef VCH
+#undef VMAJ
+#undef VSUM0
+#undef VSUM1
+#undef VS0
+#undef VS1
+#undef VLOAD
+
+/* Copy the chaining variables of CONTEXT into LANE of STATE.  */
+static void
+sha512_batch_set_lane (void *state, int lane, const void *context)
+{
+  const SHA512_CONTEXT *hd = context;
+  u64 *s = (u64 *)state + lane;
+
+  s[0 * SHA512_LANES] = hd->h0;
+  s[1 * SHA512_LANES] = hd->h1;
+  s[2 * SHA512_LANES] = hd->h2;
+  s[3 * SHA512_LANES] = hd->h3;
+  s[4 * SHA512_LANES] = hd->h4;
+  s[5 * SHA512_LANES] = hd->h5;
+  s[6 * SHA512_LANES] = hd->h6;
+  s[7 * SHA512_LANES] = hd->h7;
+}
+
+static void
+sha512_batch_init_lane (void *state, int lane)
+{
+  SHA512_CONTEXT hd;
+
+  sha512_init (&hd);
+  sha512_batch_set_lane (state, lane, &hd);
+}
+
+static void
+sha384_batch_init_lane (void *state, int lane)
+{
+  SHA512_CONTEXT hd;
+
+  sha384_init (&hd);
+  sha512_batch_set_lane (state, lane, &hd);
+}
+
+static void
+sha512_batch_read_lane (void *state, int lane, unsigned char *digest)
+{
+  u64 *s = (u64 *)state + lane;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    buf_put_be64 (digest + 8 * i, s[i * SHA512_LANES]);
+}
+
+static void
+sha384_batch_read_lane (void *state, int lane, unsigned char *digest)
+{
+  u64 *s = (u64 *)state + lane;
+  int i;
+
+  for (i = 0; i < 6; i++)
+    buf_put_be64 (digest + 8 * i, s[i * SHA512_LANES]);
+}
+
+static const md_batch_spec_t sha512_batch_spec =
+  {
+    SHA512_LANES, 128, 16, 8 * sizeof (sha512_vec_t),
+    sha512_batch_init_lane, sha512_batch_set_lane, sha512_batch_transform,
+    sha512_batch_read_lane
+  };
+
+static const md_batch_spec_t sha384_batch_spec =
+  {
+    SHA512_LANES, 128, 16, 8 * sizeof (sha512_vec_t),
+    sha384_batch_init_lane, sha512_batch_set_lane, sha512_batch_transform,
+    sha384_batch_read_lane
+  };
+
+static void
+sha512_hash_batch (const gcry_md_batch_item_t *items, size_t nitems)
+{
+  _gcry_md_batch_process (&sha512_batch_spec, items, nitems);
+  _gcry_burn_stack (32 * sizeof (sha512_vec_t));
+}
+
+static void
+sha384_hash_batch (const gcry_md_batch_item_t *items, size_t nitems)
+{
+  _gcry_md_batch_process (&sha384_batch_spec, items, nitems);
+  _gcry_burn_stack (32 * sizeof (sha512_vec_t));
+}
+#endif /*USE_MD_BATCH*/
+
+
+/* The compression function for the PBKDF2 iterations.  */
+static unsigned int
+sha512_pbkdf2_transform (void *context, const unsigned char *block)
+{
+  transform (context, block);
+  return 768;
+}
+
+static void
+sha512_pbkdf2_read (void *context, unsigned char *digest)
+{
+  SHA512_CONTEXT *hd = context;
+
+  buf_put_be64 (digest, hd->h0);
+  buf_put_be64 (digest + 8, hd->h1);
+  buf_put_be64 (digest + 16, hd->h2);
+  buf_put_be64 (digest + 24, hd->h3);
+  buf_put_be64 (digest + 32, hd->h4);
+  buf_put_be64 (digest + 40, hd->h5);
+  buf_put_be64 (digest + 48, hd->h6);
+  buf_put_be64 (digest + 56, hd->h7);
+}
+
+static const md_pbkdf2_spec_t sha512_pbkdf2_spec =
+  {
+    128, 16, 64, sizeof (SHA512_CONTEXT),
+    sha512_pbkdf2_transform, sha512_pbkdf2_read,
+#ifdef USE_MD_BATCH
+    &sha512_batch_spec
+#else
+    NULL
+#endif
+  };
+
+static const md_pbkdf2_spec_t sha384_pbkdf2_spec =
+  {
+    128, 16, 48, sizeof (SHA512_CONTEXT),
+    sha512_pbkdf2_transform, sha512_pbkdf2_read,
+#ifdef USE_MD_BATCH
+    &sha384_batch_spec
+#else
+    NULL
+#endif
+  };
+
+static void
+sha512_pbkdf2_iterate (const void *inner, const void *outer,
+                       unsigned char *u, unsigned char *t,
+                       size_t n, unsigned long count)
+{
+  _gcry_hash_pbkdf2_iterate (&sha512_pbkdf2_spec, inner, outer,
+                             u, t, n, count);
+#ifdef USE_MD_BATCH
+  _gcry_burn_stack (32 * sizeof (sha512_vec_t));
+#endif
+}
+
+static void
+sha384_pbkdf2_iterate (const void *inner, const void *outer,
+                       unsigned char *u, unsigned char *t,
+                       size_t n, unsigned long count)
+{
+  _gcry_hash_pbkdf2_iterate (&sha384_pbkdf2_spec, inner, outer,
+                             u, t, n, count);
+#ifdef USE_MD_BATCH
+  _gcry_burn_stack (32 * sizeof (sha512_vec_t));
+#endif
+}
+
+
 
 /*
      Self-test section.
@@ -597,7 +835,13 @@ gcry_md_spec_t _gcry_digest_spec_sha512 =
   };
 md_extra_spec_t _gcry_digest_extraspec_sha512 =
   {
-    run_selftests
+    run_selftests,
+#ifdef USE_MD_BATCH
+    sha512_hash_batch,
+#else
+    NULL,
+#endif
+    sha512_pbkdf2_iterate
   };
 
 static byte sha384_asn[] =	/* Object ID is 2.16.840.1.101.3.4.2.2 */
@@ -625,5 +869,11 @@ gcry_md_spec_t _gcry_digest_spec_sha384 =
   };
 md_extra_spec_t _gcry_digest_extraspec_sha384 =
   {
-    run_selftests
+    run_selftests,
+#ifdef USE_MD_BATCH
+    sha384_hash_batch,
+#else
+    NULL,
+#endif
+    sha384_pbkdf2_iterate
   };
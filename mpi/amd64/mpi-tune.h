@@ -0,0 +1,12 @@
+/* mpi-tune.h - Multiplication thresholds
+ * Generated by tests/mpitune for 64 bit limbs on Fri Oct 16 11:12:09 2026
+ */
+
+#define KARATSUBA_THRESHOLD        38
+#define KARATSUBA_SQR_THRESHOLD    54
+#define TOOM3_MUL_THRESHOLD       125
+#define TOOM3_SQR_THRESHOLD       361
+
+/* The squaring thresholds for CPUs with BMI2 and ADX.  */
+#define KARATSUBA_SQR_THRESHOLD_MULX  164
+#define TOOM3_SQR_THRESHOLD_MULX      201
@@ -22,19 +22,55 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "mpi-internal.h"
 #include "longlong.h"
 #include "g10lib.h"
+#include "ath.h"
 
 
 #define point_init(a)  _gcry_mpi_ec_point_init ((a))
 #define point_free(a)  _gcry_mpi_ec_point_free ((a))
 
+/* The width of the NAF used for the multiplication of a variable
+   point.  2^(EC_WNAF_WIDTH-2) odd multiples of the point are
+   precomputed.  */
+#define EC_WNAF_WIDTH 4
+
+/* The number of teeth of the comb used for the multiplication of a
+   base point.  A table with 2^EC_COMB_TEETH - 1 points is cached for
+   each base point.  */
+#define EC_COMB_TEETH 6
+
 
 /* Object to represent a point in projective coordinates. */
 /* Currently defined in mpi.h */
 
+/* The fast reduction for the NIST primes works on 32 bit words and
+   requires a 64 bit type for the accumulator.  */
+#undef USE_NIST_REDUCTION
+#if defined(HAVE_U64_TYPEDEF) \
+    && (BITS_PER_MPI_LIMB == 32 || BITS_PER_MPI_LIMB == 64)
+# define USE_NIST_REDUCTION 1
+#endif
+
+#ifdef USE_NIST_REDUCTION
+/* The largest NIST prime (P-521) has 17 words.  */
+#define NIST_MAX_WORDS 17
+
+/* Description of a NIST prime.  */
+struct nist_prime_s
+{
+  unsigned int nbits;
+  int nwords;
+  /* Function to reduce the product C of 2*NWORDS words to NWORDS
+     words in R.  Returns the signed carry out of R.  */
+  int (*reduce) (u32 *r, const u32 *c);
+  u32 p[NIST_MAX_WORDS];  /* The prime; least significant word first.  */
+};
+#endif /*USE_NIST_REDUCTION*/
+
 /* This context is used with all our EC functions. */
 struct mpi_ec_ctx_s
 {
@@ -56,12 +92,37 @@ struct mpi_ec_ctx_s
   gcry_mpi_t scratch[11];
 
   /* Helper for fast reduction.  */
-/*   int nist_nbits; /\* If this is a NIST curve, the number of bits.  *\/ */
-/*   gcry_mpi_t s[10]; */
-/*   gcry_mpi_t c; */
+#ifdef USE_NIST_REDUCTION
+  const struct nist_prime_s *nist; /* The NIST prime or NULL.  */
+  mpi_size_t nist_nlimbs;          /* Number of limbs of an operand.  */
+  mpi_ptr_t nist_buf;              /* Space for operands and product.  */
+#endif /*USE_NIST_REDUCTION*/
+};
+
 
+/* A table with precomputed multiples of a base point used by the comb
+   method.  With D being the distance between the teeth of the comb,
+   entry B-1 of POINTS is the sum of 2^(I*D)G for all bits I set in B.
+   The points are stored in affine coordinates (i.e. Z = 1).  */
+struct ec_base_table_s
+{
+  struct ec_base_table_s *next;
+  gcry_mpi_t p;   /* The prime and the coefficient A of the curve.  */
+  gcry_mpi_t a;
+  gcry_mpi_t gx;  /* The affine coordinates of the base point.  */
+  gcry_mpi_t gy;
+  int state;      /* 0 = POINTS not yet computed, 1 = computed,
+                     -1 = G is not suitable.  */
+  unsigned int d; /* The distance between the teeth of the comb.  */
+  mpi_point_t points[(1 << EC_COMB_TEETH) - 1];
 };
 
+/* The list of base points registered with _gcry_mpi_ec_register_base.
+   Only for these a table is computed, on first use.  Entries are never
+   removed; once computed a table is not modified anymore.  */
+static struct ec_base_table_s *base_tables;
+static ath_mutex_t base_tables_lock = ATH_MUTEX_INITIALIZER;
+
 
 
 /* Initialized a point object.  gcry_mpi_ec_point_free shall be used
@@ -95,138 +156,326 @@ point_set (mpi_point_t *d, mpi_point_t *s)
 
 
 
+/* Reduce W modulo P.  For the sum or the difference of two reduced
+   values a single addition or subtraction of P is sufficient, which
+   is much faster than a division.  */
+static void
+ec_mod (gcry_mpi_t w, mpi_ec_t ctx)
+{
+  if (w->sign)
+    mpi_add (w, w, ctx->p);
+  else if (mpi_cmp (w, ctx->p) >= 0)
+    mpi_sub (w, w, ctx->p);
+  else
+    return;
+  if (w->sign || mpi_cmp (w, ctx->p) >= 0)
+    mpi_fdiv_r (w, w, ctx->p);
+}
+
 static void
 ec_addm (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, mpi_ec_t ctx)
 {
-  mpi_addm (w, u, v, ctx->p);
+  mpi_add (w, u, v);
+  ec_mod (w, ctx);
 }
 
 static void
 ec_subm (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, mpi_ec_t ctx)
 {
-  mpi_subm (w, u, v, ctx->p);
+  mpi_sub (w, u, v);
+  ec_mod (w, ctx);
 }
 
-static void
-ec_mulm (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, mpi_ec_t ctx)
+#ifdef USE_NIST_REDUCTION
+/* The fast reduction algorithms from FIPS 186-4, D.2 for the NIST
+   primes.  The product is given as 32 bit words C[0] to C[2N-1] with
+   the least significant word first.  The words of the result are
+   accumulated in a 64 bit variable; negative values are represented
+   in two's complement and thus the carry needs to be sign
+   extended.  */
+#define NIST_CARRY(a) (((a) >> 32) | (((a) >> 63)? (~(u64)0 << 32) : 0))
+#define NIST_WORD(i, expr) do {                 \
+    acc = (expr) + NIST_CARRY (acc);            \
+    r[(i)] = (u32)acc;                          \
+  } while (0)
+
+/* Return the carry of ACC as a signed integer.  */
+static int
+nist_top (u64 acc)
 {
-#if 0
-  /* NOTE: This code works only for limb sizes of 32 bit.  */
-  mpi_limb_t *wp, *sp;
+  acc = NIST_CARRY (acc);
+  return (acc >> 63)? -(int)(-acc) : (int)acc;
+}
+
+static int
+reduce_p192 (u32 *r, const u32 *c)
+{
+  u64 acc = 0;
+
+  NIST_WORD (0, (u64)c[0] + c[6] + c[10]);
+  NIST_WORD (1, (u64)c[1] + c[7] + c[11]);
+  NIST_WORD (2, (u64)c[2] + c[6] + c[8] + c[10]);
+  NIST_WORD (3, (u64)c[3] + c[7] + c[9] + c[11]);
+  NIST_WORD (4, (u64)c[4] + c[8] + c[10]);
+  NIST_WORD (5, (u64)c[5] + c[9] + c[11]);
+  return nist_top (acc);
+}
+
+static int
+reduce_p224 (u32 *r, const u32 *c)
+{
+  u64 acc = 0;
+
+  NIST_WORD (0, (u64)c[0] - c[7] - c[11]);
+  NIST_WORD (1, (u64)c[1] - c[8] - c[12]);
+  NIST_WORD (2, (u64)c[2] - c[9] - c[13]);
+  NIST_WORD (3, (u64)c[3] + c[7] + c[11] - c[10]);
+  NIST_WORD (4, (u64)c[4] + c[8] + c[12] - c[11]);
+  NIST_WORD (5, (u64)c[5] + c[9] + c[13] - c[12]);
+  NIST_WORD (6, (u64)c[6] + c[10] - c[13]);
+  return nist_top (acc);
+}
+
+static int
+reduce_p256 (u32 *r, const u32 *c)
+{
+  u64 acc = 0;
+
+  NIST_WORD (0, (u64)c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14]);
+  NIST_WORD (1, (u64)c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15]);
+  NIST_WORD (2, (u64)c[2] + c[10] + c[11] - c[13] - c[14] - c[15]);
+  NIST_WORD (3, (u64)c[3] + 2*(u64)c[11] + 2*(u64)c[12] + c[13] - c[8] - c[9] - c[15]);
+  NIST_WORD (4, (u64)c[4] + 2*(u64)c[12] + 2*(u64)c[13] + c[14] - c[9] - c[10]);
+  NIST_WORD (5, (u64)c[5] + 2*(u64)c[13] + 2*(u64)c[14] + c[15] - c[10] - c[11]);
+  NIST_WORD (6, (u64)c[6] + c[13] + 3*(u64)c[14] + 2*(u64)c[15] - c[8] - c[9]);
+  NIST_WORD (7, (u64)c[7] + c[8] + 3*(u64)c[15] - c[10] - c[11] - c[12] - c[13]);
+  return nist_top (acc);
+}
+
+static int
+reduce_p384 (u32 *r, const u32 *c)
+{
+  u64 acc = 0;
+
+  NIST_WORD (0, (u64)c[0] + c[12] + c[20] + c[21] - c[23]);
+  NIST_WORD (1, (u64)c[1] + c[13] + c[22] + c[23] - c[12] - c[20]);
+  NIST_WORD (2, (u64)c[2] + c[14] + c[23] - c[13] - c[21]);
+  NIST_WORD (3, (u64)c[3] + c[12] + c[15] + c[20] + c[21] - c[14] - c[22] - c[23]);
+  NIST_WORD (4, (u64)c[4] + c[12] + c[13] + c[16] + c[20] + 2*(u64)c[21] + c[22] - c[15] - 2*(u64)c[23]);
+  NIST_WORD (5, (u64)c[5] + c[13] + c[14] + c[17] + c[21] + 2*(u64)c[22] + c[23] - c[16]);
+  NIST_WORD (6, (u64)c[6] + c[14] + c[15] + c[18] + c[22] + 2*(u64)c[23] - c[17]);
+  NIST_WORD (7, (u64)c[7] + c[15] + c[16] + c[19] + c[23] - c[18]);
+  NIST_WORD (8, (u64)c[8] + c[16] + c[17] + c[20] - c[19]);
+  NIST_WORD (9, (u64)c[9] + c[17] + c[18] + c[21] - c[20]);
+  NIST_WORD (10, (u64)c[10] + c[18] + c[19] + c[22] - c[21]);
+  NIST_WORD (11, (u64)c[11] + c[19] + c[20] + c[23] - c[22]);
+  return nist_top (acc);
+}
 
-  if (ctx->nist_nbits == 192)
+/* For P-521 we compute (C mod 2^521) + (C >> 521).  */
+static int
+reduce_p521 (u32 *r, const u32 *c)
+{
+  u64 acc = 0;
+  u32 t;
+  int i;
+
+  for (i=0; i < 17; i++)
     {
-      mpi_mul (w, u, v);
-      mpi_resize (w, 12);
-      wp = w->d;
-
-      sp = ctx->s[0]->d;
-      sp[0*2+0] = wp[0*2+0];
-      sp[0*2+1] = wp[0*2+1];
-      sp[1*2+0] = wp[1*2+0];
-      sp[1*2+1] = wp[1*2+1];
-      sp[2*2+0] = wp[2*2+0];
-      sp[2*2+1] = wp[2*2+1];
-
-      sp = ctx->s[1]->d;
-      sp[0*2+0] = wp[3*2+0];
-      sp[0*2+1] = wp[3*2+1];
-      sp[1*2+0] = wp[3*2+0];
-      sp[1*2+1] = wp[3*2+1];
-      sp[2*2+0] = 0;
-      sp[2*2+1] = 0;
-
-      sp = ctx->s[2]->d;
-      sp[0*2+0] = 0;
-      sp[0*2+1] = 0;
-      sp[1*2+0] = wp[4*2+0];
-      sp[1*2+1] = wp[4*2+1];
-      sp[2*2+0] = wp[4*2+0];
-      sp[2*2+1] = wp[4*2+1];
-
-      sp = ctx->s[3]->d;
-      sp[0*2+0] = wp[5*2+0];
-      sp[0*2+1] = wp[5*2+1];
-      sp[1*2+0] = wp[5*2+0];
-      sp[1*2+1] = wp[5*2+1];
-      sp[2*2+0] = wp[5*2+0];
-      sp[2*2+1] = wp[5*2+1];
-
-      ctx->s[0]->nlimbs = 6;
-      ctx->s[1]->nlimbs = 6;
-      ctx->s[2]->nlimbs = 6;
-      ctx->s[3]->nlimbs = 6;
-
-      mpi_add (ctx->c, ctx->s[0], ctx->s[1]);
-      mpi_add (ctx->c, ctx->c, ctx->s[2]);
-      mpi_add (ctx->c, ctx->c, ctx->s[3]);
-
-      while ( mpi_cmp (ctx->c, ctx->p ) >= 0 )
-        mpi_sub ( ctx->c, ctx->c, ctx->p );
-      mpi_set (w, ctx->c);
+      acc += (i < 16? c[i] : (c[16] & 0x1ff));
+      acc += ((c[16+i] >> 9) | (c[17+i] << 23));
+      r[i] = (u32)acc;
+      acc >>= 32;
     }
-  else if (ctx->nist_nbits == 384)
+  /* The sum is less than 2^522; fold the bit 521 back.  */
+  t = r[16] >> 9;
+  r[16] &= 0x1ff;
+  for (i=0; t && i < 17; i++)
     {
-      int i;
-      mpi_mul (w, u, v);
-      mpi_resize (w, 24);
-      wp = w->d;
-
-#define NEXT(a) do { ctx->s[(a)]->nlimbs = 12; \
-                     sp = ctx->s[(a)]->d; \
-                     i = 0; } while (0)
-#define X(a) do { sp[i++] = wp[(a)];} while (0)
-#define X0(a) do { sp[i++] = 0; } while (0)
-      NEXT(0);
-      X(0);X(1);X(2);X(3);X(4);X(5);X(6);X(7);X(8);X(9);X(10);X(11);
-      NEXT(1);
-      X0();X0();X0();X0();X(21);X(22);X(23);X0();X0();X0();X0();X0();
-      NEXT(2);
-      X(12);X(13);X(14);X(15);X(16);X(17);X(18);X(19);X(20);X(21);X(22);X(23);
-      NEXT(3);
-      X(21);X(22);X(23);X(12);X(13);X(14);X(15);X(16);X(17);X(18);X(19);X(20);
-      NEXT(4);
-      X0();X(23);X0();X(20);X(12);X(13);X(14);X(15);X(16);X(17);X(18);X(19);
-      NEXT(5);
-      X0();X0();X0();X0();X(20);X(21);X(22);X(23);X0();X0();X0();X0();
-      NEXT(6);
-      X(20);X0();X0();X(21);X(22);X(23);X0();X0();X0();X0();X0();X0();
-      NEXT(7);
-      X(23);X(12);X(13);X(14);X(15);X(16);X(17);X(18);X(19);X(20);X(21);X(22);
-      NEXT(8);
-      X0();X(20);X(21);X(22);X(23);X0();X0();X0();X0();X0();X0();X0();
-      NEXT(9);
-      X0();X0();X0();X(23);X(23);X0();X0();X0();X0();X0();X0();X0();
-#undef X0
-#undef X
-#undef NEXT
-      mpi_add (ctx->c, ctx->s[0], ctx->s[1]);
-      mpi_add (ctx->c, ctx->c, ctx->s[1]);
-      mpi_add (ctx->c, ctx->c, ctx->s[2]);
-      mpi_add (ctx->c, ctx->c, ctx->s[3]);
-      mpi_add (ctx->c, ctx->c, ctx->s[4]);
-      mpi_add (ctx->c, ctx->c, ctx->s[5]);
-      mpi_add (ctx->c, ctx->c, ctx->s[6]);
-      mpi_sub (ctx->c, ctx->c, ctx->s[7]);
-      mpi_sub (ctx->c, ctx->c, ctx->s[8]);
-      mpi_sub (ctx->c, ctx->c, ctx->s[9]);
-
-      while ( mpi_cmp (ctx->c, ctx->p ) >= 0 )
-        mpi_sub ( ctx->c, ctx->c, ctx->p );
-      while ( ctx->c->sign )
-        mpi_add ( ctx->c, ctx->c, ctx->p );
-      mpi_set (w, ctx->c);
+      r[i] += t;
+      t = !r[i];
     }
+  return 0;
+}
+
+#undef NIST_WORD
+
+static const struct nist_prime_s nist_primes[] =
+  {
+    { 192, 6, reduce_p192,
+      { 0xffffffff, 0xffffffff, 0xfffffffe, 0xffffffff,
+        0xffffffff, 0xffffffff } },
+    { 224, 7, reduce_p224,
+      { 0x00000001, 0x00000000, 0x00000000, 0xffffffff,
+        0xffffffff, 0xffffffff, 0xffffffff } },
+    { 256, 8, reduce_p256,
+      { 0xffffffff, 0xffffffff, 0xffffffff, 0x00000000,
+        0x00000000, 0x00000000, 0x00000001, 0xffffffff } },
+    { 384, 12, reduce_p384,
+      { 0xffffffff, 0x00000000, 0x00000000, 0xffffffff,
+        0xfffffffe, 0xffffffff, 0xffffffff, 0xffffffff,
+        0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff } },
+    { 521, 17, reduce_p521,
+      { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+        0x000001ff } }
+  };
+
+
+/* Return word I of the limb array A.  */
+static inline u32
+nist_get_word (mpi_ptr_t a, int i)
+{
+  return a[i * 32 / BITS_PER_MPI_LIMB] >> ((i * 32) % BITS_PER_MPI_LIMB);
+}
+
+
+/* Return the NIST prime P or NULL if P is not a NIST prime.  */
+static const struct nist_prime_s *
+find_nist_prime (gcry_mpi_t p)
+{
+  unsigned int nbits = mpi_get_nbits (p);
+  int i, j;
+
+  for (i=0; i < DIM (nist_primes); i++)
+    if (nist_primes[i].nbits == nbits)
+      {
+        for (j=0; j < nist_primes[i].nwords; j++)
+          if (nist_get_word (p->d, j) != nist_primes[i].p[j])
+            return NULL;
+        return &nist_primes[i];
+      }
+  return NULL;
+}
+
+
+/* Compute W = U * V mod P for a NIST prime P.  Returns false if the
+   fast reduction can't be used for the given operands.  */
+static int
+nist_mulm (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, mpi_ec_t ctx)
+{
+  const struct nist_prime_s *nist = ctx->nist;
+  mpi_size_t n = ctx->nist_nlimbs;
+  mpi_ptr_t up, vp, prodp;
+  u32 c[2 * NIST_MAX_WORDS], r[NIST_MAX_WORDS];
+  u64 acc;
+  int i, top;
+
+  /* The operands need to be non-negative and less than 2^NBITS.  */
+  if (u->sign || v->sign || u->nlimbs > n || v->nlimbs > n)
+    return 0;
+  if ((nist->nbits % BITS_PER_MPI_LIMB)
+      && (mpi_get_nbits (u) > nist->nbits
+          || mpi_get_nbits (v) > nist->nbits))
+    return 0;
+
+  /* Multiply using operands of a fixed size.  */
+  up = ctx->nist_buf;
+  vp = up + n;
+  prodp = vp + n;
+  MPN_COPY (up, u->d, u->nlimbs);
+  MPN_ZERO (up + u->nlimbs, n - u->nlimbs);
+  if (u == v)
+    vp = up;
   else
-#endif /*0*/
-    mpi_mulm (w, u, v, ctx->p);
+    {
+      MPN_COPY (vp, v->d, v->nlimbs);
+      MPN_ZERO (vp + v->nlimbs, n - v->nlimbs);
+    }
+  _gcry_mpih_mul_n (prodp, up, vp, n);
+
+#ifdef WORDS_BIGENDIAN
+  for (i=0; i < 2 * nist->nwords; i++)
+    c[i] = nist_get_word (prodp, i);
+#else
+  memcpy (c, prodp, 2 * nist->nwords * sizeof *c);
+#endif
+  top = nist->reduce (r, c);
+
+  /* The result is TOP * 2^(32*NWORDS) + R; bring it into the range
+     [0,P).  Because P is close to 2^(32*NWORDS), subtracting TOP * P
+     leaves a carry of at most one.  */
+  if (top)
+    {
+      for (acc=0, i=0; i < nist->nwords; i++)
+        {
+          acc = (u64)r[i] - (u64)top * nist->p[i] + NIST_CARRY (acc);
+          r[i] = (u32)acc;
+        }
+      top += nist_top (acc);
+    }
+  while (top < 0)
+    {
+      for (acc=0, i=0; i < nist->nwords; i++)
+        {
+          acc += (u64)r[i] + nist->p[i];
+          r[i] = (u32)acc;
+          acc >>= 32;
+        }
+      top += (int)acc;
+    }
+  for (;;)
+    {
+      if (!top)
+        {
+          for (i = nist->nwords - 1; i >= 0 && r[i] == nist->p[i]; i--)
+            ;
+          if (i >= 0 && r[i] < nist->p[i])
+            break;
+        }
+      for (acc=0, i=0; i < nist->nwords; i++)
+        {
+          acc = (u64)r[i] - nist->p[i] - acc;
+          r[i] = (u32)acc;
+          acc = (acc >> 32) & 1;
+        }
+      top -= (int)acc;
+    }
+
+  mpi_resize (w, n);
+#ifdef WORDS_BIGENDIAN
+  MPN_ZERO (w->d, n);
+  for (i=0; i < nist->nwords; i++)
+    w->d[i * 32 / BITS_PER_MPI_LIMB]
+      |= (mpi_limb_t)r[i] << ((i * 32) % BITS_PER_MPI_LIMB);
+#else
+  w->d[n-1] = 0;
+  memcpy (w->d, r, nist->nwords * sizeof *r);
+#endif
+  w->nlimbs = n;
+  w->sign = 0;
+  MPN_NORMALIZE (w->d, w->nlimbs);
+  return 1;
+}
+#undef NIST_CARRY
+#endif /*USE_NIST_REDUCTION*/
+
+
+static void
+ec_mulm (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, mpi_ec_t ctx)
+{
+#ifdef USE_NIST_REDUCTION
+  if (ctx->nist && nist_mulm (w, u, v, ctx))
+    return;
+#endif /*USE_NIST_REDUCTION*/
+  mpi_mulm (w, u, v, ctx->p);
+}
+
+/* W = B^2.  This is much faster than using mpi_powm.  */
+static void
+ec_pow2 (gcry_mpi_t w, const gcry_mpi_t b, mpi_ec_t ctx)
+{
+  ec_mulm (w, b, b, ctx);
 }
 
+/* W = B^3.  W and B may not be the same object.  */
 static void
-ec_powm (gcry_mpi_t w, const gcry_mpi_t b, const gcry_mpi_t e,
-         mpi_ec_t ctx)
+ec_pow3 (gcry_mpi_t w, const gcry_mpi_t b, mpi_ec_t ctx)
 {
-  mpi_powm (w, b, e, ctx->p);
+  ec_mulm (w, b, b, ctx);
+  ec_mulm (w, w, b, ctx);
 }
 
 static void
@@ -274,29 +523,30 @@ _gcry_mpi_ec_init (gcry_mpi_t p, gcry_mpi_t a)
   ctx->four  = mpi_alloc_set_ui (4);
   ctx->eight = mpi_alloc_set_ui (8);
   ctx->two_inv_p = mpi_alloc (0);
-  ec_invm (ctx->two_inv_p, ctx->two, ctx);
+  if (mpi_test_bit (ctx->p, 0))
+    {
+      /* For an odd P the inverse of 2 is simply (P+1)/2.  */
+      mpi_add_ui (ctx->two_inv_p, ctx->p, 1);
+      mpi_rshift (ctx->two_inv_p, ctx->two_inv_p, 1);
+    }
+  else
+    ec_invm (ctx->two_inv_p, ctx->two, ctx);
 
   /* Allocate scratch variables.  */
   for (i=0; i< DIM(ctx->scratch); i++)
     ctx->scratch[i] = mpi_alloc_like (ctx->p);
 
   /* Prepare for fast reduction.  */
-  /* FIXME: need a test for NIST values.  However it does not gain us
-     any real advantage, for 384 bits it is actually slower than using
-     mpi_mulm.  */
-/*   ctx->nist_nbits = mpi_get_nbits (ctx->p); */
-/*   if (ctx->nist_nbits == 192) */
-/*     { */
-/*       for (i=0; i < 4; i++) */
-/*         ctx->s[i] = mpi_new (192); */
-/*       ctx->c    = mpi_new (192*2); */
-/*     } */
-/*   else if (ctx->nist_nbits == 384) */
-/*     { */
-/*       for (i=0; i < 10; i++) */
-/*         ctx->s[i] = mpi_new (384); */
-/*       ctx->c    = mpi_new (384*2); */
-/*     } */
+#ifdef USE_NIST_REDUCTION
+  ctx->nist = find_nist_prime (ctx->p);
+  if (ctx->nist)
+    {
+      ctx->nist_nlimbs = ((ctx->nist->nwords * 32 + BITS_PER_MPI_LIMB - 1)
+                          / BITS_PER_MPI_LIMB);
+      ctx->nist_buf = gcry_xmalloc (4 * ctx->nist_nlimbs
+                                    * sizeof (mpi_limb_t));
+    }
+#endif /*USE_NIST_REDUCTION*/
 
   return ctx;
 }
@@ -323,18 +573,9 @@ _gcry_mpi_ec_free (mpi_ec_t ctx)
   for (i=0; i< DIM(ctx->scratch); i++)
     mpi_free (ctx->scratch[i]);
 
-/*   if (ctx->nist_nbits == 192) */
-/*     { */
-/*       for (i=0; i < 4; i++) */
-/*         mpi_free (ctx->s[i]); */
-/*       mpi_free (ctx->c); */
-/*     } */
-/*   else if (ctx->nist_nbits == 384) */
-/*     { */
-/*       for (i=0; i < 10; i++) */
-/*         mpi_free (ctx->s[i]); */
-/*       mpi_free (ctx->c); */
-/*     } */
+#ifdef USE_NIST_REDUCTION
+  gcry_free (ctx->nist_buf);
+#endif /*USE_NIST_REDUCTION*/
 
   gcry_free (ctx);
 }
@@ -405,7 +646,7 @@ _gcry_mpi_ec_dup_point (mpi_point_t *result, mpi_point_t *point, mpi_ec_t ctx)
           /* L1 = 3(X - Z^2)(X + Z^2) */
           /*                          T1: used for Z^2. */
           /*                          T2: used for the right term.  */
-          ec_powm (t1, point->z, ctx->two, ctx);
+          ec_pow2 (t1, point->z, ctx);
           ec_subm (l1, point->x, t1, ctx);
           ec_mulm (l1, l1, ctx->three, ctx);
           ec_addm (t2, point->x, t1, ctx);
@@ -415,9 +656,10 @@ _gcry_mpi_ec_dup_point (mpi_point_t *result, mpi_point_t *point, mpi_ec_t ctx)
         {
           /* L1 = 3X^2 + aZ^4 */
           /*                          T1: used for aZ^4. */
-          ec_powm (l1, point->x, ctx->two, ctx);
+          ec_pow2 (l1, point->x, ctx);
           ec_mulm (l1, l1, ctx->three, ctx);
-          ec_powm (t1, point->z, ctx->four, ctx);
+          ec_pow2 (t1, point->z, ctx);
+          ec_pow2 (t1, t1, ctx);
           ec_mulm (t1, t1, ctx->a, ctx);
           ec_addm (l1, l1, t1, ctx);
         }
@@ -427,19 +669,19 @@ _gcry_mpi_ec_dup_point (mpi_point_t *result, mpi_point_t *point, mpi_ec_t ctx)
 
       /* L2 = 4XY^2 */
       /*                              T2: used for Y2; required later. */
-      ec_powm (t2, point->y, ctx->two, ctx);
+      ec_pow2 (t2, point->y, ctx);
       ec_mulm (l2, t2, point->x, ctx);
       ec_mulm (l2, l2, ctx->four, ctx);
 
       /* X3 = L1^2 - 2L2 */
       /*                              T1: used for L2^2. */
-      ec_powm (x3, l1, ctx->two, ctx);
+      ec_pow2 (x3, l1, ctx);
       ec_mulm (t1, l2, ctx->two, ctx);
       ec_subm (x3, x3, t1, ctx);
 
       /* L3 = 8Y^4 */
       /*                              T2: taken from above. */
-      ec_powm (t2, t2, ctx->two, ctx);
+      ec_pow2 (t2, t2, ctx);
       ec_mulm (l3, t2, ctx->eight, ctx);
 
       /* Y3 = L1(L2 - X3) - L3 */
@@ -518,24 +760,34 @@ _gcry_mpi_ec_add_points (mpi_point_t *result,
         mpi_set (l1, x1);
       else
         {
-          ec_powm (l1, z2, ctx->two, ctx);
+          ec_pow2 (l1, z2, ctx);
           ec_mulm (l1, l1, x1, ctx);
         }
       if (z1_is_one)
         mpi_set (l2, x2);
       else
         {
-          ec_powm (l2, z1, ctx->two, ctx);
+          ec_pow2 (l2, z1, ctx);
           ec_mulm (l2, l2, x2, ctx);
         }
       /* l3 = l1 - l2 */
       ec_subm (l3, l1, l2, ctx);
       /* l4 = y1 z2^3  */
-      ec_powm (l4, z2, ctx->three, ctx);
-      ec_mulm (l4, l4, y1, ctx);
+      if (z2_is_one)
+        mpi_set (l4, y1);
+      else
+        {
+          ec_pow3 (l4, z2, ctx);
+          ec_mulm (l4, l4, y1, ctx);
+        }
       /* l5 = y2 z1^3  */
-      ec_powm (l5, z1, ctx->three, ctx);
-      ec_mulm (l5, l5, y2, ctx);
+      if (z1_is_one)
+        mpi_set (l5, y2);
+      else
+        {
+          ec_pow3 (l5, z1, ctx);
+          ec_mulm (l5, l5, y2, ctx);
+        }
       /* l6 = l4 - l5  */
       ec_subm (l6, l4, l5, ctx);
 
@@ -561,11 +813,18 @@ _gcry_mpi_ec_add_points (mpi_point_t *result,
           /* l8 = l4 + l5  */
           ec_addm (l8, l4, l5, ctx);
           /* z3 = z1 z2 l3  */
-          ec_mulm (z3, z1, z2, ctx);
-          ec_mulm (z3, z3, l3, ctx);
+          if (z1_is_one)
+            ec_mulm (z3, z2, l3, ctx);
+          else if (z2_is_one)
+            ec_mulm (z3, z1, l3, ctx);
+          else
+            {
+              ec_mulm (z3, z1, z2, ctx);
+              ec_mulm (z3, z3, l3, ctx);
+            }
           /* x3 = l6^2 - l7 l3^2  */
-          ec_powm (t1, l6, ctx->two, ctx);
-          ec_powm (t2, l3, ctx->two, ctx);
+          ec_pow2 (t1, l6, ctx);
+          ec_pow2 (t2, l3, ctx);
           ec_mulm (t2, t2, l7, ctx);
           ec_subm (x3, t1, t2, ctx);
           /* l9 = l7 l3^2 - 2 x3  */
@@ -573,7 +832,7 @@ _gcry_mpi_ec_add_points (mpi_point_t *result,
           ec_subm (l9, t2, t1, ctx);
           /* y3 = (l9 l6 - l8 l3^3)/2  */
           ec_mulm (l9, l9, l6, ctx);
-          ec_powm (t1, l3, ctx->three, ctx); /* fixme: Use saved value*/
+          ec_pow3 (t1, l3, ctx); /* fixme: Use saved value*/
           ec_mulm (t1, t1, l8, ctx);
           ec_subm (y3, l9, t1, ctx);
           ec_mulm (y3, y3, ctx->two_inv_p, ctx);
@@ -604,9 +863,89 @@ _gcry_mpi_ec_add_points (mpi_point_t *result,
 
 
 
+/* Compute the width-w NAF of the non-negative integer K with w being
+   EC_WNAF_WIDTH.  Each digit is either zero or odd and at most one of
+   any EC_WNAF_WIDTH consecutive digits is not zero.  K is destroyed.
+   Returns an allocated array with the digits, the least significant
+   first, and stores their number at R_NDIGITS.  */
+static signed char *
+wnaf_digits (gcry_mpi_t k, unsigned int *r_ndigits)
+{
+  signed char *naf;
+  unsigned int i;
+  int digit;
+
+  naf = gcry_xcalloc (mpi_get_nbits (k) + 1, 1);
+  for (i = 0; mpi_cmp_ui (k, 0) > 0; i++)
+    {
+      if (mpi_test_bit (k, 0))
+        {
+          digit = k->d[0] & ((1 << EC_WNAF_WIDTH) - 1);
+          if (digit >= (1 << (EC_WNAF_WIDTH - 1)))
+            {
+              digit -= (1 << EC_WNAF_WIDTH);
+              mpi_add_ui (k, k, -digit);
+            }
+          else
+            mpi_sub_ui (k, k, digit);
+          naf[i] = digit;
+        }
+      mpi_rshift (k, k, 1);
+    }
+  *r_ndigits = i;
+  return naf;
+}
+
+
+/* Store the odd multiples 1P, 3P, 5P, ... of the point P given in
+   affine coordinates in PRE and their negatives in PRENEG.  Both
+   arrays have 2^(EC_WNAF_WIDTH-2) elements which are initialized by
+   this function.  */
+static void
+wnaf_precompute (mpi_point_t *pre, mpi_point_t *preneg, mpi_point_t *p,
+                 mpi_ec_t ctx)
+{
+  mpi_point_t p2;
+  unsigned int i, n = 1 << (EC_WNAF_WIDTH - 2);
+
+  for (i=0; i < n; i++)
+    {
+      point_init (&pre[i]);
+      point_init (&preneg[i]);
+    }
+  point_init (&p2);
+  point_set (&pre[0], p);
+  _gcry_mpi_ec_dup_point (&p2, p, ctx);
+  for (i=1; i < n; i++)
+    _gcry_mpi_ec_add_points (&pre[i], &pre[i-1], &p2, ctx);
+  for (i=0; i < n; i++)
+    {
+      point_set (&preneg[i], &pre[i]);
+      ec_subm (preneg[i].y, ctx->p, preneg[i].y, ctx);
+    }
+  point_free (&p2);
+}
+
+
+/* Release the points computed by wnaf_precompute.  */
+static void
+wnaf_release (mpi_point_t *pre, mpi_point_t *preneg)
+{
+  unsigned int i;
+
+  for (i=0; i < (1 << (EC_WNAF_WIDTH - 2)); i++)
+    {
+      point_free (&pre[i]);
+      point_free (&preneg[i]);
+    }
+}
+
+
 /* Scalar point multiplication - the main function for ECC.  If takes
    an integer SCALAR and a POINT as well as the usual context CTX.
-   RESULT will be set to the resulting point. */
+   RESULT will be set to the resulting point.  A window NAF of width
+   EC_WNAF_WIDTH is used; for a fixed base point the faster function
+   _gcry_mpi_ec_mul_base should be used.  */
 void
 _gcry_mpi_ec_mul_point (mpi_point_t *result,
                         gcry_mpi_t scalar, mpi_point_t *point,
@@ -630,13 +969,16 @@ _gcry_mpi_ec_mul_point (mpi_point_t *result,
     }
 
 #else
-  gcry_mpi_t x1, y1, z1, k, h, yy;
-  unsigned int i, loops;
-  mpi_point_t p1, p2, p1inv;
+  gcry_mpi_t x1, y1, z1, k, yy;
+  unsigned int nbits;
+  int digit;
+  signed char *naf;
+  mpi_point_t p1, p2;
+  mpi_point_t pre[1 << (EC_WNAF_WIDTH - 2)];    /* 1P, 3P, 5P, ...  */
+  mpi_point_t preneg[1 << (EC_WNAF_WIDTH - 2)]; /* -1P, -3P, -5P, ...  */
 
   x1 = mpi_alloc_like (ctx->p);
   y1 = mpi_alloc_like (ctx->p);
-  h  = mpi_alloc_like (ctx->p);
   k  = mpi_copy (scalar);
   yy = mpi_copy (point->y);
 
@@ -667,55 +1009,281 @@ _gcry_mpi_ec_mul_point (mpi_point_t *result,
       mpi_free (z3);
     }
   z1 = mpi_copy (ctx->one);
-
-  mpi_mul (h, k, ctx->three); /* h = 3k */
-  loops = mpi_get_nbits (h);
-  if (loops < 2)
-    {
-      /* If SCALAR is zero, the above mpi_mul sets H to zero and thus
-         LOOPs will be zero.  To avoid an underflow of I in the main
-         loop we set LOOP to 2 and the result to (0,0,0).  */
-      loops = 2;
-      mpi_clear (result->x);
-      mpi_clear (result->y);
-      mpi_clear (result->z);
-    }
-  else
-    {
-      mpi_set (result->x, point->x);
-      mpi_set (result->y, yy);
-      mpi_set (result->z, point->z);
-    }
   mpi_free (yy); yy = NULL;
 
+  naf = wnaf_digits (k, &nbits);
+
+  /* Precompute the odd multiples 1P, 3P, 5P, ... and their
+     negatives.  */
+  point_init (&p2);
   p1.x = x1; x1 = NULL;
   p1.y = y1; y1 = NULL;
   p1.z = z1; z1 = NULL;
-  point_init (&p2);
-  point_init (&p1inv);
+  wnaf_precompute (pre, preneg, &p1, ctx);
 
-  for (i=loops-2; i > 0; i--)
+  /* Start with the point at infinity.  */
+  mpi_set_ui (result->x, 1);
+  mpi_set_ui (result->y, 1);
+  mpi_set_ui (result->z, 0);
+
+  while (nbits--)
     {
       _gcry_mpi_ec_dup_point (result, result, ctx);
-      if (mpi_test_bit (h, i) == 1 && mpi_test_bit (k, i) == 0)
-        {
-          point_set (&p2, result);
-          _gcry_mpi_ec_add_points (result, &p2, &p1, ctx);
-        }
-      if (mpi_test_bit (h, i) == 0 && mpi_test_bit (k, i) == 1)
+      digit = naf[nbits];
+      if (digit)
         {
           point_set (&p2, result);
-          /* Invert point: y = p - y mod p  */
-          point_set (&p1inv, &p1);
-          ec_subm (p1inv.y, ctx->p, p1inv.y, ctx);
-          _gcry_mpi_ec_add_points (result, &p2, &p1inv, ctx);
+          if (digit > 0)
+            _gcry_mpi_ec_add_points (result, &p2, &pre[digit/2], ctx);
+          else
+            _gcry_mpi_ec_add_points (result, &p2, &preneg[-digit/2], ctx);
         }
     }
 
+  wnaf_release (pre, preneg);
   point_free (&p1);
   point_free (&p2);
-  point_free (&p1inv);
-  mpi_free (h);
+  gcry_free (naf);
   mpi_free (k);
 #endif
 }
+
+
+
+/* Allow the use of a comb table for the base point with the affine
+   coordinates GX and GY on the curve with the prime P and the
+   coefficient A.  The table takes 63 points; thus this shall only be
+   done for a fixed set of points like the generators of the named
+   curves.  Scalar multiplications with other base points do not use
+   a table.  */
+void
+_gcry_mpi_ec_register_base (gcry_mpi_t p, gcry_mpi_t a,
+                            gcry_mpi_t gx, gcry_mpi_t gy)
+{
+  struct ec_base_table_s *tbl;
+
+  if (ath_mutex_lock (&base_tables_lock))
+    return;
+  for (tbl = base_tables; tbl; tbl = tbl->next)
+    if (!mpi_cmp (tbl->gx, gx) && !mpi_cmp (tbl->gy, gy)
+        && !mpi_cmp (tbl->p, p) && !mpi_cmp (tbl->a, a))
+      break;
+  if (!tbl)
+    {
+      tbl = gcry_xcalloc (1, sizeof *tbl);
+      tbl->p = mpi_copy (p);
+      tbl->a = mpi_copy (a);
+      tbl->gx = mpi_copy (gx);
+      tbl->gy = mpi_copy (gy);
+      tbl->next = base_tables;
+      base_tables = tbl;
+    }
+  ath_mutex_unlock (&base_tables_lock);
+}
+
+
+/* Compute the points of the comb table TBL.  Returns false if G is
+   not a suitable base point.  */
+static int
+compute_base_table (struct ec_base_table_s *tbl, mpi_ec_t ctx)
+{
+  mpi_point_t *points;
+  unsigned int i, j, b;
+
+  /* The order of G may be one bit larger than P.  */
+  tbl->d = (mpi_get_nbits (ctx->p) + EC_COMB_TEETH) / EC_COMB_TEETH;
+
+  points = tbl->points;
+  for (b=0; b < DIM (tbl->points); b++)
+    point_init (&points[b]);
+
+  /* Compute 2^(I*D)G for all teeth I.  */
+  mpi_set (points[0].x, tbl->gx);
+  mpi_set (points[0].y, tbl->gy);
+  mpi_set_ui (points[0].z, 1);
+  for (i=1; i < EC_COMB_TEETH; i++)
+    {
+      b = (1 << i) - 1;
+      _gcry_mpi_ec_dup_point (&points[b], &points[(1 << (i-1)) - 1], ctx);
+      for (j=1; j < tbl->d; j++)
+        _gcry_mpi_ec_dup_point (&points[b], &points[b], ctx);
+    }
+
+  /* Compute all other sums from the lowest bit of B and the rest.  */
+  for (b=1; b <= DIM (tbl->points); b++)
+    if ((b & (b - 1)))
+      _gcry_mpi_ec_add_points (&points[b-1], &points[(b & -b) - 1],
+                               &points[(b & (b - 1)) - 1], ctx);
+
+  /* Convert to affine coordinates to allow for the cheaper addition
+     with Z = 1.  */
+  for (b=0; b < DIM (tbl->points); b++)
+    {
+      if (_gcry_mpi_ec_get_affine (points[b].x, points[b].y, &points[b],
+                                   ctx))
+        {
+          /* The point at infinity - G is of a too small order.  */
+          for (b=0; b < DIM (tbl->points); b++)
+            point_free (&points[b]);
+          return 0;
+        }
+      mpi_set_ui (points[b].z, 1);
+    }
+
+  return 1;
+}
+
+
+/* Return the comb table for the base point BASE on the curve
+   described by CTX.  The table is computed on first use.  Returns
+   NULL if BASE has not been registered or no table is available.  */
+static struct ec_base_table_s *
+get_base_table (mpi_point_t *base, mpi_ec_t ctx)
+{
+  struct ec_base_table_s *tbl;
+
+  /* We require affine coordinates which is the case for all base
+     points taken from a curve specification.  */
+  if (mpi_cmp_ui (base->z, 1))
+    return NULL;
+
+  if (ath_mutex_lock (&base_tables_lock))
+    return NULL;
+  for (tbl = base_tables; tbl; tbl = tbl->next)
+    if (!mpi_cmp (tbl->gx, base->x) && !mpi_cmp (tbl->gy, base->y)
+        && !mpi_cmp (tbl->p, ctx->p) && !mpi_cmp (tbl->a, ctx->a))
+      break;
+  if (tbl && !tbl->state)
+    tbl->state = compute_base_table (tbl, ctx)? 1 : -1;
+  if (tbl && tbl->state < 0)
+    tbl = NULL;
+  ath_mutex_unlock (&base_tables_lock);
+
+  return tbl;
+}
+
+
+/* Scalar multiplication of the base point BASE using the comb method
+   (GECC Algorithm 3.44).  This is much faster than
+   _gcry_mpi_ec_mul_point but requires a table of precomputed points
+   which is only available for the points registered with
+   _gcry_mpi_ec_register_base.  For other points the window NAF
+   method of _gcry_mpi_ec_mul_point is used.  */
+void
+_gcry_mpi_ec_mul_base (mpi_point_t *result,
+                       gcry_mpi_t scalar, mpi_point_t *base,
+                       mpi_ec_t ctx)
+{
+  struct ec_base_table_s *tbl;
+  mpi_point_t tmp;
+  int i, j;
+  unsigned int b;
+
+  tbl = get_base_table (base, ctx);
+  if (!tbl || mpi_is_neg (scalar)
+      || mpi_get_nbits (scalar) > EC_COMB_TEETH * tbl->d)
+    {
+      _gcry_mpi_ec_mul_point (result, scalar, base, ctx);
+      return;
+    }
+
+  /* Start with the point at infinity.  */
+  mpi_set_ui (result->x, 1);
+  mpi_set_ui (result->y, 1);
+  mpi_set_ui (result->z, 0);
+
+  point_init (&tmp);
+  for (j = tbl->d - 1; j >= 0; j--)
+    {
+      _gcry_mpi_ec_dup_point (result, result, ctx);
+      for (b=0, i = EC_COMB_TEETH - 1; i >= 0; i--)
+        b = (b << 1) | mpi_test_bit (scalar, i * tbl->d + j);
+      if (b)
+        {
+          point_set (&tmp, result);
+          _gcry_mpi_ec_add_points (result, &tmp, &tbl->points[b-1], ctx);
+        }
+    }
+  point_free (&tmp);
+}
+
+
+/* Compute RESULT = U1 * BASE + U2 * POINT.  This is the double scalar
+   multiplication used to verify a signature.  If there is a comb
+   table for BASE (see _gcry_mpi_ec_register_base), the comb method
+   for BASE and a window NAF for the arbitrary point POINT are
+   interleaved (Straus) so that both multiplications share the
+   doublings.  Otherwise the two products are computed separately.  */
+void
+_gcry_mpi_ec_mul_add (mpi_point_t *result,
+                      gcry_mpi_t u1, mpi_point_t *base,
+                      gcry_mpi_t u2, mpi_point_t *point,
+                      mpi_ec_t ctx)
+{
+  struct ec_base_table_s *tbl;
+  mpi_point_t p1, tmp;
+  mpi_point_t pre[1 << (EC_WNAF_WIDTH - 2)];    /* 1P, 3P, 5P, ...  */
+  mpi_point_t preneg[1 << (EC_WNAF_WIDTH - 2)]; /* -1P, -3P, -5P, ...  */
+  signed char *naf;
+  gcry_mpi_t k;
+  unsigned int ndigits, nsteps, b;
+  int i, j, digit;
+
+  point_init (&tmp);
+  point_init (&p1);
+
+  tbl = get_base_table (base, ctx);
+  if (!tbl || mpi_is_neg (u1) || mpi_is_neg (u2)
+      || mpi_get_nbits (u1) > EC_COMB_TEETH * tbl->d
+      || _gcry_mpi_ec_get_affine (p1.x, p1.y, point, ctx))
+    {
+      /* Compute the two products separately.  */
+      _gcry_mpi_ec_mul_base (&tmp, u1, base, ctx);
+      _gcry_mpi_ec_mul_point (&p1, u2, point, ctx);
+      _gcry_mpi_ec_add_points (result, &tmp, &p1, ctx);
+      point_free (&p1);
+      point_free (&tmp);
+      return;
+    }
+  mpi_set_ui (p1.z, 1);
+
+  k = mpi_copy (u2);
+  naf = wnaf_digits (k, &ndigits);
+  mpi_free (k);
+  wnaf_precompute (pre, preneg, &p1, ctx);
+
+  /* Start with the point at infinity.  */
+  mpi_set_ui (result->x, 1);
+  mpi_set_ui (result->y, 1);
+  mpi_set_ui (result->z, 0);
+
+  nsteps = ndigits > tbl->d? ndigits : tbl->d;
+  for (j = nsteps - 1; j >= 0; j--)
+    {
+      _gcry_mpi_ec_dup_point (result, result, ctx);
+      digit = j < ndigits? naf[j] : 0;
+      if (digit)
+        {
+          point_set (&tmp, result);
+          if (digit > 0)
+            _gcry_mpi_ec_add_points (result, &tmp, &pre[digit/2], ctx);
+          else
+            _gcry_mpi_ec_add_points (result, &tmp, &preneg[-digit/2], ctx);
+        }
+      if (j < tbl->d)
+        {
+          for (b=0, i = EC_COMB_TEETH - 1; i >= 0; i--)
+            b = (b << 1) | mpi_test_bit (u1, i * tbl->d + j);
+          if (b)
+            {
+              point_set (&tmp, result);
+              _gcry_mpi_ec_add_points (result, &tmp, &tbl->points[b-1], ctx);
+            }
+        }
+    }
+
+  wnaf_release (pre, preneg);
+  point_free (&p1);
+  point_free (&tmp);
+  gcry_free (naf);
+}
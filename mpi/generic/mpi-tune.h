@@ -0,0 +1,6 @@
+/* mpi-tune.h - Multiplication thresholds
+ *
+ * No thresholds have been measured for this CPU, thus the
+ * conservative defaults from mpi-internal.h are used.  Run
+ * tests/mpitune to create a file for a CPU directory.
+ */
@@ -0,0 +1,71 @@
+/* mpih-sqr1.c  -  MPI helper functions
+ * Copyright (C) 2013 Free Software Foundation, Inc.
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mpi-internal.h"
+#include "longlong.h"
+
+/* Complete the square of U (pointed to by UP, with SIZE limbs) at
+ * RES_PTR.  On entry the limbs RES_PTR[1] to RES_PTR[2*SIZE-2] hold
+ * the sum of the cross products UP[i]*UP[j], i < j, each one shifted
+ * by i+j limbs; RES_PTR[0] and RES_PTR[2*SIZE-1] must be zero.  The
+ * cross products are doubled and the squares of the limbs are added,
+ * which yields the 2*SIZE limbs of U^2.
+ */
+
+void
+_gcry_mpih_sqr_diag_addlsh1( mpi_ptr_t res_ptr, mpi_ptr_t up,
+			     mpi_size_t size )
+{
+  mpi_limb_t x0, x1, prod_high, prod_low;
+  mpi_limb_t shift_out = 0;
+  mpi_limb_t cy_limb = 0;
+  mpi_limb_t c;
+  mpi_size_t j;
+
+  for (j = 0; j < size; j++)
+    {
+      /* Double the next two limbs.  */
+      x0 = res_ptr[0];
+      x1 = res_ptr[1];
+      res_ptr[0] = (x0 << 1) | shift_out;
+      res_ptr[1] = (x1 << 1) | (x0 >> (BITS_PER_MPI_LIMB - 1));
+      shift_out = x1 >> (BITS_PER_MPI_LIMB - 1);
+
+      /* Add the square of UP[j] and the carry.  PROD_HIGH is at most
+         B-2, thus adding the carry to it can't overflow.  */
+      umul_ppmm (prod_high, prod_low, up[j], up[j]);
+      prod_low += cy_limb;
+      prod_high += (prod_low < cy_limb);
+
+      x0 = res_ptr[0] + prod_low;
+      c = (x0 < prod_low);
+      x1 = res_ptr[1] + c;
+      cy_limb = (x1 < c);
+      x1 += prod_high;
+      cy_limb += (x1 < prod_high);
+      res_ptr[0] = x0;
+      res_ptr[1] = x1;
+
+      res_ptr += 2;
+    }
+}
@@ -51,8 +51,11 @@
 
 #include "mpi.h"
 
-/* If KARATSUBA_THRESHOLD is not already defined, define it to a
- * value which is good on most machines.  */
+/* The thresholds for the multiplication algorithms.  mpi-tune.h is
+ * linked by config.links from the directory of the CPU and has been
+ * created by tests/mpitune; the values below are only used if it
+ * does not define them.  */
+#include "mpi-tune.h"
 
 /* tested 4, 16, 32 and 64, where 16 gave the best performance when
  * checking a 768 and a 1024 bit ElGamal signature.
@@ -60,12 +63,34 @@
 #ifndef KARATSUBA_THRESHOLD
 #define KARATSUBA_THRESHOLD 16
 #endif
+#ifndef KARATSUBA_SQR_THRESHOLD
+#define KARATSUBA_SQR_THRESHOLD KARATSUBA_THRESHOLD
+#endif
+#ifndef TOOM3_MUL_THRESHOLD
+#define TOOM3_MUL_THRESHOLD 128
+#endif
+#ifndef TOOM3_SQR_THRESHOLD
+#define TOOM3_SQR_THRESHOLD 128
+#endif
 
-/* The code can't handle KARATSUBA_THRESHOLD smaller than 2.  */
+/* The code can't handle KARATSUBA_THRESHOLD smaller than 2 and
+ * TOOM3_*_THRESHOLD smaller than 5.  */
 #if KARATSUBA_THRESHOLD < 2
 #undef KARATSUBA_THRESHOLD
 #define KARATSUBA_THRESHOLD 2
 #endif
+#if KARATSUBA_SQR_THRESHOLD < 2
+#undef KARATSUBA_SQR_THRESHOLD
+#define KARATSUBA_SQR_THRESHOLD 2
+#endif
+#if TOOM3_MUL_THRESHOLD < 5
+#undef TOOM3_MUL_THRESHOLD
+#define TOOM3_MUL_THRESHOLD 5
+#endif
+#if TOOM3_SQR_THRESHOLD < 5
+#undef TOOM3_SQR_THRESHOLD
+#define TOOM3_SQR_THRESHOLD 5
+#endif
 
 
 typedef mpi_limb_t *mpi_ptr_t; /* pointer to a limb */
@@ -128,15 +153,6 @@ typedef int mpi_size_t;        /* (must be a signed type) */
 	}				    \
     } while(0)
 
-#define MPN_MUL_N_RECURSE(prodp, up, vp, size, tspace) \
-    do {						\
-	if( (size) < KARATSUBA_THRESHOLD )		\
-	    mul_n_basecase (prodp, up, vp, size);	\
-	else						\
-	    mul_n (prodp, up, vp, size, tspace);	\
-    } while (0);
-
-
 /* Divide the two-limb number in (NH,,NL) by D, with DI being the largest
  * limb not larger than (2**(2*BITS_PER_MP_LIMB))/D - (2**BITS_PER_MP_LIMB).
  * If this would yield overflow, DI should be the largest possible number
@@ -215,6 +231,15 @@ struct karatsuba_ctx {
 
 void _gcry_mpih_release_karatsuba_ctx( struct karatsuba_ctx *ctx );
 
+/* The multiplication thresholds in use.  */
+struct mpih_thresholds {
+    mpi_size_t karatsuba_mul;	/* Below this size use the schoolbook */
+    mpi_size_t karatsuba_sqr;	/* multiplication or squaring.  */
+    mpi_size_t toom3_mul;	/* From this size on use Toom-3 instead */
+    mpi_size_t toom3_sqr;	/* of Karatsuba.  */
+};
+extern struct mpih_thresholds _gcry_mpih_thresholds;
+
 mpi_limb_t _gcry_mpih_addmul_1( mpi_ptr_t res_ptr, mpi_ptr_t s1_ptr,
 			     mpi_size_t s1_size, mpi_limb_t s2_limb);
 mpi_limb_t _gcry_mpih_submul_1( mpi_ptr_t res_ptr, mpi_ptr_t s1_ptr,
@@ -226,6 +251,7 @@ mpi_limb_t _gcry_mpih_mul( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t usize,
 void _gcry_mpih_sqr_n_basecase( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t size );
 void _gcry_mpih_sqr_n( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t size,
 						mpi_ptr_t tspace);
+mpi_size_t _gcry_mpih_mul_tspace_size (mpi_size_t size);
 
 void _gcry_mpih_mul_karatsuba_case( mpi_ptr_t prodp,
 				 mpi_ptr_t up, mpi_size_t usize,
@@ -237,6 +263,10 @@ void _gcry_mpih_mul_karatsuba_case( mpi_ptr_t prodp,
 mpi_limb_t _gcry_mpih_mul_1( mpi_ptr_t res_ptr, mpi_ptr_t s1_ptr,
 			  mpi_size_t s1_size, mpi_limb_t s2_limb);
 
+/*-- mpih-sqr1.c (or xxx/cpu/ *.S) --*/
+void _gcry_mpih_sqr_diag_addlsh1( mpi_ptr_t res_ptr, mpi_ptr_t up,
+				  mpi_size_t size );
+
 /*-- mpih-div.c --*/
 mpi_limb_t _gcry_mpih_mod_1(mpi_ptr_t dividend_ptr, mpi_size_t dividend_size,
 						 mpi_limb_t divisor_limb);
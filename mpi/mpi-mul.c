@@ -182,6 +182,12 @@ gcry_mpi_mul( gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v)
 
     if( !vsize )
 	wsize = 0;
+    else if( up == vp ) {
+	/* Squaring is cheaper than a general multiplication.  */
+	_gcry_mpih_mul_n( wp, up, up, usize );
+	cy = wp[wsize - 1];
+	wsize -= cy? 0:1;
+    }
     else {
 	cy = _gcry_mpih_mul( wp, up, usize, vp, vsize );
 	wsize -= cy? 0:1;
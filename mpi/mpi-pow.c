@@ -34,17 +34,318 @@
 #include "longlong.h"
 
 
-/****************
- * RES = BASE ^ EXPO mod MOD
- */
-void
-gcry_mpi_powm (gcry_mpi_t res,
-               gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod)
+/* The table of powers used by the constant-time exponentiation is
+   allocated in secure memory if any argument is secret.  To avoid
+   exhausting the secure memory pool the window size is reduced for
+   large moduli so that the table does not exceed this many bytes.  */
+#define POWM_SECURE_TABLE_LIMIT 8192
+
+/* Context for the Montgomery multiplication modulo an odd MP.  */
+struct mont_ctx_s
+{
+  mpi_ptr_t mp;       /* The modulus.  */
+  mpi_size_t n;       /* Its size in limbs.  */
+  mpi_limb_t minv;    /* -1/MP[0] mod 2^BITS_PER_MPI_LIMB.  */
+  mpi_ptr_t tp;       /* Space for the 2N limb products.  */
+  mpi_ptr_t tspace;   /* Temporary space used by _gcry_mpih_sqr_n.  */
+  struct karatsuba_ctx karactx;
+};
+
+
+/* Compute the negative inverse of the odd limb M0 modulo
+   2^BITS_PER_MPI_LIMB.  */
+static mpi_limb_t
+mont_inverse (mpi_limb_t m0)
+{
+  mpi_limb_t inv = m0;   /* Correct to 3 bits because m0*m0 = 1 mod 8. */
+  int nbits;
+
+  /* Each Newton step doubles the number of correct bits.  */
+  for (nbits = 3; nbits < BITS_PER_MPI_LIMB; nbits *= 2)
+    inv *= 2 - m0 * inv;
+
+  return -inv;
+}
+
+
+/* Montgomery reduction: Store TP * R^{-1} mod MP at RP, where TP has
+   2N limbs and is less than R * MP.  TP is destroyed.  The final
+   subtraction is done without a branch.  */
+static void
+mont_redc (mpi_ptr_t rp, mpi_ptr_t tp, struct mont_ctx_s *ctx)
+{
+  mpi_size_t n = ctx->n;
+  mpi_size_t i;
+  mpi_limb_t q, cy, borrow, mask;
+
+  /* Each step clears the limb TP[I]; we use that limb to store the
+     carry which belongs to TP[I+N].  */
+  for (i = 0; i < n; i++)
+    {
+      q = tp[i] * ctx->minv;
+      tp[i] = _gcry_mpih_addmul_1 (tp + i, ctx->mp, n, q);
+    }
+  cy = _gcry_mpih_add_n (tp + n, tp + n, tp, n);
+
+  /* The value (CY,TP+N) is now less than 2*MP.  */
+  borrow = _gcry_mpih_sub_n (rp, tp + n, ctx->mp, n);
+  mask = (mpi_limb_t)0 - (cy | (borrow ^ 1));
+  for (i = 0; i < n; i++)
+    rp[i] = (rp[i] & mask) | (tp[n + i] & ~mask);
+}
+
+
+/* RP = AP * BP * R^{-1} mod MP.  All operands have N limbs; RP may
+   overlap with AP or BP.  */
+static void
+mont_mul (mpi_ptr_t rp, mpi_ptr_t ap, mpi_ptr_t bp, struct mont_ctx_s *ctx)
+{
+  mpi_size_t n = ctx->n;
+
+  if (ap == bp)
+    {
+      if (n < _gcry_mpih_thresholds.karatsuba_sqr)
+        _gcry_mpih_sqr_n_basecase (ctx->tp, ap, n);
+      else
+        _gcry_mpih_sqr_n (ctx->tp, ap, n, ctx->tspace);
+    }
+  else if (n < _gcry_mpih_thresholds.karatsuba_mul)
+    _gcry_mpih_mul (ctx->tp, ap, n, bp, n);
+  else
+    _gcry_mpih_mul_karatsuba_case (ctx->tp, ap, n, bp, n, &ctx->karactx);
+
+  mont_redc (rp, ctx->tp, ctx);
+}
+
+
+/* Copy entry IDX of the table TABLE with NENTRIES entries of N limbs
+   each to RP.  All entries are accessed so that the memory access
+   pattern does not depend on IDX.  */
+static void
+mont_select (mpi_ptr_t rp, mpi_ptr_t table, unsigned int nentries,
+             mpi_size_t n, unsigned int idx)
+{
+  unsigned int k;
+  mpi_size_t i;
+  mpi_limb_t d, mask;
+
+  MPN_ZERO (rp, n);
+  for (k = 0; k < nentries; k++, table += n)
+    {
+      d = k ^ idx;
+      mask = ((d | -d) >> (BITS_PER_MPI_LIMB - 1)) - 1;
+      for (i = 0; i < n; i++)
+        rp[i] |= table[i] & mask;
+    }
+}
+
+
+/* Return the W bits of the exponent (EP,ESIZE) starting at bit POS.  */
+static unsigned int
+expo_window (mpi_ptr_t ep, mpi_size_t esize, unsigned int pos, unsigned int w)
+{
+  mpi_size_t i = pos / BITS_PER_MPI_LIMB;
+  unsigned int sh = pos % BITS_PER_MPI_LIMB;
+  mpi_limb_t v;
+
+  v = ep[i] >> sh;
+  if (sh + w > BITS_PER_MPI_LIMB && i + 1 < esize)
+    v |= ep[i + 1] << (BITS_PER_MPI_LIMB - sh);
+  return v & (((mpi_limb_t)1 << w) - 1);
+}
+
+
+/* Window size for the sliding window exponentiation with an
+   exponent of EBITS bits.  */
+static unsigned int
+sliding_window_size (unsigned int ebits)
+{
+  if (ebits <= 7)
+    return 1;
+  else if (ebits <= 25)
+    return 2;
+  else if (ebits <= 81)
+    return 3;
+  else if (ebits <= 241)
+    return 4;
+  else
+    return 5;
+}
+
+
+/* RES = BASE ^ EXPO mod MOD using Montgomery multiplication.  MOD
+   must be positive and odd and EXPO must not be zero.  If SECRET is
+   set, a fixed window with a constant-time table lookup is used
+   instead of the faster sliding window, so that neither the sequence
+   of operations nor the memory access pattern depends on the bits of
+   the exponent.  */
+static void
+mont_powm (gcry_mpi_t res, gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod,
+           int secret)
+{
+  struct mont_ctx_s ctx;
+  mpi_size_t n = mod->nlimbs;
+  mpi_size_t esize = expo->nlimbs;
+  mpi_ptr_t ep = expo->d;
+  int sec = mpi_is_secure (mod) || mpi_is_secure (expo) || mpi_is_secure (base);
+  int negative_result = (ep[0] & 1) && base->sign;
+  unsigned int ebits, w, nentries, pos;
+  mpi_size_t space_nlimbs;
+  mpi_ptr_t space, rp, bp, table;
+  gcry_mpi_t t;
+  int i;
+
+  ebits = esize * BITS_PER_MPI_LIMB;
+  if (secret)
+    {
+      w = ebits > 320 ? 5 : 4;
+      if (sec)
+        while (w > 2 && (n << w) * BYTES_PER_MPI_LIMB > POWM_SECURE_TABLE_LIMIT)
+          w--;
+      nentries = 1 << w;
+    }
+  else
+    {
+      count_leading_zeros (i, ep[esize-1]);
+      ebits -= i;
+      w = sliding_window_size (ebits);
+      nentries = 1 << (w - 1);
+    }
+
+  space_nlimbs = (nentries + 4) * n + _gcry_mpih_mul_tspace_size (n);
+  space = mpi_alloc_limb_space (space_nlimbs, sec);
+  rp = space;
+  bp = rp + n;
+  table = bp + n;
+  memset (&ctx, 0, sizeof ctx);
+  ctx.mp = mod->d;
+  ctx.n = n;
+  ctx.minv = mont_inverse (mod->d[0]);
+  ctx.tp = table + nentries * n;
+  ctx.tspace = ctx.tp + 2 * n;
+
+  /* Get the absolute value of the base as N limbs.  A base with more
+     limbs than the modulus needs to be reduced first; a shorter base
+     can be converted to Montgomery form directly.  */
+  MPN_ZERO (bp, n);
+  if (base->nlimbs > n)
+    {
+      t = sec? mpi_alloc_secure (n) : mpi_alloc (n);
+      mpi_tdiv_r (t, base, mod);
+      MPN_COPY (bp, t->d, t->nlimbs);
+      mpi_free (t);
+    }
+  else
+    MPN_COPY (bp, base->d, base->nlimbs);
+
+  /* R^2 mod MOD is used to convert the base to Montgomery form.  */
+  t = sec? mpi_alloc_secure (2 * n + 1) : mpi_alloc (2 * n + 1);
+  mpi_set_ui (t, 0);
+  mpi_set_bit (t, 2 * n * BITS_PER_MPI_LIMB);
+  mpi_fdiv_r (t, t, mod);
+  MPN_ZERO (rp, n);
+  MPN_COPY (rp, t->d, t->nlimbs);
+  mpi_free (t);
+
+  if (secret)
+    {
+      /* TABLE[K] = BASE^K in Montgomery form for 0 <= K < 2^W.  */
+      mont_mul (table + n, bp, rp, &ctx);
+      MPN_ZERO (bp, n);
+      bp[0] = 1;
+      mont_mul (table, bp, rp, &ctx);
+      for (i = 2; i < nentries; i++)
+        mont_mul (table + i * n, table + (i - 1) * n, table + n, &ctx);
+
+      pos = (ebits - 1) / w * w;
+      mont_select (rp, table, nentries, n, expo_window (ep, esize, pos, w));
+      while (pos)
+        {
+          pos -= w;
+          for (i = 0; i < w; i++)
+            mont_mul (rp, rp, rp, &ctx);
+          mont_select (bp, table, nentries, n, expo_window (ep, esize, pos, w));
+          mont_mul (rp, rp, bp, &ctx);
+        }
+    }
+  else
+    {
+      int started = 0;
+      unsigned int lo, val;
+
+      /* TABLE[K] = BASE^(2K+1) in Montgomery form.  */
+      mont_mul (table, bp, rp, &ctx);
+      if (nentries > 1)
+        {
+          mont_mul (bp, table, table, &ctx);
+          for (i = 1; i < nentries; i++)
+            mont_mul (table + i * n, table + (i - 1) * n, bp, &ctx);
+        }
+
+      /* Scan the exponent from the top.  Runs of zero bits are
+         handled by squaring; each window starts and ends with a one
+         bit and has at most W bits.  */
+      for (pos = ebits; pos; )
+        {
+          if (!((ep[(pos-1) / BITS_PER_MPI_LIMB]
+                 >> ((pos-1) % BITS_PER_MPI_LIMB)) & 1))
+            {
+              mont_mul (rp, rp, rp, &ctx);
+              pos--;
+              continue;
+            }
+          lo = pos > w ? pos - w : 0;
+          while (!((ep[lo / BITS_PER_MPI_LIMB]
+                    >> (lo % BITS_PER_MPI_LIMB)) & 1))
+            lo++;
+          val = expo_window (ep, esize, lo, pos - lo);
+          if (started)
+            {
+              for (i = lo; i < pos; i++)
+                mont_mul (rp, rp, rp, &ctx);
+              mont_mul (rp, rp, table + (val >> 1) * n, &ctx);
+            }
+          else
+            {
+              MPN_COPY (rp, table + (val >> 1) * n, n);
+              started = 1;
+            }
+          pos = lo;
+        }
+    }
+
+  /* Convert back from Montgomery form.  */
+  MPN_COPY (ctx.tp, rp, n);
+  MPN_ZERO (ctx.tp + n, n);
+  mont_redc (rp, ctx.tp, &ctx);
+
+  i = n;
+  MPN_NORMALIZE (rp, i);
+  if (negative_result && i)
+    _gcry_mpih_sub_n (rp, mod->d, rp, n);
+
+  /* Now that we are done with the arguments, store the result.  */
+  RESIZE_IF_NEEDED (res, n);
+  MPN_COPY (res->d, rp, n);
+  MPN_NORMALIZE (res->d, n);
+  res->nlimbs = n;
+  res->sign = 0;
+
+  _gcry_mpih_release_karatsuba_ctx (&ctx.karactx);
+  _gcry_mpi_free_limb_space (space, sec? space_nlimbs : 0);
+}
+
+
+/* RES = BASE ^ EXPO mod MOD.  If SECRET is set EXPO is considered
+   to be secret and a side-channel resistant algorithm is used.  */
+static void
+do_powm (gcry_mpi_t res, gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod,
+         int secret)
 {
   /* Pointer to the limbs of the arguments, their size and signs. */
   mpi_ptr_t  rp, ep, mp, bp;
   mpi_size_t esize, msize, bsize, rsize;
-  int               msign, bsign, rsign;
+  int               msign, rsign;
   /* Flags telling the secure allocation status of the arguments.  */
   int        esec,  msec,  bsec;
   /* Size of the result including space for temporary values.  */
@@ -94,6 +395,13 @@ gcry_mpi_powm (gcry_mpi_t res,
       goto leave;
     }
 
+  /* Use Montgomery multiplication for odd moduli.  */
+  if (!msign && (mod->d[0] & 1))
+    {
+      mont_powm (res, base, expo, mod, secret);
+      goto leave;
+    }
+
   /* Normalize MOD (i.e. make its most significant bit set) as
      required by mpn_divrem.  This will make the intermediate values
      in the calculation slightly larger, but the correct result is
@@ -107,7 +415,6 @@ gcry_mpi_powm (gcry_mpi_t res,
     MPN_COPY( mp, mod->d, msize );
 
   bsize = base->nlimbs;
-  bsign = base->sign;
   if (bsize > msize)
     {
       /* The base is larger than the module.  Reduce it.
@@ -169,7 +476,7 @@ gcry_mpi_powm (gcry_mpi_t res,
     }
   MPN_COPY ( rp, bp, bsize );
   rsize = bsize;
-  rsign = bsign;
+  rsign = 0;
 
   /* Main processing.  */
   {
@@ -208,19 +515,19 @@ gcry_mpi_powm (gcry_mpi_t res,
             mpi_size_t xsize;
 
             /*mpih_mul_n(xp, rp, rp, rsize);*/
-            if ( rsize < KARATSUBA_THRESHOLD )
+            if ( rsize < _gcry_mpih_thresholds.karatsuba_sqr )
               _gcry_mpih_sqr_n_basecase( xp, rp, rsize );
             else
               {
                 if ( !tspace )
                   {
-                    tsize = 2 * rsize;
+                    tsize = _gcry_mpih_mul_tspace_size (rsize);
                     tspace = mpi_alloc_limb_space( tsize, 0 );
                   }
-                else if ( tsize < (2*rsize) )
+                else if ( tsize < _gcry_mpih_mul_tspace_size (rsize) )
                   {
                     _gcry_mpi_free_limb_space (tspace, 0);
-                    tsize = 2 * rsize;
+                    tsize = _gcry_mpih_mul_tspace_size (rsize);
                     tspace = mpi_alloc_limb_space (tsize, 0 );
                   }
                 _gcry_mpih_sqr_n (xp, rp, rsize, tspace);
@@ -240,12 +547,11 @@ gcry_mpi_powm (gcry_mpi_t res,
              * side-channel attack on the RSA secret exponent, we do
              * the multiplication regardless of the value of the
              * high-bit of E.  But to avoid this performance penalty
-             * we do it only if the exponent has been stored in secure
-             * memory and we can thus assume it is a secret exponent.  */
-            if (esec || (mpi_limb_signed_t)e < 0)
+             * we do it only for a secret exponent.  */
+            if (secret || (mpi_limb_signed_t)e < 0)
               {
                 /*mpih_mul( xp, rp, rsize, bp, bsize );*/
-                if( bsize < KARATSUBA_THRESHOLD )
+                if( bsize < _gcry_mpih_thresholds.karatsuba_mul )
                   _gcry_mpih_mul ( xp, rp, rsize, bp, bsize );
                 else
                   _gcry_mpih_mul_karatsuba_case (xp, rp, rsize, bp, bsize,
@@ -336,3 +642,27 @@ gcry_mpi_powm (gcry_mpi_t res,
   if (tspace)
     _gcry_mpi_free_limb_space( tspace, 0 );
 }
+
+
+/****************
+ * RES = BASE ^ EXPO mod MOD
+ *
+ * If the exponent has been stored in secure memory we assume that it
+ * is a secret exponent and use the side-channel resistant algorithm.
+ */
+void
+gcry_mpi_powm (gcry_mpi_t res,
+               gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod)
+{
+  do_powm (res, base, expo, mod, mpi_is_secure (expo));
+}
+
+
+/* Same as gcry_mpi_powm but always treat EXPO as secret.  This
+   shall be used for private key operations.  */
+void
+_gcry_mpi_powm_sec (gcry_mpi_t res,
+                    gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod)
+{
+  do_powm (res, base, expo, mod, 1);
+}
@@ -33,20 +33,48 @@
 #include "longlong.h"
 #include "g10lib.h"
 
+/* The crossover points between the multiplication algorithms.  They
+ * are initialized from mpi-tune.h and may be changed at runtime with
+ * GCRYCTL_SET_MPI_THRESHOLDS.  The size of the temporary space does
+ * not depend on these values (see _gcry_mpih_mul_tspace_size), thus
+ * it does not matter if they change while a multiplication is in
+ * progress.  */
+struct mpih_thresholds _gcry_mpih_thresholds =
+  {
+    KARATSUBA_THRESHOLD,
+    KARATSUBA_SQR_THRESHOLD,
+    TOOM3_MUL_THRESHOLD,
+    TOOM3_SQR_THRESHOLD
+  };
+
+
+static void mul_n (mpi_ptr_t prodp, mpi_ptr_t up, mpi_ptr_t vp,
+                   mpi_size_t size, mpi_ptr_t tspace);
+static void mul_toom3 (mpi_ptr_t prodp, mpi_ptr_t up, mpi_ptr_t vp,
+                       mpi_size_t size, mpi_ptr_t tspace);
+static void sqr_n (mpi_ptr_t prodp, mpi_ptr_t up,
+                   mpi_size_t size, mpi_ptr_t tspace);
+static void sqr_toom3 (mpi_ptr_t prodp, mpi_ptr_t up,
+                       mpi_size_t size, mpi_ptr_t tspace);
+
 #define MPN_MUL_N_RECURSE(prodp, up, vp, size, tspace) \
     do {						\
-	if( (size) < KARATSUBA_THRESHOLD )		\
+	if( (size) < _gcry_mpih_thresholds.karatsuba_mul ) \
 	    mul_n_basecase (prodp, up, vp, size);	\
-	else						\
+	else if( (size) < _gcry_mpih_thresholds.toom3_mul ) \
 	    mul_n (prodp, up, vp, size, tspace);	\
+	else						\
+	    mul_toom3 (prodp, up, vp, size, tspace);	\
     } while (0);
 
 #define MPN_SQR_N_RECURSE(prodp, up, size, tspace) \
     do {					    \
-	if ((size) < KARATSUBA_THRESHOLD)	    \
+	if ((size) < _gcry_mpih_thresholds.karatsuba_sqr) \
 	    _gcry_mpih_sqr_n_basecase (prodp, up, size);	 \
+	else if ((size) < _gcry_mpih_thresholds.toom3_sqr) \
+	    sqr_n (prodp, up, size, tspace);	 \
 	else					    \
-	    _gcry_mpih_sqr_n (prodp, up, size, tspace);	 \
+	    sqr_toom3 (prodp, up, size, tspace);    \
     } while (0);
 
 
@@ -222,50 +250,102 @@ mul_n( mpi_ptr_t prodp, mpi_ptr_t up, mpi_ptr_t vp,
 }
 
 
+/* On x86-64 CPUs with the BMI2 and ADX extensions the rows of cross
+ * products in the squaring are computed with MULX, which does not
+ * change the flags, and two independent carry chains using ADCX and
+ * ADOX.  The instructions are given as bytes so that an old
+ * assembler can still build this.  */
+#undef USE_MULX_ADX
+#if defined(__x86_64__) && defined(__GNUC__) && BYTES_PER_MPI_LIMB == 8
+# define USE_MULX_ADX 1
+#endif
+
+#ifdef USE_MULX_ADX
+/* Add the SIZE limbs at UP multiplied by V to the SIZE limbs at RP.
+ * Return the carry limb.  SIZE needs to be at least 1.  */
+static mpi_limb_t
+addmul_1_mulx (mpi_ptr_t rp, mpi_ptr_t up, mpi_size_t size, mpi_limb_t v)
+{
+    unsigned long count = size;
+    mpi_limb_t cy;
+
+    asm volatile
+      ("shrq   $1, %%rcx\n\t"		/* Number of limb pairs.  */
+       "jnc    1f\n\t"
+       "xorl   %%eax, %%eax\n\t"	/* Clear CF and OF.  */
+       ".byte 0xc4, 0x62, 0xb3, 0xf6, 0x06\n\t" /* mulx (%rsi),%r9,%r8 */
+       ".byte 0xf3, 0x4c, 0x0f, 0x38, 0xf6, 0x0f\n\t" /* adox (%rdi),%r9 */
+       "movq   %%r9, (%%rdi)\n\t"
+       "leaq   8(%%rsi), %%rsi\n\t"
+       "leaq   8(%%rdi), %%rdi\n\t"
+       "jmp    2f\n"
+       "1:\n\t"
+       "xorl   %%eax, %%eax\n\t"
+       "xorl   %%r8d, %%r8d\n"
+       "2:\n\t"
+       "jrcxz  4f\n"
+       "3:\n\t"
+       ".byte 0xc4, 0x62, 0xb3, 0xf6, 0x16\n\t" /* mulx (%rsi),%r9,%r10 */
+       ".byte 0x66, 0x4d, 0x0f, 0x38, 0xf6, 0xc8\n\t" /* adcx %r8,%r9 */
+       ".byte 0xf3, 0x4c, 0x0f, 0x38, 0xf6, 0x0f\n\t" /* adox (%rdi),%r9 */
+       "movq   %%r9, (%%rdi)\n\t"
+       ".byte 0xc4, 0x62, 0xa3, 0xf6, 0x46, 0x08\n\t" /* mulx 8(%rsi),%r11,%r8 */
+       ".byte 0x66, 0x4d, 0x0f, 0x38, 0xf6, 0xda\n\t" /* adcx %r10,%r11 */
+       ".byte 0xf3, 0x4c, 0x0f, 0x38, 0xf6, 0x5f, 0x08\n\t" /* adox 8(%rdi),%r11 */
+       "movq   %%r11, 8(%%rdi)\n\t"
+       "leaq   16(%%rsi), %%rsi\n\t"
+       "leaq   16(%%rdi), %%rdi\n\t"
+       "leaq   -1(%%rcx), %%rcx\n\t"	/* Does not change the flags.  */
+       "jrcxz  4f\n\t"
+       "jmp    3b\n"
+       "4:\n\t"
+       ".byte 0x66, 0x4c, 0x0f, 0x38, 0xf6, 0xc0\n\t" /* adcx %rax,%r8 */
+       ".byte 0xf3, 0x4c, 0x0f, 0x38, 0xf6, 0xc0\n\t" /* adox %rax,%r8 */
+       "movq   %%r8, %0\n"
+       : "=g" (cy), "+D" (rp), "+S" (up), "+c" (count)
+       : "d" (v)
+       : "%rax", "%r8", "%r9", "%r10", "%r11", "cc", "memory");
+    return cy;
+}
+#endif /*USE_MULX_ADX*/
+
+
+/* Square the SIZE limbs at UP and store the 2*SIZE limbs of the
+ * result at PRODP.  Each cross product UP[i]*UP[j], i != j, appears
+ * twice in the square; they are computed only once and doubled
+ * together with adding the squares of the limbs.  This takes about
+ * half the multiplications of mul_n_basecase.  */
 void
 _gcry_mpih_sqr_n_basecase( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t size )
 {
     mpi_size_t i;
-    mpi_limb_t cy_limb;
-    mpi_limb_t v_limb;
-
-    /* Multiply by the first limb in V separately, as the result can be
-     * stored (not added) to PROD.  We also avoid a loop for zeroing.  */
-    v_limb = up[0];
-    if( v_limb <= 1 ) {
-	if( v_limb == 1 )
-	    MPN_COPY( prodp, up, size );
-	else
-	    MPN_ZERO(prodp, size);
-	cy_limb = 0;
-    }
-    else
-	cy_limb = _gcry_mpih_mul_1( prodp, up, size, v_limb );
-
-    prodp[size] = cy_limb;
-    prodp++;
 
-    /* For each iteration in the outer loop, multiply one limb from
-     * U with one limb from V, and add it to PROD.  */
-    for( i=1; i < size; i++) {
-	v_limb = up[i];
-	if( v_limb <= 1 ) {
-	    cy_limb = 0;
-	    if( v_limb == 1 )
-		cy_limb = _gcry_mpih_add_n(prodp, prodp, up, size);
+    prodp[0] = 0;
+    prodp[2 * size - 1] = 0;
+    if( size > 1 ) {
+	/* The cross products; row I holds UP[I] * UP[I+1..SIZE-1].  */
+	prodp[size] = _gcry_mpih_mul_1( prodp + 1, up + 1, size - 1, up[0] );
+#ifdef USE_MULX_ADX
+	if( (_gcry_get_hw_features () & (HWF_INTEL_BMI2 | HWF_INTEL_ADX))
+	    == (HWF_INTEL_BMI2 | HWF_INTEL_ADX) ) {
+	    for( i = 1; i < size - 1; i++ )
+		prodp[size + i] = addmul_1_mulx( prodp + 2 * i + 1, up + i + 1,
+						 size - i - 1, up[i] );
 	}
 	else
-	    cy_limb = _gcry_mpih_addmul_1(prodp, up, size, v_limb);
-
-	prodp[size] = cy_limb;
-	prodp++;
+#endif /*USE_MULX_ADX*/
+	for( i = 1; i < size - 1; i++ )
+	    prodp[size + i] = _gcry_mpih_addmul_1( prodp + 2 * i + 1,
+						   up + i + 1,
+						   size - i - 1, up[i] );
     }
+
+    _gcry_mpih_sqr_diag_addlsh1( prodp, up, size );
 }
 
 
-void
-_gcry_mpih_sqr_n( mpi_ptr_t prodp,
-                  mpi_ptr_t up, mpi_size_t size, mpi_ptr_t tspace)
+static void
+sqr_n( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t size, mpi_ptr_t tspace )
 {
     if( size & 1 ) {
 	/* The size is odd, and the code below doesn't handle that.
@@ -341,33 +421,281 @@ _gcry_mpih_sqr_n( mpi_ptr_t prodp,
 }
 
 
+/* Toom-Cook 3-way multiplication.
+ *
+ * Split U and V in three pieces of K limbs each, the most significant
+ * pieces having only R = SIZE - 2K limbs:
+ *
+ *   U = U0 + U1*X + U2*X^2,  V = V0 + V1*X + V2*X^2,  X = B^K.
+ *
+ * The product W(X) = C0 + C1*X + C2*X^2 + C3*X^3 + C4*X^4 is computed
+ * from its values at the points 0, 1, 2, 3 and infinity, that is from
+ * five products of about SIZE/3 limbs instead of the nine products
+ * of the schoolbook method.  Using only non-negative points keeps all
+ * intermediate values non-negative; the price are somewhat larger
+ * evaluated operands and an exact division by 3.
+ */
+
+/* The smallest size the code can handle: R needs to be at least 1.  */
+#define TOOM3_MIN_SIZE 5
+
+
+/* Store U0 + M*U1 + M^2*U2 with K+1 limbs at AP.  */
+static void
+toom3_eval (mpi_ptr_t ap, mpi_ptr_t up, mpi_size_t k, mpi_size_t r,
+            mpi_limb_t m)
+{
+  mpi_limb_t cy;
+
+  MPN_COPY (ap, up, k);
+  ap[k] = _gcry_mpih_addmul_1 (ap, up + k, k, m);
+  cy = _gcry_mpih_addmul_1 (ap, up + 2 * k, r, m * m);
+  if (r < k)
+    cy = _gcry_mpih_add_1 (ap + r, ap + r, k - r, cy);
+  ap[k] += cy;
+}
+
+
+/* Divide the N limbs at UP by 3 and store the quotient at QP.  The
+   division needs to be exact.  This is done by a multiplication with
+   the inverse of 3 modulo B, which is much cheaper than a real
+   division.  */
+static void
+toom3_divexact_by3 (mpi_ptr_t qp, mpi_ptr_t up, mpi_size_t n)
+{
+  const mpi_limb_t third = ~(mpi_limb_t)0 / 3;
+  const mpi_limb_t inverse = 2 * third + 1;
+  mpi_limb_t c = 0;
+  mpi_limb_t s, l, q;
+  mpi_size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      s = up[i];
+      l = s - c;
+      c = l > s;
+      q = l * inverse;
+      qp[i] = q;
+      /* Add the high limb of 3*Q to the borrow.  */
+      c += (q > third) + (q > 2 * third);
+    }
+}
+
+
+/* Compute the coefficients C1, C2 and C3 from the values W(1), W(2)
+   and W(3), which are stored with 2K+2 limbs each at WS.  C0 and C4
+   are expected at PRODP and PRODP + 4K.  The coefficients are then
+   added up to the final product of 2*SIZE limbs at PRODP.  */
+static void
+toom3_interpolate (mpi_ptr_t prodp, mpi_ptr_t ws,
+                   mpi_size_t size, mpi_size_t k, mpi_size_t r)
+{
+  mpi_size_t wsize = 2 * k + 2;
+  mpi_ptr_t w1 = ws;
+  mpi_ptr_t w2 = ws + wsize;
+  mpi_ptr_t w3 = ws + 2 * wsize;
+  mpi_ptr_t c0 = prodp;
+  mpi_ptr_t c4 = prodp + 4 * k;
+  mpi_limb_t cy;
+
+  /* E1 = W(1) - C0 - C4 = C1 + C2 + C3.  */
+  _gcry_mpih_sub (w1, w1, wsize, c0, 2 * k);
+  _gcry_mpih_sub (w1, w1, wsize, c4, 2 * r);
+
+  /* E2 = (W(2) - C0 - 16*C4)/2 = C1 + 2*C2 + 4*C3.  */
+  _gcry_mpih_sub (w2, w2, wsize, c0, 2 * k);
+  cy = _gcry_mpih_submul_1 (w2, c4, 2 * r, 16);
+  _gcry_mpih_sub_1 (w2 + 2 * r, w2 + 2 * r, wsize - 2 * r, cy);
+  _gcry_mpih_rshift (w2, w2, wsize, 1);
+
+  /* E3 = (W(3) - C0 - 81*C4)/3 = C1 + 3*C2 + 9*C3.  */
+  _gcry_mpih_sub (w3, w3, wsize, c0, 2 * k);
+  cy = _gcry_mpih_submul_1 (w3, c4, 2 * r, 81);
+  _gcry_mpih_sub_1 (w3 + 2 * r, w3 + 2 * r, wsize - 2 * r, cy);
+  toom3_divexact_by3 (w3, w3, wsize);
+
+  /* D2 = E3 - E2 = C2 + 5*C3 and D1 = E2 - E1 = C2 + 3*C3.  */
+  _gcry_mpih_sub_n (w3, w3, w2, wsize);
+  _gcry_mpih_sub_n (w2, w2, w1, wsize);
+
+  /* C3 = (D2 - D1)/2, C2 = D1 - 3*C3 and C1 = E1 - C2 - C3.  */
+  _gcry_mpih_sub_n (w3, w3, w2, wsize);
+  _gcry_mpih_rshift (w3, w3, wsize, 1);
+  _gcry_mpih_submul_1 (w2, w3, wsize, 3);
+  _gcry_mpih_sub_n (w1, w1, w2, wsize);
+  _gcry_mpih_sub_n (w1, w1, w3, wsize);
+
+  /* Add up the coefficients.  The result fits into 2*SIZE limbs, thus
+     the high limbs of the coefficients which do not fit are zero.  */
+  MPN_ZERO (prodp + 2 * k, 2 * k);
+  _gcry_mpih_add (prodp + k, prodp + k, 2 * size - k,
+                  w1, MIN (wsize, 2 * size - k));
+  _gcry_mpih_add (prodp + 2 * k, prodp + 2 * k, 2 * size - 2 * k,
+                  w2, MIN (wsize, 2 * size - 2 * k));
+  _gcry_mpih_add (prodp + 3 * k, prodp + 3 * k, 2 * size - 3 * k,
+                  w3, MIN (wsize, 2 * size - 3 * k));
+}
+
+
+/* Multiply the SIZE limbs at UP and VP and store the 2*SIZE limbs of
+   the product at PRODP.  SIZE needs to be at least TOOM3_MIN_SIZE.
+   The three values W(1), W(2) and W(3) are stored at the start of
+   TSPACE; the rest of it is passed down to the recursive calls.  The
+   evaluated operands are temporarily stored at PRODP.  */
+static void
+mul_toom3 (mpi_ptr_t prodp, mpi_ptr_t up, mpi_ptr_t vp,
+           mpi_size_t size, mpi_ptr_t tspace)
+{
+  mpi_size_t k = (size + 2) / 3;
+  mpi_size_t r = size - 2 * k;
+  mpi_size_t wsize = 2 * k + 2;
+  mpi_ptr_t ap = prodp;
+  mpi_ptr_t bp = prodp + k + 1;
+  mpi_ptr_t ts = tspace + 3 * wsize;
+  mpi_limb_t m;
+
+  for (m = 1; m <= 3; m++)
+    {
+      toom3_eval (ap, up, k, r, m);
+      toom3_eval (bp, vp, k, r, m);
+      MPN_MUL_N_RECURSE (tspace + (m - 1) * wsize, ap, bp, k + 1, ts);
+    }
+
+  /* C0 = U0*V0 and C4 = U2*V2.  */
+  MPN_MUL_N_RECURSE (prodp, up, vp, k, ts);
+  MPN_MUL_N_RECURSE (prodp + 4 * k, up + 2 * k, vp + 2 * k, r, ts);
+
+  toom3_interpolate (prodp, tspace, size, k, r);
+}
+
+
+/* Square the SIZE limbs at UP and store the 2*SIZE limbs of the
+   result at PRODP.  This is the same as mul_toom3 with only one
+   operand to evaluate.  */
+static void
+sqr_toom3 (mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t size, mpi_ptr_t tspace)
+{
+  mpi_size_t k = (size + 2) / 3;
+  mpi_size_t r = size - 2 * k;
+  mpi_size_t wsize = 2 * k + 2;
+  mpi_ptr_t ap = prodp;
+  mpi_ptr_t ts = tspace + 3 * wsize;
+  mpi_limb_t m;
+
+  for (m = 1; m <= 3; m++)
+    {
+      toom3_eval (ap, up, k, r, m);
+      MPN_SQR_N_RECURSE (tspace + (m - 1) * wsize, ap, k + 1, ts);
+    }
+
+  MPN_SQR_N_RECURSE (prodp, up, k, ts);
+  MPN_SQR_N_RECURSE (prodp + 4 * k, up + 2 * k, r, ts);
+
+  toom3_interpolate (prodp, tspace, size, k, r);
+}
+
+
+/* Square the SIZE limbs at UP and store the 2*SIZE limbs of the
+ * result at PRODP.  TSPACE needs to have room for
+ * _gcry_mpih_mul_tspace_size (SIZE) limbs.  */
+void
+_gcry_mpih_sqr_n( mpi_ptr_t prodp,
+                  mpi_ptr_t up, mpi_size_t size, mpi_ptr_t tspace)
+{
+    MPN_SQR_N_RECURSE (prodp, up, size, tspace);
+}
+
+
+/* Return the number of limbs required for the temporary space of a
+ * multiplication or squaring of two SIZE limb numbers.  This is an
+ * upper bound for all possible thresholds: Each Toom-3 step takes
+ * 6K+6 limbs and recurses with K+1 limbs, whereas Karatsuba needs
+ * less than 2*SIZE limbs in total.  */
+mpi_size_t
+_gcry_mpih_mul_tspace_size (mpi_size_t size)
+{
+    mpi_size_t nlimbs = 0;
+    mpi_size_t k;
+
+    while( size >= TOOM3_MIN_SIZE ) {
+	k = (size + 2) / 3;
+	nlimbs += 6 * k + 6;
+	size = k + 1;
+    }
+    return nlimbs + 2 * size;
+}
+
+
+/* Set the multiplication thresholds.  A value of 0 selects the
+ * default from mpi-tune.h.  The squaring thresholds for CPUs with
+ * BMI2 and ADX are only used if such a CPU has been detected; this
+ * function is called with all zero values after the detection.  */
+gcry_err_code_t
+_gcry_mpi_set_thresholds (int karatsuba_mul, int karatsuba_sqr,
+                          int toom3_mul, int toom3_sqr)
+{
+    int default_karatsuba_sqr = KARATSUBA_SQR_THRESHOLD;
+    int default_toom3_sqr = TOOM3_SQR_THRESHOLD;
+
+#if defined(USE_MULX_ADX) && defined(KARATSUBA_SQR_THRESHOLD_MULX) \
+    && defined(TOOM3_SQR_THRESHOLD_MULX)
+    if( (_gcry_get_hw_features () & (HWF_INTEL_BMI2 | HWF_INTEL_ADX))
+        == (HWF_INTEL_BMI2 | HWF_INTEL_ADX) ) {
+        default_karatsuba_sqr = KARATSUBA_SQR_THRESHOLD_MULX;
+        default_toom3_sqr = TOOM3_SQR_THRESHOLD_MULX;
+    }
+#endif
+
+    if (!karatsuba_mul)
+        karatsuba_mul = KARATSUBA_THRESHOLD;
+    if (!karatsuba_sqr)
+        karatsuba_sqr = default_karatsuba_sqr;
+    if (!toom3_mul)
+        toom3_mul = TOOM3_MUL_THRESHOLD;
+    if (!toom3_sqr)
+        toom3_sqr = default_toom3_sqr;
+    if (karatsuba_mul < 2 || karatsuba_sqr < 2
+        || toom3_mul < TOOM3_MIN_SIZE || toom3_sqr < TOOM3_MIN_SIZE)
+        return GPG_ERR_INV_VALUE;
+
+    _gcry_mpih_thresholds.karatsuba_mul = karatsuba_mul;
+    _gcry_mpih_thresholds.karatsuba_sqr = karatsuba_sqr;
+    _gcry_mpih_thresholds.toom3_mul = toom3_mul;
+    _gcry_mpih_thresholds.toom3_sqr = toom3_sqr;
+    return 0;
+}
+
+
 /* This should be made into an inline function in gmp.h.  */
 void
 _gcry_mpih_mul_n( mpi_ptr_t prodp,
                      mpi_ptr_t up, mpi_ptr_t vp, mpi_size_t size)
 {
     int secure;
+    mpi_size_t tsize;
 
     if( up == vp ) {
-	if( size < KARATSUBA_THRESHOLD )
+	if( size < _gcry_mpih_thresholds.karatsuba_sqr )
 	    _gcry_mpih_sqr_n_basecase( prodp, up, size );
 	else {
 	    mpi_ptr_t tspace;
 	    secure = gcry_is_secure( up );
-	    tspace = mpi_alloc_limb_space( 2 * size, secure );
+	    tsize = _gcry_mpih_mul_tspace_size (size);
+	    tspace = mpi_alloc_limb_space( tsize, secure );
 	    _gcry_mpih_sqr_n( prodp, up, size, tspace );
-	    _gcry_mpi_free_limb_space (tspace, 2 * size );
+	    _gcry_mpi_free_limb_space (tspace, tsize );
 	}
     }
     else {
-	if( size < KARATSUBA_THRESHOLD )
+	if( size < _gcry_mpih_thresholds.karatsuba_mul )
 	    mul_n_basecase( prodp, up, vp, size );
 	else {
 	    mpi_ptr_t tspace;
 	    secure = gcry_is_secure( up ) || gcry_is_secure( vp );
-	    tspace = mpi_alloc_limb_space( 2 * size, secure );
-	    mul_n (prodp, up, vp, size, tspace);
-	    _gcry_mpi_free_limb_space (tspace, 2 * size );
+	    tsize = _gcry_mpih_mul_tspace_size (size);
+	    tspace = mpi_alloc_limb_space( tsize, secure );
+	    MPN_MUL_N_RECURSE (prodp, up, vp, size, tspace);
+	    _gcry_mpi_free_limb_space (tspace, tsize );
 	}
     }
 }
@@ -385,8 +713,8 @@ _gcry_mpih_mul_karatsuba_case( mpi_ptr_t prodp,
     if( !ctx->tspace || ctx->tspace_size < vsize ) {
 	if( ctx->tspace )
 	    _gcry_mpi_free_limb_space( ctx->tspace, ctx->tspace_nlimbs );
-        ctx->tspace_nlimbs = 2 * vsize;
-	ctx->tspace = mpi_alloc_limb_space( 2 * vsize,
+        ctx->tspace_nlimbs = _gcry_mpih_mul_tspace_size (vsize);
+	ctx->tspace = mpi_alloc_limb_space( ctx->tspace_nlimbs,
 				            (gcry_is_secure( up )
                                             || gcry_is_secure( vp )) );
 	ctx->tspace_size = vsize;
@@ -418,7 +746,7 @@ _gcry_mpih_mul_karatsuba_case( mpi_ptr_t prodp,
     }
 
     if( usize ) {
-	if( usize < KARATSUBA_THRESHOLD ) {
+	if( usize < _gcry_mpih_thresholds.karatsuba_mul ) {
 	    _gcry_mpih_mul( ctx->tspace, vp, vsize, up, usize );
 	}
 	else {
@@ -479,7 +807,7 @@ _gcry_mpih_mul( mpi_ptr_t prodp, mpi_ptr_t up, mpi_size_t usize,
     mpi_limb_t cy;
     struct karatsuba_ctx ctx;
 
-    if( vsize < KARATSUBA_THRESHOLD ) {
+    if( vsize < _gcry_mpih_thresholds.karatsuba_mul ) {
 	mpi_size_t i;
 	mpi_limb_t v_limb;
 
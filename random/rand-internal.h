@@ -92,10 +92,22 @@ gcry_err_code_t _gcry_rngfips_run_external_test (void *context,
 void _gcry_rngfips_deinit_external_test (void *context);
 
 
+/*-- random-drbg.c --*/
+gcry_err_code_t _gcry_rngdrbg_initialize (void);
+void _gcry_rngdrbg_dump_stats (void);
+gcry_error_t _gcry_rngdrbg_add_bytes (const void *buf, size_t buflen,
+                                      int quality);
+void _gcry_rngdrbg_randomize (void *buffer, size_t length,
+                              enum gcry_random_level level);
+void _gcry_rngdrbg_create_nonce (void *buffer, size_t length);
+gcry_error_t _gcry_rngdrbg_selftest (selftest_report_func_t report);
+
+
 
 
 
 /*-- rndlinux.c --*/
+int _gcry_rndlinux_have_getrandom (void);
 int _gcry_rndlinux_gather_random (void (*add) (const void *, size_t,
                                                enum random_origins),
                                    enum random_origins origin,
@@ -189,9 +189,44 @@ static ath_mutex_t pool_lock = ATH_MUTEX_INITIALIZER;
    test suite.  */
 static int pool_is_locked;
 
-/* This is the lock we use to protect the buffer used by the nonce
-   generation.  */
-static ath_mutex_t nonce_buffer_lock = ATH_MUTEX_INITIALIZER;
+/* Requests for GCRY_WEAK_RANDOM and nonces are not served directly
+   from the pool.  Instead each thread uses one of RANDOM_SHARDS small
+   generators, each with its own lock.  A generator computes SHA-1
+   over a 20 byte key and a 64 bit counter and replaces its key after
+   each request.  The key is seeded from the pool and reseeded after
+   SHARD_RESEED_REQUESTS requests, SHARD_RESEED_BYTES bytes or a fork.
+   Requests for GCRY_STRONG_RANDOM and GCRY_VERY_STRONG_RANDOM are
+   always served from the pool.  */
+#define RANDOM_SHARDS 16
+#define SHARD_RESEED_REQUESTS 1024
+#define SHARD_RESEED_BYTES (1024*1024)
+
+struct rng_shard
+{
+  ath_mutex_t lock;
+  int seeded;
+  pid_t pid;               /* The process which seeded the shard.  */
+  unsigned int requests;   /* Requests since the last reseed.  */
+  size_t nbytes;           /* Bytes returned since the last reseed.  */
+  unsigned char state[DIGESTLEN + 8];  /* The key and the counter.  */
+  pid_t nonce_pid;         /* The process which seeded NONCE.  */
+  unsigned char nonce[DIGESTLEN + 8];  /* The nonce generator.  */
+  unsigned long getbytes;  /* Stats.  */
+  unsigned long ngetbytes;
+};
+
+/* The shards; allocated along with RNDPOOL.  */
+static struct rng_shard *shards;
+
+#ifdef HAVE_THREAD_LOCAL
+/* The index of the shard used by the current thread plus one or 0 if
+   no shard has yet been assigned.  */
+static __thread unsigned int my_shard;
+
+/* The shard to be assigned to the next thread.  Protected by the
+   pool lock.  */
+static unsigned int next_shard;
+#endif
 
 
 /* We keep some counters in this structure for the sake of the
@@ -208,6 +243,7 @@ static struct
   unsigned long ngetbytes2;
   unsigned long addbytes;
   unsigned long naddbytes;
+  unsigned long shardreseeds;
 } rndstats;
 
 
@@ -272,11 +308,6 @@ initialize_basics(void)
       if (err)
         log_fatal ("failed to create the pool lock: %s\n", strerror (err) );
 
-      err = ath_mutex_init (&nonce_buffer_lock);
-      if (err)
-        log_fatal ("failed to create the nonce buffer lock: %s\n",
-                   strerror (err) );
-
 #ifdef USE_RANDOM_DAEMON
       _gcry_daemon_initialize_basics ();
 #endif /*USE_RANDOM_DAEMON*/
@@ -318,6 +349,8 @@ unlock_pool (void)
 static void
 initialize(void)
 {
+  int i, err;
+
   /* Although the basic initialization should have happened already,
      we call it here to make sure that all prerequisites are met.  */
   initialize_basics ();
@@ -336,6 +369,16 @@ initialize(void)
       keypool = (secure_alloc
                  ? gcry_xcalloc_secure (1, POOLSIZE + BLOCKLEN)
                  : gcry_xcalloc (1, POOLSIZE + BLOCKLEN));
+      shards = (secure_alloc
+                ? gcry_xcalloc_secure (RANDOM_SHARDS, sizeof *shards)
+                : gcry_xcalloc (RANDOM_SHARDS, sizeof *shards));
+      for (i = 0; i < RANDOM_SHARDS; i++)
+        {
+          err = ath_mutex_init (&shards[i].lock);
+          if (err)
+            log_fatal ("failed to create a shard lock: %s\n",
+                       strerror (err));
+        }
 
       /* Setup the slow entropy gathering function.  The code requires
          that this function exists. */
@@ -373,16 +416,27 @@ _gcry_rngcsprng_initialize (int full)
 void
 _gcry_rngcsprng_dump_stats (void)
 {
+  unsigned long getbytes1 = rndstats.getbytes1;
+  unsigned long ngetbytes1 = rndstats.ngetbytes1;
+  int i;
+
+  for (i = 0; shards && i < RANDOM_SHARDS; i++)
+    {
+      getbytes1 += shards[i].getbytes;
+      ngetbytes1 += shards[i].ngetbytes;
+    }
+
   /* In theory we would need to lock the stats here.  However this
      function is usually called during cleanup and then we _might_ run
      into problems.  */
 
   log_info ("random usage: poolsize=%d mixed=%lu polls=%lu/%lu added=%lu/%lu\n"
-	    "              outmix=%lu getlvl1=%lu/%lu getlvl2=%lu/%lu%s\n",
+	    "              outmix=%lu getlvl1=%lu/%lu getlvl2=%lu/%lu"
+            " reseeds=%lu%s\n",
             POOLSIZE, rndstats.mixrnd, rndstats.slowpolls, rndstats.fastpolls,
             rndstats.naddbytes, rndstats.addbytes,
-            rndstats.mixkey, rndstats.ngetbytes1, rndstats.getbytes1,
-            rndstats.ngetbytes2, rndstats.getbytes2,
+            rndstats.mixkey, ngetbytes1, getbytes1,
+            rndstats.ngetbytes2, rndstats.getbytes2, rndstats.shardreseeds,
             _gcry_rndhw_failed_p()? " (hwrng failed)":"");
 }
 
@@ -499,6 +553,125 @@ _gcry_rngcsprng_add_bytes (const void *buf, size_t buflen, int quality)
 }
 
 
+/* Return the shard to be used by the current thread.  */
+static struct rng_shard *
+get_shard (void)
+{
+#ifdef HAVE_THREAD_LOCAL
+  if (!my_shard)
+    {
+      lock_pool ();
+      my_shard = 1 + next_shard++ % RANDOM_SHARDS;
+      unlock_pool ();
+    }
+  return &shards[my_shard - 1];
+#else
+  return shards;
+#endif
+}
+
+/* Mix 20 bytes from the pool into the key of shard S.  Must be
+   called with the shard locked.  */
+static void
+shard_reseed (struct rng_shard *s)
+{
+  unsigned char seed[DIGESTLEN];
+  int i;
+
+  lock_pool ();
+  read_pool (seed, DIGESTLEN, GCRY_STRONG_RANDOM);
+  rndstats.shardreseeds++;
+  unlock_pool ();
+
+  for (i = 0; i < DIGESTLEN; i++)
+    s->state[i] ^= seed[i];
+  wipememory (seed, sizeof seed);
+
+  s->seeded = 1;
+  s->pid = getpid ();
+  s->requests = 0;
+  s->nbytes = 0;
+}
+
+/* Increment the counter of shard S and store the next DIGESTLEN
+   bytes of output at OUT.  */
+static void
+shard_next_block (struct rng_shard *s, unsigned char *out)
+{
+  int i;
+
+  for (i = sizeof s->state - 1; i >= DIGESTLEN && !++s->state[i]; i--)
+    ;
+  _gcry_sha1_hash_buffer (out, s->state, sizeof s->state);
+}
+
+/* Fill BUFFER with LENGTH bytes from shard S.  Must be called with
+   the shard locked.  */
+static void
+shard_generate (struct rng_shard *s, unsigned char *buffer, size_t length)
+{
+  unsigned char block[DIGESTLEN];
+  size_t n;
+
+  if (!s->seeded || s->pid != getpid ()
+      || s->requests >= SHARD_RESEED_REQUESTS)
+    shard_reseed (s);
+  s->requests++;
+  s->getbytes += length;
+  s->ngetbytes++;
+
+  for (; length; length -= n, buffer += n)
+    {
+      if (s->nbytes >= SHARD_RESEED_BYTES)
+        shard_reseed (s);
+      shard_next_block (s, block);
+      n = length > DIGESTLEN? DIGESTLEN : length;
+      memcpy (buffer, block, n);
+      s->nbytes += n;
+    }
+
+  /* Replace the key so that the returned bytes can't be computed
+     from a later state.  */
+  shard_next_block (s, s->state);
+  wipememory (block, sizeof block);
+}
+
+/* Take the lock of shard S.  */
+static void
+lock_shard (struct rng_shard *s)
+{
+  int err;
+
+  err = ath_mutex_lock (&s->lock);
+  if (err)
+    log_fatal ("failed to acquire a shard lock: %s\n", strerror (err));
+}
+
+/* Release the lock of shard S.  */
+static void
+unlock_shard (struct rng_shard *s)
+{
+  int err;
+
+  err = ath_mutex_unlock (&s->lock);
+  if (err)
+    log_fatal ("failed to release a shard lock: %s\n", strerror (err));
+}
+
+
+/* Fill BUFFER with LENGTH bytes from the shard of the current
+   thread.  */
+static void
+shard_randomize (unsigned char *buffer, size_t length)
+{
+  struct rng_shard *s = get_shard ();
+
+  lock_shard (s);
+  shard_generate (s, buffer, length);
+  unlock_shard (s);
+}
+
+
 /* Public function to fill the buffer with LENGTH bytes of
    cryptographically strong random bytes.  Level GCRY_WEAK_RANDOM is
    not very strong, GCRY_STRONG_RANDOM is strong enough for most
@@ -527,6 +700,12 @@ _gcry_rngcsprng_randomize (void *buffer, size_t length,
   allow_daemon = 0; /* Daemon failed - switch off. */
 #endif /*USE_RANDOM_DAEMON*/
 
+  if (level == GCRY_WEAK_RANDOM)
+    {
+      shard_randomize (buffer, length);
+      return;
+    }
+
   /* Acquire the pool lock. */
   lock_pool ();
 
@@ -1120,8 +1299,9 @@ getfnc_gather_random (void))(void (*)(const void*, size_t,
              enum random_origins, size_t, int);
 
 #if USE_RNDLINUX
-  if ( !access (NAME_OF_DEV_RANDOM, R_OK)
-       && !access (NAME_OF_DEV_URANDOM, R_OK))
+  if ( _gcry_rndlinux_have_getrandom ()
+       || (!access (NAME_OF_DEV_RANDOM, R_OK)
+           && !access (NAME_OF_DEV_URANDOM, R_OK)))
     {
       fnc = _gcry_rndlinux_gather_random;
       return fnc;
@@ -1326,16 +1506,12 @@ gather_faked (void (*add)(const void*, size_t, enum random_origins),
 void
 _gcry_rngcsprng_create_nonce (void *buffer, size_t length)
 {
-  static unsigned char nonce_buffer[20+8];
-  static int nonce_buffer_initialized = 0;
-  static volatile pid_t my_pid; /* The volatile is there to make sure the
-                                   compiler does not optimize the code away
-                                   in case the getpid function is badly
-                                   attributed. */
+  struct rng_shard *s;
+  /* The volatile is there to make sure the compiler does not optimize
+     the code away in case the getpid function is badly attributed. */
   volatile pid_t apid;
   unsigned char *p;
   size_t n;
-  int err;
 
   /* Make sure we are initialized. */
   initialize ();
@@ -1347,62 +1523,39 @@ _gcry_rngcsprng_create_nonce (void *buffer, size_t length)
   allow_daemon = 0; /* Daemon failed - switch off. */
 #endif /*USE_RANDOM_DAEMON*/
 
-  /* Acquire the nonce buffer lock. */
-  err = ath_mutex_lock (&nonce_buffer_lock);
-  if (err)
-    log_fatal ("failed to acquire the nonce buffer lock: %s\n",
-               strerror (err));
+  s = get_shard ();
+  lock_shard (s);
 
   apid = getpid ();
-  /* The first time initialize our buffer. */
-  if (!nonce_buffer_initialized)
+  if (s->nonce_pid != apid)
     {
+      /* The first time or after a fork initialize the buffer.  The
+         first 20 bytes are set to a reasonable value and the never
+         changing private part of 64 bits is taken from the shard's
+         generator.  Don't care about the uninitialized remaining
+         bytes. */
       time_t atime = time (NULL);
       pid_t xpid = apid;
 
-      my_pid = apid;
-
-      if ((sizeof apid + sizeof atime) > sizeof nonce_buffer)
+      if ((sizeof apid + sizeof atime) > DIGESTLEN)
         BUG ();
 
-      /* Initialize the first 20 bytes with a reasonable value so that
-         a failure of gcry_randomize won't affect us too much.  Don't
-         care about the uninitialized remaining bytes. */
-      p = nonce_buffer;
+      p = s->nonce;
       memcpy (p, &xpid, sizeof xpid);
       p += sizeof xpid;
       memcpy (p, &atime, sizeof atime);
-
-      /* Initialize the never changing private part of 64 bits. */
-      gcry_randomize (nonce_buffer+20, 8, GCRY_WEAK_RANDOM);
-
-      nonce_buffer_initialized = 1;
-    }
-  else if ( my_pid != apid )
-    {
-      /* We forked. Need to reseed the buffer - doing this for the
-         private part should be sufficient. */
-      gcry_randomize (nonce_buffer+20, 8, GCRY_WEAK_RANDOM);
-      /* Update the pid so that we won't run into here again and
-         again. */
-      my_pid = apid;
+      shard_generate (s, s->nonce + DIGESTLEN, 8);
+      s->nonce_pid = apid;
     }
 
   /* Create the nonce by hashing the entire buffer, returning the hash
      and updating the first 20 bytes of the buffer with this hash. */
   for (p = buffer; length > 0; length -= n, p += n)
     {
-      _gcry_sha1_hash_buffer (nonce_buffer,
-                              nonce_buffer, sizeof nonce_buffer);
-      n = length > 20? 20 : length;
-      memcpy (p, nonce_buffer, n);
+      _gcry_sha1_hash_buffer (s->nonce, s->nonce, sizeof s->nonce);
+      n = length > DIGESTLEN? DIGESTLEN : length;
+      memcpy (p, s->nonce, n);
     }
 
-
-  /* Release the nonce buffer lock. */
-  err = ath_mutex_unlock (&nonce_buffer_lock);
-  if (err)
-    log_fatal ("failed to release the nonce buffer lock: %s\n",
-               strerror (err));
-
+  unlock_shard (s);
 }
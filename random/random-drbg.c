@@ -0,0 +1,596 @@
+/* random-drbg.c - CTR_DRBG based random number generator
+ * Copyright (C) 2013  Free Software Foundation, Inc.
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+   This is a deterministic random bit generator following NIST SP
+   800-90A, "Recommendation for Random Number Generation Using
+   Deterministic Random Bit Generators" (2012-01).  It implements the
+   CTR_DRBG mechanism using AES-256 without a derivation function;
+   this is allowed because the seed material is taken from a full
+   entropy source (the kernel).  The generator is an alternative to
+   the standard CSPRNG for applications with a high demand for random
+   bytes and is enabled with GCRYCTL_USE_RANDOM_DRBG.  The output is
+   created by the bulk CTR mode function of the AES module and thus
+   takes advantage of AES-NI if available.
+
+   A single instance serves all random levels:
+
+   Level                    Kernel entropy         Reseed
+   ------------------------------------------------------------------
+   GCRY_VERY_STRONG_RANDOM  /dev/random, 384 bits  before each request
+   GCRY_STRONG_RANDOM       /dev/urandom, 384 bits after 2^16 requests
+   gcry_create_nonce        ditto                  ditto
+
+   Reseeding before each GCRY_VERY_STRONG_RANDOM request implements
+   the prediction resistance of SP 800-90A.  A reseed is also done
+   after a fork so that parent and child do not share their output.
+   Requests larger than 64 KiB are split into several generate calls,
+   each followed by the backtracking resistant update of the key.
+
+   The state of the generator is kept in secure memory.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "g10lib.h"
+#include "random.h"
+#include "rand-internal.h"
+#include "ath.h"
+#include "cipher.h"
+
+/* The DRBG needs AES and a kernel entropy source.  */
+#if defined(USE_AES) && (USE_RNDLINUX || USE_RNDW32)
+# define USE_DRBG 1
+#endif
+
+#ifdef USE_DRBG
+
+/* Gcc 4.x supports the aligned attribute.  The AES-NI code requires
+   the counter block to be aligned.  */
+#ifdef __GNUC__
+# define ATTR_ALIGNED_16  __attribute__ ((aligned (16)))
+#else
+# define ATTR_ALIGNED_16
+#endif
+
+#define DRBG_KEYLEN   32
+#define DRBG_BLOCKLEN 16
+#define DRBG_SEEDLEN  (DRBG_KEYLEN + DRBG_BLOCKLEN)
+
+/* The number of generate requests after which the generator is
+   reseeded.  SP 800-90A allows up to 2^48.  */
+#define DRBG_RESEED_INTERVAL 65536
+
+/* The maximum number of bytes returned by one generate request.  SP
+   800-90A allows up to 2^19 bits.  */
+#define DRBG_MAX_REQUEST 65536
+
+
+/* The state of a CTR_DRBG instance.  */
+struct drbg_state
+{
+  /* The AES context holding the current key.  CIPHER_MEM is the
+     allocated memory and CIPHER_CTX the aligned pointer into it.  */
+  void *cipher_mem;
+  void *cipher_ctx;
+
+  /* The next counter value; this is V + 1 in the terms of SP 800-90A
+     so that it can be passed directly to the CTR mode function.  */
+  unsigned char ctr[DRBG_BLOCKLEN];
+
+  /* Number of generate requests since the last (re)seed.  */
+  unsigned int reseed_counter;
+
+  /* The process which seeded the instance so that we can detect a
+     fork.  */
+  pid_t seed_pid;
+};
+typedef struct drbg_state *drbg_state_t;
+
+
+/* This lock protects the DRBG instance and the entropy collection
+   buffer.  */
+static ath_mutex_t drbg_lock;
+
+/* Flag to indicate that the DRBG_LOCK is held.  */
+static int drbg_is_locked;
+
+/* The DRBG instance.  May only be used while holding the DRBG_LOCK.  */
+static drbg_state_t drbg;
+
+/* Variables used by the entropy collection callback.  */
+static unsigned char *entropy_collect_buffer;
+static size_t entropy_collect_buffer_len;
+
+/* Statistics.  */
+static struct
+{
+  unsigned long reseeds;
+  unsigned long requests;
+  unsigned long nbytes;
+} drbg_stats;
+
+
+/* --- Functions  --- */
+
+/* Basic initialization is required to initialize mutexes.  */
+static void
+basic_initialization (void)
+{
+  static int initialized;
+  int my_errno;
+
+  if (initialized)
+    return;
+  initialized = 1;
+
+  my_errno = ath_mutex_init (&drbg_lock);
+  if (my_errno)
+    log_fatal ("failed to create the DRBG lock: %s\n", strerror (my_errno));
+  drbg_is_locked = 0;
+}
+
+
+/* Acquire the drbg_lock.  */
+static void
+lock_drbg (void)
+{
+  int my_errno;
+
+  my_errno = ath_mutex_lock (&drbg_lock);
+  if (my_errno)
+    log_fatal ("failed to acquire the DRBG lock: %s\n", strerror (my_errno));
+  drbg_is_locked = 1;
+}
+
+
+/* Release the drbg_lock.  */
+static void
+unlock_drbg (void)
+{
+  int my_errno;
+
+  drbg_is_locked = 0;
+  my_errno = ath_mutex_unlock (&drbg_lock);
+  if (my_errno)
+    log_fatal ("failed to release the DRBG lock: %s\n", strerror (my_errno));
+}
+
+
+/* Callback for the entropy gatherers.  */
+static void
+entropy_collect_cb (const void *buffer, size_t length,
+                    enum random_origins origin)
+{
+  const unsigned char *p = buffer;
+
+  (void)origin;
+
+  gcry_assert (drbg_is_locked);
+  gcry_assert (entropy_collect_buffer);
+
+  /* Note that we need to protect against gatherers returning more
+     than the requested bytes (e.g. rndw32).  */
+  while (length-- && entropy_collect_buffer_len < DRBG_SEEDLEN)
+    entropy_collect_buffer[entropy_collect_buffer_len++] ^= *p++;
+}
+
+
+/* Store DRBG_SEEDLEN bytes of kernel entropy of quality LEVEL at
+   BUFFER.  This function terminates the process if no entropy is
+   available.  */
+static void
+get_entropy (unsigned char *buffer, int level)
+{
+  int rc;
+
+  memset (buffer, 0, DRBG_SEEDLEN);
+  entropy_collect_buffer = buffer;
+  entropy_collect_buffer_len = 0;
+
+#if USE_RNDLINUX
+  rc = _gcry_rndlinux_gather_random (entropy_collect_cb, 0,
+                                     DRBG_SEEDLEN, level);
+#else /*USE_RNDW32*/
+  do
+    {
+      rc = _gcry_rndw32_gather_random (entropy_collect_cb, 0,
+                                       DRBG_SEEDLEN, level);
+    }
+  while (rc >= 0 && entropy_collect_buffer_len < DRBG_SEEDLEN);
+#endif
+
+  entropy_collect_buffer = NULL;
+  if (rc < 0 || entropy_collect_buffer_len != DRBG_SEEDLEN)
+    log_fatal ("error getting entropy data\n");
+}
+
+
+/* Set KEY as the new key of STATE.  */
+static void
+drbg_setkey (drbg_state_t state, const unsigned char *key)
+{
+  if (_gcry_cipher_spec_aes256.setkey (state->cipher_ctx, key, DRBG_KEYLEN))
+    log_fatal ("setting the DRBG key failed\n");
+}
+
+
+/* The CTR_DRBG_Update function of SP 800-90A.  PROVIDED is either
+   NULL to denote an all zero input or DRBG_SEEDLEN bytes of provided
+   data.  */
+static void
+drbg_update (drbg_state_t state, const unsigned char *provided)
+{
+  unsigned char temp[DRBG_SEEDLEN];
+  unsigned char ctr[DRBG_BLOCKLEN] ATTR_ALIGNED_16;
+  int i;
+
+  memcpy (ctr, state->ctr, DRBG_BLOCKLEN);
+  if (provided)
+    memcpy (temp, provided, DRBG_SEEDLEN);
+  else
+    memset (temp, 0, DRBG_SEEDLEN);
+  _gcry_aes_ctr_enc (state->cipher_ctx, ctr, temp, temp,
+                     DRBG_SEEDLEN / DRBG_BLOCKLEN);
+
+  drbg_setkey (state, temp);
+
+  /* The new V is the tail of TEMP; we store V + 1.  */
+  memcpy (state->ctr, temp + DRBG_KEYLEN, DRBG_BLOCKLEN);
+  for (i = DRBG_BLOCKLEN - 1; i >= 0; i--)
+    if (++state->ctr[i])
+      break;
+
+  wipememory (temp, sizeof temp);
+  wipememory (ctr, sizeof ctr);
+}
+
+
+/* Allocate a new instance.  The instance is not yet seeded.  */
+static drbg_state_t
+drbg_new (void)
+{
+  drbg_state_t state;
+  size_t n = _gcry_cipher_spec_aes256.contextsize;
+
+  state = gcry_xcalloc_secure (1, sizeof *state);
+  state->cipher_mem = gcry_xcalloc_secure (1, n + 15);
+  state->cipher_ctx = (void *)(((size_t)state->cipher_mem + 15)
+                               & ~(size_t)15);
+  return state;
+}
+
+
+/* Release an instance.  */
+static void
+drbg_release (drbg_state_t state)
+{
+  if (!state)
+    return;
+  gcry_free (state->cipher_mem);
+  wipememory (state, sizeof *state);
+  gcry_free (state);
+}
+
+
+/* The instantiate function of SP 800-90A without derivation function
+   and personalization string.  SEED are DRBG_SEEDLEN bytes of entropy
+   input.  */
+static void
+drbg_instantiate (drbg_state_t state, const unsigned char *seed)
+{
+  unsigned char key[DRBG_KEYLEN];
+
+  memset (key, 0, sizeof key);
+  drbg_setkey (state, key);
+  memset (state->ctr, 0, DRBG_BLOCKLEN);
+  state->ctr[DRBG_BLOCKLEN - 1] = 1;
+  drbg_update (state, seed);
+  state->reseed_counter = 1;
+}
+
+
+/* The reseed function of SP 800-90A without derivation function.  */
+static void
+drbg_reseed (drbg_state_t state, const unsigned char *seed)
+{
+  drbg_update (state, seed);
+  state->reseed_counter = 1;
+}
+
+
+/* The generate function of SP 800-90A without additional input.
+   Store LENGTH bytes of output at BUFFER.  LENGTH may not be larger
+   than DRBG_MAX_REQUEST.  */
+static void
+drbg_generate (drbg_state_t state, unsigned char *buffer, size_t length)
+{
+  unsigned char ctr[DRBG_BLOCKLEN] ATTR_ALIGNED_16;
+  unsigned char tail[DRBG_BLOCKLEN];
+  size_t nblocks = length / DRBG_BLOCKLEN;
+  size_t rest = length % DRBG_BLOCKLEN;
+
+  gcry_assert (length <= DRBG_MAX_REQUEST);
+
+  memcpy (ctr, state->ctr, DRBG_BLOCKLEN);
+  if (nblocks)
+    {
+      memset (buffer, 0, nblocks * DRBG_BLOCKLEN);
+      _gcry_aes_ctr_enc (state->cipher_ctx, ctr, buffer, buffer, nblocks);
+    }
+  if (rest)
+    {
+      memset (tail, 0, DRBG_BLOCKLEN);
+      _gcry_aes_ctr_enc (state->cipher_ctx, ctr, tail, tail, 1);
+      memcpy (buffer + nblocks * DRBG_BLOCKLEN, tail, rest);
+      wipememory (tail, sizeof tail);
+    }
+  memcpy (state->ctr, ctr, DRBG_BLOCKLEN);
+  wipememory (ctr, sizeof ctr);
+
+  drbg_update (state, NULL);
+  state->reseed_counter++;
+}
+
+
+/* Make sure that the DRBG instance exists and is seeded.  A new seed
+   is also taken after a fork, after DRBG_RESEED_INTERVAL requests and
+   if PREDICTION_RESISTANCE is set.  Needs to be called with the lock
+   held.  */
+static void
+drbg_check_seed (int prediction_resistance)
+{
+  unsigned char seed[DRBG_SEEDLEN];
+  pid_t pid = getpid ();
+
+  gcry_assert (drbg_is_locked);
+
+  if (!drbg)
+    {
+      drbg = drbg_new ();
+      get_entropy (seed, GCRY_VERY_STRONG_RANDOM);
+      drbg_instantiate (drbg, seed);
+    }
+  else if (prediction_resistance)
+    {
+      get_entropy (seed, GCRY_VERY_STRONG_RANDOM);
+      drbg_reseed (drbg, seed);
+    }
+  else if (drbg->seed_pid != pid
+           || drbg->reseed_counter > DRBG_RESEED_INTERVAL)
+    {
+      get_entropy (seed, GCRY_STRONG_RANDOM);
+      drbg_reseed (drbg, seed);
+    }
+  else
+    return;
+
+  drbg->seed_pid = pid;
+  drbg_stats.reseeds++;
+  wipememory (seed, sizeof seed);
+}
+
+
+/* Fill BUFFER with LENGTH bytes from the DRBG.  */
+static void
+get_random (void *buffer, size_t length, int prediction_resistance)
+{
+  unsigned char *p = buffer;
+  size_t n;
+
+  lock_drbg ();
+  drbg_check_seed (prediction_resistance);
+  while (length)
+    {
+      n = length < DRBG_MAX_REQUEST ? length : DRBG_MAX_REQUEST;
+      if (drbg->reseed_counter > DRBG_RESEED_INTERVAL)
+        drbg_check_seed (0);
+      drbg_generate (drbg, p, n);
+      drbg_stats.requests++;
+      drbg_stats.nbytes += n;
+      p += n;
+      length -= n;
+    }
+  unlock_drbg ();
+}
+
+
+/* Run a known answer test.  Return 0 on success or an error
+   code.  */
+static gcry_err_code_t
+selftest_kat (void)
+{
+  /* The test vector has been computed using an independent
+     implementation of CTR_DRBG: instantiate with the entropy input
+     00..2f, generate 64 bytes twice and compare the second output;
+     reseed with 80..af and generate another 20 bytes.  */
+  static const unsigned char expected1[64] =
+    {
+      0x04, 0x56, 0x2a, 0xd3, 0x5e, 0x8e, 0xca, 0xfa,
+      0xaf, 0xda, 0x16, 0x98, 0x1c, 0xda, 0xa1, 0x47,
+      0x60, 0x6b, 0xee, 0xa6, 0x28, 0x01, 0x34, 0x2a,
+      0xf1, 0x3c, 0x8b, 0x55, 0x35, 0xf7, 0x2f, 0x94,
+      0x95, 0xb7, 0x43, 0x17, 0xc7, 0x62, 0xf0, 0xad,
+      0xab, 0x7a, 0xbe, 0x71, 0x07, 0x97, 0x61, 0x21,
+      0x76, 0xb6, 0x1b, 0x0e, 0x20, 0x83, 0x98, 0x11,
+      0x3c, 0xf9, 0xc1, 0x70, 0x15, 0x7b, 0xc7, 0x5f
+    };
+  static const unsigned char expected2[20] =
+    {
+      0x19, 0x29, 0xba, 0x17, 0x82, 0x17, 0x58, 0xc2,
+      0xe5, 0x1b, 0x89, 0xd8, 0x44, 0xa4, 0xad, 0xc9,
+      0x04, 0xbd, 0xe0, 0x8d
+    };
+  drbg_state_t state;
+  unsigned char seed[DRBG_SEEDLEN];
+  unsigned char result[64];
+  gcry_err_code_t ec = 0;
+  int i;
+
+  state = drbg_new ();
+
+  for (i = 0; i < DRBG_SEEDLEN; i++)
+    seed[i] = i;
+  drbg_instantiate (state, seed);
+  drbg_generate (state, result, 64);
+  drbg_generate (state, result, 64);
+  if (memcmp (result, expected1, 64))
+    ec = GPG_ERR_SELFTEST_FAILED;
+
+  for (i = 0; i < DRBG_SEEDLEN; i++)
+    seed[i] = 0x80 + i;
+  drbg_reseed (state, seed);
+  drbg_generate (state, result, 20);
+  if (memcmp (result, expected2, 20))
+    ec = GPG_ERR_SELFTEST_FAILED;
+
+  drbg_release (state);
+  return ec;
+}
+
+#endif /*USE_DRBG*/
+
+
+/* Initialize the DRBG.  The instance itself is created and seeded on
+   the first use.  Returns GPG_ERR_NOT_SUPPORTED if the DRBG is not
+   available in this build and GPG_ERR_SELFTEST_FAILED if the known
+   answer test failed.  */
+gcry_err_code_t
+_gcry_rngdrbg_initialize (void)
+{
+#ifdef USE_DRBG
+  static int tested;
+  static gcry_err_code_t tested_ec;
+
+  basic_initialization ();
+
+  lock_drbg ();
+  if (!tested)
+    {
+      tested_ec = selftest_kat ();
+      tested = 1;
+    }
+  unlock_drbg ();
+  return tested_ec;
+#else
+  return GPG_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+/* Print some statistics about the DRBG.  */
+void
+_gcry_rngdrbg_dump_stats (void)
+{
+#ifdef USE_DRBG
+  log_info ("rndstats: drbg reseeds=%lu requests=%lu bytes=%lu\n",
+            drbg_stats.reseeds, drbg_stats.requests, drbg_stats.nbytes);
+#endif
+}
+
+
+/* Mix BUFLEN bytes from BUF into the state of the DRBG.  This is
+   done using the update function with the bytes as provided data.  */
+gcry_error_t
+_gcry_rngdrbg_add_bytes (const void *buf, size_t buflen, int quality)
+{
+#ifdef USE_DRBG
+  unsigned char provided[DRBG_SEEDLEN];
+  const unsigned char *p = buf;
+  size_t n;
+
+  (void)quality;
+
+  lock_drbg ();
+  drbg_check_seed (0);
+  while (buflen)
+    {
+      n = buflen < DRBG_SEEDLEN ? buflen : DRBG_SEEDLEN;
+      memset (provided, 0, DRBG_SEEDLEN);
+      memcpy (provided, p, n);
+      drbg_update (drbg, provided);
+      p += n;
+      buflen -= n;
+    }
+  unlock_drbg ();
+  wipememory (provided, sizeof provided);
+#else
+  (void)buf;
+  (void)buflen;
+  (void)quality;
+#endif
+  return 0;
+}
+
+
+/* Public function to fill the buffer with LENGTH bytes of random of
+   quality LEVEL.  */
+void
+_gcry_rngdrbg_randomize (void *buffer, size_t length,
+                         enum gcry_random_level level)
+{
+#ifdef USE_DRBG
+  get_random (buffer, length, level == GCRY_VERY_STRONG_RANDOM);
+#else
+  (void)buffer;
+  (void)length;
+  (void)level;
+  BUG ();
+#endif
+}
+
+
+/* Create an unpredicable nonce of LENGTH bytes in BUFFER.  */
+void
+_gcry_rngdrbg_create_nonce (void *buffer, size_t length)
+{
+#ifdef USE_DRBG
+  get_random (buffer, length, 0);
+#else
+  (void)buffer;
+  (void)length;
+  BUG ();
+#endif
+}
+
+
+/* Run the self-tests of the DRBG.  */
+gcry_error_t
+_gcry_rngdrbg_selftest (selftest_report_func_t report)
+{
+#ifdef USE_DRBG
+  gcry_err_code_t ec;
+
+  basic_initialization ();
+  lock_drbg ();
+  ec = selftest_kat ();
+  unlock_drbg ();
+  if (ec && report)
+    report ("random", 0, "KAT", "CTR_DRBG output mismatch");
+  return gpg_error (ec);
+#else
+  (void)report;
+  return 0;
+#endif
+}
@@ -39,6 +39,10 @@
 static void (*progress_cb) (void *,const char*,int,int, int );
 static void *progress_cb_data;
 
+/* True if the CTR_DRBG has been selected with GCRYCTL_USE_RANDOM_DRBG.
+   This is ignored in fips mode.  */
+static int use_drbg;
+
 
 
 
@@ -88,7 +92,11 @@ _gcry_random_dump_stats (void)
   if (fips_mode ())
     _gcry_rngfips_dump_stats ();
   else
-    _gcry_rngcsprng_dump_stats ();
+    {
+      _gcry_rngcsprng_dump_stats ();
+      if (use_drbg)
+        _gcry_rngdrbg_dump_stats ();
+    }
 }
 
 
@@ -139,6 +147,22 @@ _gcry_use_random_daemon (int onoff)
 }
 
 
+/* With ONOFF set to 1, use the CTR_DRBG for all random requests;
+   with ONOFF set to 0 switch back to the standard generator.  The
+   known answer test of the DRBG is run before it is enabled.  */
+gcry_err_code_t
+_gcry_use_random_drbg (int onoff)
+{
+  gcry_err_code_t ec = 0;
+
+  if (onoff)
+    ec = _gcry_rngdrbg_initialize ();
+  if (!ec)
+    use_drbg = onoff;
+  return ec;
+}
+
+
 /* This function returns true if no real RNG is available or the
    quality of the RNG has been degraded for test purposes.  */
 int
@@ -159,6 +183,8 @@ gcry_random_add_bytes (const void *buf, size_t buflen, int quality)
 {
   if (fips_mode ())
     return 0; /* No need for this in fips mode.  */
+  else if (use_drbg)
+    return _gcry_rngdrbg_add_bytes (buf, buflen, quality);
   else
     return _gcry_rngcsprng_add_bytes (buf, buflen, quality);
 }
@@ -170,6 +196,8 @@ do_randomize (void *buffer, size_t length, enum gcry_random_level level)
 {
   if (fips_mode ())
     _gcry_rngfips_randomize (buffer, length, level);
+  else if (use_drbg)
+    _gcry_rngdrbg_randomize (buffer, length, level);
   else
     _gcry_rngcsprng_randomize (buffer, length, level);
 }
@@ -267,18 +295,22 @@ gcry_create_nonce (void *buffer, size_t length)
 {
   if (fips_mode ())
     _gcry_rngfips_create_nonce (buffer, length);
+  else if (use_drbg)
+    _gcry_rngdrbg_create_nonce (buffer, length);
   else
     _gcry_rngcsprng_create_nonce (buffer, length);
 }
 
 
 /* Run the self-tests for the RNG.  This is currently only implemented
-   for the FIPS generator.  */
+   for the FIPS generator and the CTR_DRBG.  */
 gpg_error_t
 _gcry_random_selftest (selftest_report_func_t report)
 {
   if (fips_mode ())
     return _gcry_rngfips_selftest (report);
+  else if (use_drbg)
+    return _gcry_rngdrbg_selftest (report);
   else
     return 0; /* No selftests yet.  */
 }
@@ -33,6 +33,7 @@ void _gcry_enable_quick_random_gen (void);
 int  _gcry_random_is_faked(void);
 void _gcry_set_random_daemon_socket (const char *socketname);
 int  _gcry_use_random_daemon (int onoff);
+gcry_err_code_t _gcry_use_random_drbg (int onoff);
 void _gcry_set_random_seed_file (const char *name);
 void _gcry_update_random_seed_file (void);
 
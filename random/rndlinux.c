@@ -32,10 +32,28 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if defined(__linux__) && defined(HAVE_SYSCALL)
+# include <sys/syscall.h>
+# ifdef __NR_getrandom
+#  define USE_GETRANDOM 1
+# endif
+#endif
 #include "types.h"
 #include "g10lib.h"
 #include "rand-internal.h"
 
+#ifdef USE_GETRANDOM
+/* Not all libcs define the flags for getrandom.  */
+# ifndef GRND_NONBLOCK
+#  define GRND_NONBLOCK 0x0001
+# endif
+
+/* State of the getrandom system call: 0 = not yet probed, -1 = not
+   supported by the kernel, 1 = supported but the kernel may not yet
+   have seeded its pool, 2 = supported and seeded.  */
+static int getrandom_state;
+#endif /*USE_GETRANDOM*/
+
 static int open_device ( const char *name );
 
 
@@ -84,6 +102,89 @@ open_device ( const char *name )
 }
 
 
+#ifdef USE_GETRANDOM
+static long
+do_getrandom (void *buffer, size_t length, unsigned int flags)
+{
+  return syscall (__NR_getrandom, buffer, length, flags);
+}
+#endif /*USE_GETRANDOM*/
+
+
+/* Return true if the getrandom system call is available.  In this
+   case the random devices are not required.  */
+int
+_gcry_rndlinux_have_getrandom (void)
+{
+#ifdef USE_GETRANDOM
+  if (!getrandom_state)
+    {
+      /* A zero length request tells us whether the system call
+         exists without consuming entropy.  */
+      if (do_getrandom (NULL, 0, GRND_NONBLOCK) == -1 && errno == ENOSYS)
+        getrandom_state = -1;
+      else
+        getrandom_state = 1;
+    }
+  return getrandom_state > 0;
+#else
+  return 0;
+#endif
+}
+
+
+#ifdef USE_GETRANDOM
+/* Read LENGTH bytes using the getrandom system call.  This does not
+   use a file descriptor and does not depend on the device nodes.  The
+   call blocks only until the kernel has seeded its pool once; after
+   that it never blocks, regardless of the requested level.  */
+static void
+read_getrandom (void (*add)(const void*, size_t, enum random_origins),
+                enum random_origins origin, size_t length)
+{
+  byte buffer[256];
+  size_t want = length;
+  size_t nbytes;
+  long n;
+  int any_need_entropy = 0;
+
+  while (length)
+    {
+      nbytes = length < sizeof buffer? length : sizeof buffer;
+      /* As long as we don't know that the kernel pool has been
+         seeded, we first try a non-blocking read so that we can call
+         the progress function before waiting.  */
+      n = do_getrandom (buffer, nbytes,
+                        getrandom_state == 1? GRND_NONBLOCK : 0);
+      if (n == -1 && errno == EAGAIN)
+        {
+          _gcry_random_progress ("need_entropy", 'X',
+                                 (int)(want - length), (int)want);
+          any_need_entropy = 1;
+          getrandom_state = 2;
+          continue;
+        }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+        log_fatal ("getrandom failed: %s\n", strerror (errno));
+      if ((size_t)n > nbytes)
+        {
+          log_error ("bogus return from getrandom (n=%ld)\n", n);
+          n = nbytes;
+        }
+      getrandom_state = 2;
+      (*add)(buffer, n, origin);
+      length -= n;
+    }
+  wipememory (buffer, sizeof buffer);
+
+  if (any_need_entropy)
+    _gcry_random_progress ("need_entropy", 'X', (int)want, (int)want);
+}
+#endif /*USE_GETRANDOM*/
+
+
 int
 _gcry_rndlinux_gather_random (void (*add)(const void*, size_t,
                                           enum random_origins),
@@ -109,6 +210,14 @@ _gcry_rndlinux_gather_random (void (*add)(const void*, size_t,
   if (length > 1)
     length -= n_hw;
 
+#ifdef USE_GETRANDOM
+  if (_gcry_rndlinux_have_getrandom ())
+    {
+      read_getrandom (add, origin, length);
+      return 0; /* success */
+    }
+#endif /*USE_GETRANDOM*/
+
   /* Open the requested device.  */
   if (level >= 2)
     {
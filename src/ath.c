@@ -79,6 +79,15 @@ ath_init (void)
 }
 
 
+/* Return the thread model of the installed callbacks or
+   ATH_THREAD_OPTION_DEFAULT if there are none.  */
+int
+ath_get_thread_option (void)
+{
+  return ops_set? GET_OPTION (ops.option) : ATH_THREAD_OPTION_DEFAULT;
+}
+
+
 /* Initialize the locking library.  Returns 0 if the operation was
    successful, EINVAL if the operation table was invalid and EBUSY if
    we already were initialized.  */
@@ -51,6 +51,7 @@
 #define _ATH_PREFIX(x) _ATH_PREFIX2(_ATH_EXT_SYM_PREFIX,x)
 #define ath_install _ATH_PREFIX(ath_install)
 #define ath_init _ATH_PREFIX(ath_init)
+#define ath_get_thread_option _ATH_PREFIX(ath_get_thread_option)
 #define ath_mutex_init _ATH_PREFIX(ath_mutex_init)
 #define ath_mutex_destroy _ATH_PREFIX(ath_mutex_destroy)
 #define ath_mutex_lock _ATH_PREFIX(ath_mutex_lock)
@@ -111,6 +112,7 @@ struct ath_ops
 
 gpg_err_code_t ath_install (struct ath_ops *ath_ops, int check_only);
 int ath_init (void);
+int ath_get_thread_option (void);
 
 
 /* Functions for mutual exclusion.  */
@@ -64,6 +64,16 @@ typedef const char *(*pk_get_curve_t)(gcry_mpi_t *pkey, int iterator,
 /* The type used to query ECC curve parameters by name.  */
 typedef gcry_sexp_t (*pk_get_curve_param_t)(const char *name);
 
+/* The type used to hash several messages at once.  */
+typedef void (*md_hash_batch_t) (const gcry_md_batch_item_t *items,
+                                 size_t nitems);
+
+/* The type used to run the PBKDF2 iterations from the saved HMAC
+   states.  */
+typedef void (*md_pbkdf2_iterate_t) (const void *inner, const void *outer,
+                                     unsigned char *u, unsigned char *t,
+                                     size_t n, unsigned long count);
+
 /* The type used to convey additional information to a cipher.  */
 typedef gpg_err_code_t (*cipher_set_extra_info_t)
      (void *c, int what, const void *buffer, size_t buflen);
@@ -81,6 +91,8 @@ typedef struct cipher_extra_spec
 typedef struct md_extra_spec
 {
   selftest_func_t selftest;
+  md_hash_batch_t hash_batch;
+  md_pbkdf2_iterate_t pbkdf2_iterate;
 } md_extra_spec_t;
 
 typedef struct pk_extra_spec
@@ -70,6 +70,28 @@ struct pk_encoding_ctx
 
 #include "cipher-proto.h"
 
+/*-- cipher.c --*/
+void _gcry_cipher_set_pool (unsigned int max_handles);
+
+/*-- md.c --*/
+gpg_err_code_t _gcry_md_pbkdf2_iterate (gcry_md_hd_t hd,
+                                        unsigned char *u, unsigned char *t,
+                                        size_t n, unsigned long count);
+
+
+/*-- ghash.c --*/
+/* The context for the GHASH function used by the GCM mode.  */
+typedef struct
+{
+  u64 m_hi[16];                 /* Table of multiples of H (4 bit).  */
+  u64 m_lo[16];
+  unsigned char h_pow[4][16];   /* H^1..H^4 byte reflected (PCLMUL).  */
+  int use_pclmul;               /* The PCLMUL instruction shall be used.  */
+} ghash_context_t;
+
+void _gcry_ghash_setkey (ghash_context_t *ctx, const unsigned char *h);
+void _gcry_ghash (ghash_context_t *ctx, unsigned char *hash,
+                  const unsigned char *buf, size_t nblocks);
 
 /*-- rmd160.c --*/
 void _gcry_rmd160_hash_buffer (void *outbuf,
@@ -94,6 +116,13 @@ void _gcry_aes_cbc_dec (void *context, unsigned char *iv,
 void _gcry_aes_ctr_enc (void *context, unsigned char *ctr,
                         void *outbuf_arg, const void *inbuf_arg,
                         unsigned int nblocks);
+void _gcry_aes_gcm_crypt (void *context, unsigned char *ctr,
+                          ghash_context_t *ghash, unsigned char *hash,
+                          void *outbuf_arg, const void *inbuf_arg,
+                          unsigned int nblocks, int encrypt);
+void _gcry_aes_xts_crypt (void *context, unsigned char *tweak,
+                          void *outbuf_arg, const void *inbuf_arg,
+                          unsigned int nblocks, int encrypt);
 
 
 /*-- dsa.c --*/
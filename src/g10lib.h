@@ -146,6 +146,12 @@ int _gcry_log_verbosity( int level );
 #define HWF_PADLOCK_MMUL 8
 
 #define HWF_INTEL_AESNI  256
+#define HWF_INTEL_PCLMUL 512
+#define HWF_INTEL_SSSE3  1024
+#define HWF_INTEL_AVX    2048
+#define HWF_INTEL_AVX2   4096
+#define HWF_INTEL_BMI2   8192
+#define HWF_INTEL_ADX    16384
 
 
 unsigned int _gcry_get_hw_features (void);
@@ -155,6 +161,10 @@ void _gcry_detect_hw_features (unsigned int);
 /*-- mpi/mpiutil.c --*/
 const char *_gcry_mpi_get_hw_config (void);
 
+/*-- mpi/mpih-mul.c --*/
+gcry_err_code_t _gcry_mpi_set_thresholds (int karatsuba_mul, int karatsuba_sqr,
+                                          int toom3_mul, int toom3_sqr);
+
 
 /*-- cipher/pubkey.c --*/
 
@@ -191,6 +201,9 @@ gpg_err_code_t _gcry_generate_fips186_3_prime
                   gcry_mpi_t *r_q, gcry_mpi_t *r_p,
                   int *r_counter,
                   void **r_seed, size_t *r_seedlen, int *r_hashalgo);
+gpg_err_code_t _gcry_primegen_set_threads (int nthreads);
+gpg_err_code_t _gcry_primegen_set_stock (int size);
+void _gcry_primegen_dump_stats (void);
 
 
 /* Replacements of missing functions (missing-string.c).  */
@@ -230,10 +243,34 @@ void _gcry_burn_stack (int bytes);
 #define wipememory2(_ptr,_set,_len) do { \
               volatile char *_vptr=(volatile char *)(_ptr); \
               size_t _vlen=(_len); \
-              while(_vlen) { *_vptr=(_set); _vptr++; _vlen--; } \
+              unsigned char _vset=(_set); \
+              fast_wipememory2(_vptr,_vset,_vlen); \
+              while(_vlen) { *_vptr=(_vset); _vptr++; _vlen--; } \
                   } while(0)
 #define wipememory(_ptr,_len) wipememory2(_ptr,0,_len)
 
+#ifdef __GNUC__
+typedef unsigned long __attribute__ ((__may_alias__)) fast_wipememory_t;
+#else
+typedef unsigned long fast_wipememory_t;
+#endif
+
+/* Wipe the bulk of the buffer using aligned word sized stores.  The
+   tail bytes are left to wipememory2.  */
+#define fast_wipememory2(_vptr,_vset,_vlen) do { \
+              fast_wipememory_t _vset_long = (_vset); \
+              while (((size_t)(_vptr) & (sizeof (fast_wipememory_t) - 1)) \
+                     && _vlen) \
+                { *_vptr=(_vset); _vptr++; _vlen--; } \
+              _vset_long *= ~(fast_wipememory_t)0 / 0xff; \
+              while (_vlen >= sizeof (fast_wipememory_t)) \
+                { \
+                  *(volatile fast_wipememory_t *)(_vptr) = _vset_long; \
+                  _vptr += sizeof (fast_wipememory_t); \
+                  _vlen -= sizeof (fast_wipememory_t); \
+                } \
+                  } while(0)
+
 
 
 /* Digit predicates.  */
@@ -253,6 +290,30 @@ gcry_error_t _gcry_sexp_vbuild (gcry_sexp_t *retsexp, size_t *erroff,
 char *_gcry_sexp_nth_string (const gcry_sexp_t list, int number);
 
 
+/*-- module.c --*/
+
+/* Modules registered by Libgcrypt itself; they are never released.  */
+#define FLAG_MODULE_STATIC (1 << 1)
+
+typedef struct gcry_module_index *gcry_module_index_t;
+
+/* Return the name or OID number IDX of the module specification SPEC
+   or NULL if there are no more.  */
+typedef const char *(*gcry_module_name_t) (void *spec, int idx);
+
+gcry_module_index_t _gcry_module_index_new (gcry_module_t entries,
+                                            gcry_module_name_t name_func,
+                                            gcry_module_name_t oid_func);
+void _gcry_module_index_publish (gcry_module_index_t volatile *r_index,
+                                 gcry_module_index_t index);
+gcry_module_t _gcry_module_index_lookup_id (gcry_module_index_t index,
+                                            unsigned int mod_id);
+gcry_module_t _gcry_module_index_lookup_name (gcry_module_index_t index,
+                                              const char *name);
+gcry_module_t _gcry_module_index_lookup_oid (gcry_module_index_t index,
+                                             const char *oid);
+
+
 /*-- fips.c --*/
 
 void _gcry_initialize_fips_mode (int force);
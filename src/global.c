@@ -65,6 +65,12 @@ static struct
     { HWF_PADLOCK_SHA, "padlock-sha" },
     { HWF_PADLOCK_MMUL,"padlock-mmul"},
     { HWF_INTEL_AESNI, "intel-aesni" },
+    { HWF_INTEL_PCLMUL,"intel-pclmul"},
+    { HWF_INTEL_SSSE3, "intel-ssse3" },
+    { HWF_INTEL_AVX,   "intel-avx" },
+    { HWF_INTEL_AVX2,  "intel-avx2" },
+    { HWF_INTEL_BMI2,  "intel-bmi2" },
+    { HWF_INTEL_ADX,   "intel-adx" },
     { 0, NULL}
   };
 
@@ -114,6 +120,9 @@ global_init (void)
      hardware features.  */
   _gcry_detect_hw_features (disabled_hw_features);
 
+  /* Some of the MPI thresholds depend on these features.  */
+  _gcry_mpi_set_thresholds (0, 0, 0, 0);
+
   err = _gcry_cipher_init ();
   if (err)
     goto fail;
@@ -348,6 +357,7 @@ _gcry_vcontrol (enum gcry_ctl_cmds cmd, va_list arg_ptr)
 
     case GCRYCTL_DUMP_SECMEM_STATS:
       _gcry_secmem_dump_stats ();
+      _gcry_primegen_dump_stats ();
       break;
 
     case GCRYCTL_DROP_PRIVS:
@@ -367,8 +377,50 @@ _gcry_vcontrol (enum gcry_ctl_cmds cmd, va_list arg_ptr)
         err = GPG_ERR_GENERAL;
       break;
 
+    case GCRYCTL_SET_SECMEM_ARENAS:
+      {
+        unsigned int n = va_arg (arg_ptr, unsigned int);
+        unsigned int size = va_arg (arg_ptr, unsigned int);
+
+        global_init ();
+        err = _gcry_secmem_set_arenas (n, size);
+      }
+      break;
+
+    case GCRYCTL_SET_SECMEM_LIMIT:
+      global_init ();
+      _gcry_secmem_set_limit (va_arg (arg_ptr, unsigned int));
+      break;
+
+    case GCRYCTL_SET_CIPHER_POOL:
+      global_init ();
+      _gcry_cipher_set_pool (va_arg (arg_ptr, unsigned int));
+      break;
+
+    case GCRYCTL_SET_MPI_THRESHOLDS:
+      {
+        int karatsuba_mul = va_arg (arg_ptr, int);
+        int karatsuba_sqr = va_arg (arg_ptr, int);
+        int toom3_mul = va_arg (arg_ptr, int);
+        int toom3_sqr = va_arg (arg_ptr, int);
+
+        global_init ();
+        err = _gcry_mpi_set_thresholds (karatsuba_mul, karatsuba_sqr,
+                                        toom3_mul, toom3_sqr);
+      }
+      break;
+
+    case GCRYCTL_SET_KEYGEN_THREADS:
+      err = _gcry_primegen_set_threads (va_arg (arg_ptr, int));
+      break;
+
+    case GCRYCTL_SET_KEYGEN_STOCK:
+      err = _gcry_primegen_set_stock (va_arg (arg_ptr, int));
+      break;
+
     case GCRYCTL_TERM_SECMEM:
       global_init ();
+      _gcry_primegen_set_stock (0);
       _gcry_secmem_term ();
       break;
 
@@ -480,6 +532,13 @@ _gcry_vcontrol (enum gcry_ctl_cmds cmd, va_list arg_ptr)
       _gcry_use_random_daemon (!! va_arg (arg_ptr, int));
       break;
 
+    case GCRYCTL_USE_RANDOM_DRBG:
+      /* Switch between the CTR_DRBG and the standard generator.  This
+         has no effect in fips mode.  */
+      global_init ();
+      err = _gcry_use_random_drbg (!! va_arg (arg_ptr, int));
+      break;
+
       /* This command dumps information pertaining to the
          configuration of libgcrypt to the given stream.  It may be
          used before the initialization has been finished but not
@@ -153,7 +153,17 @@ detect_ia32_gnuc (void)
          "jz .Lno_aes%=\n\t"            /* No AES support.  */
          "orl $256, %0\n"               /* Set our HWF_INTEL_AES bit.  */
 
-         ".Lno_aes%=:\n"
+         ".Lno_aes%=:\n\t"
+         "testl $0x00000002, %%ecx\n\t" /* Test bit 1.  */
+         "jz .Lno_pclmul%=\n\t"         /* No PCLMUL support.  */
+         "orl $512, %0\n"               /* Set our HWF_INTEL_PCLMUL bit.  */
+
+         ".Lno_pclmul%=:\n\t"
+         "testl $0x00000200, %%ecx\n\t" /* Test bit 9.  */
+         "jz .Lno_ssse3%=\n\t"          /* No SSSE3 support.  */
+         "orl $1024, %0\n"              /* Set our HWF_INTEL_SSSE3 bit.  */
+
+         ".Lno_ssse3%=:\n"
          : "+r" (hw_features)
          :
          : "%eax", "%ecx", "%edx", "cc"
@@ -168,6 +178,126 @@ detect_ia32_gnuc (void)
 #endif /* __i386__ && SIZEOF_UNSIGNED_LONG == 4 && __GNUC__ */
 
 
+#if defined (__x86_64__) && defined (__GNUC__)
+static void
+detect_x86_64_gnuc (void)
+{
+  /* On x86-64 the CPUID instruction is always available.  */
+  unsigned int features = 0;
+  unsigned int max_level;
+  char vendor_id[12+1];
+
+  asm volatile
+    ("xorl  %%eax, %%eax\n\t"    /* 0 -> EAX.  */
+     "cpuid\n\t"                 /* Get vendor ID.  */
+     "movl  %%ebx, (%1)\n\t"     /* EBX,EDX,ECX -> VENDOR_ID.  */
+     "movl  %%edx, 4(%1)\n\t"
+     "movl  %%ecx, 8(%1)\n"
+     : "=a" (max_level)
+     : "S" (&vendor_id[0])
+     : "%ebx", "%ecx", "%edx", "cc", "memory"
+     );
+  vendor_id[12] = 0;
+
+  if (max_level < 1)
+    return;
+
+  /* Intel and AMD processors use the same bits to announce AES-NI,
+     PCLMUL, SSSE3, AVX, AVX2, BMI2 and ADX, thus we do not need to
+     distinguish them here.  */
+  if (!strcmp (vendor_id, "GenuineIntel")
+      || !strcmp (vendor_id, "AuthenticAMD"))
+    {
+      asm volatile
+        ("movl $1, %%eax\n\t"           /* Get CPU info and feature flags.  */
+         "cpuid\n\t"
+         "testl $0x02000000, %%ecx\n\t" /* Test bit 25.  */
+         "jz .Lno_aes%=\n\t"            /* No AES support.  */
+         "orl $256, %0\n"               /* Set our HWF_INTEL_AES bit.  */
+
+         ".Lno_aes%=:\n\t"
+         "testl $0x00000002, %%ecx\n\t" /* Test bit 1.  */
+         "jz .Lno_pclmul%=\n\t"         /* No PCLMUL support.  */
+         "orl $512, %0\n"               /* Set our HWF_INTEL_PCLMUL bit.  */
+
+         ".Lno_pclmul%=:\n\t"
+         "testl $0x00000200, %%ecx\n\t" /* Test bit 9.  */
+         "jz .Lno_ssse3%=\n\t"          /* No SSSE3 support.  */
+         "orl $1024, %0\n"              /* Set our HWF_INTEL_SSSE3 bit.  */
+
+         ".Lno_ssse3%=:\n"
+         : "+r" (features)
+         :
+         : "%eax", "%ebx", "%ecx", "%edx", "cc"
+         );
+
+#ifdef ENABLE_AVX_SUPPORT
+      /* AVX may only be used if the OS saves the YMM registers, which
+         is announced by the OSXSAVE bit and XCR0.  */
+      asm volatile
+        ("movl $1, %%eax\n\t"           /* Get CPU info and feature flags.  */
+         "cpuid\n\t"
+         "andl $0x18000000, %%ecx\n\t"  /* Test bits 27 and 28 for  */
+         "cmpl $0x18000000, %%ecx\n\t"  /* OSXSAVE and AVX support.  */
+         "jne .Lno_avx%=\n\t"
+         "xorl %%ecx, %%ecx\n\t"        /* Read XCR0 into EDX:EAX.  */
+         ".byte 0x0f, 0x01, 0xd0\n\t"   /* xgetbv */
+         "andl $0x06, %%eax\n\t"        /* Test that the XMM and YMM  */
+         "cmpl $0x06, %%eax\n\t"        /* states are enabled.  */
+         "jne .Lno_avx%=\n\t"
+         "orl $2048, %0\n"               /* Set our HWF_INTEL_AVX bit.  */
+
+         ".Lno_avx%=:\n"
+         : "+r" (features)
+         :
+         : "%eax", "%ebx", "%ecx", "%edx", "cc"
+         );
+
+#ifdef ENABLE_AVX2_SUPPORT
+      if ((features & HWF_INTEL_AVX) && max_level >= 7)
+        asm volatile
+          ("movl $7, %%eax\n\t"         /* Get the structured extended  */
+           "xorl %%ecx, %%ecx\n\t"      /* feature flags.  */
+           "cpuid\n\t"
+           "testl $0x00000020, %%ebx\n\t" /* Test bit 5.  */
+           "jz .Lno_avx2%=\n\t"         /* No AVX2 support.  */
+           "orl $4096, %0\n"             /* Set our HWF_INTEL_AVX2 bit.  */
+
+           ".Lno_avx2%=:\n"
+           : "+r" (features)
+           :
+           : "%eax", "%ebx", "%ecx", "%edx", "cc"
+           );
+#endif /*ENABLE_AVX2_SUPPORT*/
+#endif /*ENABLE_AVX_SUPPORT*/
+
+      /* The MULX and ADX instructions do not depend on the OS.  */
+      if (max_level >= 7)
+        asm volatile
+          ("movl $7, %%eax\n\t"         /* Get the structured extended  */
+           "xorl %%ecx, %%ecx\n\t"      /* feature flags.  */
+           "cpuid\n\t"
+           "testl $0x00000100, %%ebx\n\t" /* Test bit 8.  */
+           "jz .Lno_bmi2%=\n\t"         /* No BMI2 support.  */
+           "orl $8192, %0\n"             /* Set our HWF_INTEL_BMI2 bit.  */
+
+           ".Lno_bmi2%=:\n\t"
+           "testl $0x00080000, %%ebx\n\t" /* Test bit 19.  */
+           "jz .Lno_adx%=\n\t"          /* No ADX support.  */
+           "orl $16384, %0\n"            /* Set our HWF_INTEL_ADX bit.  */
+
+           ".Lno_adx%=:\n"
+           : "+r" (features)
+           :
+           : "%eax", "%ebx", "%ecx", "%edx", "cc"
+           );
+    }
+
+  hw_features |= features;
+}
+#endif /* __x86_64__ && __GNUC__ */
+
+
 /* Detect the available hardware features.  This function is called
    once right at startup and we assume that no other threads are
    running.  */
@@ -186,6 +316,10 @@ _gcry_detect_hw_features (unsigned int disabled_features)
 #elif defined (__i386__) && SIZEOF_UNSIGNED_LONG == 8
 #ifdef __GNUC__
 #endif
+#elif defined (__x86_64__)
+#ifdef __GNUC__
+  detect_x86_64_gnuc ();
+#endif
 #endif
 
   hw_features &= ~disabled_features;
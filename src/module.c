@@ -19,6 +19,7 @@
 
 #include <config.h>
 #include <errno.h>
+#include <string.h>
 #include "g10lib.h"
 
 /* Please match these numbers with the allocated algorithm
@@ -135,7 +136,8 @@ _gcry_module_lookup_id (gcry_module_t entries, unsigned int mod_id)
   for (entry = entries; entry; entry = entry->next)
     if (entry->mod_id == mod_id)
       {
-	entry->counter++;
+        if (! (entry->flags & FLAG_MODULE_STATIC))
+          entry->counter++;
 	break;
       }
 
@@ -155,7 +157,8 @@ _gcry_module_lookup (gcry_module_t entries, void *data,
   for (entry = entries; entry; entry = entry->next)
     if ((*func) (entry->spec, data))
       {
-	entry->counter++;
+        if (! (entry->flags & FLAG_MODULE_STATIC))
+          entry->counter++;
 	break;
       }
 
@@ -164,11 +167,12 @@ _gcry_module_lookup (gcry_module_t entries, void *data,
 
 /* Release a module.  In case the use-counter reaches zero, destroy
    the module.  Passing MODULE as NULL is a dummy operation (similar
-   to free()). */
+   to free()).  Static modules are never destroyed. */
 void
 _gcry_module_release (gcry_module_t module)
 {
-  if (module && ! --module->counter)
+  if (module && ! (module->flags & FLAG_MODULE_STATIC)
+      && ! --module->counter)
     _gcry_module_drop (module);
 }
 
@@ -176,7 +180,8 @@ _gcry_module_release (gcry_module_t module)
 void
 _gcry_module_use (gcry_module_t module)
 {
-  ++module->counter;
+  if (! (module->flags & FLAG_MODULE_STATIC))
+    ++module->counter;
 }
 
 /* If LIST is zero, write the number of modules identified by MODULES
@@ -210,3 +215,198 @@ _gcry_module_list (gcry_module_t modules,
 
   return err;
 }
+
+
+
+/* A lookup index for the modules which are registered by Libgcrypt
+   itself.  An index is built once after the default modules have been
+   registered and never changes afterwards; it may thus be used
+   without holding the lock of the module list.  All modules in an
+   index are marked with FLAG_MODULE_STATIC so that they are never
+   released and do not need a use counter.  */
+
+/* An entry of the hash tables mapping names and OIDs to modules.  */
+struct module_index_key
+{
+  const char *key;
+  gcry_module_t module;
+};
+
+struct gcry_module_index
+{
+  /* The modules directly indexed by their ID.  */
+  unsigned int n_ids;
+  gcry_module_t *by_id;
+
+  /* Hash tables with N_KEYS slots each; N_KEYS is a power of 2 and
+     unused slots have KEY set to NULL.  */
+  unsigned int n_keys;
+  struct module_index_key *by_name;
+  struct module_index_key *by_oid;
+};
+
+
+/* Case insensitive hash function for names and OIDs.  */
+static unsigned int
+module_index_hash (const char *key)
+{
+  unsigned int h = 2166136261U;
+  int c;
+
+  for (; *key; key++)
+    {
+      c = *(const unsigned char *)key;
+      if (c >= 'A' && c <= 'Z')
+        c += 'a' - 'A';
+      h = (h ^ c) * 16777619U;
+    }
+  return h;
+}
+
+
+/* Insert KEY for MODULE into the hash TABLE of SIZE slots.  Keys which
+   are already in the table are not replaced so that the first module
+   of a list wins, as with _gcry_module_lookup.  */
+static void
+module_index_insert (struct module_index_key *table, unsigned int size,
+                     const char *key, gcry_module_t module)
+{
+  unsigned int i;
+
+  for (i = module_index_hash (key) & (size - 1); table[i].key;
+       i = (i + 1) & (size - 1))
+    if (! stricmp (table[i].key, key))
+      return;
+  table[i].key = key;
+  table[i].module = module;
+}
+
+
+static gcry_module_t
+module_index_find (const struct module_index_key *table, unsigned int size,
+                   const char *key)
+{
+  unsigned int i;
+
+  for (i = module_index_hash (key) & (size - 1); table[i].key;
+       i = (i + 1) & (size - 1))
+    if (! stricmp (table[i].key, key))
+      return table[i].module;
+  return NULL;
+}
+
+
+/* Count the names returned by FUNC for SPEC.  */
+static unsigned int
+module_index_count (void *spec, gcry_module_name_t func)
+{
+  unsigned int n = 0;
+
+  if (func)
+    while ((*func) (spec, n))
+      n++;
+  return n;
+}
+
+
+/* Create a lookup index for all modules in the list ENTRIES and mark
+   them as static.  NAME_FUNC and OID_FUNC are used to enumerate the
+   names and OIDs of a module; they may be NULL.  Returns NULL if
+   there is not enough core; the callers then continue to use the
+   list.  Needs to be called with the lock of the list held.  */
+gcry_module_index_t
+_gcry_module_index_new (gcry_module_t entries,
+                        gcry_module_name_t name_func,
+                        gcry_module_name_t oid_func)
+{
+  gcry_module_index_t index;
+  gcry_module_t entry;
+  unsigned int max_id = 0;
+  unsigned int nkeys = 0;
+  unsigned int n, i;
+  const char *key;
+
+  for (entry = entries; entry; entry = entry->next)
+    {
+      if (entry->mod_id > max_id)
+        max_id = entry->mod_id;
+      n = module_index_count (entry->spec, name_func);
+      i = module_index_count (entry->spec, oid_func);
+      nkeys += n > i? n : i;
+    }
+  /* Keep the tables at most half filled.  */
+  for (n = 16; n < 2 * nkeys; n <<= 1)
+    ;
+
+  index = gcry_calloc (1, sizeof *index);
+  if (! index)
+    return NULL;
+  index->n_ids = max_id + 1;
+  index->n_keys = n;
+  index->by_id = gcry_calloc (index->n_ids, sizeof *index->by_id);
+  index->by_name = gcry_calloc (n, sizeof *index->by_name);
+  index->by_oid = gcry_calloc (n, sizeof *index->by_oid);
+  if (! index->by_id || ! index->by_name || ! index->by_oid)
+    {
+      gcry_free (index->by_id);
+      gcry_free (index->by_name);
+      gcry_free (index->by_oid);
+      gcry_free (index);
+      return NULL;
+    }
+
+  for (entry = entries; entry; entry = entry->next)
+    {
+      entry->flags |= FLAG_MODULE_STATIC;
+      if (! index->by_id[entry->mod_id])
+        index->by_id[entry->mod_id] = entry;
+      for (i = 0; name_func && (key = (*name_func) (entry->spec, i)); i++)
+        module_index_insert (index->by_name, n, key, entry);
+      for (i = 0; oid_func && (key = (*oid_func) (entry->spec, i)); i++)
+        module_index_insert (index->by_oid, n, key, entry);
+    }
+
+  return index;
+}
+
+
+/* Make INDEX available to readers through the pointer at R_INDEX.
+   The index is only published if the stores can be ordered; without
+   a memory barrier R_INDEX stays NULL and the callers keep on using
+   the locked list.  */
+void
+_gcry_module_index_publish (gcry_module_index_t volatile *r_index,
+                            gcry_module_index_t index)
+{
+#ifdef HAVE_SYNC_BUILTINS
+  __sync_synchronize ();
+  *r_index = index;
+#else
+  (void)r_index;
+  (void)index;
+#endif
+}
+
+
+/* Lookup a module by its ID in INDEX.  */
+gcry_module_t
+_gcry_module_index_lookup_id (gcry_module_index_t index, unsigned int mod_id)
+{
+  return mod_id < index->n_ids? index->by_id[mod_id] : NULL;
+}
+
+
+/* Lookup a module by one of its names in INDEX.  */
+gcry_module_t
+_gcry_module_index_lookup_name (gcry_module_index_t index, const char *name)
+{
+  return module_index_find (index->by_name, index->n_keys, name);
+}
+
+
+/* Lookup a module by one of its OIDs in INDEX.  */
+gcry_module_t
+_gcry_module_index_lookup_oid (gcry_module_index_t index, const char *oid)
+{
+  return module_index_find (index->by_oid, index->n_keys, oid);
+}
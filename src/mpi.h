@@ -198,6 +198,11 @@ void _gcry_mpi_mul_barrett (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v,
 
 /*-- mpi-gcd.c --*/
 
+/*-- mpi-pow.c --*/
+#define mpi_powm_sec(w,b,e,m) _gcry_mpi_powm_sec ((w),(b),(e),(m))
+void _gcry_mpi_powm_sec (gcry_mpi_t res, gcry_mpi_t base, gcry_mpi_t expo,
+                         gcry_mpi_t mod);
+
 /*-- mpi-mpow.c --*/
 #define mpi_mulpowm(a,b,c,d) _gcry_mpi_mulpowm ((a),(b),(c),(d))
 void _gcry_mpi_mulpowm( gcry_mpi_t res, gcry_mpi_t *basearray, gcry_mpi_t *exparray, gcry_mpi_t mod);
@@ -260,6 +265,15 @@ void _gcry_mpi_ec_add_points (mpi_point_t *result,
 void _gcry_mpi_ec_mul_point (mpi_point_t *result,
                              gcry_mpi_t scalar, mpi_point_t *point,
                              mpi_ec_t ctx);
+void _gcry_mpi_ec_register_base (gcry_mpi_t p, gcry_mpi_t a,
+                                 gcry_mpi_t gx, gcry_mpi_t gy);
+void _gcry_mpi_ec_mul_base (mpi_point_t *result,
+                            gcry_mpi_t scalar, mpi_point_t *base,
+                            mpi_ec_t ctx);
+void _gcry_mpi_ec_mul_add (mpi_point_t *result,
+                           gcry_mpi_t u1, mpi_point_t *base,
+                           gcry_mpi_t u2, mpi_point_t *point,
+                           mpi_ec_t ctx);
 
 
 
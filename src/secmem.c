@@ -36,6 +36,10 @@
 #endif
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "ath.h"
 #include "g10lib.h"
 #include "secmem.h"
@@ -48,6 +52,16 @@
 #define STANDARD_POOL_SIZE 32768
 #define DEFAULT_PAGE_SIZE 4096
 
+/* Maximum number of memory regions the pool may consist of.  */
+#define SECMEM_MAX_REGIONS 64
+
+/* Per-thread arenas require thread-local storage, atomic operations
+   and POSIX threads to notice the exit of a thread.  */
+#if (defined(HAVE_THREAD_LOCAL) && defined(HAVE_SYNC_BUILTINS) \
+     && defined(HAVE_PTHREAD))
+# define USE_SECMEM_ARENAS 1
+#endif
+
 typedef struct memblock
 {
   unsigned size;		/* Size of the memory available to the
@@ -58,20 +72,68 @@ typedef struct memblock
 
 /* This flag specifies that the memory block is in use.  */
 #define MB_FLAG_ACTIVE (1 << 0)
+/* This flag specifies that the preceding memory block is free.  */
+#define MB_FLAG_PREV_FREE (1 << 1)
+
+/* Free blocks of the pool are kept in segregated free lists.  Bins
+   1 to 31 hold the blocks of less than 1024 bytes in steps of 32
+   bytes; each larger power of two is split into 4 bins.  The links
+   of a free block are stored in its user area and its size is
+   repeated in the last bytes of the block (boundary tag) so that a
+   released block can be merged with the preceding one in constant
+   time.  */
+#define SMALL_BINS 32
+#define NBINS (SMALL_BINS + (32 - 10) * 4)
+
+/* Smallest size of a free block.  */
+#define MB_MIN_SIZE 32
+
+#define MB_FREE_NEXT(mb) (((memblock_t **) (void *) &(mb)->aligned.c)[0])
+#define MB_FREE_PREV(mb) (((memblock_t **) (void *) &(mb)->aligned.c)[1])
+#define MB_FOOTER(mb) \
+  (*(unsigned *) ((char *) (mb) + BLOCK_HEAD_SIZE + (mb)->size \
+                  - sizeof (unsigned)))
+
+/* The free lists and a bitmap of the non-empty lists.  */
+static memblock_t *bins[NBINS];
+static unsigned int binmap[(NBINS + 31) / 32];
+
+/* The pool of secure memory consists of one or more regions.  The
+   first region is allocated by init_pool; more regions are added on
+   demand as long as the total size stays below POOL_LIMIT.  The last
+   BLOCK_HEAD_SIZE bytes of each region hold an active block of size
+   0 so that blocks are never merged across regions.  */
+struct secmem_region
+{
+  char *base;
+  size_t size;
+  int is_mmapped;
+};
+
+/* An index of the regions sorted by address.  To allow lock-free
+   lookups an index is never changed once it has been made current;
+   each growth of the pool builds a new one.  The old indexes are not
+   released because a reader may still be using them; there are at
+   most SECMEM_MAX_REGIONS of them.  */
+struct region_index
+{
+  unsigned int n;
+  struct secmem_region r[1];
+};
+static struct region_index * volatile regions;
 
-/* The pool of secure memory.  */
-static void *pool;
-
-/* Size of POOL in bytes.  */
+/* Total size of all regions in bytes.  */
 static size_t pool_size;
 
+/* Size of the first region and maximum total size of the pool; 0 if
+   the pool shall not grow.  */
+static size_t pool_initial_size;
+static size_t pool_limit;
+
 /* True, if the memory pool is ready for use.  May be checked in an
    atexit function.  */
 static volatile int pool_okay;
 
-/* True, if the memory pool is mmapped.  */
-static volatile int pool_is_mmapped;
-
 /* FIXME?  */
 static int disable_secmem;
 static int show_warning;
@@ -98,6 +160,95 @@ static ath_mutex_t secmem_lock;
 #define ADDR_TO_BLOCK(addr) \
   (memblock_t *) ((char *) addr - BLOCK_HEAD_SIZE)
 
+
+#ifdef USE_SECMEM_ARENAS
+/* Per-thread arenas.  If enabled by GCRYCTL_SET_SECMEM_ARENAS, each
+   of the first threads allocating secure memory gets an arena of its
+   own.  Small blocks are then served from the size class free lists
+   of that arena without taking SECMEM_LOCK.  Blocks released by
+   another thread are pushed onto a lock-free list of the owning arena
+   and taken back by the owner on its next allocation.  When a thread
+   exits its arena is put on a free list; the next thread in need of
+   an arena adopts it together with its blocks and the pending remote
+   frees.  Large blocks, threads without an arena and exhausted arenas
+   use the global pool.  All arenas live in one locked memory region;
+   arena I starts at ARENA_REGION + I * ARENA_SIZE.  */
+
+/* Number of size classes; class I holds blocks of 32 << I bytes.  */
+#define ARENA_CLASSES 7
+#define ARENA_MAX_BLOCK (32 << (ARENA_CLASSES - 1))
+#define ARENA_MIN_SIZE  4096
+
+/* The link of a free block is stored in its user area.  */
+#define MB_NEXT(mb) (*(memblock_t **) (void *) &(mb)->aligned.c)
+
+struct secmem_arena
+{
+  char *top;                            /* Start of the unused part.  */
+  char *end;                            /* End of the arena.  */
+  memblock_t *free_list[ARENA_CLASSES];
+  memblock_t * volatile remote_free;    /* Blocks freed by others.  */
+  struct secmem_arena *next_free;       /* Link for FREE_ARENAS.  */
+  volatile unsigned int cur_alloced;    /* Stats.  */
+  volatile unsigned int cur_blocks;
+};
+
+/* The arenas and their number as requested by the user.  */
+static struct secmem_arena *arenas;
+static unsigned int arenas_count;
+static size_t arena_size;
+
+/* Number of arenas already assigned to a thread.  */
+static unsigned int arenas_used;
+
+/* The arenas of exited threads and their number.  */
+static struct secmem_arena *free_arenas;
+static unsigned int free_arenas_count;
+
+/* The key used to notice the exit of a thread owning an arena.  */
+static pthread_key_t arena_key;
+static int arena_key_created;
+
+/* The memory region holding all arenas, its size and whether it has
+   been mmapped.  */
+static char *arena_region;
+static size_t arena_region_size;
+static int arena_region_is_mmapped;
+
+/* Incremented whenever the arenas are reconfigured or released so
+   that threads notice that their cached arena is no longer valid.  */
+static volatile unsigned int arena_gen = 1;
+
+/* The arena of the current thread and the value of ARENA_GEN at the
+   time it has been assigned.  MY_ARENA may be NULL if no arena was
+   available.  */
+static __thread struct secmem_arena *my_arena;
+static __thread unsigned int my_arena_gen;
+
+/* Check whether P points into the arena region.  */
+static int
+ptr_into_arenas_p (const void *p)
+{
+  size_t p_addr = (size_t)p;
+  size_t region_addr = (size_t)arena_region;
+
+  return (arena_region
+          && p_addr >= region_addr
+          && p_addr < region_addr + arena_region_size);
+}
+
+/* Return the size class for blocks of SIZE bytes.  */
+static unsigned int
+arena_class (size_t size)
+{
+  unsigned int cls;
+
+  for (cls = 0; (32u << cls) < size; cls++)
+    ;
+  return cls;
+}
+#endif /*USE_SECMEM_ARENAS*/
+
 /* Check whether P points into the pool.  */
 static int
 ptr_into_pool_p (const void *p)
@@ -108,9 +259,28 @@ ptr_into_pool_p (const void *p)
      http://lists.gnupg.org/pipermail/gcrypt-devel/2007-February/001102.html
   */
   size_t p_addr = (size_t)p;
-  size_t pool_addr = (size_t)pool;
+  size_t base;
+  struct region_index *idx = regions;
+  unsigned int lo, hi, mid;
 
-  return p_addr >= pool_addr && p_addr <  pool_addr+pool_size;
+  if (!idx)
+    return 0;
+
+  /* Find the last region starting at or below P.  */
+  lo = 0;
+  hi = idx->n;
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if ((size_t)idx->r[mid].base <= p_addr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (!lo)
+    return 0;
+  base = (size_t)idx->r[lo - 1].base;
+  return p_addr < base + idx->r[lo - 1].size;
 }
 
 /* Update the stats.  */
@@ -129,102 +299,189 @@ stats_update (size_t add, size_t sub)
     }
 }
 
-/* Return the block following MB or NULL, if MB is the last block.  */
+/* Return the block following MB.  For the last block of a region
+   this is the terminating block of size 0.  */
 static memblock_t *
 mb_get_next (memblock_t *mb)
 {
-  memblock_t *mb_next;
+  return (memblock_t *) ((char *) mb + BLOCK_HEAD_SIZE + mb->size);
+}
 
-  mb_next = (memblock_t *) ((char *) mb + BLOCK_HEAD_SIZE + mb->size);
+/* Return the index of the bin holding free blocks of SIZE bytes.  */
+static unsigned int
+bin_index (size_t size)
+{
+  unsigned int log2;
 
-  if (! ptr_into_pool_p (mb_next))
-    mb_next = NULL;
+  if (size < 1024)
+    return size / 32;
 
-  return mb_next;
+  for (log2 = 10; size >> (log2 + 1); log2++)
+    ;
+  return SMALL_BINS + (log2 - 10) * 4 + ((size >> (log2 - 2)) & 3);
 }
 
-/* Return the block preceding MB or NULL, if MB is the first
-   block.  */
-static memblock_t *
-mb_get_prev (memblock_t *mb)
+/* Return the index of the first bin whose blocks are all at least
+   SIZE bytes, SIZE being a multiple of 32.  */
+static unsigned int
+bin_index_ceil (size_t size)
 {
-  memblock_t *mb_prev, *mb_next;
+  unsigned int idx, log2;
 
-  if (mb == pool)
-    mb_prev = NULL;
-  else
+  idx = bin_index (size);
+  if (size >= 1024)
     {
-      mb_prev = (memblock_t *) pool;
-      while (1)
-	{
-	  mb_next = mb_get_next (mb_prev);
-	  if (mb_next == mb)
-	    break;
-	  else
-	    mb_prev = mb_next;
-	}
+      for (log2 = 10; size >> (log2 + 1); log2++)
+        ;
+      if ((size & ((1 << (log2 - 2)) - 1)))
+        idx++;
     }
+  return idx;
+}
 
-  return mb_prev;
+/* Return the first non-empty bin with an index of at least IDX or
+   -1 if there is none.  */
+static int
+find_bin (unsigned int idx)
+{
+  unsigned int i, bits;
+
+  for (i = idx / 32; i < DIM (binmap); i++)
+    {
+      bits = binmap[i];
+      if (i == idx / 32)
+        bits &= ~0U << (idx % 32);
+      if (bits)
+        {
+          idx = i * 32;
+#ifdef __GNUC__
+          idx += __builtin_ctz (bits);
+#else
+          for (; !(bits & 1); bits >>= 1)
+            idx++;
+#endif
+          return idx < NBINS? (int)idx : -1;
+        }
+    }
+  return -1;
+}
+
+/* Put the free block MB into its bin.  */
+static void
+free_list_insert (memblock_t *mb)
+{
+  unsigned int idx = bin_index (mb->size);
+
+  MB_FOOTER (mb) = mb->size;
+  MB_FREE_PREV (mb) = NULL;
+  MB_FREE_NEXT (mb) = bins[idx];
+  if (bins[idx])
+    MB_FREE_PREV (bins[idx]) = mb;
+  bins[idx] = mb;
+  binmap[idx / 32] |= 1U << (idx % 32);
+}
+
+/* Remove the free block MB from its bin.  */
+static void
+free_list_remove (memblock_t *mb)
+{
+  unsigned int idx = bin_index (mb->size);
+
+  if (MB_FREE_PREV (mb))
+    MB_FREE_NEXT (MB_FREE_PREV (mb)) = MB_FREE_NEXT (mb);
+  else
+    {
+      bins[idx] = MB_FREE_NEXT (mb);
+      if (!bins[idx])
+        binmap[idx / 32] &= ~(1U << (idx % 32));
+    }
+  if (MB_FREE_NEXT (mb))
+    MB_FREE_PREV (MB_FREE_NEXT (mb)) = MB_FREE_PREV (mb);
 }
 
-/* If the preceding block of MB and/or the following block of MB
-   exist and are not active, merge them to form a bigger block.  */
+/* Merge the no longer active block MB with its free neighbours and
+   put the result into its bin.  */
 static void
 mb_merge (memblock_t *mb)
 {
   memblock_t *mb_prev, *mb_next;
 
-  mb_prev = mb_get_prev (mb);
-  mb_next = mb_get_next (mb);
+  mb->flags &= ~MB_FLAG_ACTIVE;
 
-  if (mb_prev && (! (mb_prev->flags & MB_FLAG_ACTIVE)))
+  mb_next = mb_get_next (mb);
+  if (!(mb_next->flags & MB_FLAG_ACTIVE))
+    {
+      free_list_remove (mb_next);
+      mb->size += BLOCK_HEAD_SIZE + mb_next->size;
+    }
+  if ((mb->flags & MB_FLAG_PREV_FREE))
     {
+      mb_prev = (memblock_t *) ((char *) mb - ((unsigned *) mb)[-1]
+                                - BLOCK_HEAD_SIZE);
+      free_list_remove (mb_prev);
       mb_prev->size += BLOCK_HEAD_SIZE + mb->size;
       mb = mb_prev;
     }
-  if (mb_next && (! (mb_next->flags & MB_FLAG_ACTIVE)))
-    mb->size += BLOCK_HEAD_SIZE + mb_next->size;
+
+  free_list_insert (mb);
+  mb_get_next (mb)->flags |= MB_FLAG_PREV_FREE;
 }
 
 /* Return a new block, which can hold SIZE bytes.  */
 static memblock_t *
-mb_get_new (memblock_t *block, size_t size)
+mb_get_new (size_t size)
 {
   memblock_t *mb, *mb_split;
+  int idx;
 
-  for (mb = block; ptr_into_pool_p (mb); mb = mb_get_next (mb))
-    if (! (mb->flags & MB_FLAG_ACTIVE) && mb->size >= size)
-      {
-	/* Found a free block.  */
-	mb->flags |= MB_FLAG_ACTIVE;
-
-	if (mb->size - size > BLOCK_HEAD_SIZE)
-	  {
-	    /* Split block.  */
-
-	    mb_split = (memblock_t *) (((char *) mb) + BLOCK_HEAD_SIZE + size);
-	    mb_split->size = mb->size - size - BLOCK_HEAD_SIZE;
-	    mb_split->flags = 0;
-
-	    mb->size = size;
-
-	    mb_merge (mb_split);
-
-	  }
-
-	break;
-      }
+  idx = find_bin (bin_index_ceil (size));
+  if (idx != -1)
+    mb = bins[idx];
+  else
+    {
+      /* The bin below may still hold a block which is large
+         enough.  */
+      for (mb = bins[bin_index (size)]; mb; mb = MB_FREE_NEXT (mb))
+        if (mb->size >= size)
+          break;
+      if (!mb)
+        {
+          gpg_err_set_errno (ENOMEM);
+          return NULL;
+        }
+    }
 
-  if (! ptr_into_pool_p (mb))
+  free_list_remove (mb);
+  if (mb->size - size >= BLOCK_HEAD_SIZE + MB_MIN_SIZE)
     {
-      gpg_err_set_errno (ENOMEM);
-      mb = NULL;
+      /* Split block.  */
+      mb_split = (memblock_t *) (((char *) mb) + BLOCK_HEAD_SIZE + size);
+      mb_split->size = mb->size - size - BLOCK_HEAD_SIZE;
+      mb_split->flags = 0;
+      mb->size = size;
+      free_list_insert (mb_split);
     }
+  else
+    mb_get_next (mb)->flags &= ~MB_FLAG_PREV_FREE;
+  mb->flags |= MB_FLAG_ACTIVE;
 
   return mb;
 }
 
+/* Wipe out the user area of MB.  This does not make much sense:
+   probably this memory is held in the cache.  We do it anyway.  */
+static void
+mb_wipe (memblock_t *mb)
+{
+  void *p = &mb->aligned.c;
+  size_t size = mb->size;
+
+  wipememory2 (p, 0xff, size);
+  wipememory2 (p, 0xaa, size);
+  wipememory2 (p, 0x55, size);
+  wipememory2 (p, 0x00, size);
+}
+
 /* Print a warning message.  */
 static void
 print_warn (void)
@@ -343,18 +600,17 @@ lock_pool (void *p, size_t n)
 #endif
 }
 
-/* Initialize POOL.  */
-static void
-init_pool (size_t n)
+/* Allocate a memory region of *N bytes for secure memory.  *N is
+   rounded up to a multiple of the page size if mmap is used, in which
+   case *R_MMAPPED is set.  Returns NULL on error.  */
+static void *
+alloc_region (size_t *n, int *r_mmapped)
 {
+  void *p = NULL;
   size_t pgsize;
   long int pgsize_val;
-  memblock_t *mb;
 
-  pool_size = n;
-
-  if (disable_secmem)
-    log_bug ("secure memory is disabled");
+  *r_mmapped = 0;
 
 #if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
   pgsize_val = sysconf (_SC_PAGESIZE);
@@ -365,12 +621,11 @@ init_pool (size_t n)
 #endif
   pgsize = (pgsize_val != -1 && pgsize_val > 0)? pgsize_val:DEFAULT_PAGE_SIZE;
 
-
 #if HAVE_MMAP
-  pool_size = (pool_size + pgsize - 1) & ~(pgsize - 1);
+  *n = (*n + pgsize - 1) & ~(pgsize - 1);
 #ifdef MAP_ANONYMOUS
-  pool = mmap (0, pool_size, PROT_READ | PROT_WRITE,
-	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  p = mmap (0, *n, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 #else /* map /dev/zero instead */
   {
     int fd;
@@ -379,39 +634,174 @@ init_pool (size_t n)
     if (fd == -1)
       {
 	log_error ("can't open /dev/zero: %s\n", strerror (errno));
-	pool = (void *) -1;
+	p = (void *) -1;
       }
     else
       {
-	pool = mmap (0, pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	p = mmap (0, *n, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
         close (fd);
       }
   }
 #endif
-  if (pool == (void *) -1)
-    log_info ("can't mmap pool of %u bytes: %s - using malloc\n",
-	      (unsigned) pool_size, strerror (errno));
-  else
+  if (p == (void *) -1)
     {
-      pool_is_mmapped = 1;
-      pool_okay = 1;
+      log_info ("can't mmap pool of %u bytes: %s - using malloc\n",
+                (unsigned) *n, strerror (errno));
+      p = NULL;
     }
+  else
+    *r_mmapped = 1;
+#endif
+  if (!p)
+    p = malloc (*n);
+
+  return p;
+}
+
+/* Wipe out a region of N bytes allocated by alloc_region and unmap
+   it if MMAPPED is set.  Regions allocated with malloc are not
+   released because this may be called from a signal handler.  */
+static void
+wipe_region (void *p, size_t n, int mmapped)
+{
+  wipememory2 (p, 0xff, n);
+  wipememory2 (p, 0xaa, n);
+  wipememory2 (p, 0x55, n);
+  wipememory2 (p, 0x00, n);
+#if HAVE_MMAP
+  if (mmapped)
+    munmap (p, n);
+#else
+  (void)mmapped;
+#endif
+}
 
+/* Lock a region added to a grown pool into core.  Privileges may
+   have been dropped already; thus unlike lock_pool this only tries
+   mlock.  Returns false if the region could not be locked.  */
+static int
+lock_region (void *p, size_t n)
+{
+#ifdef HAVE_MLOCK
+  return !mlock (p, n);
+#else
+  (void)p;
+  (void)n;
+  return 1;
 #endif
-  if (!pool_okay)
+}
+
+/* Add a region of at least N bytes to the pool and put its memory
+   into the free lists.  GROW is set if the pool is being grown; if
+   the pool has been locked so far, the region is then refused if it
+   can't be locked too.  Returns false on error.  */
+static int
+add_region (size_t n, int grow)
+{
+  struct region_index *old = regions;
+  struct region_index *idx;
+  struct secmem_region r;
+  memblock_t *mb;
+  unsigned int i, j;
+
+  if (old && old->n == SECMEM_MAX_REGIONS)
+    return 0;
+  idx = malloc (sizeof *idx + (old? old->n : 0) * sizeof idx->r[0]);
+  if (!idx)
+    return 0;
+
+  r.size = n;
+  r.base = alloc_region (&r.size, &r.is_mmapped);
+  if (!r.base)
     {
-      pool = malloc (pool_size);
-      if (!pool)
-	log_fatal ("can't allocate memory pool of %u bytes\n",
-		   (unsigned) pool_size);
-      else
-	pool_okay = 1;
+      free (idx);
+      return 0;
     }
+  if (!grow)
+    lock_pool (r.base, r.size);
+  else if (!not_locked && !lock_region (r.base, r.size))
+    {
+      wipe_region (r.base, r.size, r.is_mmapped);
+      if (!r.is_mmapped)
+        free (r.base);
+      free (idx);
+      return 0;
+    }
+  /* Keep the block sizes a multiple of the alignment.  */
+  r.size &= ~(size_t)31;
 
-  /* Initialize first memory block.  */
-  mb = (memblock_t *) pool;
-  mb->size = pool_size;
+  /* One free block followed by the terminating block.  */
+  mb = (memblock_t *) r.base;
+  mb->size = r.size - 2 * BLOCK_HEAD_SIZE;
   mb->flags = 0;
+  free_list_insert (mb);
+  mb = mb_get_next (mb);
+  mb->size = 0;
+  mb->flags = MB_FLAG_ACTIVE | MB_FLAG_PREV_FREE;
+
+  /* Build the new index.  */
+  for (i = j = 0; old && i < old->n; i++)
+    {
+      if (j == i && (size_t)old->r[i].base > (size_t)r.base)
+        idx->r[j++] = r;
+      idx->r[j++] = old->r[i];
+    }
+  if (j == i)
+    idx->r[j++] = r;
+  idx->n = j;
+#ifdef HAVE_SYNC_BUILTINS
+  __sync_synchronize ();
+#endif
+  regions = idx;
+
+  pool_size += r.size;
+  return 1;
+}
+
+/* Initialize POOL.  */
+static void
+init_pool (size_t n)
+{
+  if (disable_secmem)
+    log_bug ("secure memory is disabled");
+
+  memset (bins, 0, sizeof bins);
+  memset (binmap, 0, sizeof binmap);
+  regions = NULL;
+  pool_size = 0;
+  if (!add_region (n, 0))
+    log_fatal ("can't allocate memory pool of %u bytes\n", (unsigned) n);
+  pool_initial_size = pool_size;
+  pool_okay = 1;
+}
+
+/* Try to grow the pool so that a block of SIZE bytes can be
+   allocated.  The pool is grown by its current size but not beyond
+   POOL_LIMIT.  */
+static int
+grow_pool (size_t size)
+{
+  size_t n;
+
+  size += 2 * BLOCK_HEAD_SIZE;
+  n = pool_size > pool_initial_size? pool_size : pool_initial_size;
+  if (n < size)
+    n = size;
+  if (pool_size + n > pool_limit)
+    n = pool_limit > pool_size? pool_limit - pool_size : 0;
+  if (n < size)
+    return 0;
+
+  return add_region (n, 1);
+}
+
+/* Allow the pool to grow up to N bytes.  N = 0 disables growing.  */
+void
+_gcry_secmem_set_limit (size_t n)
+{
+  SECMEM_LOCK;
+  pool_limit = n;
+  SECMEM_UNLOCK;
 }
 
 void
@@ -480,10 +870,7 @@ secmem_init (size_t n)
       if (n < MINIMUM_POOL_SIZE)
 	n = MINIMUM_POOL_SIZE;
       if (! pool_okay)
-	{
-	  init_pool (n);
-	  lock_pool (pool, n);
-	}
+	init_pool (n);
       else
 	log_error ("Oops, secure memory pool already initialized\n");
     }
@@ -506,6 +893,240 @@ _gcry_secmem_init (size_t n)
 }
 
 
+/* Enable per-thread arenas: up to N threads get an arena of SIZE
+   bytes each.  N = 0 disables the arenas.  This needs to be called
+   before the first thread has been assigned an arena.  */
+gcry_err_code_t
+_gcry_secmem_set_arenas (unsigned int n, size_t size)
+{
+#ifdef USE_SECMEM_ARENAS
+  gcry_err_code_t ec = 0;
+  struct secmem_arena *a = NULL;
+
+  if (n)
+    {
+      a = calloc (n, sizeof *a);
+      if (!a)
+        return gpg_err_code_from_errno (errno);
+    }
+
+  SECMEM_LOCK;
+  if (arena_region)
+    {
+      ec = GPG_ERR_CONFLICT;
+      free (a);
+    }
+  else
+    {
+      free (arenas);
+      arenas = a;
+      arenas_count = n;
+      arena_size = size < ARENA_MIN_SIZE? ARENA_MIN_SIZE : size;
+      arena_size = (arena_size + DEFAULT_PAGE_SIZE - 1)
+                   & ~(size_t)(DEFAULT_PAGE_SIZE - 1);
+      free_arenas = NULL;
+      free_arenas_count = 0;
+      arena_gen++;
+    }
+  SECMEM_UNLOCK;
+
+  return ec;
+#else
+  (void)n;
+  (void)size;
+  return GPG_ERR_NOT_SUPPORTED;
+#endif
+}
+
+
+#ifdef USE_SECMEM_ARENAS
+/* Called on the exit of a thread owning the arena ARG.  Put the
+   arena on the free list unless the arenas have been released in
+   the meantime.  */
+static void
+arena_detach (void *arg)
+{
+  struct secmem_arena *a = arg;
+
+  SECMEM_LOCK;
+  if (a == my_arena && my_arena_gen == arena_gen)
+    {
+      a->next_free = free_arenas;
+      free_arenas = a;
+      free_arenas_count++;
+    }
+  my_arena = NULL;
+  SECMEM_UNLOCK;
+}
+
+
+/* Assign an arena to the current thread.  The arena region is
+   allocated on the first call.  An arena of an exited thread is
+   preferred over an unused one.  */
+static void
+arena_attach (void)
+{
+  unsigned int i;
+  int mmapped;
+
+  SECMEM_LOCK;
+
+  my_arena = NULL;
+  my_arena_gen = arena_gen;
+
+  /* The global pool is used for the large blocks; initialize it
+     first so that disabled secure memory is detected.  */
+  if (!pool_okay && !disable_secmem)
+    secmem_init (STANDARD_POOL_SIZE);
+  if (!pool_okay || !arenas_count)
+    goto leave;
+
+  if (!arena_region)
+    {
+      arena_region_size = arenas_count * arena_size;
+      arena_region = alloc_region (&arena_region_size, &mmapped);
+      if (!arena_region)
+        {
+          log_info ("can't allocate %u secure memory arenas\n",
+                    arenas_count);
+          arenas_count = 0;
+          goto leave;
+        }
+      arena_region_is_mmapped = mmapped;
+      lock_pool (arena_region, arena_region_size);
+      for (i = 0; i < arenas_count; i++)
+        {
+          memset (&arenas[i], 0, sizeof arenas[i]);
+          arenas[i].top = arena_region + i * arena_size;
+          arenas[i].end = arenas[i].top + arena_size;
+        }
+      arenas_used = 0;
+    }
+
+  if (show_warning && !suspend_warning)
+    {
+      show_warning = 0;
+      print_warn ();
+    }
+
+  if (!arena_key_created)
+    {
+      if (pthread_key_create (&arena_key, arena_detach))
+        goto leave;
+      arena_key_created = 1;
+    }
+
+  if (free_arenas)
+    {
+      my_arena = free_arenas;
+      free_arenas = my_arena->next_free;
+      free_arenas_count--;
+    }
+  else if (arenas_used < arenas_count)
+    my_arena = &arenas[arenas_used++];
+  if (my_arena && pthread_setspecific (arena_key, my_arena))
+    {
+      /* Without the destructor the arena would be lost on exit.  */
+      my_arena->next_free = free_arenas;
+      free_arenas = my_arena;
+      free_arenas_count++;
+      my_arena = NULL;
+    }
+
+ leave:
+  SECMEM_UNLOCK;
+}
+
+/* Allocate a block of SIZE bytes from the arena of the current
+   thread.  Returns NULL if the block needs to be taken from the
+   global pool.  */
+static void *
+arena_malloc (size_t size)
+{
+  struct secmem_arena *a;
+  memblock_t *mb, *list;
+  unsigned int cls;
+  size_t csize;
+
+  if (size > ARENA_MAX_BLOCK)
+    return NULL;
+  if (my_arena_gen != arena_gen)
+    arena_attach ();
+  a = my_arena;
+  if (!a || (not_locked && fips_mode ()))
+    return NULL;
+
+  /* Take back the blocks released by other threads.  */
+  if (a->remote_free)
+    {
+      list = __sync_lock_test_and_set (&a->remote_free, NULL);
+      while (list)
+        {
+          mb = list;
+          list = MB_NEXT (mb);
+          cls = arena_class (mb->size);
+          MB_NEXT (mb) = a->free_list[cls];
+          a->free_list[cls] = mb;
+        }
+    }
+
+  cls = arena_class (size);
+  csize = 32u << cls;
+  mb = a->free_list[cls];
+  if (mb)
+    a->free_list[cls] = MB_NEXT (mb);
+  else if (a->end - a->top >= BLOCK_HEAD_SIZE + csize)
+    {
+      mb = (memblock_t *) a->top;
+      mb->size = csize;
+      a->top += BLOCK_HEAD_SIZE + csize;
+    }
+  else
+    return NULL;
+
+  mb->flags = MB_FLAG_ACTIVE;
+  __sync_fetch_and_add (&a->cur_alloced, csize);
+  __sync_fetch_and_add (&a->cur_blocks, 1);
+
+  return &mb->aligned.c;
+}
+
+/* Wipe out and release the arena block P.  If the block belongs to
+   the arena of another thread it is handed back to that arena.  */
+static void
+arena_free (void *p)
+{
+  memblock_t *mb = ADDR_TO_BLOCK (p);
+  struct secmem_arena *a;
+  memblock_t *old;
+  unsigned int cls;
+
+  a = &arenas[((char *) mb - arena_region) / arena_size];
+
+  mb_wipe (mb);
+  mb->flags = 0;
+  __sync_fetch_and_sub (&a->cur_alloced, mb->size);
+  __sync_fetch_and_sub (&a->cur_blocks, 1);
+
+  if (a == my_arena && my_arena_gen == arena_gen)
+    {
+      cls = arena_class (mb->size);
+      MB_NEXT (mb) = a->free_list[cls];
+      a->free_list[cls] = mb;
+    }
+  else
+    {
+      do
+        {
+          old = a->remote_free;
+          MB_NEXT (mb) = old;
+        }
+      while (!__sync_bool_compare_and_swap (&a->remote_free, old, mb));
+    }
+}
+#endif /*USE_SECMEM_ARENAS*/
+
+
 static void *
 _gcry_secmem_malloc_internal (size_t size)
 {
@@ -538,9 +1159,11 @@ _gcry_secmem_malloc_internal (size_t size)
   /* Blocks are always a multiple of 32. */
   size = ((size + 31) / 32) * 32;
 
-  mb = mb_get_new ((memblock_t *) pool, size);
+  mb = mb_get_new (size);
+  if (!mb && pool_limit && grow_pool (size))
+    mb = mb_get_new (size);
   if (mb)
-    stats_update (size, 0);
+    stats_update (mb->size, 0);
 
   return mb ? &mb->aligned.c : NULL;
 }
@@ -550,6 +1173,15 @@ _gcry_secmem_malloc (size_t size)
 {
   void *p;
 
+#ifdef USE_SECMEM_ARENAS
+  if (arenas_count)
+    {
+      p = arena_malloc (size);
+      if (p)
+        return p;
+    }
+#endif
+
   SECMEM_LOCK;
   p = _gcry_secmem_malloc_internal (size);
   SECMEM_UNLOCK;
@@ -569,22 +1201,10 @@ _gcry_secmem_free_internal (void *a)
   mb = ADDR_TO_BLOCK (a);
   size = mb->size;
 
-  /* This does not make much sense: probably this memory is held in the
-   * cache. We do it anyway: */
-#define MB_WIPE_OUT(byte) \
-  wipememory2 ((memblock_t *) ((char *) mb + BLOCK_HEAD_SIZE), (byte), size);
-
-  MB_WIPE_OUT (0xff);
-  MB_WIPE_OUT (0xaa);
-  MB_WIPE_OUT (0x55);
-  MB_WIPE_OUT (0x00);
+  mb_wipe (mb);
 
   stats_update (0, size);
 
-  mb->flags &= ~MB_FLAG_ACTIVE;
-
-  /* Update stats.  */
-
   mb_merge (mb);
 }
 
@@ -592,6 +1212,14 @@ _gcry_secmem_free_internal (void *a)
 void
 _gcry_secmem_free (void *a)
 {
+#ifdef USE_SECMEM_ARENAS
+  if (a && ptr_into_arenas_p (a))
+    {
+      arena_free (a);
+      return;
+    }
+#endif
+
   SECMEM_LOCK;
   _gcry_secmem_free_internal (a);
   SECMEM_UNLOCK;
@@ -605,28 +1233,24 @@ _gcry_secmem_realloc (void *p, size_t newsize)
   size_t size;
   void *a;
 
-  SECMEM_LOCK;
-
-  mb = (memblock_t *) ((char *) p - ((size_t) &((memblock_t *) 0)->aligned.c));
+  mb = ADDR_TO_BLOCK (p);
   size = mb->size;
   if (newsize < size)
     {
       /* It is easier to not shrink the memory.  */
-      a = p;
+      return p;
     }
-  else
+
+  /* The block is owned by the caller, thus it is safe to copy it
+     without holding the lock.  */
+  a = _gcry_secmem_malloc (newsize);
+  if (a)
     {
-      a = _gcry_secmem_malloc_internal (newsize);
-      if (a)
-	{
-	  memcpy (a, p, size);
-	  memset ((char *) a + size, 0, newsize - size);
-	  _gcry_secmem_free_internal (p);
-	}
+      memcpy (a, p, size);
+      memset ((char *) a + size, 0, newsize - size);
+      _gcry_secmem_free (p);
     }
 
-  SECMEM_UNLOCK;
-
   return a;
 }
 
@@ -635,7 +1259,11 @@ _gcry_secmem_realloc (void *p, size_t newsize)
 int
 _gcry_private_is_secure (const void *p)
 {
-  return pool_okay && ptr_into_pool_p (p);
+#ifdef USE_SECMEM_ARENAS
+  if (ptr_into_arenas_p (p))
+    return 1;
+#endif
+  return ptr_into_pool_p (p);
 }
 
 
@@ -650,18 +1278,29 @@ _gcry_private_is_secure (const void *p)
 void
 _gcry_secmem_term ()
 {
+  struct region_index *idx;
+  unsigned int i;
+
+#ifdef USE_SECMEM_ARENAS
+  if (arena_region)
+    {
+      wipe_region (arena_region, arena_region_size, arena_region_is_mmapped);
+      arena_region = NULL;
+      arena_region_size = 0;
+      arenas_used = 0;
+      free_arenas = NULL;
+      free_arenas_count = 0;
+      arena_gen++;
+    }
+#endif
+
   if (!pool_okay)
     return;
 
-  wipememory2 (pool, 0xff, pool_size);
-  wipememory2 (pool, 0xaa, pool_size);
-  wipememory2 (pool, 0x55, pool_size);
-  wipememory2 (pool, 0x00, pool_size);
-#if HAVE_MMAP
-  if (pool_is_mmapped)
-    munmap (pool, pool_size);
-#endif
-  pool = NULL;
+  idx = regions;
+  regions = NULL;
+  for (i = 0; i < idx->n; i++)
+    wipe_region (idx->r[i].base, idx->r[i].size, idx->r[i].is_mmapped);
   pool_okay = 0;
   pool_size = 0;
   not_locked = 0;
@@ -674,23 +1313,44 @@ _gcry_secmem_dump_stats ()
 #if 1
   SECMEM_LOCK;
 
- if (pool_okay)
+ if (pool_okay && regions->n > 1)
+    log_info ("secmem usage: %u/%lu bytes in %u blocks (%u regions)\n",
+	      cur_alloced, (unsigned long)pool_size, cur_blocks,
+              regions->n);
+ else if (pool_okay)
     log_info ("secmem usage: %u/%lu bytes in %u blocks\n",
 	      cur_alloced, (unsigned long)pool_size, cur_blocks);
+#ifdef USE_SECMEM_ARENAS
+  if (arena_region)
+    {
+      unsigned int i, alloced = 0, blocks = 0;
+
+      for (i = 0; i < arenas_used; i++)
+        {
+          alloced += arenas[i].cur_alloced;
+          blocks += arenas[i].cur_blocks;
+        }
+      log_info ("secmem arenas: %u/%lu bytes in %u blocks"
+                " (%u of %u arenas in use)\n",
+                alloced, (unsigned long)arena_region_size, blocks,
+                arenas_used - free_arenas_count, arenas_count);
+    }
+#endif
   SECMEM_UNLOCK;
 #else
   memblock_t *mb;
+  unsigned int r;
   int i;
 
   SECMEM_LOCK;
 
-  for (i = 0, mb = (memblock_t *) pool;
-       ptr_into_pool_p (mb);
-       mb = mb_get_next (mb), i++)
-    log_info ("SECMEM: [%s] block: %i; size: %i\n",
-	      (mb->flags & MB_FLAG_ACTIVE) ? "used" : "free",
-	      i,
-	      mb->size);
+  for (r = 0; pool_okay && r < regions->n; r++)
+    for (i = 0, mb = (memblock_t *) regions->r[r].base;
+         mb->size;
+         mb = mb_get_next (mb), i++)
+      log_info ("SECMEM: [%s] region: %u; block: %i; size: %i\n",
+                (mb->flags & MB_FLAG_ACTIVE) ? "used" : "free",
+                r, i, mb->size);
   SECMEM_UNLOCK;
 #endif
 }
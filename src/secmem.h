@@ -23,6 +23,8 @@
 
 void _gcry_secmem_init (size_t npool);
 void _gcry_secmem_term (void);
+gcry_err_code_t _gcry_secmem_set_arenas (unsigned int n, size_t size);
+void _gcry_secmem_set_limit (size_t n);
 void *_gcry_secmem_malloc (size_t size) _GCRY_GCC_ATTR_MALLOC;
 void *_gcry_secmem_realloc (void *a, size_t newsize);
 void _gcry_secmem_free (void *a);
@@ -512,6 +512,18 @@ gcry_cipher_close (gcry_cipher_hd_t h)
   _gcry_cipher_close (h);
 }
 
+gcry_error_t
+gcry_cipher_copy (gcry_cipher_hd_t *r_hd, gcry_cipher_hd_t h)
+{
+  if (!fips_is_operational ())
+    {
+      *r_hd = NULL;
+      return gpg_error (fips_not_operational ());
+    }
+
+  return _gcry_cipher_copy (r_hd, h);
+}
+
 gcry_error_t
 gcry_cipher_setkey (gcry_cipher_hd_t hd, const void *key, size_t keylen)
 {
@@ -668,6 +680,15 @@ gcry_pk_verify (gcry_sexp_t sigval, gcry_sexp_t data, gcry_sexp_t pkey)
   return _gcry_pk_verify (sigval, data, pkey);
 }
 
+gcry_error_t
+gcry_pk_verify_batch (const gcry_pk_verify_item_t *items, size_t nitems,
+                      gcry_error_t *results)
+{
+  if (!fips_is_operational ())
+    return gpg_error (fips_not_operational ());
+  return _gcry_pk_verify_batch (items, nitems, results);
+}
+
 gcry_error_t
 gcry_pk_testkey (gcry_sexp_t key)
 {
@@ -845,6 +866,15 @@ gcry_md_hash_buffer (int algo, void *digest,
   _gcry_md_hash_buffer (algo, digest, buffer, length);
 }
 
+gcry_error_t
+gcry_md_hash_batch (int algo, const gcry_md_batch_item_t *items,
+                    size_t nitems)
+{
+  if (!fips_is_operational ())
+    return gpg_error (fips_not_operational ());
+  return _gcry_md_hash_batch (algo, items, nitems);
+}
+
 int
 gcry_md_get_algo (gcry_md_hd_t hd)
 {
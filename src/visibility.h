@@ -63,6 +63,7 @@
 #define gcry_md_get_algo            _gcry_md_get_algo
 #define gcry_md_get_algo_dlen       _gcry_md_get_algo_dlen
 #define gcry_md_hash_buffer         _gcry_md_hash_buffer
+#define gcry_md_hash_batch          _gcry_md_hash_batch
 #define gcry_md_info                _gcry_md_info
 #define gcry_md_is_enabled          _gcry_md_is_enabled
 #define gcry_md_is_secure           _gcry_md_is_secure
@@ -80,6 +81,7 @@
 #define gcry_cipher_algo_info       _gcry_cipher_algo_info
 #define gcry_cipher_algo_name       _gcry_cipher_algo_name
 #define gcry_cipher_close           _gcry_cipher_close
+#define gcry_cipher_copy            _gcry_cipher_copy
 #define gcry_cipher_setkey          _gcry_cipher_setkey
 #define gcry_cipher_setiv           _gcry_cipher_setiv
 #define gcry_cipher_setctr          _gcry_cipher_setctr
@@ -113,6 +115,7 @@
 #define gcry_pk_sign                _gcry_pk_sign
 #define gcry_pk_testkey             _gcry_pk_testkey
 #define gcry_pk_verify              _gcry_pk_verify
+#define gcry_pk_verify_batch        _gcry_pk_verify_batch
 
 #define gcry_ac_data_new            _gcry_ac_data_new
 #define gcry_ac_data_destroy        _gcry_ac_data_destroy
@@ -413,6 +416,7 @@ void gcry_ac_os_to_mpi (gcry_mpi_t mpi, unsigned char *os, size_t os_n);
 #undef gcry_md_get_algo
 #undef gcry_md_get_algo_dlen
 #undef gcry_md_hash_buffer
+#undef gcry_md_hash_batch
 #undef gcry_md_info
 #undef gcry_md_is_enabled
 #undef gcry_md_is_secure
@@ -430,6 +434,7 @@ void gcry_ac_os_to_mpi (gcry_mpi_t mpi, unsigned char *os, size_t os_n);
 #undef gcry_cipher_algo_info
 #undef gcry_cipher_algo_name
 #undef gcry_cipher_close
+#undef gcry_cipher_copy
 #undef gcry_cipher_setkey
 #undef gcry_cipher_setiv
 #undef gcry_cipher_setctr
@@ -463,6 +468,7 @@ void gcry_ac_os_to_mpi (gcry_mpi_t mpi, unsigned char *os, size_t os_n);
 #undef gcry_pk_sign
 #undef gcry_pk_testkey
 #undef gcry_pk_verify
+#undef gcry_pk_verify_batch
 
 #undef gcry_ac_data_new
 #undef gcry_ac_data_destroy
@@ -627,6 +633,7 @@ MARK_VISIBLE (gcry_md_get)
 MARK_VISIBLE (gcry_md_get_algo)
 MARK_VISIBLE (gcry_md_get_algo_dlen)
 MARK_VISIBLE (gcry_md_hash_buffer)
+MARK_VISIBLE (gcry_md_hash_batch)
 MARK_VISIBLE (gcry_md_info)
 MARK_VISIBLE (gcry_md_is_enabled)
 MARK_VISIBLE (gcry_md_is_secure)
@@ -644,6 +651,7 @@ MARK_VISIBLE (gcry_md_debug)
 MARK_VISIBLE (gcry_cipher_algo_info)
 MARK_VISIBLE (gcry_cipher_algo_name)
 MARK_VISIBLE (gcry_cipher_close)
+MARK_VISIBLE (gcry_cipher_copy)
 MARK_VISIBLE (gcry_cipher_setkey)
 MARK_VISIBLE (gcry_cipher_setiv)
 MARK_VISIBLE (gcry_cipher_setctr)
@@ -677,6 +685,7 @@ MARK_VISIBLE (gcry_pk_sign)
 MARK_VISIBLE (gcry_pk_testkey)
 MARK_VISIBLE (gcry_pk_unregister)
 MARK_VISIBLE (gcry_pk_verify)
+MARK_VISIBLE (gcry_pk_verify_batch)
 
 MARK_VISIBLE (gcry_ac_data_new)
 MARK_VISIBLE (gcry_ac_data_destroy)
@@ -1119,6 +1119,552 @@ check_ofb_cipher (void)
 }
 
 
+static void
+check_gcm_cipher (void)
+{
+  struct tv
+  {
+    int algo;
+    char key[MAX_DATA_LEN];
+    char iv[MAX_DATA_LEN];
+    int ivlen;
+    unsigned char aad[MAX_DATA_LEN];
+    int aadlen;
+    unsigned char plaintext[MAX_DATA_LEN];
+    int inlen;
+    char out[MAX_DATA_LEN];
+    char tag[MAX_DATA_LEN];
+  } tv[] =
+    {
+      /* http://csrc.nist.gov/groups/ST/toolkit/BCM/documents/proposedmodes/gcm/gcm-revised-spec.pdf */
+      { GCRY_CIPHER_AES,
+        "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+        "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 12,
+        "", 0,
+        "", 0,
+        "",
+        "\x58\xe2\xfc\xce\xfa\x7e\x30\x61\x36\x7f\x1d\x57\xa4\xe7\x45\x5a" },
+      { GCRY_CIPHER_AES,
+        "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+        "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 12,
+        "", 0,
+        "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+        16,
+        "\x03\x88\xda\xce\x60\xb6\xa3\x92\xf3\x28\xc2\xb9\x71\xb2\xfe\x78",
+        "\xab\x6e\x47\xd4\x2c\xec\x13\xbd\xf5\x3a\x67\xb2\x12\x57\xbd\xdf" },
+      { GCRY_CIPHER_AES,
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08",
+        "\xca\xfe\xba\xbe\xfa\xce\xdb\xad\xde\xca\xf8\x88", 12,
+        "", 0,
+        "\xd9\x31\x32\x25\xf8\x84\x06\xe5\xa5\x59\x09\xc5\xaf\xf5\x26\x9a"
+        "\x86\xa7\xa9\x53\x15\x34\xf7\xda\x2e\x4c\x30\x3d\x8a\x31\x8a\x72"
+        "\x1c\x3c\x0c\x95\x95\x68\x09\x53\x2f\xcf\x0e\x24\x49\xa6\xb5\x25"
+        "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57\xba\x63\x7b\x39\x1a\xaf\xd2\x55",
+        64,
+        "\x42\x83\x1e\xc2\x21\x77\x74\x24\x4b\x72\x21\xb7\x84\xd0\xd4\x9c"
+        "\xe3\xaa\x21\x2f\x2c\x02\xa4\xe0\x35\xc1\x7e\x23\x29\xac\xa1\x2e"
+        "\x21\xd5\x14\xb2\x54\x66\x93\x1c\x7d\x8f\x6a\x5a\xac\x84\xaa\x05"
+        "\x1b\xa3\x0b\x39\x6a\x0a\xac\x97\x3d\x58\xe0\x91\x47\x3f\x59\x85",
+        "\x4d\x5c\x2a\xf3\x27\xcd\x64\xa6\x2c\xf3\x5a\xbd\x2b\xa6\xfa\xb4" },
+      { GCRY_CIPHER_AES,
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08",
+        "\xca\xfe\xba\xbe\xfa\xce\xdb\xad\xde\xca\xf8\x88", 12,
+        "\xfe\xed\xfa\xce\xde\xad\xbe\xef\xfe\xed\xfa\xce\xde\xad\xbe\xef"
+        "\xab\xad\xda\xd2", 20,
+        "\xd9\x31\x32\x25\xf8\x84\x06\xe5\xa5\x59\x09\xc5\xaf\xf5\x26\x9a"
+        "\x86\xa7\xa9\x53\x15\x34\xf7\xda\x2e\x4c\x30\x3d\x8a\x31\x8a\x72"
+        "\x1c\x3c\x0c\x95\x95\x68\x09\x53\x2f\xcf\x0e\x24\x49\xa6\xb5\x25"
+        "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57\xba\x63\x7b\x39",
+        60,
+        "\x42\x83\x1e\xc2\x21\x77\x74\x24\x4b\x72\x21\xb7\x84\xd0\xd4\x9c"
+        "\xe3\xaa\x21\x2f\x2c\x02\xa4\xe0\x35\xc1\x7e\x23\x29\xac\xa1\x2e"
+        "\x21\xd5\x14\xb2\x54\x66\x93\x1c\x7d\x8f\x6a\x5a\xac\x84\xaa\x05"
+        "\x1b\xa3\x0b\x39\x6a\x0a\xac\x97\x3d\x58\xe0\x91",
+        "\x5b\xc9\x4f\xbc\x32\x21\xa5\xdb\x94\xfa\xe9\x5a\xe7\x12\x1a\x47" },
+      { GCRY_CIPHER_AES,
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08",
+        "\xca\xfe\xba\xbe\xfa\xce\xdb\xad", 8,
+        "\xfe\xed\xfa\xce\xde\xad\xbe\xef\xfe\xed\xfa\xce\xde\xad\xbe\xef"
+        "\xab\xad\xda\xd2", 20,
+        "\xd9\x31\x32\x25\xf8\x84\x06\xe5\xa5\x59\x09\xc5\xaf\xf5\x26\x9a"
+        "\x86\xa7\xa9\x53\x15\x34\xf7\xda\x2e\x4c\x30\x3d\x8a\x31\x8a\x72"
+        "\x1c\x3c\x0c\x95\x95\x68\x09\x53\x2f\xcf\x0e\x24\x49\xa6\xb5\x25"
+        "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57\xba\x63\x7b\x39",
+        60,
+        "\x61\x35\x3b\x4c\x28\x06\x93\x4a\x77\x7f\xf5\x1f\xa2\x2a\x47\x55"
+        "\x69\x9b\x2a\x71\x4f\xcd\xc6\xf8\x37\x66\xe5\xf9\x7b\x6c\x74\x23"
+        "\x73\x80\x69\x00\xe4\x9f\x24\xb2\x2b\x09\x75\x44\xd4\x89\x6b\x42"
+        "\x49\x89\xb5\xe1\xeb\xac\x0f\x07\xc2\x3f\x45\x98",
+        "\x36\x12\xd2\xe7\x9e\x3b\x07\x85\x56\x1b\xe1\x4a\xac\xa2\xfc\xcb" },
+      { GCRY_CIPHER_AES,
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08",
+        "\x93\x13\x22\x5d\xf8\x84\x06\xe5\x55\x90\x9c\x5a\xff\x52\x69\xaa"
+        "\x6a\x7a\x95\x38\x53\x4f\x7d\xa1\xe4\xc3\x03\xd2\xa3\x18\xa7\x28"
+        "\xc3\xc0\xc9\x51\x56\x80\x95\x39\xfc\xf0\xe2\x42\x9a\x6b\x52\x54"
+        "\x16\xae\xdb\xf5\xa0\xde\x6a\x57\xa6\x37\xb3\x9b", 60,
+        "\xfe\xed\xfa\xce\xde\xad\xbe\xef\xfe\xed\xfa\xce\xde\xad\xbe\xef"
+        "\xab\xad\xda\xd2", 20,
+        "\xd9\x31\x32\x25\xf8\x84\x06\xe5\xa5\x59\x09\xc5\xaf\xf5\x26\x9a"
+        "\x86\xa7\xa9\x53\x15\x34\xf7\xda\x2e\x4c\x30\x3d\x8a\x31\x8a\x72"
+        "\x1c\x3c\x0c\x95\x95\x68\x09\x53\x2f\xcf\x0e\x24\x49\xa6\xb5\x25"
+        "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57\xba\x63\x7b\x39",
+        60,
+        "\x8c\xe2\x49\x98\x62\x56\x15\xb6\x03\xa0\x33\xac\xa1\x3f\xb8\x94"
+        "\xbe\x91\x12\xa5\xc3\xa2\x11\xa8\xba\x26\x2a\x3c\xca\x7e\x2c\xa7"
+        "\x01\xe4\xa9\xa4\xfb\xa4\x3c\x90\xcc\xdc\xb2\x81\xd4\x8c\x7c\x6f"
+        "\xd6\x28\x75\xd2\xac\xa4\x17\x03\x4c\x34\xae\xe5",
+        "\x61\x9c\xc5\xae\xff\xfe\x0b\xfa\x46\x2a\xf4\x3c\x16\x99\xd0\x50" },
+      { GCRY_CIPHER_AES256,
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08"
+        "\xfe\xff\xe9\x92\x86\x65\x73\x1c\x6d\x6a\x8f\x94\x67\x30\x83\x08",
+        "\xca\xfe\xba\xbe\xfa\xce\xdb\xad\xde\xca\xf8\x88", 12,
+        "\xfe\xed\xfa\xce\xde\xad\xbe\xef\xfe\xed\xfa\xce\xde\xad\xbe\xef"
+        "\xab\xad\xda\xd2", 20,
+        "\xd9\x31\x32\x25\xf8\x84\x06\xe5\xa5\x59\x09\xc5\xaf\xf5\x26\x9a"
+        "\x86\xa7\xa9\x53\x15\x34\xf7\xda\x2e\x4c\x30\x3d\x8a\x31\x8a\x72"
+        "\x1c\x3c\x0c\x95\x95\x68\x09\x53\x2f\xcf\x0e\x24\x49\xa6\xb5\x25"
+        "\xb1\x6a\xed\xf5\xaa\x0d\xe6\x57\xba\x63\x7b\x39",
+        60,
+        "\x52\x2d\xc1\xf0\x99\x56\x7d\x07\xf4\x7f\x37\xa3\x2a\x84\x42\x7d"
+        "\x64\x3a\x8c\xdc\xbf\xe5\xc0\xc9\x75\x98\xa2\xbd\x25\x55\xd1\xaa"
+        "\x8c\xb0\x8e\x48\x59\x0d\xbb\x3d\xa7\xb0\x8b\x10\x56\x82\x88\x38"
+        "\xc5\xf6\x1e\x63\x93\xba\x7a\x0a\xbc\xc9\xf6\x62",
+        "\x76\xfc\x6e\xce\x0f\x4e\x17\x68\xcd\xdf\x88\x53\xbb\x2d\x55\x1b" }
+    };
+  gcry_cipher_hd_t hde, hdd;
+  unsigned char out[MAX_DATA_LEN];
+  unsigned char tag[16];
+  int i, keylen, byteNum;
+  gcry_error_t err = 0;
+
+  if (verbose)
+    fprintf (stderr, "  Starting GCM checks.\n");
+
+  for (i = 0; i < sizeof (tv) / sizeof (tv[0]); i++)
+    {
+      if (verbose)
+        fprintf (stderr, "    checking GCM mode for %s [%i]\n",
+                 gcry_cipher_algo_name (tv[i].algo),
+                 tv[i].algo);
+      err = gcry_cipher_open (&hde, tv[i].algo, GCRY_CIPHER_MODE_GCM, 0);
+      if (!err)
+        err = gcry_cipher_open (&hdd, tv[i].algo, GCRY_CIPHER_MODE_GCM, 0);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_open failed: %s\n", gpg_strerror (err));
+          return;
+        }
+
+      keylen = gcry_cipher_get_algo_keylen(tv[i].algo);
+      if (!keylen)
+        {
+          fail ("aes-gcm, gcry_cipher_get_algo_keylen failed\n");
+          return;
+        }
+
+      err = gcry_cipher_setkey (hde, tv[i].key, keylen);
+      if (!err)
+        err = gcry_cipher_setkey (hdd, tv[i].key, keylen);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_setkey failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      err = gcry_cipher_setiv (hde, tv[i].iv, tv[i].ivlen);
+      if (!err)
+        err = gcry_cipher_setiv (hdd, tv[i].iv, tv[i].ivlen);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_setiv failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      err = gcry_cipher_authenticate (hde, tv[i].aad, tv[i].aadlen);
+      if (!err)
+        err = gcry_cipher_authenticate (hdd, tv[i].aad, tv[i].aadlen);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_authenticate failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      err = gcry_cipher_encrypt (hde, out, MAX_DATA_LEN,
+                                 tv[i].plaintext, tv[i].inlen);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_encrypt (%d) failed: %s\n",
+                i, gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      if (memcmp (tv[i].out, out, tv[i].inlen))
+        fail ("aes-gcm, encrypt mismatch entry %d\n", i);
+
+      err = gcry_cipher_gettag (hde, tag, sizeof tag);
+      if (err)
+        fail ("aes-gcm, gcry_cipher_gettag (%d) failed: %s\n",
+              i, gpg_strerror (err));
+      else if (memcmp (tv[i].tag, tag, sizeof tag))
+        fail ("aes-gcm, tag mismatch entry %d\n", i);
+
+      err = gcry_cipher_decrypt (hdd, out, tv[i].inlen, NULL, 0);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_decrypt (%d) failed: %s\n",
+                i, gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      if (memcmp (tv[i].plaintext, out, tv[i].inlen))
+        fail ("aes-gcm, decrypt mismatch entry %d\n", i);
+
+      err = gcry_cipher_checktag (hdd, tv[i].tag, 16);
+      if (err)
+        fail ("aes-gcm, gcry_cipher_checktag (%d) failed: %s\n",
+              i, gpg_strerror (err));
+
+      /* A truncated tag is also accepted; a modified one is not.  */
+      err = gcry_cipher_checktag (hdd, tv[i].tag, 12);
+      if (err)
+        fail ("aes-gcm, gcry_cipher_checktag (%d,12) failed: %s\n",
+              i, gpg_strerror (err));
+      memcpy (tag, tv[i].tag, 16);
+      tag[15] ^= 1;
+      err = gcry_cipher_checktag (hdd, tag, 16);
+      if (gpg_err_code (err) != GPG_ERR_CHECKSUM)
+        fail ("aes-gcm, gcry_cipher_checktag (%d) did not detect a "
+              "modified tag: %s\n", i, gpg_strerror (err));
+
+      /* Now the same byte by byte.  */
+      err = gcry_cipher_setiv (hde, tv[i].iv, tv[i].ivlen);
+      if (!err)
+        err = gcry_cipher_setiv (hdd, tv[i].iv, tv[i].ivlen);
+      if (err)
+        {
+          fail ("aes-gcm, gcry_cipher_setiv failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      for (byteNum = 0; byteNum < tv[i].aadlen; ++byteNum)
+        {
+          err = gcry_cipher_authenticate (hde, tv[i].aad + byteNum, 1);
+          if (!err)
+            err = gcry_cipher_authenticate (hdd, tv[i].aad + byteNum, 1);
+          if (err)
+            {
+              fail ("aes-gcm, gcry_cipher_authenticate (%d) failed: %s\n",
+                    i, gpg_strerror (err));
+              gcry_cipher_close (hde);
+              gcry_cipher_close (hdd);
+              return;
+            }
+        }
+
+      for (byteNum = 0; byteNum < tv[i].inlen; ++byteNum)
+        {
+          err = gcry_cipher_encrypt (hde, out+byteNum, 1,
+                                     (tv[i].plaintext) + byteNum, 1);
+          if (err)
+            {
+              fail ("aes-gcm, gcry_cipher_encrypt (%d) failed: %s\n",
+                    i, gpg_strerror (err));
+              gcry_cipher_close (hde);
+              gcry_cipher_close (hdd);
+              return;
+            }
+        }
+
+      if (memcmp (tv[i].out, out, tv[i].inlen))
+        fail ("aes-gcm, encrypt mismatch entry %d (byte-wise)\n", i);
+
+      err = gcry_cipher_gettag (hde, tag, sizeof tag);
+      if (err)
+        fail ("aes-gcm, gcry_cipher_gettag (%d) failed: %s\n",
+              i, gpg_strerror (err));
+      else if (memcmp (tv[i].tag, tag, sizeof tag))
+        fail ("aes-gcm, tag mismatch entry %d (byte-wise)\n", i);
+
+      for (byteNum = 0; byteNum < tv[i].inlen; ++byteNum)
+        {
+          err = gcry_cipher_decrypt (hdd, out+byteNum, 1, NULL, 0);
+          if (err)
+            {
+              fail ("aes-gcm, gcry_cipher_decrypt (%d) failed: %s\n",
+                    i, gpg_strerror (err));
+              gcry_cipher_close (hde);
+              gcry_cipher_close (hdd);
+              return;
+            }
+        }
+
+      if (memcmp (tv[i].plaintext, out, tv[i].inlen))
+        fail ("aes-gcm, decrypt mismatch entry %d (byte-wise)\n", i);
+
+      err = gcry_cipher_checktag (hdd, tv[i].tag, 16);
+      if (err)
+        fail ("aes-gcm, gcry_cipher_checktag (%d) failed: %s\n",
+              i, gpg_strerror (err));
+
+      /* No more AAD or data is allowed after the tag.  */
+      err = gcry_cipher_authenticate (hde, tv[i].aad, 1);
+      if (gpg_err_code (err) != GPG_ERR_INV_STATE)
+        fail ("aes-gcm, gcry_cipher_authenticate (%d) after tag: %s\n",
+              i, gpg_strerror (err));
+
+      /* After a new key an IV is required again; there is no
+         default IV.  */
+      err = gcry_cipher_setkey (hde, tv[i].key, keylen);
+      if (!err)
+        err = gcry_cipher_encrypt (hde, out, tv[i].inlen,
+                                   tv[i].plaintext, tv[i].inlen);
+      if (gpg_err_code (err) != GPG_ERR_MISSING_VALUE)
+        fail ("aes-gcm, gcry_cipher_encrypt (%d) without IV: %s\n",
+              i, gpg_strerror (err));
+      err = gcry_cipher_gettag (hde, out, 16);
+      if (gpg_err_code (err) != GPG_ERR_MISSING_VALUE)
+        fail ("aes-gcm, gcry_cipher_gettag (%d) without IV: %s\n",
+              i, gpg_strerror (err));
+
+      gcry_cipher_close (hde);
+      gcry_cipher_close (hdd);
+    }
+  if (verbose)
+    fprintf (stderr, "  Completed GCM checks.\n");
+}
+
+
+static void
+check_xts_cipher (void)
+{
+  struct tv
+  {
+    int algo;
+    char key[2*16];
+    char iv[16];
+    unsigned char plaintext[MAX_DATA_LEN];
+    int inlen;
+    char out[MAX_DATA_LEN];
+  } tv[] =
+    {
+      /* IEEE Std 1619-2007, vector 2.  */
+      { GCRY_CIPHER_AES,
+        "\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11"
+        "\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22",
+        "\x33\x33\x33\x33\x33\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+        "\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44"
+        "\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44\x44",
+        32,
+        "\xc4\x54\x18\x5e\x6a\x16\x93\x6e\x39\x33\x40\x38\xac\xef\x83\x8b"
+        "\xfb\x18\x6f\xff\x74\x80\xad\xc4\x28\x93\x82\xec\xd6\xd3\x94\xf0" },
+      /* A partial last block which requires ciphertext stealing.  */
+      { GCRY_CIPHER_AES,
+        "\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8\xf7\xf6\xf5\xf4\xf3\xf2\xf1\xf0"
+        "\xbf\xbe\xbd\xbc\xbb\xba\xb9\xb8\xb7\xb6\xb5\xb4\xb3\xb2\xb1\xb0",
+        "\x12\x34\x56\x78\x9a\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+        "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+        "\x10",
+        17,
+        "\x64\x16\x10\x67\x9d\xcb\xf9\x2e\x50\x5c\x41\x33\x3f\xb0\x6c\x2a"
+        "\x95" }
+    };
+  /* IEEE Std 1619-2007, vector 4.  The plaintext is the sequence of
+     bytes 0 to 255 repeated; the length is sufficient to exercise
+     bulk implementations.  */
+  static const char long_key[2*16] =
+    "\x27\x18\x28\x18\x28\x45\x90\x45\x23\x53\x60\x28\x74\x71\x35\x26"
+    "\x31\x41\x59\x26\x53\x58\x97\x93\x23\x84\x62\x64\x33\x83\x27\x95";
+  static const char long_out[512] =
+        "\x27\xa7\x47\x9b\xef\xa1\xd4\x76\x48\x9f\x30\x8c\xd4\xcf\xa6\xe2"
+        "\xa9\x6e\x4b\xbe\x32\x08\xff\x25\x28\x7d\xd3\x81\x96\x16\xe8\x9c"
+        "\xc7\x8c\xf7\xf5\xe5\x43\x44\x5f\x83\x33\xd8\xfa\x7f\x56\x00\x00"
+        "\x05\x27\x9f\xa5\xd8\xb5\xe4\xad\x40\xe7\x36\xdd\xb4\xd3\x54\x12"
+        "\x32\x80\x63\xfd\x2a\xab\x53\xe5\xea\x1e\x0a\x9f\x33\x25\x00\xa5"
+        "\xdf\x94\x87\xd0\x7a\x5c\x92\xcc\x51\x2c\x88\x66\xc7\xe8\x60\xce"
+        "\x93\xfd\xf1\x66\xa2\x49\x12\xb4\x22\x97\x61\x46\xae\x20\xce\x84"
+        "\x6b\xb7\xdc\x9b\xa9\x4a\x76\x7a\xae\xf2\x0c\x0d\x61\xad\x02\x65"
+        "\x5e\xa9\x2d\xc4\xc4\xe4\x1a\x89\x52\xc6\x51\xd3\x31\x74\xbe\x51"
+        "\xa1\x0c\x42\x11\x10\xe6\xd8\x15\x88\xed\xe8\x21\x03\xa2\x52\xd8"
+        "\xa7\x50\xe8\x76\x8d\xef\xff\xed\x91\x22\x81\x0a\xae\xb9\x9f\x91"
+        "\x72\xaf\x82\xb6\x04\xdc\x4b\x8e\x51\xbc\xb0\x82\x35\xa6\xf4\x34"
+        "\x13\x32\xe4\xca\x60\x48\x2a\x4b\xa1\xa0\x3b\x3e\x65\x00\x8f\xc5"
+        "\xda\x76\xb7\x0b\xf1\x69\x0d\xb4\xea\xe2\x9c\x5f\x1b\xad\xd0\x3c"
+        "\x5c\xcf\x2a\x55\xd7\x05\xdd\xcd\x86\xd4\x49\x51\x1c\xeb\x7e\xc3"
+        "\x0b\xf1\x2b\x1f\xa3\x5b\x91\x3f\x9f\x74\x7a\x8a\xfd\x1b\x13\x0e"
+        "\x94\xbf\xf9\x4e\xff\xd0\x1a\x91\x73\x5c\xa1\x72\x6a\xcd\x0b\x19"
+        "\x7c\x4e\x5b\x03\x39\x36\x97\xe1\x26\x82\x6f\xb6\xbb\xde\x8e\xcc"
+        "\x1e\x08\x29\x85\x16\xe2\xc9\xed\x03\xff\x3c\x1b\x78\x60\xf6\xde"
+        "\x76\xd4\xce\xcd\x94\xc8\x11\x98\x55\xef\x52\x97\xca\x67\xe9\xf3"
+        "\xe7\xff\x72\xb1\xe9\x97\x85\xca\x0a\x7e\x77\x20\xc5\xb3\x6d\xc6"
+        "\xd7\x2c\xac\x95\x74\xc8\xcb\xbc\x2f\x80\x1e\x23\xe5\x6f\xd3\x44"
+        "\xb0\x7f\x22\x15\x4b\xeb\xa0\xf0\x8c\xe8\x89\x1e\x64\x3e\xd9\x95"
+        "\xc9\x4d\x9a\x69\xc9\xf1\xb5\xf4\x99\x02\x7a\x78\x57\x2a\xee\xbd"
+        "\x74\xd2\x0c\xc3\x98\x81\xc2\x13\xee\x77\x0b\x10\x10\xe4\xbe\xa7"
+        "\x18\x84\x69\x77\xae\x11\x9f\x7a\x02\x3a\xb5\x8c\xca\x0a\xd7\x52"
+        "\xaf\xe6\x56\xbb\x3c\x17\x25\x6a\x9f\x6e\x9b\xf1\x9f\xdd\x5a\x38"
+        "\xfc\x82\xbb\xe8\x72\xc5\x53\x9e\xdb\x60\x9e\xf4\xf7\x9c\x20\x3e"
+        "\xbb\x14\x0f\x2e\x58\x3c\xb2\xad\x15\xb4\xaa\x5b\x65\x50\x16\xa8"
+        "\x44\x92\x77\xdb\xd4\x77\xef\x2c\x8d\x6c\x01\x7d\xb7\x38\xb1\x8d"
+        "\xeb\x4a\x42\x7d\x19\x23\xce\x3f\xf2\x62\x73\x57\x79\xa4\x18\xf2"
+        "\x0a\x28\x2d\xf9\x20\x14\x7b\xea\xbe\x42\x1e\xe5\x31\x9d\x05\x68";
+  gcry_cipher_hd_t hde, hdd;
+  unsigned char out[512];
+  unsigned char in[512];
+  int i, n, keylen;
+  gcry_error_t err = 0;
+
+  if (verbose)
+    fprintf (stderr, "  Starting XTS checks.\n");
+
+  for (i = 0; i < sizeof (tv) / sizeof (tv[0]); i++)
+    {
+      if (verbose)
+        fprintf (stderr, "    checking XTS mode for %s [%i]\n",
+                 gcry_cipher_algo_name (tv[i].algo),
+                 tv[i].algo);
+      err = gcry_cipher_open (&hde, tv[i].algo, GCRY_CIPHER_MODE_XTS, 0);
+      if (!err)
+        err = gcry_cipher_open (&hdd, tv[i].algo, GCRY_CIPHER_MODE_XTS, 0);
+      if (err)
+        {
+          fail ("aes-xts, gcry_cipher_open failed: %s\n", gpg_strerror (err));
+          return;
+        }
+
+      /* XTS takes two keys.  */
+      keylen = 2 * gcry_cipher_get_algo_keylen (tv[i].algo);
+      err = gcry_cipher_setkey (hde, tv[i].key, keylen);
+      if (!err)
+        err = gcry_cipher_setkey (hdd, tv[i].key, keylen);
+      if (err)
+        {
+          fail ("aes-xts, gcry_cipher_setkey failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      err = gcry_cipher_setiv (hde, tv[i].iv, 16);
+      if (!err)
+        err = gcry_cipher_setiv (hdd, tv[i].iv, 16);
+      if (err)
+        {
+          fail ("aes-xts, gcry_cipher_setiv failed: %s\n",
+                gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      err = gcry_cipher_encrypt (hde, out, MAX_DATA_LEN,
+                                 tv[i].plaintext, tv[i].inlen);
+      if (err)
+        {
+          fail ("aes-xts, gcry_cipher_encrypt (%d) failed: %s\n",
+                i, gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      if (memcmp (tv[i].out, out, tv[i].inlen))
+        fail ("aes-xts, encrypt mismatch entry %d\n", i);
+
+      err = gcry_cipher_decrypt (hdd, out, tv[i].inlen, NULL, 0);
+      if (err)
+        {
+          fail ("aes-xts, gcry_cipher_decrypt (%d) failed: %s\n",
+                i, gpg_strerror (err));
+          gcry_cipher_close (hde);
+          gcry_cipher_close (hdd);
+          return;
+        }
+
+      if (memcmp (tv[i].plaintext, out, tv[i].inlen))
+        fail ("aes-xts, decrypt mismatch entry %d\n", i);
+
+      gcry_cipher_close (hde);
+      gcry_cipher_close (hdd);
+    }
+
+  if (verbose)
+    fprintf (stderr, "    checking XTS mode with a long data unit\n");
+  err = gcry_cipher_open (&hde, GCRY_CIPHER_AES, GCRY_CIPHER_MODE_XTS, 0);
+  if (err)
+    {
+      fail ("aes-xts, gcry_cipher_open failed: %s\n", gpg_strerror (err));
+      return;
+    }
+  err = gcry_cipher_setkey (hde, long_key, 2*16);
+  if (!err)
+    err = gcry_cipher_setiv (hde, NULL, 0);
+  if (err)
+    {
+      fail ("aes-xts, gcry_cipher_setkey failed: %s\n", gpg_strerror (err));
+      gcry_cipher_close (hde);
+      return;
+    }
+
+  for (i = 0; i < sizeof in; i++)
+    in[i] = i;
+  err = gcry_cipher_encrypt (hde, out, sizeof out, in, sizeof in);
+  if (err)
+    fail ("aes-xts, gcry_cipher_encrypt failed: %s\n", gpg_strerror (err));
+  else if (memcmp (long_out, out, sizeof out))
+    fail ("aes-xts, encrypt mismatch for the long data unit\n");
+
+  /* A data unit may be split into several calls if all but the last
+     one process complete blocks.  */
+  gcry_cipher_reset (hde);
+  err = gcry_cipher_setkey (hde, long_key, 2*16);
+  if (err)
+    fail ("aes-xts, gcry_cipher_setkey failed: %s\n", gpg_strerror (err));
+  memcpy (out, long_out, sizeof out);
+  for (i = 0, n = 16; !err && i < sizeof out; i += n, n += 16)
+    {
+      if (i + n > sizeof out)
+        n = sizeof out - i;
+      err = gcry_cipher_decrypt (hde, out + i, n, NULL, 0);
+    }
+  if (err)
+    fail ("aes-xts, gcry_cipher_decrypt failed: %s\n", gpg_strerror (err));
+  else if (memcmp (in, out, sizeof out))
+    fail ("aes-xts, decrypt mismatch for the long data unit\n");
+
+  /* An odd key length and data shorter than a block are rejected.  */
+  err = gcry_cipher_setkey (hde, long_key, 2*16 - 1);
+  if (gpg_err_code (err) != GPG_ERR_INV_KEYLEN)
+    fail ("aes-xts, gcry_cipher_setkey accepted an invalid key length\n");
+  err = gcry_cipher_setkey (hde, long_key, 2*16);
+  if (!err)
+    err = gcry_cipher_encrypt (hde, out, 15, in, 15);
+  if (gpg_err_code (err) != GPG_ERR_INV_LENGTH)
+    fail ("aes-xts, gcry_cipher_encrypt accepted a short data unit\n");
+
+  gcry_cipher_close (hde);
+
+  if (verbose)
+    fprintf (stderr, "  Completed XTS checks.\n");
+}
+
+
 /* Check that our bulk encryption fucntions work properly.  */
 static void
 check_bulk_cipher_modes (void)
@@ -1640,11 +2186,127 @@ check_cipher_modes(void)
   check_ctr_cipher ();
   check_cfb_cipher ();
   check_ofb_cipher ();
+  check_gcm_cipher ();
+  check_xts_cipher ();
 
   if (verbose)
     fprintf (stderr, "Completed Cipher Mode checks.\n");
 }
 
+
+/* Check that a handle created by gcry_cipher_copy continues with the
+   key and state of the original and that a reset restores the key.
+   The pool is enabled so that the second pass runs with reused
+   handles.  */
+static void
+check_cipher_copy (void)
+{
+  static const int modes[] =
+    {
+      GCRY_CIPHER_MODE_CBC, GCRY_CIPHER_MODE_CFB, GCRY_CIPHER_MODE_CTR,
+      GCRY_CIPHER_MODE_GCM, GCRY_CIPHER_MODE_XTS, 0
+    };
+  unsigned char key[32], iv[16], plain[64];
+  unsigned char ref[64], out1[64], out2[64];
+  unsigned char tag1[16], tag2[16];
+  gcry_cipher_hd_t hd, hd2;
+  gcry_error_t err;
+  int i, pass, mode;
+
+  if (verbose)
+    fprintf (stderr, "Starting cipher copy checks.\n");
+
+  for (i = 0; i < sizeof key; i++)
+    key[i] = i + 1;
+  for (i = 0; i < sizeof iv; i++)
+    iv[i] = 0xf0 + i;
+  for (i = 0; i < sizeof plain; i++)
+    plain[i] = i * 7;
+
+  gcry_control (GCRYCTL_SET_CIPHER_POOL, 4);
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; (mode = modes[i]); i++)
+      {
+        err = gcry_cipher_open (&hd, GCRY_CIPHER_AES, mode, 0);
+        if (err)
+          {
+            fail ("cipher copy, mode %d: open failed: %s\n",
+                  mode, gpg_strerror (err));
+            continue;
+          }
+        hd2 = NULL;
+        err = gcry_cipher_setkey (hd, key,
+                                  mode == GCRY_CIPHER_MODE_XTS? 32 : 16);
+        if (!err)
+          err = gcry_cipher_setiv (hd, iv, sizeof iv);
+        if (!err)
+          err = gcry_cipher_encrypt (hd, ref, sizeof ref,
+                                     plain, sizeof plain);
+        if (!err)
+          {
+            gcry_cipher_reset (hd);
+            err = gcry_cipher_setiv (hd, iv, sizeof iv);
+          }
+        if (!err)
+          err = gcry_cipher_encrypt (hd, out1, 16, plain, 16);
+        if (!err)
+          err = gcry_cipher_copy (&hd2, hd);
+        if (!err)
+          err = gcry_cipher_encrypt (hd, out1 + 16, 48, plain + 16, 48);
+        if (!err)
+          err = gcry_cipher_encrypt (hd2, out2 + 16, 48, plain + 16, 48);
+        if (err)
+          {
+            fail ("cipher copy, mode %d: operation failed: %s\n",
+                  mode, gpg_strerror (err));
+            goto next;
+          }
+        if (memcmp (ref + 16, out1 + 16, 48))
+          fail ("cipher copy, mode %d: original mismatch\n", mode);
+        if (memcmp (ref + 16, out2 + 16, 48))
+          {
+            fail ("cipher copy, mode %d: copy mismatch\n", mode);
+            mismatch (ref + 16, 48, out2 + 16, 48);
+          }
+
+        if (mode == GCRY_CIPHER_MODE_GCM)
+          {
+            err = gcry_cipher_gettag (hd, tag1, sizeof tag1);
+            if (!err)
+              err = gcry_cipher_gettag (hd2, tag2, sizeof tag2);
+            if (err)
+              fail ("cipher copy, mode %d: gettag failed: %s\n",
+                    mode, gpg_strerror (err));
+            else if (memcmp (tag1, tag2, sizeof tag1))
+              fail ("cipher copy, mode %d: tag mismatch\n", mode);
+          }
+
+        /* Closing the original must not affect the copy.  */
+        gcry_cipher_close (hd);
+        hd = NULL;
+        gcry_cipher_reset (hd2);
+        err = gcry_cipher_setiv (hd2, iv, sizeof iv);
+        if (!err)
+          err = gcry_cipher_encrypt (hd2, out2, sizeof out2,
+                                     plain, sizeof plain);
+        if (err)
+          fail ("cipher copy, mode %d: reset failed: %s\n",
+                mode, gpg_strerror (err));
+        else if (memcmp (ref, out2, sizeof ref))
+          fail ("cipher copy, mode %d: mismatch after reset\n", mode);
+
+      next:
+        gcry_cipher_close (hd);
+        gcry_cipher_close (hd2);
+      }
+
+  gcry_control (GCRYCTL_SET_CIPHER_POOL, 0);
+
+  if (verbose)
+    fprintf (stderr, "Completed cipher copy checks.\n");
+}
+
 static void
 check_one_md (int algo, const char *data, int len, const char *expect)
 {
@@ -1965,6 +2627,90 @@ check_digests (void)
     fprintf (stderr, "Completed hash checks.\n");
 }
 
+
+/* Compare gcry_md_hash_batch with gcry_md_hash_buffer.  The messages
+   cover all the lengths around the padding boundaries and are of
+   different size so that the lanes of a multi-buffer implementation
+   run out of sync.  */
+static void
+check_digest_batch (void)
+{
+  static int algos[] =
+    {
+      GCRY_MD_SHA1, GCRY_MD_SHA224, GCRY_MD_SHA256,
+      GCRY_MD_SHA384, GCRY_MD_SHA512, GCRY_MD_RMD160,
+      0
+    };
+  enum { NITEMS = 300 };
+  unsigned char *buffer;
+  unsigned char *digests;
+  unsigned char expect[64];
+  gcry_md_batch_item_t items[NITEMS];
+  gcry_error_t err;
+  int i, j, mdlen;
+
+  if (verbose)
+    fprintf (stderr, "Starting batch hash checks.\n");
+
+  buffer = gcry_xmalloc (2 * NITEMS);
+  digests = gcry_xmalloc (NITEMS * 64);
+  for (i = 0; i < 2 * NITEMS; i++)
+    buffer[i] = i * 7;
+
+  for (i = 0; i < NITEMS; i++)
+    {
+      items[i].buffer = buffer + i;
+      items[i].length = (i * 37) % NITEMS;
+      items[i].digest = digests + i * 64;
+    }
+
+  for (i = 0; algos[i]; i++)
+    {
+      if (gcry_md_test_algo (algos[i]) && in_fips_mode)
+        continue;
+      if (verbose)
+        fprintf (stderr, "  checking %s\n", gcry_md_algo_name (algos[i]));
+
+      mdlen = gcry_md_get_algo_dlen (algos[i]);
+      memset (digests, 0, NITEMS * 64);
+      err = gcry_md_hash_batch (algos[i], items, NITEMS);
+      if (err)
+        {
+          fail ("algo %d, gcry_md_hash_batch failed: %s\n",
+                algos[i], gpg_strerror (err));
+          continue;
+        }
+      for (j = 0; j < NITEMS; j++)
+        {
+          gcry_md_hash_buffer (algos[i], expect,
+                               items[j].buffer, items[j].length);
+          if (memcmp (items[j].digest, expect, mdlen))
+            fail ("algo %d, digest mismatch for item %d\n", algos[i], j);
+        }
+
+      /* A single message takes the non-batched path.  */
+      err = gcry_md_hash_batch (algos[i], items + 1, 1);
+      gcry_md_hash_buffer (algos[i], expect,
+                           items[1].buffer, items[1].length);
+      if (err || memcmp (items[1].digest, expect, mdlen))
+        fail ("algo %d, single item batch failed\n", algos[i]);
+    }
+
+  err = gcry_md_hash_batch (GCRY_MD_SHA256, items, 0);
+  if (err)
+    fail ("gcry_md_hash_batch with no items failed: %s\n",
+          gpg_strerror (err));
+  err = gcry_md_hash_batch (0x7fff, items, NITEMS);
+  if (gpg_err_code (err) != GPG_ERR_DIGEST_ALGO)
+    fail ("gcry_md_hash_batch did not detect an invalid algorithm\n");
+
+  gcry_free (digests);
+  gcry_free (buffer);
+
+  if (verbose)
+    fprintf (stderr, "Completed batch hash checks.\n");
+}
+
 static void
 check_one_hmac (int algo, const char *data, int datalen,
 		const char *key, int keylen, const char *expect)
@@ -2018,6 +2764,13 @@ check_one_hmac (int algo, const char *data, int datalen,
       fail ("algo %d, digest mismatch\n", algo);
     }
 
+  /* The same MAC needs to be computed again after a reset.  */
+  gcry_md_reset (hd2);
+  gcry_md_write (hd2, data, datalen);
+  p = gcry_md_read (hd2, algo);
+  if (!p || memcmp (p, expect, mdlen))
+    fail ("algo %d, digest mismatch after reset\n", algo);
+
   gcry_md_close (hd2);
 }
 
@@ -2760,6 +3513,257 @@ check_one_pubkey_new (int n)
   gcry_sexp_release (skey);
 }
 
+/* Verify a known ECDSA signature and run a sign/verify round trip
+   with the same key.  The test vector is from RFC-6979 (A.2.5,
+   SHA-256, message "sample").  */
+static void
+check_ecdsa_known_signature (void)
+{
+  static const char seckey[] =
+    "(private-key\n"
+    " (ecdsa\n"
+    "  (curve \"NIST P-256\")\n"
+    "  (q #0460FED4BA255A9D31C961EB74C6356D68C049B8923B61FA6CE669622E60F29FB6"
+    "      7903FE1008B8BC99A41AE9E95628BC64F2F1B20C2D7E9F5177A3C294D4462299#)\n"
+    "  (d #C9AFA9D845BA75166B5C215767B1D6934E50C3DB36E89B127B8A622B120F6721#)))\n";
+  static const char key[] =
+    "(public-key\n"
+    " (ecdsa\n"
+    "  (curve \"NIST P-256\")\n"
+    "  (q #0460FED4BA255A9D31C961EB74C6356D68C049B8923B61FA6CE669622E60F29FB6"
+    "      7903FE1008B8BC99A41AE9E95628BC64F2F1B20C2D7E9F5177A3C294D4462299#)))\n";
+  static const char hashdata[] =
+    "(data (flags raw)\n"
+    " (value #AF2BDBE1AA9B6EC1E2ADE1D694F41FC71A831D0268E9891562113D8A62ADD1BF#))";
+  static const char baddata[] =
+    "(data (flags raw)\n"
+    " (value #AF2BDBE1AA9B6EC1E2ADE1D694F41FC71A831D0268E9891562113D8A62ADD1C0#))";
+  static const char sigdata[] =
+    "(sig-val\n"
+    " (ecdsa\n"
+    "  (r #EFD48B2AACB6A8FD1140DD9CD45E81D69D2C877B56AAF991C34D0EA84EAF3716#)\n"
+    "  (s #F7CB1C942D657C41D436C7A1B6E29F65F3E900DBB9AFF4064DC4AB2F843ACDA8#)))";
+  gcry_error_t rc;
+  gcry_sexp_t skey, pkey, hash, badhash, sig;
+
+  if (verbose)
+    fprintf (stderr, "  checking known ECDSA signature\n");
+
+  rc = gcry_sexp_sscan (&skey, NULL, seckey, strlen (seckey));
+  if (!rc)
+    rc = gcry_sexp_sscan (&pkey, NULL, key, strlen (key));
+  if (!rc)
+    rc = gcry_sexp_sscan (&hash, NULL, hashdata, strlen (hashdata));
+  if (!rc)
+    rc = gcry_sexp_sscan (&badhash, NULL, baddata, strlen (baddata));
+  if (!rc)
+    rc = gcry_sexp_sscan (&sig, NULL, sigdata, strlen (sigdata));
+  if (rc)
+    die ("converting data failed: %s\n", gpg_strerror (rc));
+
+  verify_one_signature (pkey, hash, badhash, sig);
+  gcry_sexp_release (sig);
+
+  rc = gcry_pk_testkey (skey);
+  if (rc)
+    fail ("gcry_pk_testkey failed: %s\n", gpg_strerror (rc));
+
+  rc = gcry_pk_sign (&sig, hash, skey);
+  if (rc)
+    fail ("gcry_pk_sign failed: %s\n", gpg_strerror (rc));
+  else
+    {
+      verify_one_signature (pkey, hash, badhash, sig);
+      gcry_sexp_release (sig);
+    }
+
+  gcry_sexp_release (badhash);
+  gcry_sexp_release (hash);
+  gcry_sexp_release (pkey);
+  gcry_sexp_release (skey);
+}
+
+
+/* Run a sign/verify round trip with a new key for each of the NIST
+   curves, which use a fast reduction, and a Brainpool curve.  */
+static void
+check_ecdsa_curves (void)
+{
+  static const char *curves[] =
+    {
+      "NIST P-192", "NIST P-224", "NIST P-256", "NIST P-384", "NIST P-521",
+      "brainpoolP256r1"
+    };
+  static const char hashdata[] =
+    "(data (flags raw)\n"
+    " (value #0123456789ABCDEF0123456789ABCDEF01234567#))";
+  static const char baddata[] =
+    "(data (flags raw)\n"
+    " (value #0123456789ABCDEF0123456789ABCDEF01234568#))";
+  gcry_error_t rc;
+  gcry_sexp_t key_spec, key, pkey, skey, hash, badhash, sig;
+  int i;
+
+  rc = gcry_sexp_sscan (&hash, NULL, hashdata, strlen (hashdata));
+  if (!rc)
+    rc = gcry_sexp_sscan (&badhash, NULL, baddata, strlen (baddata));
+  if (rc)
+    die ("converting data failed: %s\n", gpg_strerror (rc));
+
+  for (i=0; i < DIM (curves); i++)
+    {
+      if (verbose)
+        fprintf (stderr, "  checking ECDSA with curve %s\n", curves[i]);
+
+      rc = gcry_sexp_build (&key_spec, NULL,
+                            "(genkey (ecdsa (curve %s)))", curves[i]);
+      if (rc)
+        die ("error creating S-expression: %s\n", gpg_strerror (rc));
+      rc = gcry_pk_genkey (&key, key_spec);
+      gcry_sexp_release (key_spec);
+      if (rc)
+        {
+          fail ("error generating ECDSA key for %s: %s\n",
+                curves[i], gpg_strerror (rc));
+          continue;
+        }
+      pkey = gcry_sexp_find_token (key, "public-key", 0);
+      skey = gcry_sexp_find_token (key, "private-key", 0);
+      gcry_sexp_release (key);
+      if (!pkey || !skey)
+        die ("key parts missing in ECDSA key\n");
+
+      rc = gcry_pk_testkey (skey);
+      if (rc)
+        fail ("gcry_pk_testkey failed for %s: %s\n",
+              curves[i], gpg_strerror (rc));
+
+      rc = gcry_pk_sign (&sig, hash, skey);
+      if (rc)
+        fail ("gcry_pk_sign failed for %s: %s\n",
+              curves[i], gpg_strerror (rc));
+      else
+        {
+          verify_one_signature (pkey, hash, badhash, sig);
+          gcry_sexp_release (sig);
+        }
+
+      gcry_sexp_release (pkey);
+      gcry_sexp_release (skey);
+    }
+
+  gcry_sexp_release (badhash);
+  gcry_sexp_release (hash);
+}
+
+
+/* Check gcry_pk_verify_batch with two ECDSA keys.  More key objects
+   than cached by the batch function are used; some of them are
+   different objects for the same key.  */
+static void
+check_pk_verify_batch (void)
+{
+  enum { NKEYOBJS = 10, NITEMS = 24 };
+  gcry_error_t rc, rcs[NITEMS];
+  gcry_sexp_t key_spec, key[2], skey[2];
+  gcry_sexp_t pkey[NKEYOBJS], hash[NITEMS], sig[NITEMS];
+  gcry_pk_verify_item_t items[NITEMS];
+  unsigned char value[32];
+  int i, expect_bad, nbad;
+
+  if (verbose)
+    fprintf (stderr, "  checking batch verification\n");
+
+  rc = gcry_sexp_build (&key_spec, NULL, "(genkey (ecdsa (curve %s)))",
+                        "NIST P-256");
+  if (rc)
+    die ("error creating S-expression: %s\n", gpg_strerror (rc));
+  for (i=0; i < 2; i++)
+    {
+      rc = gcry_pk_genkey (&key[i], key_spec);
+      if (rc)
+        die ("error generating ECDSA key: %s\n", gpg_strerror (rc));
+      skey[i] = gcry_sexp_find_token (key[i], "private-key", 0);
+      if (!skey[i])
+        die ("private part missing in ECDSA key\n");
+    }
+  gcry_sexp_release (key_spec);
+  for (i=0; i < NKEYOBJS; i++)
+    {
+      pkey[i] = gcry_sexp_find_token (key[i % 2], "public-key", 0);
+      if (!pkey[i])
+        die ("public part missing in ECDSA key\n");
+    }
+
+  for (i=0; i < NITEMS; i++)
+    {
+      memset (value, i, sizeof value);
+      rc = gcry_sexp_build (&hash[i], NULL,
+                            "(data (flags raw) (value %b))",
+                            (int)sizeof value, value);
+      if (rc)
+        die ("error creating S-expression: %s\n", gpg_strerror (rc));
+      rc = gcry_pk_sign (&sig[i], hash[i], skey[i % 2]);
+      if (rc)
+        die ("gcry_pk_sign failed: %s\n", gpg_strerror (rc));
+    }
+
+  /* The key object for item I is I % NKEYOBJS; it matches the signing
+     key if I and I % NKEYOBJS are both odd or even.  Every fifth item
+     uses the wrong data.  */
+  for (i=0; i < NITEMS; i++)
+    {
+      items[i].sigval = sig[i];
+      items[i].data = (i % 5 == 4)? hash[(i + 2) % NITEMS] : hash[i];
+      items[i].pkey = pkey[i % NKEYOBJS];
+    }
+
+  rc = gcry_pk_verify_batch (items, NITEMS, rcs);
+  for (i=0, nbad=0; i < NITEMS; i++)
+    {
+      expect_bad = (i % 5 == 4) || ((i % NKEYOBJS) % 2 != i % 2);
+      if (expect_bad)
+        nbad++;
+      if (expect_bad && gcry_err_code (rcs[i]) != GPG_ERR_BAD_SIGNATURE)
+        fail ("gcry_pk_verify_batch failed to detect bad signature %d: %s\n",
+              i, gpg_strerror (rcs[i]));
+      else if (!expect_bad && rcs[i])
+        fail ("gcry_pk_verify_batch failed for item %d: %s\n",
+              i, gpg_strerror (rcs[i]));
+      if (rcs[i] != gcry_pk_verify (items[i].sigval, items[i].data,
+                                    items[i].pkey))
+        fail ("gcry_pk_verify_batch does not match gcry_pk_verify for "
+              "item %d\n", i);
+    }
+  if (!nbad || gcry_err_code (rc) != GPG_ERR_BAD_SIGNATURE)
+    fail ("gcry_pk_verify_batch returned a wrong error: %s\n",
+          gpg_strerror (rc));
+
+  /* Without the bad items.  */
+  for (i=0; i < NITEMS; i++)
+    {
+      items[i].data = hash[i];
+      items[i].pkey = pkey[i % 2];
+    }
+  rc = gcry_pk_verify_batch (items, NITEMS, NULL);
+  if (rc)
+    fail ("gcry_pk_verify_batch failed: %s\n", gpg_strerror (rc));
+
+  for (i=0; i < NITEMS; i++)
+    {
+      gcry_sexp_release (hash[i]);
+      gcry_sexp_release (sig[i]);
+    }
+  for (i=0; i < NKEYOBJS; i++)
+    gcry_sexp_release (pkey[i]);
+  for (i=0; i < 2; i++)
+    {
+      gcry_sexp_release (skey[i]);
+      gcry_sexp_release (key[i]);
+    }
+}
+
+
 /* Run all tests for the public key functions. */
 static void
 check_pubkey (void)
@@ -2884,6 +3888,12 @@ check_pubkey (void)
           }
         check_one_pubkey (i, pubkeys[i]);
       }
+  if (!gcry_pk_test_algo (GCRY_PK_ECDSA))
+    {
+      check_ecdsa_known_signature ();
+      check_ecdsa_curves ();
+      check_pk_verify_batch ();
+    }
   if (verbose)
     fprintf (stderr, "Completed public key checks.\n");
 
@@ -2952,6 +3962,17 @@ main (int argc, char **argv)
           die_on_error = 1;
           argc--; argv++;
         }
+      else if (!strcmp (*argv, "--disable-hwf"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              if (gcry_control (GCRYCTL_DISABLE_HWF, *argv, NULL))
+                fprintf (stderr, "basic: unknown hardware feature `%s'"
+                         " - option ignored\n", *argv);
+              argc--; argv++;
+            }
+        }
     }
 
   gcry_control (GCRYCTL_SET_VERBOSITY, (int)verbose);
@@ -2984,7 +4005,9 @@ main (int argc, char **argv)
       check_ciphers ();
       check_cipher_modes ();
       check_bulk_cipher_modes ();
+      check_cipher_copy ();
       check_digests ();
+      check_digest_batch ();
       check_hmac ();
       check_pubkey ();
     }
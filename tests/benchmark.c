@@ -377,6 +377,7 @@ static void
 random_bench (int very_strong)
 {
   char buf[128];
+  char *bigbuf;
   int i;
 
   printf ("%-10s", "random");
@@ -388,6 +389,14 @@ random_bench (int very_strong)
         gcry_randomize (buf, sizeof buf, GCRY_STRONG_RANDOM);
       stop_timer ();
       printf (" %s", elapsed_time ());
+
+      bigbuf = gcry_xmalloc (16384);
+      start_timer ();
+      for (i=0; i < 100; i++)
+        gcry_randomize (bigbuf, 16384, GCRY_STRONG_RANDOM);
+      stop_timer ();
+      printf (" %s", elapsed_time ());
+      gcry_free (bigbuf);
     }
 
   start_timer ();
@@ -510,6 +519,24 @@ md_bench ( const char *algoname )
       gcry_md_hash_buffer (algo, digest, largebuf, 10000);
   stop_timer ();
   printf (" %s", elapsed_time ());
+
+  /* The same amount of data as 100 independent messages in one call
+     to the batch function.  */
+  {
+    gcry_md_batch_item_t items[100];
+
+    for (i=0; i < 100; i++)
+      {
+        items[i].buffer = largebuf;
+        items[i].length = 10000;
+        items[i].digest = digest;
+      }
+    start_timer ();
+    for (repcount=0; repcount < hash_repetitions; repcount++)
+      gcry_md_hash_batch (algo, items, 100);
+    stop_timer ();
+    printf (" %s", elapsed_time ());
+  }
   free (largebuf_base);
 
   putchar ('\n');
@@ -523,7 +550,7 @@ cipher_bench ( const char *algoname )
   int algo;
   gcry_cipher_hd_t hd;
   int i;
-  int keylen, blklen;
+  int keylen, blklen, modekeylen;
   char key[128];
   char *outbuf, *buf;
   char *raw_outbuf, *raw_buf;
@@ -535,6 +562,8 @@ cipher_bench ( const char *algoname )
     { GCRY_CIPHER_MODE_CFB, "      CFB", 0 },
     { GCRY_CIPHER_MODE_OFB, "      OFB", 0 },
     { GCRY_CIPHER_MODE_CTR, "      CTR", 0 },
+    { GCRY_CIPHER_MODE_GCM, "      GCM", 0 },
+    { GCRY_CIPHER_MODE_XTS, "      XTS", 0 },
     { GCRY_CIPHER_MODE_STREAM, "", 0 },
     {0}
   };
@@ -600,13 +629,13 @@ cipher_bench ( const char *algoname )
 	       algoname);
       exit (1);
     }
-  if ( keylen > sizeof key )
+  if ( 2 * keylen > sizeof key )
     {
         fprintf (stderr, PGM ": algo %d, keylength problem (%d)\n",
                  algo, keylen );
         exit (1);
     }
-  for (i=0; i < keylen; i++)
+  for (i=0; i < 2 * keylen; i++)
     key[i] = i + (clock () & 0xff);
 
   blklen = gcry_cipher_get_algo_blklen (algo);
@@ -626,6 +655,19 @@ cipher_bench ( const char *algoname )
           | (blklen == 1 && modes[modeidx].mode != GCRY_CIPHER_MODE_STREAM))
         continue;
 
+      /* GCM and XTS are only defined for 128 bit block ciphers.  */
+      if (blklen != 16 && (modes[modeidx].mode == GCRY_CIPHER_MODE_GCM
+                           || modes[modeidx].mode == GCRY_CIPHER_MODE_XTS))
+        {
+          printf ("%16s", "");
+          continue;
+        }
+
+      /* XTS takes two keys.  */
+      modekeylen = keylen;
+      if (modes[modeidx].mode == GCRY_CIPHER_MODE_XTS)
+        modekeylen *= 2;
+
       for (i=0; i < sizeof buf; i++)
         buf[i] = i;
 
@@ -638,7 +680,7 @@ cipher_bench ( const char *algoname )
 
       if (!cipher_with_keysetup)
         {
-          err = gcry_cipher_setkey (hd, key, keylen);
+          err = gcry_cipher_setkey (hd, key, modekeylen);
           if (err)
             {
               fprintf (stderr, "gcry_cipher_setkey failed: %s\n",
@@ -657,7 +699,7 @@ cipher_bench ( const char *algoname )
         {
           if (cipher_with_keysetup)
             {
-              err = gcry_cipher_setkey (hd, key, keylen);
+              err = gcry_cipher_setkey (hd, key, modekeylen);
               if (err)
                 {
                   fprintf (stderr, "gcry_cipher_setkey failed: %s\n",
@@ -666,7 +708,11 @@ cipher_bench ( const char *algoname )
                   exit (1);
                 }
             }
-          err = gcry_cipher_encrypt ( hd, outbuf, buflen, buf, buflen);
+          /* GCM requires an IV for each message.  */
+          if (modes[modeidx].mode == GCRY_CIPHER_MODE_GCM)
+            err = gcry_cipher_setiv (hd, key, 12);
+          if (!err)
+            err = gcry_cipher_encrypt ( hd, outbuf, buflen, buf, buflen);
         }
       stop_timer ();
 
@@ -689,7 +735,7 @@ cipher_bench ( const char *algoname )
 
       if (!cipher_with_keysetup)
         {
-          err = gcry_cipher_setkey (hd, key, keylen);
+          err = gcry_cipher_setkey (hd, key, modekeylen);
           if (err)
             {
               fprintf (stderr, "gcry_cipher_setkey failed: %s\n",
@@ -704,7 +750,7 @@ cipher_bench ( const char *algoname )
         {
           if (cipher_with_keysetup)
             {
-              err = gcry_cipher_setkey (hd, key, keylen);
+              err = gcry_cipher_setkey (hd, key, modekeylen);
               if (err)
                 {
                   fprintf (stderr, "gcry_cipher_setkey failed: %s\n",
@@ -713,7 +759,11 @@ cipher_bench ( const char *algoname )
                   exit (1);
                 }
             }
-          err = gcry_cipher_decrypt ( hd, outbuf, buflen,  buf, buflen);
+          /* GCM requires an IV for each message.  */
+          if (modes[modeidx].mode == GCRY_CIPHER_MODE_GCM)
+            err = gcry_cipher_setiv (hd, key, 12);
+          if (!err)
+            err = gcry_cipher_decrypt ( hd, outbuf, buflen,  buf, buflen);
         }
       stop_timer ();
       printf (" %s", elapsed_time ());
@@ -966,8 +1016,8 @@ ecc_bench (int iterations, int print_header)
   int testno;
 
   if (print_header)
-    printf ("Algorithm         generate %4d*sign %4d*verify\n"
-            "------------------------------------------------\n",
+    printf ("Algorithm         generate %4d*sign %4d*verify   batch\n"
+            "--------------------------------------------------------\n",
             iterations, iterations );
   for (testno=0; testno < DIM (p_sizes); testno++)
     {
@@ -975,6 +1025,7 @@ ecc_bench (int iterations, int print_header)
       gcry_mpi_t x;
       gcry_sexp_t data;
       gcry_sexp_t sig = NULL;
+      gcry_pk_verify_item_t *items;
       int count;
 
       printf ("ECDSA %3d bit ", p_sizes[testno]);
@@ -1037,8 +1088,24 @@ ecc_bench (int iterations, int print_header)
             }
         }
       stop_timer ();
-      printf ("     %s\n", elapsed_time ());
+      printf ("     %s", elapsed_time ());
+      fflush (stdout);
+
+      items = gcry_xcalloc (iterations, sizeof *items);
+      for (count=0; count < iterations; count++)
+        {
+          items[count].sigval = sig;
+          items[count].data = data;
+          items[count].pkey = pub_key;
+        }
+      start_timer ();
+      err = gcry_pk_verify_batch (items, iterations, NULL);
+      if (err)
+        die ("batch verify failed: %s\n", gpg_strerror (err));
+      stop_timer ();
+      printf ("  %s\n", elapsed_time ());
       fflush (stdout);
+      gcry_free (items);
 
       gcry_sexp_release (sig);
       gcry_sexp_release (data);
@@ -1119,6 +1186,7 @@ main( int argc, char **argv )
   int last_argc = -1;
   int no_blinding = 0;
   int use_random_daemon = 0;
+  int use_random_drbg = 0;
   int with_progress = 0;
 
   buffer_alignment = 1;
@@ -1151,6 +1219,11 @@ main( int argc, char **argv )
           use_random_daemon = 1;
           argc--; argv++;
         }
+      else if (!strcmp (*argv, "--use-random-drbg"))
+        {
+          use_random_drbg = 1;
+          argc--; argv++;
+        }
       else if (!strcmp (*argv, "--no-blinding"))
         {
           no_blinding = 1;
@@ -1237,6 +1310,9 @@ main( int argc, char **argv )
   if (use_random_daemon)
     gcry_control (GCRYCTL_USE_RANDOM_DAEMON, 1);
 
+  if (use_random_drbg && gcry_control (GCRYCTL_USE_RANDOM_DRBG, 1))
+    die ("the CTR_DRBG is not available\n");
+
   if (with_progress)
     gcry_set_progress_handler (progress_cb, NULL);
 
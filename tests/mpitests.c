@@ -277,6 +277,173 @@ test_powm (void)
 }
 
 
+/* Check the Karatsuba and Toom-3 code by comparing products and
+   squares computed with different thresholds to the result of the
+   schoolbook multiplication.  */
+static int
+test_mul_thresholds (void)
+{
+  static const int thresholds[][4] = {
+    { 2, 2, 5, 5 }, { 3, 2, 9, 6 }, { 8, 8, 24, 20 }, { 0, 0, 0, 0 }
+  };
+  static const unsigned int sizes[][2] = {
+    { 64, 64 }, { 320, 320 }, { 383, 300 }, { 450, 390 }, { 1000, 1000 },
+    { 1000, 70 }, { 2048, 2048 }, { 4100, 4100 }, { 8192, 3000 },
+    { 16384, 16384 }
+  };
+  gcry_mpi_t u, v, w, ref, ucopy;
+  int i, j, k;
+
+  if (!gcry_control (GCRYCTL_SET_MPI_THRESHOLDS, 2, 2, 4, 5))
+    die ("test_mul_thresholds: a too small threshold was accepted\n");
+
+  u = gcry_mpi_new (0);
+  v = gcry_mpi_new (0);
+  w = gcry_mpi_new (0);
+  ref = gcry_mpi_new (0);
+
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+    for (j = 0; j < 2; j++)
+      {
+        if (j)
+          {
+            /* All bits set to check the carry handling.  */
+            gcry_mpi_set_ui (u, 1);
+            gcry_mpi_mul_2exp (u, u, sizes[i][0]);
+            gcry_mpi_sub_ui (u, u, 1);
+            gcry_mpi_set_ui (v, 1);
+            gcry_mpi_mul_2exp (v, v, sizes[i][1]);
+            gcry_mpi_sub_ui (v, v, 1);
+          }
+        else
+          {
+            gcry_mpi_randomize (u, sizes[i][0], GCRY_WEAK_RANDOM);
+            gcry_mpi_randomize (v, sizes[i][1], GCRY_WEAK_RANDOM);
+          }
+        /* The reference for U^2 is computed from a copy of U so that
+           it does not take the squaring code path.  */
+        ucopy = gcry_mpi_copy (u);
+
+        for (k = 0; k < sizeof thresholds / sizeof thresholds[0]; k++)
+          {
+            gcry_control (GCRYCTL_SET_MPI_THRESHOLDS, 100000, 100000,
+                          100000, 100000);
+            gcry_mpi_mul (ref, u, v);
+            if (gcry_control (GCRYCTL_SET_MPI_THRESHOLDS,
+                              thresholds[k][0], thresholds[k][1],
+                              thresholds[k][2], thresholds[k][3]))
+              die ("test_mul_thresholds: setting the thresholds failed\n");
+            gcry_mpi_mul (w, u, v);
+            if (gcry_mpi_cmp (w, ref))
+              die ("test_mul_thresholds failed for size %u/%u (%d)\n",
+                   sizes[i][0], sizes[i][1], k);
+
+            gcry_control (GCRYCTL_SET_MPI_THRESHOLDS, 100000, 100000,
+                          100000, 100000);
+            gcry_mpi_mul (ref, u, ucopy);
+            gcry_control (GCRYCTL_SET_MPI_THRESHOLDS,
+                          thresholds[k][0], thresholds[k][1],
+                          thresholds[k][2], thresholds[k][3]);
+            gcry_mpi_mul (w, u, u);
+            if (gcry_mpi_cmp (w, ref))
+              die ("test_mul_thresholds failed for size %u squared (%d)\n",
+                   sizes[i][0], k);
+          }
+        gcry_mpi_release (ucopy);
+      }
+
+  gcry_mpi_release (u);
+  gcry_mpi_release (v);
+  gcry_mpi_release (w);
+  gcry_mpi_release (ref);
+  return 1;
+}
+
+
+/* Compute BASE ^ EXPO mod MOD using gcry_mpi_mulm.  */
+static void
+powm_reference (gcry_mpi_t res, gcry_mpi_t base, gcry_mpi_t expo,
+                gcry_mpi_t mod)
+{
+  gcry_mpi_t b = gcry_mpi_new (0);
+  int i;
+
+  gcry_mpi_mod (b, base, mod);
+  gcry_mpi_set_ui (res, 1);
+  for (i = gcry_mpi_get_nbits (expo) - 1; i >= 0; i--)
+    {
+      gcry_mpi_mulm (res, res, res, mod);
+      if (gcry_mpi_test_bit (expo, i))
+        gcry_mpi_mulm (res, res, b, mod);
+    }
+  gcry_mpi_release (b);
+}
+
+
+/* Check gcry_mpi_powm with random arguments of different sizes for
+   odd and even moduli and for public and secret exponents.  */
+static int
+test_powm_random (void)
+{
+  static const unsigned int sizes[][2] = {
+    { 64, 3 }, { 64, 64 }, { 130, 17 }, { 192, 100 }, { 300, 300 },
+    { 512, 20 }, { 512, 512 }, { 1050, 250 }, { 1024, 1024 }, { 2100, 700 }
+  };
+  gcry_mpi_t base, expo, sexpo, mod, res, ref;
+  gcry_mpi_t zero = gcry_mpi_set_ui (NULL, 0);
+  int i, j, neg;
+
+  base = gcry_mpi_new (0);
+  expo = gcry_mpi_new (0);
+  sexpo = gcry_mpi_snew (0);
+  mod = gcry_mpi_new (0);
+  res = gcry_mpi_new (0);
+  ref = gcry_mpi_new (0);
+
+  for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+    for (j = 0; j < 4; j++)
+      {
+        gcry_mpi_randomize (mod, sizes[i][0], GCRY_WEAK_RANDOM);
+        gcry_mpi_set_highbit (mod, sizes[i][0] - 1);
+        if (j == 3)
+          gcry_mpi_clear_bit (mod, 0);
+        else
+          gcry_mpi_set_bit (mod, 0);
+        /* Sometimes use a base larger than the modulus.  */
+        gcry_mpi_randomize (base, sizes[i][0] + (j & 1) * 100,
+                            GCRY_WEAK_RANDOM);
+        gcry_mpi_randomize (expo, sizes[i][1], GCRY_WEAK_RANDOM);
+        gcry_mpi_set_highbit (expo, sizes[i][1] - 1);
+        gcry_mpi_set (sexpo, expo);
+
+        for (neg = 0; neg < 2; neg++)
+          {
+            if (neg)
+              gcry_mpi_sub (base, zero, base);
+            powm_reference (ref, base, expo, mod);
+
+            gcry_mpi_powm (res, base, expo, mod);
+            if (gcry_mpi_cmp (res, ref))
+              die ("test_powm_random failed for size %u/%u (%d)\n",
+                   sizes[i][0], sizes[i][1], j);
+            gcry_mpi_powm (res, base, sexpo, mod);
+            if (gcry_mpi_cmp (res, ref))
+              die ("test_powm_random failed for size %u/%u (%d, secret)\n",
+                   sizes[i][0], sizes[i][1], j);
+          }
+      }
+
+  gcry_mpi_release (base);
+  gcry_mpi_release (expo);
+  gcry_mpi_release (sexpo);
+  gcry_mpi_release (mod);
+  gcry_mpi_release (res);
+  gcry_mpi_release (ref);
+  gcry_mpi_release (zero);
+  return 1;
+}
+
+
 int
 main (int argc, char* argv[])
 {
@@ -295,7 +462,9 @@ main (int argc, char* argv[])
   test_add ();
   test_sub ();
   test_mul ();
+  test_mul_thresholds ();
   test_powm ();
+  test_powm_random ();
 
   return 0;
 }
@@ -0,0 +1,326 @@
+/* mpitune.c - Determine the multiplication thresholds
+ * Copyright (C) 2013 Free Software Foundation, Inc.
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program measures the crossover points between schoolbook,
+   Karatsuba and Toom-3 multiplication and squaring on the host and
+   writes them to stdout in the format of mpi/CPU/mpi-tune.h, where
+   CPU is the directory selected by mpi/config.links.  Usage:
+
+     ./mpitune > ../mpi/CPU/mpi-tune.h
+
+   and rebuild the library.  On x86-64 the squaring uses different
+   code on CPUs with BMI2 and ADX.  The thresholds for other CPUs
+   are then measured with "--disable-hwf intel-adx" and the ones for
+   the MULX code are appended with
+
+     ./mpitune --mulx >> ../mpi/amd64/mpi-tune.h
+
+   The thresholds may also be set at runtime with
+   GCRYCTL_SET_MPI_THRESHOLDS.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "../src/gcrypt.h"
+
+#define PGM "mpitune"
+
+/* The size of a limb in bits.  The limb type of Libgcrypt is an
+   unsigned long on all platforms but 64 bit Windows.  */
+#ifdef _WIN64
+# define LIMB_BITS 64
+#else
+# define LIMB_BITS (8 * (int)sizeof (unsigned long))
+#endif
+
+/* Indices into the array of thresholds; the order is the one
+   expected by GCRYCTL_SET_MPI_THRESHOLDS.  */
+enum { KARATSUBA_MUL, KARATSUBA_SQR, TOOM3_MUL, TOOM3_SQR, N_THRESHOLDS };
+
+/* A value for thresholds which are not to be reached.  */
+#define NEVER 100000
+
+/* The number of consecutive sizes the faster algorithm needs to win
+   before we take the first of them as threshold.  */
+#define STABLE 3
+
+/* The number of timing runs of which the fastest is used.  */
+#define NRUNS 7
+
+static int verbose;
+static int thresholds[N_THRESHOLDS];
+
+
+static void
+show (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  if (!verbose)
+    return;
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+}
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (1);
+}
+
+
+static void
+set_thresholds (void)
+{
+  gcry_error_t err;
+
+  err = gcry_control (GCRYCTL_SET_MPI_THRESHOLDS,
+                      thresholds[KARATSUBA_MUL], thresholds[KARATSUBA_SQR],
+                      thresholds[TOOM3_MUL], thresholds[TOOM3_SQR]);
+  if (err)
+    die ("setting the thresholds failed: %s\n", gpg_strerror (err));
+}
+
+
+/* Return an iteration count for W = U * V which takes at least
+   10ms.  */
+static unsigned long
+calibrate (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v)
+{
+  unsigned long count, i;
+  clock_t started;
+
+  for (count = 1; ; count *= 2)
+    {
+      started = clock ();
+      for (i = 0; i < count; i++)
+        gcry_mpi_mul (w, u, v);
+      if (clock () - started >= CLOCKS_PER_SEC / 100)
+        return count;
+    }
+}
+
+
+/* Return the CPU time in seconds for COUNT multiplications
+   W = U * V.  */
+static double
+measure (gcry_mpi_t w, gcry_mpi_t u, gcry_mpi_t v, unsigned long count)
+{
+  unsigned long i;
+  clock_t started;
+
+  started = clock ();
+  for (i = 0; i < count; i++)
+    gcry_mpi_mul (w, u, v);
+  return (double)(clock () - started) / CLOCKS_PER_SEC;
+}
+
+
+/* Return true if the algorithm above threshold WHICH is faster for
+   operands of SIZE limbs than the one below it.  The sizes used for
+   the recursive calls are smaller than SIZE, thus only the algorithm
+   at the top level differs.  The runs of both algorithms are
+   interleaved and the fastest run of each is used so that other
+   load on the host affects both in the same way.  */
+static int
+upper_wins (int which, int size)
+{
+  int sqr = (which == KARATSUBA_SQR || which == TOOM3_SQR);
+  gcry_mpi_t u, v, w;
+  double below = 0, above = 0, t;
+  unsigned long count;
+  int run;
+
+  u = gcry_mpi_new (size * LIMB_BITS);
+  v = gcry_mpi_new (size * LIMB_BITS);
+  w = gcry_mpi_new (2 * size * LIMB_BITS);
+  gcry_mpi_randomize (u, size * LIMB_BITS, GCRY_WEAK_RANDOM);
+  gcry_mpi_set_bit (u, size * LIMB_BITS - 1);
+  gcry_mpi_randomize (v, size * LIMB_BITS, GCRY_WEAK_RANDOM);
+  gcry_mpi_set_bit (v, size * LIMB_BITS - 1);
+
+  thresholds[which] = size + 1;
+  set_thresholds ();
+  count = calibrate (w, u, sqr? u : v);
+
+  for (run = 0; run < NRUNS; run++)
+    {
+      thresholds[which] = size + 1;
+      set_thresholds ();
+      t = measure (w, u, sqr? u : v, count);
+      if (!run || t < below)
+        below = t;
+
+      thresholds[which] = size;
+      set_thresholds ();
+      t = measure (w, u, sqr? u : v, count);
+      if (!run || t < above)
+        above = t;
+    }
+
+  show ("%-14s %4d limbs: %9.0f ns %9.0f ns\n",
+        which == KARATSUBA_MUL? "karatsuba-mul" :
+        which == KARATSUBA_SQR? "karatsuba-sqr" :
+        which == TOOM3_MUL?     "toom3-mul" : "toom3-sqr",
+        size, below * 1e9 / count, above * 1e9 / count);
+
+  gcry_mpi_release (u);
+  gcry_mpi_release (v);
+  gcry_mpi_release (w);
+  return above < below;
+}
+
+
+/* Return the threshold WHICH: The first of STABLE consecutive sizes
+   from START on for which the upper algorithm is faster.  */
+static int
+find_threshold (int which, int start, int limit)
+{
+  int size, first = 0, wins = 0;
+
+  for (size = start; size < limit; size += 1 + size / 32)
+    {
+      if (upper_wins (which, size))
+        {
+          if (!wins++)
+            first = size;
+          if (wins == STABLE)
+            break;
+        }
+      else
+        wins = 0;
+    }
+  if (wins < STABLE)
+    first = limit;
+
+  thresholds[which] = first;
+  set_thresholds ();
+  return first;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int limit = 512;
+  int mulx = 0;
+  time_t now;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--mulx"))
+        {
+          mulx = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--disable-hwf"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              if (gcry_control (GCRYCTL_DISABLE_HWF, *argv, NULL))
+                fprintf (stderr, PGM ": unknown hardware feature `%s'"
+                         " - option ignored\n", *argv);
+              argc--; argv++;
+            }
+        }
+      else if (!strcmp (*argv, "--limit"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              limit = atoi (*argv);
+              argc--; argv++;
+            }
+        }
+    }
+  if (limit < 8)
+    die ("limit is too small\n");
+
+  if (!gcry_check_version (GCRYPT_VERSION))
+    die ("version mismatch\n");
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  /* Disable Toom-3 while looking for the Karatsuba thresholds.  */
+  thresholds[KARATSUBA_MUL] = NEVER;
+  thresholds[KARATSUBA_SQR] = NEVER;
+  thresholds[TOOM3_MUL] = NEVER;
+  thresholds[TOOM3_SQR] = NEVER;
+
+  if (!mulx)
+    find_threshold (KARATSUBA_MUL, 2, limit);
+  find_threshold (KARATSUBA_SQR, 2, limit);
+  if (!mulx)
+    find_threshold (TOOM3_MUL, thresholds[KARATSUBA_MUL] > 5?
+                    thresholds[KARATSUBA_MUL] : 5, limit);
+  find_threshold (TOOM3_SQR, thresholds[KARATSUBA_SQR] > 5?
+                  thresholds[KARATSUBA_SQR] : 5, limit);
+
+  if (mulx)
+    {
+      printf ("\n/* The squaring thresholds for CPUs with BMI2"
+              " and ADX.  */\n");
+      printf ("#define KARATSUBA_SQR_THRESHOLD_MULX %4d\n",
+              thresholds[KARATSUBA_SQR]);
+      printf ("#define TOOM3_SQR_THRESHOLD_MULX     %4d\n",
+              thresholds[TOOM3_SQR]);
+      return 0;
+    }
+
+  now = time (NULL);
+  printf ("/* mpi-tune.h - Multiplication thresholds\n"
+          " * Generated by tests/mpitune for %d bit limbs on %s"
+          " */\n\n", LIMB_BITS, ctime (&now));
+  printf ("#define KARATSUBA_THRESHOLD      %4d\n",
+          thresholds[KARATSUBA_MUL]);
+  printf ("#define KARATSUBA_SQR_THRESHOLD  %4d\n",
+          thresholds[KARATSUBA_SQR]);
+  printf ("#define TOOM3_MUL_THRESHOLD      %4d\n",
+          thresholds[TOOM3_MUL]);
+  printf ("#define TOOM3_SQR_THRESHOLD      %4d\n",
+          thresholds[TOOM3_SQR]);
+
+  return 0;
+}
@@ -56,6 +56,7 @@ check_primes (void)
     {
       { 1024, 100, GCRY_PRIME_FLAG_SPECIAL_FACTOR },
       { 128, 0, 0 },
+      { 48, 0, 0 },
       { 0 },
     };
 
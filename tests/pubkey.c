@@ -24,6 +24,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_PTHREAD
+# include <errno.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+#endif
 
 
 #include "../src/gcrypt.h"
@@ -856,6 +863,352 @@ check_x931_derived_key (int what)
 
 
 
+#ifdef HAVE_PTHREAD
+static int
+th_init (void)
+{
+  return 0;
+}
+
+static int
+th_mutex_init (void **priv)
+{
+  pthread_mutex_t *lock = malloc (sizeof *lock);
+
+  if (!lock)
+    return ENOMEM;
+  pthread_mutex_init (lock, NULL);
+  *priv = lock;
+  return 0;
+}
+
+static int
+th_mutex_destroy (void **priv)
+{
+  pthread_mutex_destroy (*priv);
+  free (*priv);
+  return 0;
+}
+
+static int
+th_mutex_lock (void **priv)
+{
+  return pthread_mutex_lock (*priv);
+}
+
+static int
+th_mutex_unlock (void **priv)
+{
+  return pthread_mutex_unlock (*priv);
+}
+
+/* The callbacks for POSIX threads in the layout expected by
+   GCRYCTL_SET_THREAD_CBS; the I/O functions are not needed.  */
+static struct
+{
+  unsigned int option;
+  int (*init) (void);
+  int (*mutex_init) (void **priv);
+  int (*mutex_destroy) (void **priv);
+  int (*mutex_lock) (void **priv);
+  int (*mutex_unlock) (void **priv);
+  void *io_functions[8];
+} pthread_cbs =
+  {
+    3 | (1 << 8),  /* GCRY_THREAD_OPTION_PTHREAD, version 1.  */
+    th_init, th_mutex_init, th_mutex_destroy,
+    th_mutex_lock, th_mutex_unlock
+  };
+
+
+static int stocked_primes;
+
+/* Log handler picking up the number of stocked secret primes from
+   the output of GCRYCTL_DUMP_SECMEM_STATS.  */
+static void
+stock_log_handler (void *opaque, int level, const char *fmt, va_list arg_ptr)
+{
+  char line[256];
+  int n, size;
+
+  (void)opaque;
+  (void)level;
+  vsnprintf (line, sizeof line, fmt, arg_ptr);
+  if (sscanf (line, "prime stock: %d/%d secret primes", &n, &size) == 2)
+    stocked_primes = n;
+}
+
+
+/* Wait up to a minute until at least N secret primes are stocked.  */
+static int
+wait_for_stock (int n)
+{
+  int i;
+
+  for (i = 0; i < 6000; i++)
+    {
+      stocked_primes = -1;
+      gcry_set_log_handler (stock_log_handler, NULL);
+      gcry_control (GCRYCTL_DUMP_SECMEM_STATS);
+      gcry_set_log_handler (NULL, NULL);
+      if (stocked_primes >= n)
+        return 1;
+      usleep (10000);
+    }
+  return 0;
+}
+
+
+/* Generate an RSA key and store its primes at R_P and R_Q.  */
+static void
+get_stocked_primes (gcry_mpi_t *r_p, gcry_mpi_t *r_q)
+{
+  gcry_sexp_t key_spec, key;
+  int rc;
+
+  rc = gcry_sexp_new (&key_spec, "(genkey (rsa (nbits 4:1024)))", 0, 1);
+  if (rc)
+    die ("error creating S-expression: %s\n", gcry_strerror (rc));
+  rc = gcry_pk_genkey (&key, key_spec);
+  gcry_sexp_release (key_spec);
+  if (rc)
+    die ("error generating RSA key: %s\n", gcry_strerror (rc));
+  *r_p = key_param_from_sexp (key, "private-key", "p");
+  *r_q = key_param_from_sexp (key, "private-key", "q");
+  if (!*r_p || !*r_q)
+    die ("RSA key without p or q\n");
+  gcry_sexp_release (key);
+}
+
+
+/* Read an MPI in hex format terminated by a linefeed from FP.  */
+static gcry_mpi_t
+read_mpi_line (FILE *fp)
+{
+  char line[1024];
+  gcry_mpi_t a;
+
+  if (!fgets (line, sizeof line, fp))
+    return NULL;
+  line[strcspn (line, "\n")] = 0;
+  if (gcry_mpi_scan (&a, GCRYMPI_FMT_HEX, line, 0, NULL))
+    return NULL;
+  return a;
+}
+
+
+/* Fork while the background thread refills the stock.  The children
+   must be able to use the secure memory and the RNG, whose locks may
+   not be held by the thread at the time of the fork.  */
+static void
+check_fork_during_refill (void)
+{
+  pid_t pid;
+  int i, n, status;
+  void *p;
+
+  if (gcry_control (GCRYCTL_SET_KEYGEN_STOCK, 64))
+    die ("GCRYCTL_SET_KEYGEN_STOCK failed with thread callbacks\n");
+  for (n = 0; n < 200; n++)
+    {
+      pid = fork ();
+      if (pid == (pid_t)(-1))
+        die ("fork failed: %s\n", strerror (errno));
+      if (!pid)
+        {
+          alarm (5);
+          p = gcry_malloc_secure (64);
+          if (!p)
+            exit (1);
+          gcry_randomize (p, 64, GCRY_STRONG_RANDOM);
+          gcry_free (p);
+          exit (0);
+        }
+      while ((i = waitpid (pid, &status, 0)) == -1 && errno == EINTR)
+        ;
+      if (i == (pid_t)(-1) || !WIFEXITED (status) || WEXITSTATUS (status))
+        die ("child %d forked during the refill failed\n", n);
+    }
+}
+
+
+/* The stocked primes must not be used by both the parent and the
+   child after a fork, and the child needs to refill its stock.  */
+static void
+check_stock_fork (void)
+{
+  gcry_mpi_t p, q, cp, cq;
+  pid_t pid;
+  int fd[2];
+  int i, status;
+  FILE *fp;
+  char line[1024];
+
+  if (gcry_control (GCRYCTL_SET_KEYGEN_STOCK, 4))
+    die ("GCRYCTL_SET_KEYGEN_STOCK failed with thread callbacks\n");
+  /* The first key creates the stock.  */
+  get_stocked_primes (&p, &q);
+  gcry_mpi_release (p);
+  gcry_mpi_release (q);
+  if (!wait_for_stock (4))
+    die ("the prime stock has not been filled\n");
+
+  if (pipe (fd) == -1)
+    die ("pipe failed: %s\n", strerror (errno));
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    die ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      close (fd[0]);
+      get_stocked_primes (&p, &q);
+      fp = fdopen (fd[1], "w");
+      if (!fp)
+        die ("fdopen failed: %s\n", strerror (errno));
+      gcry_mpi_print (GCRYMPI_FMT_HEX, (unsigned char *)line, sizeof line,
+                      NULL, p);
+      fprintf (fp, "%s\n", line);
+      gcry_mpi_print (GCRYMPI_FMT_HEX, (unsigned char *)line, sizeof line,
+                      NULL, q);
+      fprintf (fp, "%s\n", line);
+      fclose (fp);
+      if (!wait_for_stock (1))
+        die ("the prime stock of the child is not refilled\n");
+      exit (0);
+    }
+  close (fd[1]);
+  get_stocked_primes (&p, &q);
+
+  fp = fdopen (fd[0], "r");
+  if (!fp)
+    die ("fdopen failed: %s\n", strerror (errno));
+  cp = read_mpi_line (fp);
+  cq = read_mpi_line (fp);
+  if (!cp || !cq)
+    die ("reading the primes of the child failed\n");
+  fclose (fp);
+
+  while ((i = waitpid (pid, &status, 0)) == -1 && errno == EINTR)
+    ;
+  if (i == (pid_t)(-1) || !WIFEXITED (status) || WEXITSTATUS (status))
+    die ("child failed\n");
+
+  if (!gcry_mpi_cmp (p, cp) || !gcry_mpi_cmp (p, cq)
+      || !gcry_mpi_cmp (q, cp) || !gcry_mpi_cmp (q, cq))
+    die ("parent and child got the same prime from the stock\n");
+
+  gcry_mpi_release (p);
+  gcry_mpi_release (q);
+  gcry_mpi_release (cp);
+  gcry_mpi_release (cq);
+
+  check_fork_during_refill ();
+}
+
+
+/* The keys generated with the helper threads must be the same as
+   without them, and a child needs to start its own helpers after a
+   fork.  */
+static void
+check_keygen_threads (void)
+{
+  gcry_sexp_t pkey, skey;
+  pid_t pid;
+  int i, status;
+
+  for (i = 0; i < 4; i++)
+    check_x931_derived_key (i);
+  if (gcry_control (GCRYCTL_SET_KEYGEN_THREADS, 4))
+    die ("GCRYCTL_SET_KEYGEN_THREADS failed with thread callbacks\n");
+  for (i = 0; i < 4; i++)
+    check_x931_derived_key (i);
+
+  get_keys_new (&pkey, &skey);
+  check_keys (pkey, skey, 800, 0);
+  gcry_sexp_release (pkey);
+  gcry_sexp_release (skey);
+  get_dsa_key_new (&pkey, &skey, 0);
+  gcry_sexp_release (pkey);
+  gcry_sexp_release (skey);
+
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    die ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      alarm (60);
+      get_keys_new (&pkey, &skey);
+      check_keys (pkey, skey, 800, 0);
+      gcry_sexp_release (pkey);
+      gcry_sexp_release (skey);
+      exit (0);
+    }
+  while ((i = waitpid (pid, &status, 0)) == -1 && errno == EINTR)
+    ;
+  if (i == (pid_t)(-1) || !WIFEXITED (status) || WEXITSTATUS (status))
+    die ("generating a key with helper threads after a fork failed\n");
+
+  if (gcry_control (GCRYCTL_SET_KEYGEN_THREADS, 1))
+    die ("GCRYCTL_SET_KEYGEN_THREADS failed\n");
+}
+
+
+/* Run the checks requiring the callbacks for POSIX threads.  This
+   runs in a process of its own because the callbacks need to be
+   installed before Libgcrypt is initialized.  */
+static void
+thread_cbs_process (void)
+{
+  gcry_sexp_t key_spec, key;
+  int rc;
+
+  gcry_control (GCRYCTL_SET_THREAD_CBS, &pthread_cbs);
+  if (!gcry_check_version (GCRYPT_VERSION))
+    die ("version mismatch\n");
+  gcry_control (GCRYCTL_DISABLE_SECMEM_WARN);
+  gcry_control (GCRYCTL_INIT_SECMEM, 65536, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+
+  check_keygen_threads ();
+  check_stock_fork ();
+
+  /* Terminating the secure memory needs to wait for the background
+     thread, which is now generating primes for the next 2048 bit
+     key.  */
+  rc = gcry_sexp_new (&key_spec, "(genkey (rsa (nbits 4:2048)))", 0, 1);
+  if (rc)
+    die ("error creating S-expression: %s\n", gcry_strerror (rc));
+  rc = gcry_pk_genkey (&key, key_spec);
+  gcry_sexp_release (key_spec);
+  if (rc)
+    die ("error generating RSA key: %s\n", gcry_strerror (rc));
+  gcry_sexp_release (key);
+  gcry_control (GCRYCTL_TERM_SECMEM);
+}
+
+
+static void
+check_thread_cbs (void)
+{
+  pid_t pid;
+  int i, status;
+
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    die ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      thread_cbs_process ();
+      exit (0);
+    }
+  while ((i = waitpid (pid, &status, 0)) == -1 && errno == EINTR)
+    ;
+  if (i == (pid_t)(-1) || !WIFEXITED (status) || WEXITSTATUS (status))
+    die ("checking with the thread callbacks failed\n");
+}
+#endif /*HAVE_PTHREAD*/
+
 
 int
 main (int argc, char **argv)
@@ -871,6 +1224,11 @@ main (int argc, char **argv)
       debug = 1;
     }
 
+#ifdef HAVE_PTHREAD
+  /* This needs to be done before Libgcrypt is initialized.  */
+  check_thread_cbs ();
+#endif
+
   gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
   if (!gcry_check_version (GCRYPT_VERSION))
     die ("version mismatch\n");
@@ -886,5 +1244,16 @@ main (int argc, char **argv)
   for (i=0; i < 4; i++)
     check_x931_derived_key (i);
 
+  /* Without the callbacks for POSIX threads the primes can't be
+     searched on several threads nor stocked up in the background.  */
+  if (!gcry_control (GCRYCTL_SET_KEYGEN_THREADS, 4))
+    die ("GCRYCTL_SET_KEYGEN_THREADS succeeded without thread callbacks\n");
+  if (gcry_control (GCRYCTL_SET_KEYGEN_THREADS, 1))
+    die ("GCRYCTL_SET_KEYGEN_THREADS failed\n");
+  if (!gcry_control (GCRYCTL_SET_KEYGEN_STOCK, 2))
+    die ("GCRYCTL_SET_KEYGEN_STOCK succeeded without thread callbacks\n");
+  if (gcry_control (GCRYCTL_SET_KEYGEN_STOCK, 0))
+    die ("GCRYCTL_SET_KEYGEN_STOCK failed\n");
+
   return 0;
 }
@@ -224,6 +224,39 @@ check_nonce_forking (void)
 
 
 
+/* Check the CTR_DRBG with requests crossing its internal request
+   limit.  */
+static void
+check_drbg (void)
+{
+  size_t buflen = 200000;
+  unsigned char *buf1, *buf2;
+  unsigned char nonce[10];
+  size_t i;
+
+  buf1 = gcry_xmalloc (buflen);
+  buf2 = gcry_xmalloc (buflen);
+
+  gcry_randomize (buf1, buflen, GCRY_STRONG_RANDOM);
+  gcry_randomize (buf2, buflen, GCRY_STRONG_RANDOM);
+  if (!memcmp (buf1, buf2, buflen))
+    die ("DRBG returned the same random twice\n");
+  for (i = 0; i < buflen - 16; i += 16)
+    if (!memcmp (buf1 + i, buf1 + i + 16, 16))
+      die ("DRBG output repeats at offset %u\n", (unsigned int)i);
+
+  gcry_randomize (buf1, 17, GCRY_VERY_STRONG_RANDOM);
+  if (verbose)
+    print_hex ("very strong random: ", buf1, 17);
+  gcry_create_nonce (nonce, sizeof nonce);
+  if (verbose)
+    print_hex ("nonce: ", nonce, sizeof nonce);
+
+  gcry_free (buf1);
+  gcry_free (buf2);
+}
+
+
 
 
 int
@@ -249,5 +282,18 @@ main (int argc, char **argv)
   check_forking ();
   check_nonce_forking ();
 
+  if (gcry_control (GCRYCTL_USE_RANDOM_DRBG, 1))
+    {
+      if (verbose)
+        fprintf (stderr, "CTR_DRBG not available - skipped\n");
+    }
+  else
+    {
+      check_drbg ();
+      check_forking ();
+      check_nonce_forking ();
+      gcry_control (GCRYCTL_USE_RANDOM_DRBG, 0);
+    }
+
   return 0;
 }
@@ -857,7 +857,7 @@ check_openpgp (void)
 static void
 check_pbkdf2 (void)
 {
-  /* Test vectors are from RFC-6070.  */
+  /* Test vectors are from RFC-6070 and RFC-7914.  */
   static struct {
     const char *p;   /* Passphrase.  */
     size_t plen;     /* Length of P. */
@@ -867,6 +867,7 @@ check_pbkdf2 (void)
     int dklen;       /* Requested key length.  */
     const char *dk;  /* Derived key.  */
     int disabled;
+    int hashalgo;    /* Hash algorithm; 0 for SHA-1.  */
   } tv[] = {
     {
       "password", 8,
@@ -926,10 +927,95 @@ check_pbkdf2 (void)
       "\x13\x3a\x4c\xe8\x37\xb4\xd2\x52\x1e\xe2"
       "\xbf\x03\xe1\x1c\x71\xca\x79\x4e\x07\x97"
     },
+    {
+      "passwd", 6,
+      "salt", 4,
+      1,
+      64,
+      "\x55\xac\x04\x6e\x56\xe3\x08\x9f\xec\x16"
+      "\x91\xc2\x25\x44\xb6\x05\xf9\x41\x85\x21"
+      "\x6d\xde\x04\x65\xe6\x8b\x9d\x57\xc2\x0d"
+      "\xac\xbc\x49\xca\x9c\xcc\xf1\x79\xb6\x45"
+      "\x99\x16\x64\xb3\x9d\x77\xef\x31\x7c\x71"
+      "\xb8\x45\xb1\xe3\x0b\xd5\x09\x11\x20\x41"
+      "\xd3\xa1\x97\x83",
+      0, GCRY_MD_SHA256
+    },
+    {
+      "Password", 8,
+      "NaCl", 4,
+      80000,
+      64,
+      "\x4d\xdc\xd8\xf6\x0b\x98\xbe\x21\x83\x0c"
+      "\xee\x5e\xf2\x27\x01\xf9\x64\x1a\x44\x18"
+      "\xd0\x4c\x04\x14\xae\xff\x08\x87\x6b\x34"
+      "\xab\x56\xa1\xd4\x25\xa1\x22\x58\x33\x54"
+      "\x9a\xdb\x84\x1b\x51\xc9\xb3\x17\x6a\x27"
+      "\x2b\xde\xbb\xa1\xd0\x78\x47\x8f\x62\xb3"
+      "\x97\xf3\x3c\x8d",
+      0, GCRY_MD_SHA256
+    },
+    { /* 9 blocks to check the parallel computation of the blocks,
+         not in an RFC.  */
+      "password", 8,
+      "salt", 4,
+      2,
+      168,
+      "\xea\x6c\x01\x4d\xc7\x2d\x6f\x8c\xcd\x1e"
+      "\xd9\x2a\xce\x1d\x41\xf0\xd8\xde\x89\x57"
+      "\xca\xe9\x31\x36\x26\x65\x37\xa8\xd7\xbf"
+      "\x4b\x76\xc5\x10\x94\xcc\x1a\xe0\x10\xb1"
+      "\x99\x23\xdd\xc4\x39\x5c\xd0\x64\xac\xb0"
+      "\x23\xff\xd1\xed\xd5\xef\x4b\xe8\xff\xe6"
+      "\x14\x26\xc2\x8e\xfa\x15\x8b\x83\xac\x87"
+      "\x3b\x4d\x3c\x4e\xbb\x33\xc1\x14\x63\xfe"
+      "\xdf\x57\x04\x1b\x01\x63\x7f\xef\xe5\xbc"
+      "\x7b\x9f\x11\x8d\xa1\x90\x06\x70\x31\x2f"
+      "\xf4\x6c\xd4\xde\xd2\x09\x94\xed\x36\x7f"
+      "\xc5\x61\xc0\x6d\xa4\xbc\xc2\x50\xd8\x1c"
+      "\x85\x19\xcb\xe3\x0a\xca\xc9\x6c\x16\x08"
+      "\x5c\xd2\xed\xae\xc2\x93\xb0\x2c\x9f\x64"
+      "\x43\x7c\xa3\x7f\xa4\x22\x2a\xfe\x14\x7a"
+      "\xbc\x79\x5d\xdb\xe5\xef\xab\x1c\x7d\xbf"
+      "\x60\x81\xa3\x5e\x55\xa8\x47\x06"
+    },
+    { /* 4 blocks, not in an RFC.  */
+      "password", 8,
+      "salt", 4,
+      3,
+      256,
+      "\xb6\xb0\x7c\xb2\xce\xbf\x4a\xd8\x44\x68"
+      "\x39\x1a\x54\x38\x24\xfc\xcf\xfe\x0e\x07"
+      "\x69\xdb\xe6\xbd\xdf\x10\xa6\x56\x73\xc4"
+      "\xb6\x48\xe6\x12\xd4\x49\x18\xf9\xce\x9a"
+      "\x19\xa1\x29\x4c\xf5\x14\x06\x28\x08\x4b"
+      "\xa9\x94\xc3\xb2\x1a\x4e\xf4\x74\x12\x20"
+      "\xb8\x11\xc6\x33\xcf\xc0\x64\x1f\xcc\xbc"
+      "\xc4\x16\x4f\x1b\xbf\xcb\x1f\x33\xf5\x95"
+      "\xae\x9a\xa4\xa3\x3d\xdc\xce\x57\x01\x57"
+      "\x77\x59\x80\x36\x2c\x0e\xe2\x8a\xa3\x40"
+      "\xc8\x42\xa3\xae\x84\x71\x01\x67\xae\xa2"
+      "\xf9\xba\x34\x83\x3c\xbf\x66\xa8\x92\x2e"
+      "\x5f\x16\x5d\x88\x68\x68\xfd\x3f\xd4\x26"
+      "\xf9\xba\x2a\x82\xa5\xe9\x7e\xf8\xed\xa7"
+      "\xd0\x2d\x98\x2f\xf1\x3f\x1a\x96\xf0\xea"
+      "\x9e\x8c\xcc\x90\x94\x77\x53\xb1\x8d\xe3"
+      "\x0d\x2a\x4f\x8f\x8c\xdf\x1f\xd8\xfc\x5a"
+      "\x59\x06\x22\x56\xa0\xa2\x0d\x78\xa0\x95"
+      "\x4c\x8d\x63\x78\xdc\x6d\x06\x03\x7d\x4c"
+      "\x44\x7b\x96\x1d\x4f\x31\x74\xc5\xea\xe8"
+      "\x1e\x26\xfe\x8f\x1c\xa1\x4d\x9b\x25\x76"
+      "\x05\x4c\x09\x80\x0b\xec\x05\x57\xd5\x90"
+      "\x4c\xbe\xbd\xe0\xfd\x3e\x87\x0d\x57\x1e"
+      "\x01\xb7\x2e\xf8\xac\xe3\xe4\xa2\x29\x59"
+      "\xc3\x2d\x6d\x55\xc5\x8b\x13\x0f\x12\xc2"
+      "\xc1\x7b\xc9\x2c\xdb\x6d",
+      0, GCRY_MD_SHA512
+    },
   };
   int tvidx;
   gpg_error_t err;
-  unsigned char outbuf[32];
+  unsigned char outbuf[256];
   int i;
 
   for (tvidx=0; tvidx < DIM(tv); tvidx++)
@@ -940,7 +1026,9 @@ check_pbkdf2 (void)
         fprintf (stderr, "checking PBKDF2 test vector %d\n", tvidx);
       assert (tv[tvidx].dklen <= sizeof outbuf);
       err = gcry_kdf_derive (tv[tvidx].p, tv[tvidx].plen,
-                             GCRY_KDF_PBKDF2, GCRY_MD_SHA1,
+                             GCRY_KDF_PBKDF2,
+                             (tv[tvidx].hashalgo? tv[tvidx].hashalgo
+                              : GCRY_MD_SHA1),
                              tv[tvidx].salt, tv[tvidx].saltlen,
                              tv[tvidx].c, tv[tvidx].dklen, outbuf);
       if (err)
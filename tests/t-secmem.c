@@ -0,0 +1,376 @@
+/* t-secmem.c - Test and benchmark of the secure memory allocator
+ * Copyright (C) 2013 Free Software Foundation, Inc.
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_MLOCK
+# include <sys/mman.h>
+#endif
+
+#include "../src/gcrypt.h"
+
+#define PGM "t-secmem"
+
+/* Size of the secure memory pool.  */
+#define POOL_SIZE (4 * 1024 * 1024)
+
+/* Number of blocks kept alive during the churn test.  */
+#define NSLOTS 1024
+
+static int verbose;
+static int error_count;
+
+/* The number of arenas in use as reported by the last stats dump or
+   -1.  */
+static int arenas_in_use = -1;
+
+
+static void
+show (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  if (!verbose)
+    return;
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+}
+
+static void
+fail (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  error_count++;
+}
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (1);
+}
+
+
+/* A simple deterministic PRNG so that runs are reproducible.  */
+static unsigned int
+lcg (unsigned int *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
+/* Return a block size resembling the allocations of MPI limb
+   buffers: mostly small blocks with a few large ones.  */
+static size_t
+random_size (unsigned int *state)
+{
+  unsigned int r = lcg (state);
+
+  switch (r % 20)
+    {
+    case 0:  return 2048 + (r / 20) % 6144;
+    case 1:
+    case 2:
+    case 3:  return 512 + (r / 20) % 1536;
+    default: return 1 + (r / 20) % 512;
+    }
+}
+
+
+/* Allocate and release blocks of random size in random order while
+   keeping NSLOTS blocks alive.  The content of each block is checked
+   before it is released to detect overlapping blocks.  */
+static void
+check_churn (int iterations)
+{
+  unsigned char *slot[NSLOTS];
+  size_t slotlen[NSLOTS];
+  unsigned int state = 42;
+  unsigned int i, k;
+  size_t n;
+  int iter;
+  clock_t started;
+
+  memset (slot, 0, sizeof slot);
+
+  started = clock ();
+  for (iter = 0; iter < iterations; iter++)
+    {
+      k = lcg (&state) % NSLOTS;
+      if (slot[k])
+        {
+          for (n = 0; n < slotlen[k]; n++)
+            if (slot[k][n] != (unsigned char)k)
+              break;
+          if (n < slotlen[k])
+            fail ("block %u of %u bytes has been overwritten\n",
+                  k, (unsigned int)slotlen[k]);
+          gcry_free (slot[k]);
+        }
+      slotlen[k] = random_size (&state);
+      slot[k] = gcry_malloc_secure (slotlen[k]);
+      if (!slot[k])
+        die ("allocating %u bytes failed after %d iterations\n",
+             (unsigned int)slotlen[k], iter);
+      if (!gcry_is_secure (slot[k]))
+        fail ("block %u is not in secure memory\n", k);
+      memset (slot[k], k, slotlen[k]);
+    }
+  show ("%d allocations in %.0f ms\n", iterations,
+        (double)(clock () - started) * 1000.0 / CLOCKS_PER_SEC);
+
+  if (verbose)
+    gcry_control (GCRYCTL_DUMP_SECMEM_STATS);
+
+  for (i = 0; i < NSLOTS; i++)
+    gcry_free (slot[i]);
+}
+
+
+/* After releasing all blocks the pool needs to be in one piece
+   again.  */
+static void
+check_coalescing (void)
+{
+  void *p;
+
+  p = gcry_malloc_secure (POOL_SIZE - 4096);
+  if (!p)
+    fail ("freed blocks have not been merged\n");
+  gcry_free (p);
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Log handler picking up the number of arenas in use from the
+   output of GCRYCTL_DUMP_SECMEM_STATS.  */
+static void
+stats_log_handler (void *opaque, int level, const char *fmt, va_list arg_ptr)
+{
+  char line[256];
+  const char *s;
+  unsigned int used, count;
+
+  (void)opaque;
+  (void)level;
+  vsnprintf (line, sizeof line, fmt, arg_ptr);
+  if (verbose)
+    fputs (line, stderr);
+  s = strstr (line, "secmem arenas:");
+  if (s && (s = strchr (s, '('))
+      && sscanf (s, "(%u of %u arenas in use)", &used, &count) == 2)
+    arenas_in_use = used;
+}
+
+
+/* Allocate some blocks and leave half of them to the main thread.  */
+static void *
+arena_thread (void *arg)
+{
+  void **blocks = arg;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    {
+      blocks[i] = gcry_malloc_secure (64 + i);
+      if (!blocks[i])
+        die ("allocating in a thread failed\n");
+      memset (blocks[i], i, 64 + i);
+    }
+  for (i = 0; i < 16; i += 2)
+    gcry_free (blocks[i]);
+  return NULL;
+}
+
+
+/* The arena of an exited thread needs to be handed to the next
+   thread.  The main thread owns one arena; thus running many threads
+   one after the other must not use up the others.  */
+static void
+check_arena_reuse (unsigned int arenas)
+{
+  void *blocks[16];
+  pthread_t thread;
+  int i, k;
+
+  for (k = 0; k < 3 * arenas + 2; k++)
+    {
+      if (pthread_create (&thread, NULL, arena_thread, blocks))
+        die ("creating a thread failed\n");
+      pthread_join (thread, NULL);
+      for (i = 1; i < 16; i += 2)
+        gcry_free (blocks[i]);
+    }
+
+  gcry_set_log_handler (stats_log_handler, NULL);
+  gcry_control (GCRYCTL_DUMP_SECMEM_STATS);
+  gcry_set_log_handler (NULL, NULL);
+  if (arenas_in_use == -1)
+    show ("arena statistics not available\n");
+  else if (arenas_in_use > 1)
+    fail ("%d arenas in use after the threads have exited\n",
+          arenas_in_use);
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Return true if N more bytes can be locked into core.  */
+static int
+can_lock_more (size_t n)
+{
+#ifdef HAVE_MLOCK
+  char *p = malloc (n);
+  int okay;
+
+  if (!p)
+    return 0;
+  okay = !mlock (p, n);
+  if (okay)
+    munlock (p, n);
+  free (p);
+  return okay;
+#else
+  (void)n;
+  return 1;
+#endif
+}
+
+
+/* Let the pool grow beyond its initial size.  */
+static void
+check_growing (void)
+{
+  unsigned char *p[3];
+  int i;
+
+  gcry_control (GCRYCTL_SET_SECMEM_LIMIT, 3 * POOL_SIZE);
+  for (i = 0; i < 3; i++)
+    {
+      p[i] = gcry_malloc_secure (POOL_SIZE / 2 + 4096);
+      if (!p[i] && i && !can_lock_more (2 * POOL_SIZE))
+        {
+          /* The pool is only grown by memory which can be locked.  */
+          show ("not enough lockable memory to test growing\n");
+          while (i--)
+            gcry_free (p[i]);
+          gcry_control (GCRYCTL_SET_SECMEM_LIMIT, 0);
+          return;
+        }
+      if (!p[i])
+        die ("growing the pool failed\n");
+      if (!gcry_is_secure (p[i]))
+        fail ("block of the grown pool is not in secure memory\n");
+      memset (p[i], i, POOL_SIZE / 2 + 4096);
+    }
+  if (verbose)
+    gcry_control (GCRYCTL_DUMP_SECMEM_STATS);
+  if (gcry_is_secure (&i))
+    fail ("stack memory is reported as secure memory\n");
+  for (i = 0; i < 3; i++)
+    gcry_free (p[i]);
+
+  gcry_control (GCRYCTL_SET_SECMEM_LIMIT, 0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int iterations = 100000;
+  unsigned int arenas = 2;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--iterations"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              iterations = atoi (*argv);
+              argc--; argv++;
+            }
+        }
+      else if (!strcmp (*argv, "--arenas"))
+        {
+          argc--; argv++;
+          if (argc)
+            {
+              arenas = atoi (*argv);
+              argc--; argv++;
+            }
+        }
+    }
+
+  if (!gcry_check_version (GCRYPT_VERSION))
+    die ("version mismatch\n");
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM_WARN);
+  if (arenas
+      && gcry_control (GCRYCTL_SET_SECMEM_ARENAS, arenas, 65536))
+    {
+      show ("secure memory arenas are not supported\n");
+      arenas = 0;
+    }
+  gcry_control (GCRYCTL_INIT_SECMEM, POOL_SIZE, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  check_churn (iterations);
+  check_coalescing ();
+#ifdef HAVE_PTHREAD
+  if (arenas)
+    check_arena_reuse (arenas);
+#endif
+  check_growing ();
+
+  show ("All tests completed. Errors: %d\n", error_count);
+  return error_count ? 1 : 0;
+}